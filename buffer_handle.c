@@ -202,8 +202,10 @@ int read_from_fd_to_buffer(int fd, BUFFER *buff)
 	bytes = cal_numbytes_to_read(buff);
 	if (bytes <= 0)
 		return(bytes);
-	/* Read from file to buffer. */
-	n = read(fd, buff->readp, bytes);
+	/* Read from file to buffer, unless the serial thread or the io_uring engine has done it already
+	   (see serial_thread.c and io_engine.c). */
+	if ((serial_thread_read(fd, buff->readp, bytes, &n) == 0) && (io_engine_read_done(fd, buff, bytes, &n) == 0))
+		n = read(fd, buff->readp, bytes);
 	if (n < 0) {
 		debug_perror("buffer_handle.c: r_f_ftb()");
 		if ((errno != EINTR) && (errno != EAGAIN)) {
@@ -294,7 +296,9 @@ int write_from_buffer_to_fd(int fd, BUFFER *buff)
 	if (bytes <= 0)
 		return(bytes);
 
-	n = write(fd, buff->writep, bytes);
+	/* the serial thread queues what goes to its device (see serial_thread.c) */
+	if (serial_thread_write(fd, buff->writep, bytes, &n) == 0)
+		n = write(fd, buff->writep, bytes);
 	if (n < 0) {
 		debug_perror("bfwrite()");
 		if ((errno != EINTR) && (errno != EAGAIN)) {
@@ -440,12 +444,13 @@ void bfdump(BUFFER *buff,int opt)
 /*
  	 Location: buffer_handle.c
  	 This is to free buffer.
- 	 Free: buff-> label and buff->buffp.
+ 	 Free: buff-> label and buff->buffp, unless the buffer is part of the session arena.
  */
 
 void bffree(BUFFER *buff)
 {
 	if (buff == NULL) return;
+	if (buff->arena) return;			/* see session_arena.c */
 
 	if (buff->label != NULL)
 		free(buff->label);
@@ -0,0 +1,319 @@
+/*
+ * capture.c
+ *	This is the capture ring of a serial port ("capture size" in serial_ip.conf). While no session holds
+ *	the port, nobody reads the device the daemon holds open for it (see port_bringup.c): what the device
+ *	says piles up in the kernel tty buffer, arrives as one burst with the next session, overflows, or is
+ *	thrown away by "flush on connect". With a capture ring, the parent reads the idle devices of its
+ *	shard as it waits for connections, into a ring of "capture size" bytes, so the tty buffer never
+ *	fills up between sessions. A session which takes the port reads what was left in the tty buffer
+ *	into the ring first, before any flush, and is sent the end of the ring before the live data
+ *	("capture replay": the last N bytes, or what came in the last N seconds).
+ *	The ring is in memory shared with the session processes, and tells who reads the device: owner is
+ *	0 while the parent captures, the pid of the session process which holds the port otherwise. The
+ *	parent raises draining while it reads, after it saw owner 0; a session process sets owner, then waits
+ *	for draining to go down: the two never read the device at the same time.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+#include <sys/mman.h>
+
+#define CAPTURE_MARKS		256				/* seconds of traffic the ring keeps the time of */
+#define CAPTURE_MAX_SIZE	(16 * 1024 * 1024)
+
+/*
+	Location: capture.c
+	Where the ring was at a given second, for a replay by time.
+*/
+struct capture_mark_t {
+	unsigned long long pos;
+	time_t t;
+};
+
+/*
+	Location: capture.c
+	The capture ring of a port, in shared memory. The byte at position p is at data[p % size] for as long
+	as head - p <= size.
+*/
+struct capture_t {
+	pid_t owner;							/* the session process which holds the port, 0 for none */
+	int draining;							/* the parent is reading the device */
+	unsigned int size;
+	unsigned long long head;				/* bytes ever captured */
+	struct capture_mark_t marks[CAPTURE_MARKS];
+	unsigned int next_mark;
+	unsigned char data[];
+};
+
+/*
+	Location: capture.c
+	This is to parse a "capture replay" value: a number of bytes, or of seconds with an s after it.
+	returns 0 on success, 1 on failure.
+*/
+int capture_replay_parse(const char *value, int *bytes, int *seconds)
+{
+	char *end;
+	long n;
+
+	n = strtol(value, &end, 10);
+	if ((end == value) || (n < 0) || (n > CAPTURE_MAX_SIZE))
+		return(1);
+	while (isspace((unsigned char) *end))
+		end++;
+	if ((*end == 's') || (*end == 'S')) {
+		*bytes = 0;
+		*seconds = n;
+		end++;
+	} else {
+		*bytes = n;
+		*seconds = 0;
+	}
+	return((*end == '\0') ? 0 : 1);
+}
+
+/*
+	Location: capture.c
+	This is to check a "capture size" value.
+	returns 0 if it will do, 1 otherwise.
+*/
+int capture_size_check(int size)
+{
+	return(((size < 0) || (size > CAPTURE_MAX_SIZE)) ? 1 : 0);
+}
+
+/*
+	Location: capture.c
+	This is to read what the device has into the ring, without blocking: the device is in blocking
+	mode, the way the daemon holds it. It is in raw mode too (see serial_port_restore(), capture_reset()),
+	so that FIONREAD counts a line which has no newline yet.
+	returns the number of bytes read.
+*/
+static int capture_read(struct capture_t *cap, int fd)
+{
+	unsigned int offset;
+	time_t now;
+	int avail;
+	int total;
+	int n;
+
+	total = 0;
+	while ((ioctl(fd, FIONREAD, &avail) == 0) && (avail > 0)) {
+		offset = cap->head % cap->size;
+		n = read(fd, &cap->data[offset], MIN((unsigned int) avail, cap->size - offset));
+		if (n <= 0)
+			break;
+		now = time(NULL);
+		if ((cap->marks[(cap->next_mark + CAPTURE_MARKS - 1) % CAPTURE_MARKS].t != now) || (cap->head == 0)) {
+			cap->marks[cap->next_mark].pos = cap->head;
+			cap->marks[cap->next_mark].t = now;
+			cap->next_mark = (cap->next_mark + 1) % CAPTURE_MARKS;
+		}
+		cap->head += n;
+		total += n;
+		if (total >= (int) cap->size)
+			break;												/* the others have their turn */
+	}
+	return(total);
+}
+
+/*
+	Location: capture.c
+	This is to forget the capture ring of a port.
+*/
+void capture_free(SERIAL_INFO *port)
+{
+	if (port->capture == NULL)
+		return;
+	munmap(port->capture, sizeof(struct capture_t) + port->capture->size);
+	port->capture = NULL;
+}
+
+/*
+	Location: capture.c
+	This is to set up the capture ring of a port. The port may be held by a session already (the ring
+	was just turned on or resized by a reload): it stays with it.
+	returns 0 on success, 1 on failure.
+*/
+static int capture_alloc(SERIAL_INFO *port)
+{
+	extern int errno;
+	struct capture_t *cap;
+	char *lockfile;
+	pid_t pid;
+
+	cap = mmap(NULL, sizeof(struct capture_t) + port->capture_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (cap == MAP_FAILED) {
+		syslog(LOG_ERR, "capture.c: capture_alloc(): cannot map %d bytes for %s: %s", port->capture_size, port->device,
+				strerror(errno));
+		return(1);
+	}
+	memset(cap, 0, sizeof(struct capture_t));
+	cap->size = port->capture_size;
+	lockfile = get_uucp_lock_device_file(port->device);
+	if ((lockfile != NULL) && (verify_device_lock_state(lockfile, &pid) == 0) && (pid != getpid()))
+		cap->owner = pid;
+	port->capture = cap;
+	syslog(LOG_INFO, "capture.c: capture_alloc(): capturing %s into %d bytes%s", port->device, port->capture_size,
+			(cap->owner != 0) ? ", once its session is over" : "");
+	return(0);
+}
+
+/*
+	Location: capture.c
+	This is to put the settings of a held device back after its session died without releasing it:
+	serial_cleanup() did not run, the device may still be at the speed and in the mode the client
+	asked for, and a canonical tty only counts complete lines in FIONREAD.
+*/
+static void capture_reset(SERIAL_INFO *port)
+{
+	int flags;
+
+	tcsetattr(port->fd, TCSANOW, &(port->new_termios));
+	flags = fcntl(port->fd, F_GETFL, 0);
+	if (flags != -1)
+		fcntl(port->fd, F_SETFL, flags & ~O_NONBLOCK);
+}
+
+/*
+	Location: capture.c
+	This is to add the idle devices of the ports of our shard which capture to the fds the parent waits
+	on, setting up or dropping their rings as the settings say.
+*/
+void capture_watch(struct config_t *conf, fd_set *watch, int *maxfd)
+{
+	SERIAL_INFO *port;
+	int i;
+
+	for (i = 0; i < conf->ports.nslots; i++) {
+		port = port_registry_at(&conf->ports, i);
+		if (port == NULL)
+			continue;
+		if ((port->capture != NULL) && ((port->capture_size != (int) port->capture->size) || (port->state != PORT_READY)))
+			capture_free(port);
+		if ((port->capture_size <= 0) || (port->state != PORT_READY) || (port->fd < 0) || (! shard_owns(port)))
+			continue;
+		if ((port->capture == NULL) && (capture_alloc(port) != 0))
+			continue;
+		if ((port->capture->owner > 0) && (kill(port->capture->owner, 0) != 0)) {
+			capture_reset(port);								/* its session died without releasing it */
+			port->capture->owner = 0;
+		}
+		if ((port->capture->owner == 0) && (port->fd < FD_SETSIZE)) {
+			FD_SET(port->fd, watch);
+			*maxfd = MAX(*maxfd, port->fd);
+		}
+	}
+}
+
+/*
+	Location: capture.c
+	This is to read the idle devices which have something into their rings.
+	returns the number of devices read.
+*/
+int capture_drain(struct config_t *conf, fd_set *ready)
+{
+	struct capture_t *cap;
+	SERIAL_INFO *port;
+	int ndrained;
+	int i;
+
+	ndrained = 0;
+	for (i = 0; i < conf->ports.nslots; i++) {
+		port = port_registry_at(&conf->ports, i);
+		if ((port == NULL) || (port->capture == NULL) || (port->fd < 0) || (port->fd >= FD_SETSIZE) || (! FD_ISSET(port->fd, ready)))
+			continue;
+		cap = port->capture;
+		__atomic_store_n(&cap->draining, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&cap->owner, __ATOMIC_SEQ_CST) == 0)
+			capture_read(cap, port->fd);
+		__atomic_store_n(&cap->draining, 0, __ATOMIC_SEQ_CST);
+		ndrained++;
+	}
+	return(ndrained);
+}
+
+/*
+	Location: capture.c
+	This is for a session process to take the device of a port from the capture: it waits for the parent
+	to be done reading it, then reads what was left in the tty buffer into the ring, before any flush.
+*/
+void capture_take(SERIAL_INFO *port, int fd)
+{
+	struct capture_t *cap;
+
+	cap = port->capture;
+	if (cap == NULL)
+		return;
+	__atomic_store_n(&cap->owner, getpid(), __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&cap->draining, __ATOMIC_SEQ_CST))
+		sched_yield();											/* a non-blocking read, it does not take long */
+	capture_read(cap, fd);
+}
+
+/*
+	Location: capture.c
+	This is for a session process to give the device of a port back to the capture.
+*/
+void capture_release(SERIAL_INFO *port)
+{
+	if ((port->capture != NULL) && (port->capture->owner == getpid()))
+		__atomic_store_n(&port->capture->owner, 0, __ATOMIC_SEQ_CST);
+}
+
+/*
+	Location: capture.c
+	This is to send a new client the end of the ring, before the live data: the last "capture replay"
+	bytes, or what came in the last "capture replay" seconds. With quote, IAC bytes are doubled for a
+	Telnet client.
+	returns 0 on success, 1 if the socket failed.
+*/
+int capture_replay(SERIAL_INFO *port, int sockfd, int quote)
+{
+	extern int errno;
+	struct capture_t *cap;
+	struct capture_mark_t *mark;
+	unsigned char out[2 * 1024];
+	unsigned long long start;
+	unsigned long long oldest;
+	unsigned long long p;
+	time_t since;
+	int len;
+	int n;
+	int i;
+
+	cap = port->capture;
+	if ((cap == NULL) || ((port->capture_replay_bytes <= 0) && (port->capture_replay_seconds <= 0)))
+		return(0);
+	oldest = (cap->head > cap->size) ? cap->head - cap->size : 0;
+	if (port->capture_replay_bytes > 0) {
+		start = (cap->head > (unsigned long long) port->capture_replay_bytes) ? cap->head - port->capture_replay_bytes : 0;
+	} else {
+		/* the first second we know of which is recent enough */
+		since = time(NULL) - port->capture_replay_seconds;
+		start = cap->head;
+		for (i = 0; i < CAPTURE_MARKS; i++) {
+			mark = &cap->marks[(cap->next_mark + i) % CAPTURE_MARKS];
+			if ((mark->t >= since) && (mark->pos < start))
+				start = mark->pos;
+		}
+	}
+	start = MAX(start, oldest);
+	for (p = start; p < cap->head; ) {
+		for (len = 0; (p < cap->head) && (len < (int) sizeof(out) - 1); p++) {
+			out[len++] = cap->data[p % cap->size];
+			if (quote && (out[len - 1] == IAC))
+				out[len++] = IAC;
+		}
+		for (i = 0; i < len; i += n) {
+			n = write(sockfd, out + i, len - i);
+			if ((n < 0) && (errno == EINTR))
+				n = 0;
+			else if (n <= 0)
+				return(1);
+		}
+	}
+	syslog(LOG_INFO, "capture.c: capture_replay(): replayed %llu bytes of %s", cap->head - start, port->device);
+	return(0);
+}
@@ -16,8 +16,10 @@ char *def_description = "Sabre Lite Serial Interface";
 	This is to initialize serial port settings.	Return 0 on success.
 */
 
-int serial_init_termios(SERIAL_INFO *sabre_serial_port, int *fd, struct termios old_setting, struct termios new_setting)
+int serial_init_termios(SERIAL_INFO *sabre_serial_port, int *fd, struct termios *old_termios, struct termios *new_termios)
 {
+	struct termios old_setting;
+	struct termios new_setting;
 	int ret;
 	/* get two copies of the current termios settings */
 	ret = tcgetattr(*fd, &old_setting);
@@ -114,6 +116,8 @@ int serial_init_termios(SERIAL_INFO *sabre_serial_port, int *fd, struct termios
 		tcsetattr(*fd, TCSANOW, &old_setting);
 		return(ret);
 	}
+	*old_termios = old_setting;				/* hand both settings back, serial_cleanup() restores the old ones */
+	*new_termios = new_setting;
 	return(0);
 }
 
@@ -173,6 +177,7 @@ int read_configuration_file(char *file, struct config_t *conf)
 	char buffer[BUFSIZ];
 	SERIAL_INFO *serial_device;
 	SERIAL_INFO sabre_defaults;
+	int listen_port;
 
 	fp = fopen(file, "r");
 	if (fp == NULL) {
@@ -192,6 +197,12 @@ int read_configuration_file(char *file, struct config_t *conf)
 	sabre_defaults.flowcontrol = HARDWARE_FLOW;
 	sabre_defaults.conn_flush = 0;										/* don't flush serial port on connect */
 	sabre_defaults.disc_flush = 1;										/* do flush serial port on discconnect */
+	port_sched_init(&sabre_defaults.sched);								/* scheduling left alone */
+	sabre_defaults.protocol = PORT_PROTOCOL_DEFAULT;					/* follows the server type */
+	sabre_defaults.socket_profile = SOCKET_PROFILE_DEFAULT;				/* sockets left as they are */
+	sabre_defaults.multicast_ttl = 1;									/* published on the local network only */
+	sabre_defaults.share_writer = SHARE_WRITER_FIRST;					/* the first client of a shared port */
+	sabre_defaults.shm_size = 65536;									/* each way, for a shm ring */
 
 	/*	Parse the configuration file and save the info within the config_t structure */
 	lines = 0;
@@ -237,12 +248,14 @@ int read_configuration_file(char *file, struct config_t *conf)
 			error = save_value(entry.value, entry.type, &(conf->server_type));
 			break;
 		case DEVICE:
-			/*	add serial port to conf->serial_port[] array.  increments conf->number_ports
-				and dynamically allocates memory for the device name. */
-			error = add_serial_port_info(conf, entry.value);
-			if (! error)
+			/*	add serial port to the conf->ports registry.  dynamically allocates
+				memory for the device name. */
+			serial_device = add_serial_port_info(conf, entry.value);
+			if (serial_device == NULL)
 			{
-				serial_device = conf->serial_port[conf->number_ports - 1];		/* ptr to current modem */
+				serial_device = &sabre_defaults;
+				error = 1;
+			} else {
 				serial_device->speed = sabre_defaults.speed;				/* copy defaults */
 				serial_device->databits = sabre_defaults.databits;
 				serial_device->parity = sabre_defaults.parity;
@@ -251,7 +264,68 @@ int read_configuration_file(char *file, struct config_t *conf)
 				serial_device->description = strdup(sabre_defaults.description);
 				serial_device->conn_flush = sabre_defaults.conn_flush;
 				serial_device->disc_flush = sabre_defaults.disc_flush;
+				serial_device->sched = sabre_defaults.sched;				/* structure copy */
+				serial_device->protocol = sabre_defaults.protocol;
+				serial_device->socket_profile = sabre_defaults.socket_profile;
+				serial_device->udp_sequence = sabre_defaults.udp_sequence;
+				serial_device->multicast_ttl = sabre_defaults.multicast_ttl;
+				serial_device->share_writer = sabre_defaults.share_writer;
+				serial_device->capture_size = sabre_defaults.capture_size;
+				serial_device->capture_replay_bytes = sabre_defaults.capture_replay_bytes;
+				serial_device->capture_replay_seconds = sabre_defaults.capture_replay_seconds;
+				serial_device->shm_size = sabre_defaults.shm_size;
+				if (sabre_defaults.socket_users != NULL)
+					serial_device->socket_users = strdup(sabre_defaults.socket_users);
+				error = port_registry_set_pool(&conf->ports, serial_device, sabre_defaults.pool);
+			}
+			break;
+		case LISTENPORT:
+			if (serial_device == &sabre_defaults) {
+				syslog(LOG_ERR,"configuration.c(): listen port must follow a serial device at line %d: %s",lines,entry.value);
+				error = 1;
+				break;
+			}
+			error = save_value(entry.value,entry.type,&listen_port);
+			if (! error)
+				error = port_registry_set_listen_port(&conf->ports, serial_device, listen_port);
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid listen port value at line %d: %s",lines,entry.value);
+			break;
+		case LISTENSOCKET:
+			if (serial_device == &sabre_defaults) {
+				syslog(LOG_ERR,"configuration.c(): listen socket must follow a serial device at line %d: %s",lines,entry.value);
+				error = 1;
+				break;
 			}
+			if (unix_socket_name_check(entry.value) != 0) {
+				syslog(LOG_ERR,"configuration.c(): listen socket must be an absolute path or @name at line %d: %s",lines,entry.value);
+				error = 1;
+				break;
+			}
+			if (serial_device->listen_socket != NULL)
+				free(serial_device->listen_socket);
+			serial_device->listen_socket = strdup(entry.value);
+			break;
+		case SOCKETUSERS:
+			if (unix_socket_users_check(entry.value) != 0) {
+				syslog(LOG_ERR,"configuration.c(): invalid socket users value at line %d: %s",lines,entry.value);
+				error = 1;
+				break;
+			}
+			if (serial_device->socket_users != NULL)
+				free(serial_device->socket_users);
+			serial_device->socket_users = strdup(entry.value);		/* for the following devices, before the first one */
+			break;
+		case POOL:
+			if (serial_device == &sabre_defaults) {
+				if (sabre_defaults.pool != NULL)
+					free(sabre_defaults.pool);
+				sabre_defaults.pool = strdup(entry.value);		/* default pool for the following devices */
+			} else {
+				error = port_registry_set_pool(&conf->ports, serial_device, entry.value);
+			}
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid pool value at line %d: %s",lines,entry.value);
 			break;
 		case DESCRIPTION:
 			if (serial_device->description != NULL)
@@ -345,6 +419,135 @@ int read_configuration_file(char *file, struct config_t *conf)
 			if(error)
 				syslog(LOG_ERR,"configuration.c(): invalid dish_flush value at line %d: %s",lines,entry.value);
 			break;
+		case SCHEDPOLICY:
+			error = port_sched_parse_policy(entry.value, &(serial_device->sched.policy));
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid scheduling policy value at line %d: %s",lines,entry.value);
+			break;
+		case SCHEDPRIORITY:
+			error = save_value(entry.value,entry.type,&(serial_device->sched.priority));
+			if ((! error) && ((serial_device->sched.priority < 1) || (serial_device->sched.priority > 99)))
+				error = 1;
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid scheduling priority value at line %d: %s",lines,entry.value);
+			break;
+		case CPUAFFINITY:
+			error = port_sched_parse_cpus(entry.value, &(serial_device->sched.cpus));
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid cpu affinity value at line %d: %s",lines,entry.value);
+			break;
+		case NICELEVEL:
+			error = save_value(entry.value,entry.type,&(serial_device->sched.nice));
+			if ((! error) && ((serial_device->sched.nice < -20) || (serial_device->sched.nice > 19)))
+				error = 1;
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid nice value at line %d: %s",lines,entry.value);
+			break;
+		case UDPPORT:
+			if (serial_device == &sabre_defaults) {
+				syslog(LOG_ERR,"configuration.c(): udp port must follow a serial device at line %d: %s",lines,entry.value);
+				error = 1;
+				break;
+			}
+			error = save_value(entry.value,entry.type,&(serial_device->udp_port));
+			if ((! error) && ((serial_device->udp_port < 0) || (serial_device->udp_port > 65535)))
+				error = 1;
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid udp port value at line %d: %s",lines,entry.value);
+			break;
+		case UDPPEERS:
+			if (serial_device == &sabre_defaults) {
+				syslog(LOG_ERR,"configuration.c(): udp peers must follow a serial device at line %d: %s",lines,entry.value);
+				error = 1;
+				break;
+			}
+			if (serial_device->udp_peers != NULL)
+				free(serial_device->udp_peers);
+			serial_device->udp_peers = strdup(entry.value);
+			break;
+		case UDPSEQUENCE:
+			error = save_value(entry.value,entry.type,&(serial_device->udp_sequence));
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid udp sequence value at line %d: %s",lines,entry.value);
+			break;
+		case MULTICASTGROUP:
+			if (serial_device == &sabre_defaults) {
+				syslog(LOG_ERR,"configuration.c(): multicast group must follow a serial device at line %d: %s",lines,entry.value);
+				error = 1;
+				break;
+			}
+			if (serial_device->multicast_group != NULL)
+				free(serial_device->multicast_group);
+			serial_device->multicast_group = strdup(entry.value);
+			break;
+		case MULTICASTTTL:
+			error = save_value(entry.value,entry.type,&(serial_device->multicast_ttl));
+			if ((! error) && ((serial_device->multicast_ttl < 0) || (serial_device->multicast_ttl > 255)))
+				error = 1;
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid multicast ttl value at line %d: %s",lines,entry.value);
+			break;
+		case SHAREPORT:
+			if (serial_device == &sabre_defaults) {
+				syslog(LOG_ERR,"configuration.c(): share port must follow a serial device at line %d: %s",lines,entry.value);
+				error = 1;
+				break;
+			}
+			error = save_value(entry.value,entry.type,&(serial_device->share_port));
+			if ((! error) && ((serial_device->share_port < 0) || (serial_device->share_port > 65535)))
+				error = 1;
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid share port value at line %d: %s",lines,entry.value);
+			break;
+		case SHAREWRITER:
+			error = share_writer_parse(entry.value, &(serial_device->share_writer));
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid share writer value at line %d: %s",lines,entry.value);
+			break;
+		case CAPTURESIZE:
+			error = save_value(entry.value,entry.type,&(serial_device->capture_size));
+			if ((! error) && capture_size_check(serial_device->capture_size))
+				error = 1;
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid capture size value at line %d: %s",lines,entry.value);
+			break;
+		case CAPTUREREPLAY:
+			error = capture_replay_parse(entry.value, &(serial_device->capture_replay_bytes), &(serial_device->capture_replay_seconds));
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid capture replay value at line %d: %s",lines,entry.value);
+			break;
+		case SHMRING:
+			if (serial_device == &sabre_defaults) {
+				syslog(LOG_ERR,"configuration.c(): shm ring must follow a serial device at line %d: %s",lines,entry.value);
+				error = 1;
+				break;
+			}
+			if (entry.value[0] != '/') {
+				syslog(LOG_ERR,"configuration.c(): shm ring must start with a / at line %d: %s",lines,entry.value);
+				error = 1;
+				break;
+			}
+			if (serial_device->shm_ring != NULL)
+				free(serial_device->shm_ring);
+			serial_device->shm_ring = strdup(entry.value);
+			break;
+		case SHMSIZE:
+			error = save_value(entry.value,entry.type,&(serial_device->shm_size));
+			if ((! error) && shm_size_check(serial_device->shm_size))
+				error = 1;
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid shm size value at line %d (a power of 2 is needed): %s",lines,entry.value);
+			break;
+		case PORTPROTOCOL:
+			error = session_protocol_parse(entry.value, &(serial_device->protocol));
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid protocol value at line %d: %s",lines,entry.value);
+			break;
+		case SOCKETPROFILE:
+			error = socket_profile_parse(entry.value, &(serial_device->socket_profile));
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid socket profile value at line %d: %s",lines,entry.value);
+			break;
 		case REPLYPURGEDATA:
 			error = save_value(entry.value,entry.type,&(conf->reply_purge_data));
 			if(error)
@@ -370,6 +573,50 @@ int read_configuration_file(char *file, struct config_t *conf)
 			if(error)
 				syslog(LOG_ERR,"configuration.c(): invalid send_logout value at line %d: %s",lines,entry.value);
 			break;
+		case IOENGINE:
+			error = save_value(entry.value, entry.type, &(conf->io_engine));
+			break;
+		case BRINGUPWORKERS:
+			error = save_value(entry.value,entry.type,&(conf->bringup_workers));
+			if ((! error) && ((conf->bringup_workers < 1) || (conf->bringup_workers > 64)))
+				error = 1;
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid bringup workers value at line %d: %s",lines,entry.value);
+			break;
+		case REACTORSHARDS:
+			error = save_value(entry.value,entry.type,&(conf->reactor_shards));
+			if ((! error) && ((conf->reactor_shards < 1) || (conf->reactor_shards > SHARD_MAX)))
+				error = 1;
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid reactor shards value at line %d: %s",lines,entry.value);
+			break;
+		case PINSHARDS:
+			error = save_value(entry.value,entry.type,&(conf->pin_shards));
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid pin shards value at line %d: %s",lines,entry.value);
+			break;
+		case SERIALTHREAD:
+			error = save_value(entry.value,entry.type,&(conf->serial_thread));
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid serial thread value at line %d: %s",lines,entry.value);
+			break;
+		case DETERMINISTICMEMORY:
+			error = save_value(entry.value,entry.type,&(conf->deterministic_memory));
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid deterministic memory value at line %d: %s",lines,entry.value);
+			break;
+		case MUXPORT:
+			error = save_value(entry.value,entry.type,&(conf->mux_port));
+			if ((! error) && ((conf->mux_port < 0) || (conf->mux_port > 65535)))
+				error = 1;
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid mux port value at line %d: %s",lines,entry.value);
+			break;
+		case HOTPLUG:
+			error = add_hotplug_pattern(conf, entry.value);
+			if(error)
+				syslog(LOG_ERR,"configuration.c(): invalid hotplug device value at line %d: %s",lines,entry.value);
+			break;
 		case INVALID:
 			syslog(LOG_ERR,"invalid or missing value at line %d: %s",lines,buffer);
 			/* we won't treat this as an error */
@@ -385,6 +632,7 @@ int read_configuration_file(char *file, struct config_t *conf)
 	} /* while */
 
 	fclose(fp);							/* close configuration file */
+	conf->port_defaults = sabre_defaults;	/* hotplug ports get the defaults, and own its strings now */
 	if (error != 0) {
 		syslog(LOG_ERR,"error in configuration file near line %d",lines);
 	}
@@ -392,6 +640,30 @@ int read_configuration_file(char *file, struct config_t *conf)
 }
 
 
+/*
+	Location: configuration.c
+	This is to add a glob pattern for hotplug serial devices to the configuration.
+	returns 0 on success, 1 on failure.
+*/
+int add_hotplug_pattern(struct config_t *conf, char *pattern)
+{
+	char **patterns;
+
+	if ((pattern == NULL) || (*pattern != '/')) {
+		syslog(LOG_ERR,"configuration.c: add_hotplug_pattern(): pattern must be an absolute path");
+		return(1);
+	}
+	patterns = realloc(conf->hotplug_patterns, (conf->nhotplug + 1) * sizeof(char *));
+	if (patterns == NULL)
+		return(1);
+	conf->hotplug_patterns = patterns;
+	conf->hotplug_patterns[conf->nhotplug] = strdup(pattern);
+	if (conf->hotplug_patterns[conf->nhotplug] == NULL)
+		return(1);
+	conf->nhotplug++;
+	return(0);
+}
+
 /*
 	Location: configuration.c
 
@@ -472,6 +744,7 @@ int sane_config(struct config_t *conf)
 	extern int def_reply_purge_data;
 	extern int def_idletimer;
 	extern int def_send_logout;
+	extern char *def_ioengine;
 	//int i;
 
 	if (conf->user == NULL)
@@ -506,6 +779,19 @@ int sane_config(struct config_t *conf)
 			return(1);
 		}
 	}
+	if (conf->io_engine == NULL)
+	{
+		conf->io_engine = strdup(def_ioengine);
+	} else 							/* check specified I/O engine */
+	{
+		if ((strcmp(conf->io_engine,"auto") != 0) &&
+			(strcmp(conf->io_engine,"io_uring") != 0) &&
+			(strcmp(conf->io_engine,"epoll") != 0) &&
+		    (strcmp(conf->io_engine,"select") != 0)) {
+			syslog(LOG_ERR,"config: unknown io engine: %s",conf->io_engine);
+			return(1);
+		}
+	}
 	if (conf->pidfile == NULL)
 		conf->pidfile = strdup(def_pidfile);
 	if (conf->timeout <= 0)
@@ -546,7 +832,7 @@ int sane_config(struct config_t *conf)
 	/*
 		make sure we have one or more serial port. Remember that Sabre has 1 serial port.
 	*/
-	if (conf->number_ports < 1) {
+	if ((conf->ports.nports < 1) && (conf->nhotplug < 1)) {
 		syslog(LOG_ERR,"no modems were configured");
 		return(1);
 	}
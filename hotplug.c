@@ -0,0 +1,351 @@
+/*
+ * hotplug.c
+ *	This is to discover serial devices which appear or disappear while we are running.
+ *	Devices matching one of the "hotplug device" patterns of serial_ip.conf are attached to the
+ *	port registry with the default serial port settings, and detached again when they are unplugged.
+ *	We listen to kernel uevents on a netlink socket when we can, otherwise we watch the
+ *	directories of the patterns with inotify.
+ *	Only the port which comes or goes is touched, sessions on the other ports go on undisturbed.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+#include <fnmatch.h>
+#include <glob.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+#include <linux/netlink.h>
+
+#define HOTPLUG_NONE		0x00
+#define HOTPLUG_NETLINK		0x01
+#define HOTPLUG_INOTIFY		0x02
+
+#define HOTPLUG_BUFSIZE		8192
+
+int hotplug_fd = -1;					/* netlink or inotify fd, -1 if disabled */
+int hotplug_type = HOTPLUG_NONE;
+
+/*
+	Location: hotplug.c
+	This is to check a device path against the configured hotplug patterns.
+	returns 1 if it matches one of them, 0 otherwise.
+*/
+static int hotplug_device_matches(struct config_t *conf, const char *device)
+{
+	int i;
+
+	for (i = 0; i < conf->nhotplug; i++) {
+		if (fnmatch(conf->hotplug_patterns[i], device, FNM_PATHNAME) == 0)
+			return(1);
+	}
+	return(0);
+}
+
+/*
+	Location: hotplug.c
+	This is to attach a newly discovered device to the port registry, using the default
+	serial port settings from serial_ip.conf.
+	returns 0 on success (or if the device is already known), 1 on failure.
+*/
+int hotplug_attach(struct config_t *conf, char *device)
+{
+	SERIAL_INFO *port;
+
+	if (port_lookup_device(&conf->ports, device) != NULL)
+		return(0);										/* configured or attached already */
+	port = add_serial_port_info(conf, device);
+	if (port == NULL)
+		return(1);
+	port->speed = conf->port_defaults.speed;
+	port->databits = conf->port_defaults.databits;
+	port->parity = conf->port_defaults.parity;
+	port->stopbits = conf->port_defaults.stopbits;
+	port->flowcontrol = conf->port_defaults.flowcontrol;
+	port->conn_flush = conf->port_defaults.conn_flush;
+	port->disc_flush = conf->port_defaults.disc_flush;
+	port->sched = conf->port_defaults.sched;					/* structure copy */
+	port->protocol = conf->port_defaults.protocol;
+	port->socket_profile = conf->port_defaults.socket_profile;
+	port->udp_sequence = conf->port_defaults.udp_sequence;
+	port->multicast_ttl = conf->port_defaults.multicast_ttl;
+	port->share_writer = conf->port_defaults.share_writer;
+	port->capture_size = conf->port_defaults.capture_size;
+	port->capture_replay_bytes = conf->port_defaults.capture_replay_bytes;
+	port->capture_replay_seconds = conf->port_defaults.capture_replay_seconds;
+	port->shm_size = conf->port_defaults.shm_size;
+	if (conf->port_defaults.description != NULL)
+		port->description = strdup(conf->port_defaults.description);
+	if (conf->port_defaults.socket_users != NULL)
+		port->socket_users = strdup(conf->port_defaults.socket_users);
+	port->hotplug = 1;
+	port_registry_set_pool(&conf->ports, port, conf->port_defaults.pool);
+	session_arena_signature_update(port);
+	port_bringup_queue(port);
+	syslog(LOG_INFO, "hotplug.c: hotplug_attach(): attached serial device %s (%d port(s))", device, conf->ports.nports);
+	return(0);
+}
+
+/*
+	Location: hotplug.c
+	This is to detach an unplugged device from the port registry. Ports which come from
+	serial_ip.conf stay registered, they just cannot be opened until the device comes back.
+	returns 0 on success, 1 on failure.
+*/
+int hotplug_detach(struct config_t *conf, char *device)
+{
+	SERIAL_INFO *port;
+
+	port = port_lookup_device(&conf->ports, device);
+	if (port == NULL)
+		return(0);
+	if (! port->hotplug) {
+		syslog(LOG_INFO, "hotplug.c: hotplug_detach(): configured serial device %s was removed", device);
+		return(0);
+	}
+	syslog(LOG_INFO, "hotplug.c: hotplug_detach(): detaching serial device %s", device);
+	return(port_registry_remove(&conf->ports, port));
+}
+
+/*
+	Location: hotplug.c
+	This is to attach every existing device which matches a hotplug pattern, so that devices
+	plugged in before we started are found too.
+*/
+static void hotplug_scan(struct config_t *conf)
+{
+	glob_t matches;
+	size_t j;
+	int i;
+
+	for (i = 0; i < conf->nhotplug; i++) {
+		if (glob(conf->hotplug_patterns[i], 0, NULL, &matches) != 0)
+			continue;
+		for (j = 0; j < matches.gl_pathc; j++)
+			hotplug_attach(conf, matches.gl_pathv[j]);
+		globfree(&matches);
+	}
+}
+
+/*
+	Location: hotplug.c
+	This is to open a netlink socket which receives the kernel uevents.
+	returns the socket fd, -1 if netlink uevents are not available.
+*/
+static int hotplug_open_netlink(void)
+{
+#ifdef NETLINK_KOBJECT_UEVENT
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return(-1);
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = 0;									/* let the kernel pick */
+	addr.nl_groups = 1;									/* kernel uevent multicast group */
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(fd);
+		return(-1);
+	}
+	return(fd);
+#else
+	return(-1);
+#endif
+}
+
+/*
+	Location: hotplug.c
+	This is to open an inotify fd watching the directory of every hotplug pattern.
+	returns the inotify fd, -1 on error.
+*/
+static int hotplug_open_inotify(struct config_t *conf)
+{
+	extern int errno;
+	char dir[PATH_MAX];
+	int fd;
+	int i;
+	int nwatch;
+
+	fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (fd < 0) {
+		syslog(LOG_ERR, "hotplug.c: hotplug_open_inotify(): inotify_init1() error: %s", strerror(errno));
+		return(-1);
+	}
+	nwatch = 0;
+	for (i = 0; i < conf->nhotplug; i++) {
+		snprintf(dir, sizeof(dir), "%s", conf->hotplug_patterns[i]);
+		if (inotify_add_watch(fd, dirname(dir), IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO) < 0)
+			syslog(LOG_ERR, "hotplug.c: hotplug_open_inotify(): cannot watch %s: %s", dir, strerror(errno));
+		else
+			nwatch++;
+	}
+	if (nwatch == 0) {
+		close(fd);
+		return(-1);
+	}
+	return(fd);
+}
+
+/*
+	Location: hotplug.c
+	uevents only carry the kernel device name, so they can only be used when all patterns
+	name device nodes directly in /dev (eg. /dev/ttyUSB*, not /dev/serial/by-id/...).
+	returns 1 if so, 0 otherwise.
+*/
+static int hotplug_patterns_in_dev(struct config_t *conf)
+{
+	char dir[PATH_MAX];
+	int i;
+
+	for (i = 0; i < conf->nhotplug; i++) {
+		snprintf(dir, sizeof(dir), "%s", conf->hotplug_patterns[i]);
+		if (strcmp(dirname(dir), "/dev") != 0)
+			return(0);
+	}
+	return(1);
+}
+
+/*
+	Location: hotplug.c
+	This is to start hotplug discovery, if serial_ip.conf has any "hotplug device" pattern.
+	returns the fd to watch for hotplug events, -1 if hotplug discovery is disabled.
+*/
+int hotplug_init(struct config_t *conf)
+{
+	extern int hotplug_fd;
+	extern int hotplug_type;
+
+	hotplug_close();
+	if (conf->nhotplug == 0)
+		return(-1);
+	if (hotplug_patterns_in_dev(conf))
+		hotplug_fd = hotplug_open_netlink();
+	if (hotplug_fd >= 0) {
+		hotplug_type = HOTPLUG_NETLINK;
+		syslog(LOG_INFO, "hotplug.c: hotplug_init(): listening to kernel uevents");
+	} else {
+		hotplug_fd = hotplug_open_inotify(conf);
+		if (hotplug_fd >= 0) {
+			hotplug_type = HOTPLUG_INOTIFY;
+			syslog(LOG_INFO, "hotplug.c: hotplug_init(): watching device directories with inotify");
+		}
+	}
+	if (hotplug_fd < 0)
+		syslog(LOG_ERR, "hotplug.c: hotplug_init(): hotplug discovery is not available");
+	hotplug_scan(conf);
+	return(hotplug_fd);
+}
+
+/*
+	Location: hotplug.c
+	This is to stop hotplug discovery.
+*/
+void hotplug_close(void)
+{
+	extern int hotplug_fd;
+	extern int hotplug_type;
+
+	if (hotplug_fd >= 0) {
+		io_engine_forget(hotplug_fd);
+		close(hotplug_fd);
+	}
+	hotplug_fd = -1;
+	hotplug_type = HOTPLUG_NONE;
+}
+
+/*
+	Location: hotplug.c
+	This is to handle one kernel uevent. A uevent is a "ACTION@DEVPATH" header followed by
+	null terminated KEY=VALUE strings. We care about ACTION, SUBSYSTEM and DEVNAME.
+*/
+static void hotplug_uevent(struct config_t *conf, char *msg, int len)
+{
+	char device[PATH_MAX];
+	char *action = NULL;
+	char *subsystem = NULL;
+	char *devname = NULL;
+	char *p;
+
+	for (p = msg; p < msg + len; p += strlen(p) + 1) {
+		if (strncmp(p, "ACTION=", 7) == 0)
+			action = p + 7;
+		else if (strncmp(p, "SUBSYSTEM=", 10) == 0)
+			subsystem = p + 10;
+		else if (strncmp(p, "DEVNAME=", 8) == 0)
+			devname = p + 8;
+	}
+	if ((action == NULL) || (subsystem == NULL) || (devname == NULL))
+		return;
+	if (strcmp(subsystem, "tty") != 0)
+		return;
+	if (*devname == '/')
+		snprintf(device, sizeof(device), "%s", devname);
+	else
+		snprintf(device, sizeof(device), "/dev/%s", devname);
+	if (! hotplug_device_matches(conf, device))
+		return;
+	if (strcmp(action, "add") == 0)
+		hotplug_attach(conf, device);
+	else if (strcmp(action, "remove") == 0)
+		hotplug_detach(conf, device);
+}
+
+/*
+	Location: hotplug.c
+	This is to handle a batch of inotify events.
+*/
+static void hotplug_inotify_events(struct config_t *conf, char *buf, int len)
+{
+	struct inotify_event *ev;
+	char dir[PATH_MAX];
+	char device[PATH_MAX];
+	char *p;
+	int i;
+
+	for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+		ev = (struct inotify_event *) p;
+		if (ev->len == 0)
+			continue;
+		/* rebuild the full path name from the directory of the matching pattern */
+		for (i = 0; i < conf->nhotplug; i++) {
+			snprintf(dir, sizeof(dir), "%s", conf->hotplug_patterns[i]);
+			snprintf(device, sizeof(device), "%s/%s", dirname(dir), ev->name);
+			if (fnmatch(conf->hotplug_patterns[i], device, FNM_PATHNAME) == 0)
+				break;
+		}
+		if (i == conf->nhotplug)
+			continue;
+		if (ev->mask & (IN_CREATE|IN_MOVED_TO))
+			hotplug_attach(conf, device);
+		else if (ev->mask & (IN_DELETE|IN_MOVED_FROM))
+			hotplug_detach(conf, device);
+	}
+}
+
+/*
+	Location: hotplug.c
+	This is called when the hotplug fd is readable. We drain it and apply every event.
+*/
+void hotplug_handle_events(struct config_t *conf)
+{
+	extern int hotplug_fd;
+	extern int hotplug_type;
+	char buf[HOTPLUG_BUFSIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int n;
+
+	if (hotplug_fd < 0)
+		return;
+	for ( ; ; ) {
+		n = read(hotplug_fd, buf, sizeof(buf) - 1);
+		if (n <= 0)
+			break;										/* EAGAIN: drained */
+		buf[n] = '\0';
+		if (hotplug_type == HOTPLUG_NETLINK)
+			hotplug_uevent(conf, buf, n);
+		else
+			hotplug_inotify_events(conf, buf, n);
+	}
+}
@@ -0,0 +1,775 @@
+/*
+ * io_engine.c
+ *	This is the I/O engine the event loops wait on, in place of calling select() themselves. A loop
+ *	passes the set of fds it wants to read and gets back the ones which are ready, as with select().
+ *	There are three engines, picked at run time ("io engine" in serial_ip.conf):
+ *	- io_uring: the fds are watched by operations on a submission ring. All the operations a loop
+ *	  pass needs are submitted together with the wait, in a single io_uring_enter(). Listeners get a
+ *	  multishot accept, so accept() costs no syscall of its own. The session buffers are registered
+ *	  with the ring, and the socket and serial port of a Telnet session are read straight into them
+ *	  (READ_FIXED); read_from_fd_to_buffer() then takes the data without a read() call.
+ *	- epoll: an epoll instance keeps the interest list between loop passes.
+ *	- select: what the loops did before.
+ *	"auto" tries io_uring, then epoll. The ring is set up with raw syscalls, liburing is not needed.
+ *	Only fds below FD_SETSIZE can be watched, as with select().
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+
+#define IO_ENGINE_SELECT	0
+#define IO_ENGINE_EPOLL		1
+#define IO_ENGINE_URING		2
+
+#define IO_WATCH_POLL		0				/* report when readable */
+#define IO_WATCH_READ		1				/* read into a BUFFER (io_uring) */
+#define IO_WATCH_ACCEPT		2				/* listening socket (io_uring: multishot accept) */
+
+#define IO_OP_POLL			1				/* kinds of operations, in user_data */
+#define IO_OP_READ			2
+#define IO_OP_ACCEPT		3
+#define IO_OP_CANCEL		4
+
+#define IO_RING_ENTRIES		64
+#define IO_ACCEPT_QUEUE		32				/* connections accepted ahead of the loop */
+#define IO_MAX_BUFFERS		8
+
+/*
+	Location: io_engine.c
+	What the engine knows about an fd.
+*/
+struct io_fd_t {
+	int mode;								/* IO_WATCH_* */
+	int armed;								/* an operation is in flight (io_uring), or in the epoll set */
+	int op;									/* IO_OP_* of the operation in flight */
+	int cancelling;							/* we asked the ring to cancel it */
+	unsigned int gen;						/* completions of older generations are stale */
+	int ready;								/* readable, not reported yet */
+	int done;								/* a read completed into buff, not taken yet */
+	int result;								/* its result */
+	int tty;								/* a tty: 0 bytes means VTIME ran out, not EOF */
+	int tty_poll;							/* so we poll it before the next read */
+	BUFFER *buff;							/* IO_WATCH_READ: the buffer to read into */
+	unsigned char *target;					/* where the read in flight puts its data */
+	int accepted[IO_ACCEPT_QUEUE];			/* IO_WATCH_ACCEPT: connections waiting for accept() */
+	int naccepted;
+};
+
+/*
+	Location: io_engine.c
+	The submission and completion rings, mapped from the kernel.
+*/
+struct io_ring_t {
+	int fd;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int sq_entries;
+	unsigned int sq_local_tail;				/* sqes filled in, not yet published */
+	unsigned int to_submit;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_map, *cq_map;
+	size_t sq_map_len, cq_map_len, sqes_len;
+	int multishot_accept;					/* the kernel has IORING_ACCEPT_MULTISHOT */
+	BUFFER *buffers[IO_MAX_BUFFERS];		/* registered with the ring */
+	int nbuffers;
+};
+
+static int io_engine = -1;					/* IO_ENGINE_*, -1 before io_engine_init() */
+static int io_epoll_fd = -1;
+static struct io_ring_t io_ring;
+static struct io_fd_t io_fds[FD_SETSIZE];
+static int io_fd_top = 0;					/* fds at or above this one are unknown to us */
+
+static const char *io_engine_names[] = { "select", "epoll", "io_uring" };
+
+/*
+	Location: io_engine.c
+	This is to map the rings of a new io_uring instance.
+	returns 0 on success, 1 on failure.
+*/
+static int io_ring_setup(void)
+{
+	extern int errno;
+	struct io_uring_params p;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	fd = syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &p);
+	if (fd < 0) {
+		syslog(LOG_INFO, "io_engine.c: io_ring_setup(): io_uring not available: %s", strerror(errno));
+		return(1);
+	}
+	memset(&io_ring, 0, sizeof(io_ring));
+	io_ring.fd = fd;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	io_ring.sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	io_ring.cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (io_ring.cq_map_len > io_ring.sq_map_len)
+			io_ring.sq_map_len = io_ring.cq_map_len;
+		io_ring.cq_map_len = io_ring.sq_map_len;
+	}
+	io_ring.sq_map = mmap(NULL, io_ring.sq_map_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (io_ring.sq_map == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		io_ring.cq_map = io_ring.sq_map;
+	else {
+		io_ring.cq_map = mmap(NULL, io_ring.cq_map_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (io_ring.cq_map == MAP_FAILED)
+			goto fail;
+	}
+	io_ring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	io_ring.sqes = mmap(NULL, io_ring.sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (io_ring.sqes == MAP_FAILED)
+		goto fail;
+	/* a forked child must not touch our rings, see io_engine_close() */
+	madvise(io_ring.sq_map, io_ring.sq_map_len, MADV_DONTFORK);
+	if (io_ring.cq_map != io_ring.sq_map)
+		madvise(io_ring.cq_map, io_ring.cq_map_len, MADV_DONTFORK);
+	madvise(io_ring.sqes, io_ring.sqes_len, MADV_DONTFORK);
+	io_ring.sq_head = (unsigned int *) ((char *) io_ring.sq_map + p.sq_off.head);
+	io_ring.sq_tail = (unsigned int *) ((char *) io_ring.sq_map + p.sq_off.tail);
+	io_ring.sq_mask = (unsigned int *) ((char *) io_ring.sq_map + p.sq_off.ring_mask);
+	io_ring.sq_array = (unsigned int *) ((char *) io_ring.sq_map + p.sq_off.array);
+	io_ring.sq_entries = p.sq_entries;
+	io_ring.sq_local_tail = *io_ring.sq_tail;
+	io_ring.cq_head = (unsigned int *) ((char *) io_ring.cq_map + p.cq_off.head);
+	io_ring.cq_tail = (unsigned int *) ((char *) io_ring.cq_map + p.cq_off.tail);
+	io_ring.cq_mask = (unsigned int *) ((char *) io_ring.cq_map + p.cq_off.ring_mask);
+	io_ring.cqes = (struct io_uring_cqe *) ((char *) io_ring.cq_map + p.cq_off.cqes);
+	io_ring.multishot_accept = 1;			/* until the kernel tells us otherwise */
+	return(0);
+fail:
+	syslog(LOG_ERR, "io_engine.c: io_ring_setup(): mmap() error: %s", strerror(errno));
+	if ((io_ring.sq_map != NULL) && (io_ring.sq_map != MAP_FAILED))
+		munmap(io_ring.sq_map, io_ring.sq_map_len);
+	if ((io_ring.cq_map != NULL) && (io_ring.cq_map != MAP_FAILED) && (io_ring.cq_map != io_ring.sq_map))
+		munmap(io_ring.cq_map, io_ring.cq_map_len);
+	close(fd);
+	memset(&io_ring, 0, sizeof(io_ring));
+	io_ring.fd = -1;
+	return(1);
+}
+
+/*
+	Location: io_engine.c
+	This is to submit the sqes filled in so far, and to wait for min_complete completions.
+	returns 0 on success, -1 on error (errno is set).
+*/
+static int io_ring_enter(unsigned int min_complete)
+{
+	int ret;
+
+	__atomic_store_n(io_ring.sq_tail, io_ring.sq_local_tail, __ATOMIC_RELEASE);
+	if ((io_ring.to_submit == 0) && (min_complete == 0))
+		return(0);
+	ret = syscall(__NR_io_uring_enter, io_ring.fd, io_ring.to_submit, min_complete,
+			min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (ret < 0)
+		return(-1);
+	io_ring.to_submit = ((unsigned int) ret < io_ring.to_submit) ? io_ring.to_submit - ret : 0;
+	return(0);
+}
+
+/*
+	Location: io_engine.c
+	This is to get a free sqe. If the ring is full, what is in it is submitted first.
+	returns the sqe, cleared.
+*/
+static struct io_uring_sqe *io_ring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head;
+	unsigned int idx;
+
+	head = __atomic_load_n(io_ring.sq_head, __ATOMIC_ACQUIRE);
+	while (io_ring.sq_local_tail - head >= io_ring.sq_entries) {
+		io_ring_enter(0);
+		head = __atomic_load_n(io_ring.sq_head, __ATOMIC_ACQUIRE);
+	}
+	idx = io_ring.sq_local_tail & *io_ring.sq_mask;
+	sqe = &io_ring.sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	io_ring.sq_array[idx] = idx;
+	io_ring.sq_local_tail++;
+	io_ring.to_submit++;
+	return(sqe);
+}
+
+/*
+	Location: io_engine.c
+	This is to build the user_data of an operation on fd.
+*/
+static unsigned long long io_user_data(int fd, int kind)
+{
+	return(((unsigned long long) io_fds[fd].gen << 32) | ((unsigned long long) fd << 8) | kind);
+}
+
+/*
+	Location: io_engine.c
+	This is to get the index of the registered buffer which holds ptr.
+	returns the index, -1 if ptr is not in a registered buffer.
+*/
+static int io_ring_buffer_index(unsigned char *ptr)
+{
+	int i;
+
+	for (i = 0; i < io_ring.nbuffers; i++) {
+		if ((ptr >= io_ring.buffers[i]->buffp) && (ptr < io_ring.buffers[i]->buffp + io_ring.buffers[i]->size))
+			return(i);
+	}
+	return(-1);
+}
+
+/*
+	Location: io_engine.c
+	This is to start the operation which watches fd: a read into its buffer, an accept or a poll.
+*/
+static void io_ring_arm(int fd)
+{
+	struct io_fd_t *f = &io_fds[fd];
+	struct io_uring_sqe *sqe;
+	int bytes;
+	int idx;
+
+	if ((f->mode == IO_WATCH_ACCEPT) && (f->naccepted < IO_ACCEPT_QUEUE)) {
+		sqe = io_ring_get_sqe();
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = fd;
+		if (io_ring.multishot_accept)
+			sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->user_data = io_user_data(fd, IO_OP_ACCEPT);
+		f->op = IO_OP_ACCEPT;
+		f->armed = 1;
+		return;
+	}
+	if ((f->mode == IO_WATCH_READ) && (! f->tty_poll)) {
+		bytes = cal_numbytes_to_read(f->buff);
+		if (bytes > 0) {
+			sqe = io_ring_get_sqe();
+			idx = io_ring_buffer_index(f->buff->readp);
+			if (idx >= 0) {
+				sqe->opcode = IORING_OP_READ_FIXED;
+				sqe->buf_index = idx;
+			} else
+				sqe->opcode = IORING_OP_READ;
+			sqe->fd = fd;
+			sqe->addr = (unsigned long) f->buff->readp;
+			sqe->len = bytes;
+			sqe->off = (unsigned long long) -1;		/* current position: sockets and ttys have none */
+			sqe->user_data = io_user_data(fd, IO_OP_READ);
+			f->target = f->buff->readp;
+			f->op = IO_OP_READ;
+			f->armed = 1;
+			return;
+		}
+	}
+	if (f->mode == IO_WATCH_ACCEPT)
+		return;										/* queue full: the loop accepts first */
+	/* one-shot: it checks the fd when armed, so data left unread is reported again, as with select() */
+	sqe = io_ring_get_sqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = io_user_data(fd, IO_OP_POLL);
+	f->op = IO_OP_POLL;
+	f->armed = 1;
+}
+
+/*
+	Location: io_engine.c
+	This is to ask the ring to cancel the operation in flight on fd. It completes later on.
+*/
+static void io_ring_cancel(int fd)
+{
+	struct io_fd_t *f = &io_fds[fd];
+	struct io_uring_sqe *sqe;
+
+	if ((! f->armed) || f->cancelling)
+		return;
+	sqe = io_ring_get_sqe();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = io_user_data(fd, f->op);
+	sqe->user_data = io_user_data(fd, IO_OP_CANCEL);
+	f->cancelling = 1;
+}
+
+/*
+	Location: io_engine.c
+	This is to handle a completion.
+*/
+static void io_ring_complete(struct io_uring_cqe *cqe)
+{
+	struct io_fd_t *f;
+	unsigned int gen;
+	int kind;
+	int fd;
+
+	kind = cqe->user_data & 0xff;
+	fd = (cqe->user_data >> 8) & 0xffffff;
+	gen = cqe->user_data >> 32;
+	if ((kind == IO_OP_CANCEL) || (fd >= FD_SETSIZE))
+		return;
+	f = &io_fds[fd];
+	if (gen != f->gen) {
+		if ((kind == IO_OP_ACCEPT) && (cqe->res >= 0))
+			close(cqe->res);							/* a listener we forgot */
+		return;
+	}
+	switch (kind) {
+	case IO_OP_POLL:
+		f->armed = f->cancelling = 0;
+		if (cqe->res != -ECANCELED)
+			f->ready = 1;								/* readable, or an error read() will tell about */
+		f->tty_poll = 0;
+		break;
+	case IO_OP_READ:
+		f->armed = f->cancelling = 0;
+		if (cqe->res == -ECANCELED)
+			break;
+		if (f->tty && (cqe->res == 0)) {
+			f->tty_poll = 1;							/* VTIME ran out, or hangup: let poll tell */
+			break;
+		}
+		f->done = 1;
+		f->result = cqe->res;
+		break;
+	case IO_OP_ACCEPT:
+		if (cqe->res >= 0) {
+			if (f->naccepted < IO_ACCEPT_QUEUE)
+				f->accepted[f->naccepted++] = cqe->res;
+			else
+				close(cqe->res);						/* not reached: we cancel when the queue fills up */
+			if (f->naccepted >= IO_ACCEPT_QUEUE / 2)
+				io_ring_cancel(fd);						/* let the backlog hold the rest */
+		} else if ((cqe->res == -EINVAL) && io_ring.multishot_accept) {
+			syslog(LOG_INFO, "io_engine.c: io_ring_complete(): no multishot accept, accepting one at a time");
+			io_ring.multishot_accept = 0;
+		}
+		if (! (cqe->flags & IORING_CQE_F_MORE))
+			f->armed = f->cancelling = 0;
+		break;
+	}
+}
+
+/*
+	Location: io_engine.c
+	This is to handle every completion which is waiting in the ring.
+*/
+static void io_ring_reap(void)
+{
+	unsigned int head;
+	unsigned int tail;
+
+	head = *io_ring.cq_head;
+	tail = __atomic_load_n(io_ring.cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		io_ring_complete(&io_ring.cqes[head & *io_ring.cq_mask]);
+		head++;
+		__atomic_store_n(io_ring.cq_head, head, __ATOMIC_RELEASE);
+		tail = __atomic_load_n(io_ring.cq_tail, __ATOMIC_ACQUIRE);
+	}
+}
+
+/*
+	Location: io_engine.c
+	This is to pick the engine given by "io engine" and set it up. It is done once per process, the
+	first time an event loop needs it.
+	returns 0 on success, 1 if we fell back to select().
+*/
+int io_engine_init(void)
+{
+	extern struct config_t conf;
+	const char *want;
+
+	if (io_engine >= 0)
+		return(0);
+	want = (conf.io_engine != NULL) ? conf.io_engine : "auto";
+	memset(io_fds, 0, sizeof(io_fds));
+	io_fd_top = 0;
+	io_ring.fd = -1;
+	io_engine = IO_ENGINE_SELECT;
+	if (((strcmp(want, "auto") == 0) || (strcmp(want, "io_uring") == 0)) && (io_ring_setup() == 0))
+		io_engine = IO_ENGINE_URING;
+	else if (strcmp(want, "select") != 0) {
+		io_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (io_epoll_fd >= 0)
+			io_engine = IO_ENGINE_EPOLL;
+		else
+			syslog(LOG_ERR, "io_engine.c: io_engine_init(): epoll_create1() error: %s", strerror(errno));
+	}
+	syslog(LOG_INFO, "io_engine.c: io_engine_init(): using %s (asked for %s)", io_engine_names[io_engine], want);
+	return(io_engine == IO_ENGINE_SELECT && (strcmp(want, "select") != 0));
+}
+
+/*
+	Location: io_engine.c
+	This is to drop the engine, eg. in a child process: the rings are not mapped in a child
+	(MADV_DONTFORK), so the child sets up its own. Connections accepted ahead are the parent's.
+*/
+void io_engine_close(void)
+{
+	int fd;
+
+	if (io_engine < 0)
+		return;
+	for (fd = 0; fd < io_fd_top; fd++) {
+		while (io_fds[fd].naccepted > 0)
+			close(io_fds[fd].accepted[--io_fds[fd].naccepted]);
+	}
+	if (io_engine == IO_ENGINE_URING) {
+		munmap(io_ring.sq_map, io_ring.sq_map_len);
+		if (io_ring.cq_map != io_ring.sq_map)
+			munmap(io_ring.cq_map, io_ring.cq_map_len);
+		munmap(io_ring.sqes, io_ring.sqes_len);
+		close(io_ring.fd);
+		memset(&io_ring, 0, sizeof(io_ring));
+		io_ring.fd = -1;
+	}
+	if (io_epoll_fd >= 0)
+		close(io_epoll_fd);
+	io_epoll_fd = -1;
+	memset(io_fds, 0, sizeof(io_fds));
+	io_fd_top = 0;
+	io_engine = -1;
+}
+
+/*
+	Location: io_engine.c
+	This is to start using fd: forget what we knew about an older fd with the same number.
+*/
+static struct io_fd_t *io_fd_get(int fd)
+{
+	if ((io_engine < 0) || (fd < 0) || (fd >= FD_SETSIZE))
+		return(NULL);
+	if (fd >= io_fd_top)
+		io_fd_top = fd + 1;
+	return(&io_fds[fd]);
+}
+
+/*
+	Location: io_engine.c
+	This is to have fd read into buff by the ring, from now on. With epoll and select, the loop
+	reads it as usual.
+*/
+void io_engine_read_into(int fd, BUFFER *buff)
+{
+	struct io_fd_t *f;
+
+	if ((f = io_fd_get(fd)) == NULL)
+		return;
+	f->mode = IO_WATCH_READ;
+	f->buff = buff;
+	f->tty = isatty(fd);
+}
+
+/*
+	Location: io_engine.c
+	This is to tell the engine fd is a listening socket.
+*/
+void io_engine_accept_on(int fd)
+{
+	struct io_fd_t *f;
+
+	if ((f = io_fd_get(fd)) == NULL)
+		return;
+	f->mode = IO_WATCH_ACCEPT;
+}
+
+/*
+	Location: io_engine.c
+	This is to stop the operation in flight on fd and wait until it is gone. Data a read brought in
+	meanwhile is put into its buffer, so nothing is lost, eg. when a session is handed over.
+*/
+void io_engine_quiesce(int fd)
+{
+	struct io_fd_t *f;
+	int n;
+
+	if ((f = io_fd_get(fd)) == NULL)
+		return;
+	if (io_engine == IO_ENGINE_URING) {
+		io_ring_cancel(fd);
+		while (f->armed) {
+			if ((io_ring_enter(1) < 0) && (errno != EINTR))
+				break;
+			io_ring_reap();
+		}
+	}
+	if (f->done && (f->result > 0) && (f->buff != NULL)) {
+		n = cal_numbytes_to_read(f->buff);
+		n = (f->result < n) ? f->result : n;
+		if (f->target != f->buff->readp)
+			memmove(f->buff->readp, f->target, n);
+		buffer_readpointer_position(f->buff, n);
+		f->done = 0;
+	}
+}
+
+/*
+	Location: io_engine.c
+	This is to forget fd before it is closed. An operation in flight is cancelled and waited for, so
+	it neither keeps the file open nor writes into a buffer which is about to be freed.
+*/
+void io_engine_forget(int fd)
+{
+	struct io_fd_t *f;
+	unsigned int gen;
+
+	if ((f = io_fd_get(fd)) == NULL)
+		return;
+	if (io_engine == IO_ENGINE_URING) {
+		io_ring_cancel(fd);
+		while (f->armed) {
+			if ((io_ring_enter(1) < 0) && (errno != EINTR))
+				break;
+			io_ring_reap();
+		}
+	}
+	if ((io_engine == IO_ENGINE_EPOLL) && f->armed)
+		epoll_ctl(io_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	while (f->naccepted > 0)
+		close(f->accepted[--f->naccepted]);
+	gen = f->gen;
+	memset(f, 0, sizeof(struct io_fd_t));
+	f->gen = gen + 1;								/* late completions are stale */
+}
+
+/*
+	Location: io_engine.c
+	This is to register the buffers of a session with the ring, so that reads into them need no
+	page pinning per operation. Without io_uring, or if the kernel refuses (RLIMIT_MEMLOCK), reads
+	simply go without.
+	returns 0 on success, 1 on failure.
+*/
+int io_engine_register_buffers(BUFFER **buffers, int nbuffers)
+{
+	extern int errno;
+	struct iovec iov[IO_MAX_BUFFERS];
+	int i;
+
+	if ((io_engine != IO_ENGINE_URING) || (nbuffers > IO_MAX_BUFFERS))
+		return(1);
+	io_engine_unregister_buffers();
+	for (i = 0; i < nbuffers; i++) {
+		iov[i].iov_base = buffers[i]->buffp;
+		iov[i].iov_len = buffers[i]->size;
+	}
+	if (syscall(__NR_io_uring_register, io_ring.fd, IORING_REGISTER_BUFFERS, iov, nbuffers) < 0) {
+		syslog(LOG_INFO, "io_engine.c: io_engine_register_buffers(): %s, reading without registered buffers", strerror(errno));
+		return(1);
+	}
+	for (i = 0; i < nbuffers; i++)
+		io_ring.buffers[i] = buffers[i];
+	io_ring.nbuffers = nbuffers;
+	return(0);
+}
+
+/*
+	Location: io_engine.c
+	This is to unregister the buffers, before they are freed. No read may be in flight into them,
+	see io_engine_forget().
+*/
+void io_engine_unregister_buffers(void)
+{
+	if ((io_engine != IO_ENGINE_URING) || (io_ring.nbuffers == 0))
+		return;
+	syscall(__NR_io_uring_register, io_ring.fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+	io_ring.nbuffers = 0;
+}
+
+/*
+	Location: io_engine.c
+	This is called by read_from_fd_to_buffer(): if the ring has read fd into buff already, the data
+	is taken from there. bytes is the room left in buff.
+	returns 1 and sets *n as read() would have (errno too), 0 if read() must be called.
+*/
+int io_engine_read_done(int fd, BUFFER *buff, int bytes, int *n)
+{
+	extern int errno;
+	struct io_fd_t *f;
+
+	if ((io_engine != IO_ENGINE_URING) || (fd < 0) || (fd >= io_fd_top))
+		return(0);
+	f = &io_fds[fd];
+	if ((f->mode != IO_WATCH_READ) || (f->buff != buff))
+		return(0);
+	if (f->armed && ! f->done) {
+		errno = EAGAIN;								/* a read is in flight, it must not race with ours */
+		*n = -1;
+		return(1);
+	}
+	if (! f->done)
+		return(0);
+	f->done = 0;
+	if (f->result < 0) {
+		errno = -f->result;
+		*n = -1;
+		return(1);
+	}
+	*n = (f->result < bytes) ? f->result : bytes;
+	if (f->target != buff->readp)
+		memmove(buff->readp, f->target, *n);		/* the buffer was reset meanwhile */
+	return(1);
+}
+
+/*
+	Location: io_engine.c
+	This is to accept a connection on a listening socket the engine reported ready. With io_uring
+	it was accepted already.
+	returns the socket fd of the client, -1 on error (errno is set).
+*/
+int io_engine_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+	struct io_fd_t *f;
+	int client;
+	int i;
+
+	if ((io_engine != IO_ENGINE_URING) || (fd < 0) || (fd >= io_fd_top) || (io_fds[fd].naccepted == 0))
+		return(accept(fd, addr, addrlen));
+	f = &io_fds[fd];
+	client = f->accepted[0];
+	for (i = 1; i < f->naccepted; i++)
+		f->accepted[i - 1] = f->accepted[i];
+	f->naccepted--;
+	if ((addr != NULL) && (addrlen != NULL))
+		getpeername(client, addr, addrlen);
+	return(client);
+}
+
+/*
+	Location: io_engine.c
+	This is to check whether fd has something for the loop.
+	returns 1 if it has, 0 otherwise.
+*/
+static int io_ring_is_ready(int fd)
+{
+	struct io_fd_t *f = &io_fds[fd];
+
+	if (f->mode == IO_WATCH_ACCEPT)
+		return(f->naccepted > 0);
+	return(f->ready || f->done);
+}
+
+/*
+	Location: io_engine.c
+	This is the io_uring part of io_engine_wait(): arm what watch wants and is not armed yet, cancel
+	what it does not want any more, then submit all of it and wait, in one io_uring_enter().
+*/
+static int io_ring_wait(fd_set *watch, fd_set *ready, int nfds)
+{
+	struct io_fd_t *f;
+	int count;
+	int fd;
+
+	for ( ; ; ) {
+		count = 0;
+		for (fd = 0; fd < io_fd_top || fd < nfds; fd++) {
+			if (fd >= io_fd_top)
+				io_fd_top = fd + 1;
+			f = &io_fds[fd];
+			if ((fd < nfds) && FD_ISSET(fd, watch)) {
+				if (io_ring_is_ready(fd)) {
+					count++;
+					continue;
+				}
+				if (! f->armed)
+					io_ring_arm(fd);
+			} else if (f->armed)
+				io_ring_cancel(fd);
+		}
+		if (io_ring_enter(count > 0 ? 0 : 1) < 0)
+			return(-1);								/* EINTR: a signal without signal_fd */
+		io_ring_reap();
+		count = 0;
+		for (fd = 0; fd < nfds; fd++) {
+			if (FD_ISSET(fd, watch) && io_ring_is_ready(fd)) {
+				FD_SET(fd, ready);
+				io_fds[fd].ready = 0;				/* done is cleared when the data is taken */
+				count++;
+			}
+		}
+		if (count > 0)
+			return(count);
+	}
+}
+
+/*
+	Location: io_engine.c
+	This is the epoll part of io_engine_wait(): the interest list follows watch.
+*/
+static int io_epoll_wait(fd_set *watch, fd_set *ready, int nfds)
+{
+	struct epoll_event events[64];
+	struct epoll_event ev;
+	struct io_fd_t *f;
+	int count;
+	int ret;
+	int fd;
+	int i;
+
+	for (fd = 0; fd < io_fd_top || fd < nfds; fd++) {
+		if (fd >= io_fd_top)
+			io_fd_top = fd + 1;
+		f = &io_fds[fd];
+		if ((fd < nfds) && FD_ISSET(fd, watch)) {
+			if (! f->armed) {
+				memset(&ev, 0, sizeof(ev));
+				ev.events = EPOLLIN;
+				ev.data.fd = fd;
+				if ((epoll_ctl(io_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0) || (errno == EEXIST))
+					f->armed = 1;
+			}
+		} else if (f->armed) {
+			epoll_ctl(io_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+			f->armed = 0;
+		}
+	}
+	for ( ; ; ) {
+		ret = epoll_wait(io_epoll_fd, events, sizeof(events) / sizeof(events[0]), -1);
+		if (ret < 0)
+			return(-1);
+		count = 0;
+		for (i = 0; i < ret; i++) {
+			fd = events[i].data.fd;
+			if ((fd < nfds) && FD_ISSET(fd, watch)) {
+				FD_SET(fd, ready);
+				count++;
+			}
+		}
+		if (count > 0)
+			return(count);
+	}
+}
+
+/*
+	Location: io_engine.c
+	This is to wait until one of the fds in watch can be read, like select() with no timeout: the
+	timers have their own fd (timer_wheel.c). nfds is the highest fd + 1.
+	returns the number of fds set in ready, -1 on error (errno is set).
+*/
+int io_engine_wait(fd_set *watch, fd_set *ready, int nfds)
+{
+	if (io_engine < 0)
+		io_engine_init();
+	if (nfds > FD_SETSIZE)
+		nfds = FD_SETSIZE;
+	FD_ZERO(ready);
+	if (io_engine == IO_ENGINE_URING)
+		return(io_ring_wait(watch, ready, nfds));
+	if (io_engine == IO_ENGINE_EPOLL)
+		return(io_epoll_wait(watch, ready, nfds));
+	*ready = *watch;								/* structure copy */
+	return(select(nfds, ready, NULL, NULL, NULL));
+}
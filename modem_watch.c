@@ -0,0 +1,226 @@
+/*
+ * modem_watch.c
+ *	This is to learn about modem line changes (CD, RI, DSR, CTS) as they happen, instead of on the
+ *	next poll interval. While a Telnet session runs, a helper thread sleeps in TIOCMIWAIT on the
+ *	serial device and writes a byte into a pipe whenever a line changes. The session loop selects
+ *	on that pipe and sends NOTIFY-MODEMSTATE / NOTIFY-LINESTATE (RFC2217) from its own context.
+ *	The pipe is non-blocking and drained in one go, so a burst of toggles while the session is busy
+ *	becomes a single notification; the TIOCGICOUNT counters still tell which lines moved.
+ *	Drivers without TIOCMIWAIT (eg. pseudo terminals) fall back to the poll interval.
+ *	The thread is stopped by a flag and MODEM_WATCH_SIGNAL, which takes it out of TIOCMIWAIT with
+ *	EINTR: ioctl() is not a cancellation point, and asynchronous cancellation is not safe around it.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#define _GNU_SOURCE							/* pipe2() */
+#include "serial_ip.h"
+
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+#define MODEM_WATCH_LINES	(TIOCM_CD|TIOCM_RI|TIOCM_DSR|TIOCM_CTS)
+#define MODEM_WATCH_SIGNAL	SIGRTMIN		/* wakes the thread up to stop */
+
+int modem_watch_fd = -1;					/* readable when a modem line changed */
+
+static int modem_watch_pipe[2] = { -1, -1 };
+static int modem_watch_serial_fd = -1;
+static int modem_watch_running = 0;
+static volatile sig_atomic_t modem_watch_blocked = 0;		/* the thread waits in TIOCMIWAIT */
+static volatile sig_atomic_t modem_watch_quit = 0;			/* the thread is told to stop */
+static volatile sig_atomic_t modem_watch_done = 0;			/* the thread is on its way out */
+static pthread_t modem_watch_tid;
+static struct serial_icounter_struct modem_watch_icount;	/* counters at the last notification */
+static int modem_watch_have_icount = 0;
+
+/*
+	Location: modem_watch.c
+	This is what MODEM_WATCH_SIGNAL does: nothing, the ioctl() it interrupts returns EINTR.
+*/
+static void modem_watch_wakeup(int signal)
+{
+}
+
+/*
+	Location: modem_watch.c
+	This is the helper thread. TIOCMIWAIT returns once one of the modem lines changed, or with EINTR
+	when we are told to stop.
+*/
+static void *modem_watch_thread(void *arg)
+{
+	extern int errno;
+	extern struct config_t conf;
+	sigset_t wakeup;
+
+	sigemptyset(&wakeup);
+	sigaddset(&wakeup, MODEM_WATCH_SIGNAL);
+	pthread_sigmask(SIG_UNBLOCK, &wakeup, NULL);			/* the only signal for us */
+	while (! modem_watch_quit) {
+		if (ioctl(modem_watch_serial_fd, TIOCMIWAIT, MODEM_WATCH_LINES) < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_INFO, "modem_watch.c: modem_watch_thread(): TIOCMIWAIT not available (%s), polling every %d second(s)",
+					strerror(errno), conf.ms_pollinterval);
+			modem_watch_blocked = 0;
+			break;
+		}
+		if (write(modem_watch_pipe[1], "", 1) < 0)
+			;												/* pipe full: the session has been woken up already */
+	}
+	modem_watch_done = 1;
+	return(NULL);
+}
+
+/*
+	Location: modem_watch.c
+	This is to start watching the modem lines of the serial device of a session.
+	returns 0 on success, 1 on failure (the session then polls on its poll timer).
+*/
+int modem_watch_start(int serial_file_descriptor)
+{
+	extern int modem_watch_fd;
+	struct sigaction sa;
+	sigset_t all, old;
+	int ret;
+
+	modem_watch_stop();
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = modem_watch_wakeup;					/* no SA_RESTART: TIOCMIWAIT returns EINTR */
+	sigemptyset(&sa.sa_mask);
+	sigaction(MODEM_WATCH_SIGNAL, &sa, NULL);
+	modem_watch_have_icount = (ioctl(serial_file_descriptor, TIOCGICOUNT, &modem_watch_icount) == 0);
+	if (pipe2(modem_watch_pipe, O_NONBLOCK|O_CLOEXEC) < 0) {
+		syslog(LOG_ERR, "modem_watch.c: modem_watch_start(): pipe2() error: %s", strerror(errno));
+		return(1);
+	}
+	modem_watch_serial_fd = serial_file_descriptor;
+	modem_watch_blocked = 1;
+	modem_watch_quit = 0;
+	modem_watch_done = 0;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);					/* signals are for the session */
+	ret = pthread_create(&modem_watch_tid, NULL, modem_watch_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0) {
+		syslog(LOG_ERR, "modem_watch.c: modem_watch_start(): pthread_create() error: %s", strerror(ret));
+		close(modem_watch_pipe[0]);
+		close(modem_watch_pipe[1]);
+		modem_watch_pipe[0] = modem_watch_pipe[1] = -1;
+		modem_watch_blocked = 0;
+		return(1);
+	}
+	modem_watch_running = 1;
+	modem_watch_fd = modem_watch_pipe[0];
+	return(0);
+}
+
+/*
+	Location: modem_watch.c
+	This is to stop watching, at the end of a session.
+*/
+void modem_watch_stop(void)
+{
+	extern int modem_watch_fd;
+
+	if (modem_watch_running) {
+		/* again until it is out: the signal may come just before it goes into TIOCMIWAIT */
+		modem_watch_quit = 1;
+		while (! modem_watch_done) {
+			pthread_kill(modem_watch_tid, MODEM_WATCH_SIGNAL);
+			msleep(1000);
+		}
+		pthread_join(modem_watch_tid, NULL);
+		modem_watch_running = 0;
+	}
+	if (modem_watch_pipe[0] >= 0) {
+		io_engine_forget(modem_watch_pipe[0]);
+		close(modem_watch_pipe[0]);
+	}
+	if (modem_watch_pipe[1] >= 0)
+		close(modem_watch_pipe[1]);
+	modem_watch_pipe[0] = modem_watch_pipe[1] = -1;
+	modem_watch_fd = -1;
+	modem_watch_serial_fd = -1;
+	modem_watch_blocked = 0;
+}
+
+/*
+	Location: modem_watch.c
+	This is to tell whether modem line changes are reported by the thread.
+	returns 1 if they are, 0 if the modem lines must be polled.
+*/
+int modem_watch_waiting(void)
+{
+	return(modem_watch_blocked);
+}
+
+/*
+	Location: modem_watch.c
+	This is called when modem_watch_fd is readable: it empties the pipe, however many changes were signaled.
+*/
+void modem_watch_drain(void)
+{
+	extern int modem_watch_fd;
+	char drain[64];
+
+	while ((modem_watch_fd >= 0) && (read(modem_watch_fd, drain, sizeof(drain)) > 0))
+		;
+}
+
+/*
+	Location: modem_watch.c
+	This is to read the modem lines in RFC2217 form. previous is the last state we sent; a delta bit is
+	set for each line whose level differs from it, or which toggled since then (TIOCGICOUNT).
+	line_errors gets the line state error bits (break, framing, parity, overrun) seen since the last call.
+	returns the modem state, with the delta bits.
+*/
+unsigned char get_modemstate(int serial_file_descriptor, unsigned char previous, unsigned char *line_errors)
+{
+	struct serial_icounter_struct icount;
+	unsigned char state;
+	int lines;
+
+	*line_errors = 0;
+	if (ioctl(serial_file_descriptor, TIOCMGET, &lines) < 0)
+		return(previous & (CPC_MODEMSTATE_CD|CPC_MODEMSTATE_RI|CPC_MODEMSTATE_DSR|CPC_MODEMSTATE_CTS));
+	state = 0;
+	if (lines & TIOCM_CD)
+		state |= CPC_MODEMSTATE_CD;
+	if (lines & TIOCM_RI)
+		state |= CPC_MODEMSTATE_RI;
+	if (lines & TIOCM_DSR)
+		state |= CPC_MODEMSTATE_DSR;
+	if (lines & TIOCM_CTS)
+		state |= CPC_MODEMSTATE_CTS;
+	if ((state ^ previous) & CPC_MODEMSTATE_CD)
+		state |= CPC_MODEMSTATE_DELTA_CD;
+	if ((previous & CPC_MODEMSTATE_RI) && ! (state & CPC_MODEMSTATE_RI))
+		state |= CPC_MODEMSTATE_TRLEDGE_RI;						/* trailing edge of ring */
+	if ((state ^ previous) & CPC_MODEMSTATE_DSR)
+		state |= CPC_MODEMSTATE_DELTA_DSR;
+	if ((state ^ previous) & CPC_MODEMSTATE_CTS)
+		state |= CPC_MODEMSTATE_DELTA_CTS;
+	if (modem_watch_have_icount && (ioctl(serial_file_descriptor, TIOCGICOUNT, &icount) == 0)) {
+		/* lines which went and came back between two calls */
+		if (icount.dcd != modem_watch_icount.dcd)
+			state |= CPC_MODEMSTATE_DELTA_CD;
+		if (icount.rng != modem_watch_icount.rng)
+			state |= CPC_MODEMSTATE_TRLEDGE_RI;
+		if (icount.dsr != modem_watch_icount.dsr)
+			state |= CPC_MODEMSTATE_DELTA_DSR;
+		if (icount.cts != modem_watch_icount.cts)
+			state |= CPC_MODEMSTATE_DELTA_CTS;
+		if (icount.brk != modem_watch_icount.brk)
+			*line_errors |= CPC_LINESTATE_BREAK_DETECT;
+		if (icount.frame != modem_watch_icount.frame)
+			*line_errors |= CPC_LINESTATE_FRAMING_ERROR;
+		if (icount.parity != modem_watch_icount.parity)
+			*line_errors |= CPC_LINESTATE_PARITY_ERROR;
+		if ((icount.overrun != modem_watch_icount.overrun) || (icount.buf_overrun != modem_watch_icount.buf_overrun))
+			*line_errors |= CPC_LINESTATE_OVERRUN_ERROR;
+		modem_watch_icount = icount;
+	}
+	return(state);
+}
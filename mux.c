@@ -0,0 +1,556 @@
+/*
+ * mux.c
+ *	This is the multiplexed connection: many serial ports over one TCP connection, accepted on the
+ *	"mux port". Everything on it travels in frames, both ways:
+ *		<version(2)> <type(1)> <flags(1)> <channel(2)> <length(2)> <payload(length)>
+ *	in network byte order, version being MUX_VERSION (SERIAL_IP_VERSION, minor 1), and a payload of at
+ *	most MUX_MAX_PAYLOAD bytes (see struct mux_header in serial_ip.h).
+ *	The client opens a channel with MUX_OPEN, naming a serial device of the configuration and choosing
+ *	the channel number; we answer MUX_OPEN, or MUX_ERROR with the reason. Then MUX_DATA carries the
+ *	bytes of the port each way, MUX_CONTROL sets or asks baud rate, data size, parity and stop size with
+ *	the RFC2217 command numbers (the answer carries the S2C number and the value in effect), and
+ *	MUX_CLOSE ends the channel from either side.
+ *	Flow control is by credit, per channel and per direction: a side may only send as many data bytes
+ *	as the other allowed, MUX_WINDOW when the channel opens, and more with each MUX_CREDIT frame. We give
+ *	credit back as the serial device takes the bytes, and stop reading a device whose client gave us no
+ *	credit, so a slow port or a slow client holds up its own channel and not the others.
+ *	Whatever we have for the client in one turn of the loop, data of several channels and answers, is
+ *	batched in one buffer and goes out with a single write().
+ *	A channel closes without the hangup of serial_cleanup(), which would stall the other channels for
+ *	a second. A multiplexed connection is not handed over to a new binary (see upgrade.c): it keeps
+ *	running in the old one until the client is done.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+#include <poll.h>
+
+#define MUX_HEADER_SIZE		((int) sizeof(struct mux_header))
+#define MUX_FRAME_SIZE		(MUX_HEADER_SIZE + MUX_MAX_PAYLOAD)
+#define MUX_IN_SIZE			(2 * MUX_FRAME_SIZE)
+#define MUX_OUT_SIZE		(4 * MUX_FRAME_SIZE)
+#define MUX_RESERVE			256					/* room kept for the answers to one frame */
+
+/*
+	Location: mux.c
+	A channel: the serial port the client opened under a number, and its credits.
+*/
+struct mux_channel_t {
+	uint16_t id;								/* channel number */
+	SERIAL_INFO *port;
+	int fd;										/* serial device */
+	struct termios old_setting;					/* put back when the channel closes */
+	struct termios new_setting;
+	unsigned long credit;						/* data bytes the client still takes */
+	unsigned char queue[MUX_WINDOW];			/* data bytes for the device */
+	int qstart;
+	int qlen;
+	unsigned long drained;						/* taken by the device since we last gave credit */
+	int closed;									/* to be freed at the end of the turn */
+};
+
+/*
+	Location: mux.c
+	A multiplexed connection.
+*/
+struct mux_conn_t {
+	int sockfd;
+	struct mux_channel_t **channels;
+	int nchannels;
+	unsigned char in[MUX_IN_SIZE];				/* from the client, up to a whole frame */
+	int nin;
+	unsigned char out[MUX_OUT_SIZE];			/* for the client, written once a turn */
+	int nout;
+};
+
+/*
+	Location: mux.c
+	This is to queue a frame for the client.
+	returns 0 on success, 1 if there is no room for it.
+*/
+static int mux_put(struct mux_conn_t *mc, uint8_t type, uint16_t channel, const void *payload, int len)
+{
+	struct mux_header hdr;
+
+	if (mc->nout + MUX_HEADER_SIZE + len > MUX_OUT_SIZE)
+		return(1);
+	hdr.version = MUX_VERSION;
+	hdr.type = type;
+	hdr.flags = 0;
+	hdr.channel = channel;
+	hdr.length = (uint16_t) len;
+	PACK_MUX_HEADER(1, &hdr);
+	memcpy(mc->out + mc->nout, &hdr, MUX_HEADER_SIZE);
+	if (len > 0)
+		memcpy(mc->out + mc->nout + MUX_HEADER_SIZE, payload, len);
+	mc->nout += MUX_HEADER_SIZE + len;
+	return(0);
+}
+
+/*
+	Location: mux.c
+	This is to tell the client why a request on a channel failed.
+*/
+static void mux_error(struct mux_conn_t *mc, uint16_t channel, const char *why)
+{
+	syslog(LOG_ERR, "mux.c: mux_error(): channel %u: %s", channel, why);
+	mux_put(mc, MUX_ERROR, channel, why, strlen(why));
+}
+
+/*
+	Location: mux.c
+	This is to give the client credit for what the device took.
+*/
+static void mux_give_credit(struct mux_conn_t *mc, struct mux_channel_t *ch)
+{
+	uint32_t netvalue;
+
+	netvalue = htonl((uint32_t) ch->drained);
+	if (mux_put(mc, MUX_CREDIT, ch->id, &netvalue, 4) == 0)
+		ch->drained = 0;
+}
+
+/*
+	Location: mux.c
+	This is to find an open channel by number.
+	returns the channel, NULL if there is none.
+*/
+static struct mux_channel_t *mux_channel(struct mux_conn_t *mc, uint16_t id)
+{
+	int i;
+
+	for (i = 0; i < mc->nchannels; i++) {
+		if ((! mc->channels[i]->closed) && (mc->channels[i]->id == id))
+			return(mc->channels[i]);
+	}
+	return(NULL);
+}
+
+/*
+	Location: mux.c
+	This is to open a channel on the serial device named in the payload of a MUX_OPEN frame.
+*/
+static void mux_open(struct mux_conn_t *mc, uint16_t id, const unsigned char *payload, int len)
+{
+	extern struct config_t conf;
+	struct mux_channel_t **channels;
+	struct mux_channel_t *ch;
+	char device[PATH_MAX];
+	int flags;
+
+	if (mux_channel(mc, id) != NULL) {
+		mux_error(mc, id, "channel in use");
+		return;
+	}
+	if ((len <= 0) || (len >= (int) sizeof(device))) {
+		mux_error(mc, id, "bad device name");
+		return;
+	}
+	memcpy(device, payload, len);
+	device[len] = '\0';
+	channels = realloc(mc->channels, (mc->nchannels + 1) * sizeof(struct mux_channel_t *));
+	ch = calloc(1, sizeof(struct mux_channel_t));
+	if ((channels == NULL) || (ch == NULL)) {
+		if (channels != NULL)
+			mc->channels = channels;
+		free(ch);
+		mux_error(mc, id, "out of memory");
+		return;
+	}
+	mc->channels = channels;
+	ch->port = serial_port_claim(&conf, device, &ch->fd, &ch->old_setting, &ch->new_setting);
+	if (ch->port == NULL) {
+		free(ch);
+		mux_error(mc, id, "serial port not available");
+		return;
+	}
+	/* the loop waits on every device at once */
+	flags = fcntl(ch->fd, F_GETFL, 0);
+	if (flags != -1)
+		fcntl(ch->fd, F_SETFL, flags | O_NONBLOCK);
+	ch->id = id;
+	ch->credit = MUX_WINDOW;
+	mc->channels[mc->nchannels++] = ch;
+	syslog(LOG_INFO, "mux.c: mux_open(): channel %u is %s", id, ch->port->device);
+	mux_put(mc, MUX_OPEN, id, NULL, 0);
+}
+
+/*
+	Location: mux.c
+	This is to close a channel and release its serial port, as serial_cleanup() does but for the hangup.
+	The channel is freed by mux_reap().
+*/
+static void mux_close(struct mux_channel_t *ch)
+{
+	syslog(LOG_INFO, "mux.c: mux_close(): channel %u, releasing serial port %s", ch->id, ch->port->device);
+	if (ch->port->disc_flush)
+		tcflush(ch->fd, TCIOFLUSH);
+	serial_port_restore(ch->port, ch->fd, &ch->old_setting);
+	close(ch->fd);
+	ch->fd = -1;
+	release_serial_port(ch->port);
+	ch->closed = 1;
+}
+
+/*
+	Location: mux.c
+	This is to free the channels closed during this turn of the loop.
+*/
+static void mux_reap(struct mux_conn_t *mc)
+{
+	int i, j;
+
+	for (i = j = 0; i < mc->nchannels; i++) {
+		if (mc->channels[i]->closed)
+			free(mc->channels[i]);
+		else
+			mc->channels[j++] = mc->channels[i];
+	}
+	mc->nchannels = j;
+}
+
+/*
+	Location: mux.c
+	This is to act on a MUX_CONTROL frame: set or ask a port setting, as RFC2217 does (see telnet.c).
+*/
+static void mux_control(struct mux_conn_t *mc, struct mux_channel_t *ch, const unsigned char *payload, int len)
+{
+	unsigned char answer[5];
+	uint32_t netvalue;
+	unsigned long value;
+	int ret;
+
+	if (len != 5) {
+		mux_error(mc, ch->id, "bad control frame");
+		return;
+	}
+	memcpy(&netvalue, payload + 1, 4);
+	value = ntohl(netvalue);
+	ret = 0;
+	switch (payload[0]) {
+	case CPC_SET_BAUDRATE_C2S:
+		if (value != 0)
+			ret = set_baudrate(ch->fd, value);
+		value = get_baudrate(ch->fd);
+		break;
+	case CPC_SET_DATASIZE_C2S:
+		if (value != CPC_DATASIZE_REQUEST)
+			ret = set_datasize(ch->fd, value);
+		value = get_datasize(ch->fd);
+		break;
+	case CPC_SET_PARITY_C2S:
+		if (value != CPC_PARITY_REQUEST)
+			ret = set_parity(ch->fd, value);
+		value = get_parity(ch->fd);
+		break;
+	case CPC_SET_STOPSIZE_C2S:
+		if (value != CPC_STOPSIZE_REQUEST)
+			ret = set_stopsize(ch->fd, value);
+		value = get_stopsize(ch->fd);
+		break;
+	default:
+		mux_error(mc, ch->id, "unknown control command");
+		return;
+	}
+	if (ret != 0)
+		syslog(LOG_ERR, "mux.c: mux_control(): channel %u: cannot apply command %u value %lu", ch->id, payload[0], value);
+	answer[0] = payload[0] + 100;						/* the S2C number */
+	netvalue = htonl((uint32_t) value);
+	memcpy(answer + 1, &netvalue, 4);
+	mux_put(mc, MUX_CONTROL, ch->id, answer, 5);
+}
+
+/*
+	Location: mux.c
+	This is to act on one frame from the client.
+	returns 0 on success, 1 if the connection cannot go on.
+*/
+static int mux_frame(struct mux_conn_t *mc, struct mux_header *hdr, const unsigned char *payload)
+{
+	struct mux_channel_t *ch;
+	uint32_t netvalue;
+	int room;
+
+	if (hdr->type == MUX_OPEN) {
+		mux_open(mc, hdr->channel, payload, hdr->length);
+		return(0);
+	}
+	ch = mux_channel(mc, hdr->channel);
+	if (ch == NULL) {
+		if (hdr->type != MUX_CLOSE)						/* a close may cross ours */
+			mux_error(mc, hdr->channel, "no such channel");
+		return(0);
+	}
+	switch (hdr->type) {
+	case MUX_DATA:
+		room = MUX_WINDOW - ch->qlen;
+		if (hdr->length > room) {
+			mux_error(mc, ch->id, "credit exceeded");
+			mux_close(ch);
+			mux_put(mc, MUX_CLOSE, hdr->channel, NULL, 0);
+			break;
+		}
+		if (ch->qstart + ch->qlen + hdr->length > MUX_WINDOW) {
+			memmove(ch->queue, ch->queue + ch->qstart, ch->qlen);
+			ch->qstart = 0;
+		}
+		memcpy(ch->queue + ch->qstart + ch->qlen, payload, hdr->length);
+		ch->qlen += hdr->length;
+		break;
+	case MUX_CLOSE:
+		mux_close(ch);
+		mux_put(mc, MUX_CLOSE, hdr->channel, NULL, 0);
+		break;
+	case MUX_CREDIT:
+		if (hdr->length != 4) {
+			mux_error(mc, ch->id, "bad credit frame");
+			break;
+		}
+		memcpy(&netvalue, payload, 4);
+		ch->credit += ntohl(netvalue);
+		break;
+	case MUX_CONTROL:
+		mux_control(mc, ch, payload, hdr->length);
+		break;
+	default:
+		mux_error(mc, ch->id, "unknown frame type");
+		break;
+	}
+	return(0);
+}
+
+/*
+	Location: mux.c
+	This is to act on the whole frames the client sent, as long as there is room for the answers.
+	returns 0 on success, 1 if the connection cannot go on (eg. a frame of another version).
+*/
+static int mux_parse(struct mux_conn_t *mc)
+{
+	struct mux_header hdr;
+	int done;
+
+	done = 0;
+	while ((mc->nin - done >= MUX_HEADER_SIZE) && (mc->nout + MUX_RESERVE <= MUX_OUT_SIZE)) {
+		memcpy(&hdr, mc->in + done, MUX_HEADER_SIZE);
+		PACK_MUX_HEADER(0, &hdr);
+		if ((hdr.version & 0xff00) != SERIAL_IP_VERSION) {
+			mux_error(mc, hdr.channel, "unsupported version");
+			return(1);
+		}
+		if (hdr.length > MUX_MAX_PAYLOAD) {
+			mux_error(mc, hdr.channel, "frame too long");
+			return(1);
+		}
+		if (mc->nin - done < MUX_HEADER_SIZE + hdr.length)
+			break;											/* the rest of it is still on its way */
+		if (mux_frame(mc, &hdr, mc->in + done + MUX_HEADER_SIZE) != 0)
+			return(1);
+		done += MUX_HEADER_SIZE + hdr.length;
+	}
+	if (done > 0) {
+		mc->nin -= done;
+		memmove(mc->in, mc->in + done, mc->nin);
+	}
+	return(0);
+}
+
+/*
+	Location: mux.c
+	This is to write the queued data of a channel to its serial device, and give credit for it.
+	returns 0 on success, 1 if the device failed.
+*/
+static int mux_serial_write(struct mux_conn_t *mc, struct mux_channel_t *ch)
+{
+	extern int errno;
+	int n;
+
+	n = write(ch->fd, ch->queue + ch->qstart, ch->qlen);
+	if (n < 0)
+		return((errno == EAGAIN) || (errno == EINTR) ? 0 : 1);
+	ch->qstart += n;
+	ch->qlen -= n;
+	if (ch->qlen == 0)
+		ch->qstart = 0;
+	ch->drained += n;
+	/* credit in sizeable steps, not a frame per write */
+	if ((ch->drained >= MUX_WINDOW / 2) || ((ch->qlen == 0) && (ch->drained > 0)))
+		mux_give_credit(mc, ch);
+	return(0);
+}
+
+/*
+	Location: mux.c
+	This is to read a serial device straight into a data frame for the client, as much as its credit
+	and our room allow.
+	returns 0 on success, 1 on EOF or if the device failed.
+*/
+static int mux_serial_read(struct mux_conn_t *mc, struct mux_channel_t *ch)
+{
+	extern int errno;
+	struct mux_header hdr;
+	int room;
+	int n;
+
+	room = MUX_OUT_SIZE - mc->nout - MUX_HEADER_SIZE - MUX_RESERVE;
+	if (room > MUX_MAX_PAYLOAD)
+		room = MUX_MAX_PAYLOAD;
+	if ((unsigned long) room > ch->credit)
+		room = (int) ch->credit;
+	if (room <= 0)
+		return(0);
+	n = read(ch->fd, mc->out + mc->nout + MUX_HEADER_SIZE, room);
+	if (n < 0)
+		return((errno == EAGAIN) || (errno == EINTR) ? 0 : 1);
+	if (n == 0)
+		return(1);
+	/* the payload is in place, put the header in front of it */
+	hdr.version = MUX_VERSION;
+	hdr.type = MUX_DATA;
+	hdr.flags = 0;
+	hdr.channel = ch->id;
+	hdr.length = (uint16_t) n;
+	PACK_MUX_HEADER(1, &hdr);
+	memcpy(mc->out + mc->nout, &hdr, MUX_HEADER_SIZE);
+	mc->nout += MUX_HEADER_SIZE + n;
+	ch->credit -= n;
+	return(0);
+}
+
+/*
+	Location: mux.c
+	This is to write what we have for the client, in one go.
+	returns 0 on success, 1 if the socket failed.
+*/
+static int mux_flush(struct mux_conn_t *mc)
+{
+	extern int errno;
+	int n;
+
+	if (mc->nout == 0)
+		return(0);
+	n = write(mc->sockfd, mc->out, mc->nout);
+	if (n < 0)
+		return((errno == EAGAIN) || (errno == EINTR) ? 0 : 1);
+	mc->nout -= n;
+	memmove(mc->out, mc->out + n, mc->nout);
+	return(0);
+}
+
+/*
+	Location: mux.c
+	This is to serve a multiplexed connection, from its first frame to the end of the connection or the
+	idle timer. All the channels still open are then closed.
+	returns 0 on success, 1 on failure (eg. no memory for the connection).
+*/
+int mux_session(int sockfd)
+{
+	extern int errno;
+	extern struct config_t conf;
+	extern int signal_fd;							/* a signal came in */
+	struct mux_conn_t *mc;
+	struct mux_channel_t *ch;
+	struct pollfd *pfds;
+	struct pollfd *p;
+	int npfds;
+	int timeout;
+	int done;
+	int ret;
+	int n;
+	int i;
+
+	mc = calloc(1, sizeof(struct mux_conn_t));
+	if (mc == NULL) {
+		debug_perror("mux.c: mux_session()");
+		return(1);
+	}
+	mc->sockfd = sockfd;
+	network_init(sockfd, NONBLOCKING);
+	timeout = (conf.idletimer > 0) ? conf.idletimer * 1000 : -1;
+	syslog(LOG_INFO, "mux.c: mux_session(): multiplexed connection on socket %d", sockfd);
+
+	pfds = NULL;
+	done = 0;
+	while (! done) {
+		/* the socket, the signals, then a slot per channel */
+		npfds = 2 + mc->nchannels;
+		p = realloc(pfds, npfds * sizeof(struct pollfd));
+		if (p == NULL) {
+			debug_perror("mux.c: mux_session()");
+			break;
+		}
+		pfds = p;
+		pfds[0].fd = sockfd;
+		pfds[0].events = (mc->nin < MUX_IN_SIZE ? POLLIN : 0) | (mc->nout > 0 ? POLLOUT : 0);
+		pfds[1].fd = signal_fd;
+		pfds[1].events = POLLIN;
+		for (i = 0; i < mc->nchannels; i++) {
+			ch = mc->channels[i];
+			pfds[2 + i].fd = ch->fd;
+			pfds[2 + i].events = 0;
+			if ((ch->credit > 0) && (mc->nout + MUX_HEADER_SIZE + MUX_RESERVE < MUX_OUT_SIZE))
+				pfds[2 + i].events |= POLLIN;
+			if (ch->qlen > 0)
+				pfds[2 + i].events |= POLLOUT;
+		}
+		ret = poll(pfds, npfds, timeout);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "mux.c: mux_session(): poll() error: %s", strerror(errno));
+			break;
+		}
+		if (ret == 0) {
+			syslog(LOG_INFO, "mux.c: mux_session(): terminating idle multiplexed connection");
+			break;
+		}
+		if (pfds[1].revents & POLLIN)
+			signal_fd_handle();
+
+		/* what the client sent */
+		if (pfds[0].revents & (POLLIN|POLLHUP|POLLERR)) {
+			n = read(sockfd, mc->in + mc->nin, MUX_IN_SIZE - mc->nin);
+			if (n == 0) {
+				write_to_debuglog(DBG_INF, "mux.c: mux_session(): read EOF on socket fd %d", sockfd);
+				done = 1;
+			} else if (n > 0) {
+				mc->nin += n;
+			} else if ((errno != EAGAIN) && (errno != EINTR)) {
+				done = 1;
+			}
+		}
+		if (mux_parse(mc) != 0)
+			done = 1;
+
+		/* the serial devices */
+		for (i = 0; i < npfds - 2; i++) {
+			ch = mc->channels[i];
+			if (ch->closed)
+				continue;
+			if ((pfds[2 + i].revents & POLLOUT) && (mux_serial_write(mc, ch) != 0)) {
+				mux_close(ch);
+				mux_put(mc, MUX_CLOSE, ch->id, NULL, 0);
+				continue;
+			}
+			if ((pfds[2 + i].revents & POLLIN) ? (mux_serial_read(mc, ch) != 0) : (pfds[2 + i].revents & (POLLHUP|POLLERR|POLLNVAL))) {
+				mux_close(ch);										/* the device is gone */
+				mux_put(mc, MUX_CLOSE, ch->id, NULL, 0);
+			}
+		}
+		mux_reap(mc);
+
+		/* all of it, in one write */
+		if (mux_flush(mc) != 0)
+			done = 1;
+	}
+
+	for (i = 0; i < mc->nchannels; i++)
+		mux_close(mc->channels[i]);
+	mux_reap(mc);
+	free(mc->channels);
+	free(pfds);
+	free(mc);
+	syslog(LOG_INFO, "mux.c: mux_session(): multiplexed connection on socket %d is over", sockfd);
+	return(0);
+}
@@ -13,11 +13,11 @@
 	returns 0 on success, 1 on failure	*/
 int write_socket(int sockfd, BUFFER *serial_to_socket_buf)
 {
-	extern int session_state;
+	extern TELNET_SESSION tnsession;
 	int n;
 	int ret;
 
-	if (session_state == SUSPEND)
+	if (tnsession.session_state == SUSPEND)
 		return(0);
 	n = write_from_buffer_to_fd(sockfd, serial_to_socket_buf);
 	if (n < 0) {											/* error on write */
@@ -33,19 +33,14 @@ int write_socket(int sockfd, BUFFER *serial_to_socket_buf)
 
 /*	Location: network_controller.c
 	This is to read data from serial_file_descriptor, and put its content into serial_to_socket buffer.
+	With quote set (Telnet, unless -n), the IAC chars are escaped.
 	returns 0 on success, 1 on failure (including EOF)	*/
-int read_serial(int serial_file_descriptor, BUFFER *serial_to_socket_buf)
+int read_serial(int serial_file_descriptor, BUFFER *serial_to_socket_buf, int quote)
 {
-	extern unsigned char linestate;
-	extern int noquote;														/* don't quote IAC char */
-	extern int useconds;													/* i/o wait time */
+	extern TELNET_SESSION tnsession;
 	int n;
 	int ret;
 
-	/* wait a bit before reading the serial port */
-	if (useconds > 0) {
-		msleep(useconds);
-	}
 	n = read_from_fd_to_buffer(serial_file_descriptor, serial_to_socket_buf);
 	if (n < 0) {															/* error on read */
 		ret = 1;
@@ -58,11 +53,11 @@ int read_serial(int serial_file_descriptor, BUFFER *serial_to_socket_buf)
 		}
 	} else {																/* some data was read */
 		ret = 0;
-		linestate |= CPC_LINESTATE_DATA_READY;								/* Enable flag of data ready => can read data.*/
+		tnsession.linestate |= CPC_LINESTATE_DATA_READY;								/* Enable flag of data ready => can read data.*/
 		bfdump(serial_to_socket_buf,0);										/* debugging dump of BUFFER */
 
-		/* check for IAC char unless 'noquote' option was enabled */
-		if (! noquote) {
+		/* check for IAC char unless 'noquote' option was enabled, or this is no Telnet session */
+		if (quote) {
 			if (bfstrchr(serial_to_socket_buf, IAC) != NULL) {			/* we detect IAC chars in the serial_to_sock buf for escaping them.*/
 				escape_iac_chars(serial_to_socket_buf);
 				bfdump(serial_to_socket_buf,0);								/* debugging dump of BUFFER */
@@ -90,7 +85,7 @@ int write_serial(int serial_file_descriptor, BUFFER *socket_to_serial_buf)
 	} else {														/* some data was written */
 		ret = 0;
 		if (bf_get_nbytes_active(socket_to_serial_buf) == 0)		/* no data left in buffer */
-			//linestate &= ~CPC_LINESTATE_DATA_READY;					/* Disable flag of data ready => can not receive anymore.*/
+			//tnsession.linestate &= ~CPC_LINESTATE_DATA_READY;					/* Disable flag of data ready => can not receive anymore.*/
 		bfdump(socket_to_serial_buf, 0);							/* debugging dump of BUFFER */
 	}
 	return(ret);
@@ -98,21 +93,17 @@ int write_serial(int serial_file_descriptor, BUFFER *socket_to_serial_buf)
 
 /*	Location: network_controller.c
 	This is to read from the networking socket and write content into socket_to_serial buffer.
+	The new bytes are appended at readp; a Telnet session acts on the commands among them (see session_protocol.c).
 	returns 0 on success, 1 on failure (including EOF)	*/
-int read_socket(int sockfd, int serial_file_descriptor, BUFFER *socket_to_serial_buf, BUFFER *sabre_to_socket_buf)
+int read_socket(int sockfd, BUFFER *socket_to_serial_buf)
 {
-	extern int useconds;			/* i/o wait time */
-	extern int raw_flag;			/* is raw TCP gateway?*/
+	extern SERIAL_INFO *si;
 	int n;
 	int ret;
 
-	/* wait a bit before reading the socket */
-	if (useconds > 0) {
-		msleep(useconds);
-	}
-
-	if(!raw_flag)
-		n = read_from_fd_to_buffer(sockfd, socket_to_serial_buf);
+	n = read_from_fd_to_buffer(sockfd, socket_to_serial_buf);
+	if (n > 0)
+		socket_profile_read(si, sockfd);							/* a latency session, see socket_profile.c */
 
 	if (n < 0) {													/* error on read */
 		ret = 1;
@@ -127,15 +118,6 @@ int read_socket(int sockfd, int serial_file_descriptor, BUFFER *socket_to_serial
 	} else {														/* some data was read */
 		ret = 0;
 		bfdump(socket_to_serial_buf, 0);							/* debugging dump of BUFFER */
-		if(!raw_flag)
-		{
-			/* check for IAC char */
-			if (bfstrchr(socket_to_serial_buf, IAC) != NULL)
-			{
-				process_telnet_options(sockfd, serial_file_descriptor, socket_to_serial_buf, sabre_to_socket_buf);
-				bfdump(socket_to_serial_buf, 0);							/* debugging dump of BUFFER */
-			}
-		}
 	}
 	return(ret);
 }
@@ -192,14 +174,38 @@ int parent_accept_socket_connection(int sockfd)
 {
 	extern SERIAL_INFO *si;						/* global ptr */
 	extern struct config_t conf;
+	extern int noquote;							/* don't quote IAC chars from serial lines */
 	SERIAL_INFO *sabre_serial_port;				/* a serial port from the pool */
 	int serial_file_descriptor;					/* serial port file descriptor */
 	struct termios old_setting;					/* original termios */
 	struct termios new_setting;					/* our custom termios */
+	struct sockaddr_storage local_addr;			/* address the client connected to */
+	socklen_t local_len;
+	int listen_port;							/* tcp port the client connected to */
+	SERIAL_INFO *bound;							/* the port of that listen port or socket */
 	//char *p;									/* gp ptr */
 
+	/* find out which listen port or unix socket the client used, it selects the serial port */
+	listen_port = 0;
+	bound = NULL;
+	local_len = sizeof(local_addr);
+	if (getsockname(sockfd, (struct sockaddr *) &local_addr, &local_len) == 0) {
+		if (local_addr.ss_family == AF_UNIX) {
+			bound = unix_socket_accept(&conf, sockfd, (struct sockaddr_un *) &local_addr, local_len);
+			if (bound == NULL)
+				return(1);
+		} else {
+			listen_port = ntohs(((struct sockaddr_in *) &local_addr)->sin_port);
+		}
+	}
+	/* a multiplexed connection opens its serial ports itself, by channel (see mux.c) */
+	if ((conf.mux_port > 0) && (listen_port == conf.mux_port))
+		return(mux_session(sockfd));
+	if (bound == NULL)
+		bound = port_lookup_listen_port(&conf.ports, listen_port);
+
 	/* allocate a serial port for SabreLite and prepare it for use */
-	sabre_serial_port = serial_port_init(&serial_file_descriptor, old_setting, new_setting);
+	sabre_serial_port = serial_port_init(bound, &serial_file_descriptor, &old_setting, &new_setting);
 	if (sabre_serial_port == NULL) {
 		/* The next 2 lines will be disabled for easy checking!  ---- Changelog on 18.09.2015*/
 		//p = "network_controller.c: Unable to allocate a serial port on Sabre for you.\r\n";
@@ -210,13 +216,25 @@ int parent_accept_socket_connection(int sockfd)
 
 	/* store a global ptr to the sabre serial port */
 	si = sabre_serial_port;
+	/* real-time priority, nice level and cpu affinity of the port, if it has any */
+	port_sched_apply(sabre_serial_port);
 	/* set socket options: keep-alive and non-blocking mode. */
 	network_init(sockfd, BLOCKING);
 	syslog(LOG_INFO, "network_controller.c: parent_accept_socket_connection(): network_init() - status: ok!");
+	/* the socket profile of the port, before anything is sent (see socket_profile.c) */
+	socket_profile_apply(sabre_serial_port, sockfd);
+	/* what the port said while nobody was connected, if it captures (see capture.c) */
+	if (capture_replay(sabre_serial_port, sockfd, session_protocol(sabre_serial_port)->rfc2217 && (! noquote)) != 0) {
+		serial_cleanup(sabre_serial_port, &serial_file_descriptor, old_setting, new_setting);
+		port_sched_restore();
+		si = NULL;
+		return(1);
+	}
 	/* pass data between the modem and the socket */
 	serial_ip_communication_process(sockfd, serial_file_descriptor, new_setting, sabre_serial_port);
 	/* restore the modem line to its original state */
 	serial_cleanup(sabre_serial_port, &serial_file_descriptor, old_setting, new_setting);
+	port_sched_restore();
 	si = NULL;
 	return(0);
 }
@@ -11,6 +11,33 @@
 
 #include "serial_ip.h"
 
+/*
+	Location: network_handle.c
+	This is the callback of the session timers: it raises the flag the timer was set up with.
+*/
+static void session_timer_expired(void *arg)
+{
+	*((int *) arg) = 1;
+}
+
+/*
+	Location: network_handle.c
+	This is to get the interval the modem and line state are polled at. When modem_watch.c reports
+	modem line changes as they happen, only the line state is left to poll.
+	returns the interval in milliseconds, 0 for no polling.
+*/
+static unsigned long session_poll_interval(void)
+{
+	extern struct config_t conf;
+	int secs;
+
+	if (modem_watch_waiting())
+		secs = conf.ls_pollinterval;
+	else
+		secs = (MIN(conf.ms_pollinterval, conf.ls_pollinterval));
+	return(secs > 0 ? secs * 1000UL : 0);
+}
+
 /*
 	Location: network_handle.c
 	This function is the heart of the software, when server got at least a connection from remote client.
@@ -21,11 +48,13 @@
 	3. Socket buffer for communicating with client.
 
 	Function:
-	- init the telnet options structure
-	- send initial telnet options: Com Port Control, Binary, etc.
+	- bind to the data path of the protocol of the port (see session_protocol.c); for Telnet,
+	  init the telnet options structure and send initial telnet options: Com Port Control, Binary, etc.
 	- set up select() call and enable a timeout
 	- enter select() loop
-	- use select() timeout to poll modem for state changes
+	- with "serial thread", read and write the serial port through the rings of serial_thread.c
+	- wake up on modem line changes (modem_watch.c), and on the session timers (timer_wheel.c):
+	  idle timeout, modem polling, batching window (-w) and write pacing
 	- also check for pending signals; SIGINT indicates BREAK condition
 	- buffer data to/from modem/socket
 	- handle telnet option negotiations
@@ -38,16 +67,33 @@ int serial_ip_communication_process(int sockfd, int serial_file_descriptor, stru
 	extern int errno;
 	extern int signo_child;							/* what signal did we receive? */
 	extern struct config_t conf;					/* built from config file */
-	extern int client_logged_in;					/* is the client still "logged in"? */
-	extern int raw_flag;							/* raw TCP mode? */
+	extern TELNET_SESSION tnsession;
+	extern int useconds;							/* i/o wait time (-w) */
+	extern int upgrade_listen_fd;					/* a new binary wants to take over */
+	extern int modem_watch_fd;						/* a modem line changed */
+	extern int timer_fd;							/* a timer is due */
+	extern int signal_fd;							/* a signal came in */
+	extern volatile sig_atomic_t reload_pending;	/* SIGHUP */
+	struct upgrade_session_t session;				/* what we hand over to it */
 	BUFFER *socket_to_serial_buf;					/* buffer for socket -> modem */
 	BUFFER *serial_to_socket_buf;					/* buffer for modem -> socket */
 	BUFFER *sabre_to_socket_buf;					/* buffer for us -> socket */
-	struct op_pdu op_pdu_recv;						/* buffer for raw TCP mode */
-	struct op_pdu op_pdu_send;						/* buffer for raw TCP mode */
-	struct timeval tv;								/* timer for select() */
-	int tvsecs;										/* what to put into tv.tv_sec */
-	time_t now, elapsed, idle_cnt;
+	BUFFER *ring_buffers[3];						/* registered with the io_uring engine */
+	SESSION_PROTOCOL *proto;						/* data path of the protocol of the port */
+	SESSION_IO io;									/* what it works on */
+	WHEEL_TIMER idle_timer;							/* connection goes idle */
+	WHEEL_TIMER linger_timer;						/* time for the client to answer DO LOGOUT */
+	WHEEL_TIMER poll_timer;							/* poll the modem and line state */
+	WHEEL_TIMER socket_timer;						/* batching window (-w) or write pacing of the socket */
+	WHEEL_TIMER serial_timer;						/* batching window (-w) of the serial port */
+	WHEEL_TIMER quiet_timer;						/* no traffic: the buffers give their pages back */
+	int idle_due, linger_due, poll_due;				/* set by the timers */
+	int socket_due, serial_due, quiet_due;
+	int buffers_pinned;								/* registered with io_uring, cannot be trimmed */
+	int socket_batched;								/* the batching window of the socket is over */
+	int serial_batched;								/* the batching window of the serial port is over */
+	int logout_sent;								/* we told the idle client to log out */
+	int socket_ready;								/* the socket can be read now */
 	int idle;										/* connection went idle */
 	int ret;										/* return value of select() */
 	int maxfd;										/* highest fd + 1 */
@@ -55,42 +101,87 @@ int serial_ip_communication_process(int sockfd, int serial_file_descriptor, stru
 	int check_serialfd;								/* check if serial fd is set in socket entry table or not.	*/
 	fd_set orig_fds;								/* original fd struct */
 	fd_set read_fds;								/* read fd struct */
+	BUFFER *arena_buffers[3];						/* session buffers preallocated by session_arena.c */
+	SESSION_SLAB *slab = NULL;						/* or our buffers, in one block (session_slab.c) */
 
 	write_to_debuglog(DBG_INF, "network_handle.c: serial_ip_communication_process(): sockfd fd=%d, serial port fd=%d",
 			sockfd, serial_file_descriptor);
 	syslog(LOG_INFO, "network_handle.c: serial_ip_communication_process(): sockfd fd=%d, serial port fd=%d",
 				sockfd, serial_file_descriptor);
-	/* allocate buffers */
-	socket_to_serial_buf = bfmalloc("network", SIZE_BUFFER);
-	serial_to_socket_buf = bfmalloc("serial", SIZE_BUFFER);
-	sabre_to_socket_buf = bfmalloc("sabre", SIZE_BUFFER);
-	if ((socket_to_serial_buf == NULL) || (serial_to_socket_buf == NULL) || (sabre_to_socket_buf == NULL))
-	{
-		bffree(socket_to_serial_buf);
-		bffree(serial_to_socket_buf);
-		bffree(sabre_to_socket_buf);
-		return(1);
+	/* take the buffers from a slab, or from the arena with "deterministic memory" */
+	if (session_arena_buffers(arena_buffers) == 0) {
+		socket_to_serial_buf = arena_buffers[0];
+		serial_to_socket_buf = arena_buffers[1];
+		sabre_to_socket_buf = arena_buffers[2];
+	} else {
+		slab = session_slab_alloc(SIZE_BUFFER);
+		if (slab == NULL)
+			return(1);
+		socket_to_serial_buf = &slab->buffers[0];
+		serial_to_socket_buf = &slab->buffers[1];
+		sabre_to_socket_buf = &slab->buffers[2];
 	}
 	bfdump(socket_to_serial_buf, 1);
 	bfdump(serial_to_socket_buf, 1);
 	bfdump(sabre_to_socket_buf, 1);
 
 	syslog(LOG_INFO, "network_handle.c: serial_ip_communication_process(): initialization for buffers - status: ok!");
-	if(raw_flag){
-		/*Init buffer in raw TCP mode.	*/
-		bzero(&op_pdu_send, sizeof(op_pdu_send));
-		bzero(&op_pdu_recv, sizeof(op_pdu_recv));
-	}
+	proto = session_protocol(sabre_serial_port);
+	syslog(LOG_INFO, "network_handle.c: serial_ip_communication_process(): %s speaks %s", sabre_serial_port->device, proto->name);
+	io.sockfd = sockfd;
+	io.serial_fd = serial_file_descriptor;
+	io.serial_watch_fd = serial_file_descriptor;
+	io.quote = 0;
+	io.socket_to_serial_buf = socket_to_serial_buf;
+	io.serial_to_socket_buf = serial_to_socket_buf;
+	io.sabre_to_socket_buf = sabre_to_socket_buf;
 
-	/* init telnet options structure and send initial options when sever type is concurrent or iterative. */
-	if (!raw_flag)
-		telnet_init(sockfd, sabre_to_socket_buf);
+	/* start the protocol: for Telnet, init telnet options structure and send initial options.
+	   a session taken over from the previous binary gets its state back instead (see upgrade.c). */
+	proto->start(&io, upgrade_restore_session(socket_to_serial_buf, serial_to_socket_buf, sabre_to_socket_buf));
+	/* a thread of its own may drain the serial device, whatever the network does (see serial_thread.c) */
+	if (proto->buffered && conf.serial_thread && (serial_thread_start(serial_file_descriptor) == 0)) {
+		if (serial_thread_fd < FD_SETSIZE)
+			io.serial_watch_fd = serial_thread_fd;
+		else
+			serial_thread_release();
+	}
+	/* the io_uring engine reads the session straight into its buffers (see io_engine.c) */
+	io_engine_init();
+	buffers_pinned = 0;
+	if (proto->buffered) {
+		ring_buffers[0] = socket_to_serial_buf;
+		ring_buffers[1] = serial_to_socket_buf;
+		ring_buffers[2] = sabre_to_socket_buf;
+		buffers_pinned = (io_engine_register_buffers(ring_buffers, 3) == 0);
+		io_engine_read_into(sockfd, socket_to_serial_buf);
+		if (io.serial_watch_fd == serial_file_descriptor)
+			io_engine_read_into(serial_file_descriptor, serial_to_socket_buf);
+	}
 	/* set up select loop */
-	maxfd = (sockfd >= serial_file_descriptor ? sockfd : serial_file_descriptor) + 1;
+	maxfd = (sockfd >= io.serial_watch_fd ? sockfd : io.serial_watch_fd) + 1;
 	FD_ZERO(&orig_fds);															/* Clear all entries from orig_fd set.*/
 	FD_SET(sockfd, &orig_fds);													/* Add network fd to orig_fd set.*/
-	FD_SET(serial_file_descriptor, &orig_fds);									/* Add serial fd to orig_fd set.*/
-	check_serialfd = FD_ISSET(serial_file_descriptor, &orig_fds);
+	FD_SET(io.serial_watch_fd, &orig_fds);										/* Add serial fd to orig_fd set.*/
+	if ((upgrade_listen_fd >= 0) && (upgrade_listen_fd < FD_SETSIZE)) {
+		FD_SET(upgrade_listen_fd, &orig_fds);									/* Add upgrade socket to orig_fd set.*/
+		maxfd = MAX(maxfd, upgrade_listen_fd + 1);
+	}
+	/* watch the modem lines, so that the client hears about changes right away (RFC2217) */
+	if (proto->rfc2217 && (modem_watch_start(serial_file_descriptor) == 0) && (modem_watch_fd < FD_SETSIZE)) {
+		FD_SET(modem_watch_fd, &orig_fds);										/* Add modem watch pipe to orig_fd set.*/
+		maxfd = MAX(maxfd, modem_watch_fd + 1);
+	}
+	/* the session timers, select() has no timeout of its own */
+	if ((timer_wheel_init() == 0) && (timer_fd < FD_SETSIZE)) {
+		FD_SET(timer_fd, &orig_fds);											/* Add timerfd to orig_fd set.*/
+		maxfd = MAX(maxfd, timer_fd + 1);
+	}
+	if ((signal_fd >= 0) && (signal_fd < FD_SETSIZE)) {
+		FD_SET(signal_fd, &orig_fds);											/* Add signalfd to orig_fd set.*/
+		maxfd = MAX(maxfd, signal_fd + 1);
+	}
+	check_serialfd = FD_ISSET(io.serial_watch_fd, &orig_fds);
 	if(check_serialfd == 0)
 		syslog(LOG_DEBUG, "network_handle.c: si_com_proc(): set serial fd %d to socket fd entry table failed",
 				serial_file_descriptor);
@@ -98,144 +189,448 @@ int serial_ip_communication_process(int sockfd, int serial_file_descriptor, stru
 		syslog(LOG_INFO, "network_handle.c: si_com_proc(): set serial fd %d to socket fd entry table - status: ok!",
 				serial_file_descriptor);
 	error = 0;																	/* Default error flag.*/
-	client_logged_in = 1;
+	tnsession.client_logged_in = 1;
 
-	/* calc select() timeout value */
 	idle = 0;
-	idle_cnt = 0;
-	tvsecs = MIN(conf.ms_pollinterval, conf.ls_pollinterval);
-    if (conf.idletimer > 0)
-    {
-		tvsecs = MIN(conf.idletimer,tvsecs);
-	}
+	logout_sent = 0;
+	socket_batched = serial_batched = 0;
+	idle_due = linger_due = poll_due = socket_due = serial_due = quiet_due = 0;
+	timer_init(&idle_timer, session_timer_expired, &idle_due);
+	timer_init(&linger_timer, session_timer_expired, &linger_due);
+	timer_init(&poll_timer, session_timer_expired, &poll_due);
+	timer_init(&socket_timer, session_timer_expired, &socket_due);
+	timer_init(&serial_timer, session_timer_expired, &serial_due);
+	timer_init(&quiet_timer, session_timer_expired, &quiet_due);
+	if ((slab != NULL) && (! buffers_pinned))
+		timer_add(&quiet_timer, SESSION_BUFFER_LINGER * 1000UL);
+	if (conf.idletimer > 0)
+		timer_add(&idle_timer, conf.idletimer * 1000UL);
+	if (proto->rfc2217 && (session_poll_interval() > 0))
+		timer_add(&poll_timer, session_poll_interval());
 
 	/* select loop */
-	while ((client_logged_in) && (! idle) && (! error))
+	while ((tnsession.client_logged_in) && (! idle) && (! error))
 	{
-		/* check for idle connection */
-		if (conf.idletimer > 0)
+		read_fds = orig_fds;												/* structure copy */
+		ret = io_engine_wait(&orig_fds, &read_fds, maxfd);					/* the timers wake us up */
+		if (ret < 0)														/* select error */
 		{
-			if (idle_cnt >= conf.idletimer)
-			{
-				if (! idle)														/* we're just going into idle state */
-				{
-					idle++;														/* set the idle state flag */
-					write_to_debuglog(DBG_INF, "network_handle.c: si_com_proc(): terminating idle connection on serial port %s",
-							sabre_serial_port->device);
-					syslog(LOG_INFO, "network_handle.c: si_com_proc(): terminating idle connection on serial port %s",
-												sabre_serial_port->device);
-					/* let the remote user know what's happening */
-					bfstrcat(sabre_to_socket_buf, "\r\nserial_ip: terminating idle connection\r\n");
-					write_from_buffer_to_fd(sockfd, sabre_to_socket_buf);
-					/* Depend on server type, we perform a suitable action. */
-					/* tell the client to log out if in server "concurrent" or "itarative".*/
-					if (!raw_flag)
-						send_telnet_option(sockfd, sabre_to_socket_buf, DO, TELOPT_LOGOUT);
-					else{
-						;}
-					msleep(250000);		/* sleep for 0.25second */
-				}
-				/*	we want to go through the select loop one last time,
-					in order to process the client's reply to DO LOGOUT.	*/
+			if (errno != EINTR) {
+				system_errorlog("network_handle.c: si_com_proc(): io_engine_wait() error");
+				syslog(LOG_ERR, "network_handle.c: si_com_proc(): io_engine_wait() error: %s", strerror(errno));
 			}
+			FD_ZERO(&read_fds);
 		}
-		tv.tv_sec = tvsecs;													/* set timeout */
-		tv.tv_usec = 0;
-		read_fds = orig_fds;												/* structure copy */
-
-		check_serialfd = FD_ISSET(serial_file_descriptor, &read_fds);
-		if(check_serialfd == 0)
-			syslog(LOG_DEBUG, "network_handle.c: si_com_proc(): set serial fd %d to socket fd entry table failed",
-					serial_file_descriptor);
-		else
-			syslog(LOG_INFO, "network_handle.c: si_com_proc(): set serial fd %d to socket fd entry table with check value %d - status: ok!",
-					serial_file_descriptor, check_serialfd);
-
-		now = time((time_t *) NULL);										/* current time, in seconds */
-		ret = select(maxfd, &read_fds, NULL, NULL, &tv);
-		switch (ret)
+		if ((upgrade_listen_fd >= 0) && FD_ISSET(upgrade_listen_fd, &read_fds))
 		{
-		case -1:															/* select error */
-			if (errno != EINTR)
-				system_errorlog("network_handle.c: si_com_proc(): select() error");
-				syslog(LOG_ERR, "network_handle.c: si_com_proc(): select() error: %s", strerror(errno));
+			/* a new binary takes over: it gets this session too. returns only if the upgrade failed. */
+			io_engine_quiesce(sockfd);										/* no read may be in flight */
+			io_engine_quiesce(serial_file_descriptor);
+			if (io.serial_watch_fd != serial_file_descriptor) {
+				serial_thread_stop();										/* the device is ours again */
+				read_serial(serial_file_descriptor, serial_to_socket_buf, io.quote);	/* what the thread read ahead */
+			}
+			session.sockfd = sockfd;
+			session.serial_fd = serial_file_descriptor;
+			session.port = sabre_serial_port;
+			session.buffers[0] = socket_to_serial_buf;
+			session.buffers[1] = serial_to_socket_buf;
+			session.buffers[2] = sabre_to_socket_buf;
+			upgrade_handoff(&session);
+			if (io.serial_watch_fd != serial_file_descriptor)
+				serial_thread_resume();
+		}
+		if ((modem_watch_fd >= 0) && FD_ISSET(modem_watch_fd, &read_fds))
+		{
+			/* however many times the lines toggled, the client gets one update */
+			modem_watch_drain();
+			proto->state_changed(&io);
+		}
+		if ((signal_fd >= 0) && FD_ISSET(signal_fd, &read_fds))
+			signal_fd_handle();												/* SIGINT is a break, see telnet_sigint() */
+		if (reload_pending)
+			reload_configuration();											/* SIGHUP to a parent serving the session itself */
+		if ((timer_fd >= 0) && FD_ISSET(timer_fd, &read_fds))
+			timer_wheel_run();												/* raises the *_due flags */
 
-			elapsed = time((time_t *) NULL) - now;							/* seconds spent in select() */
-			idle_cnt += elapsed;											/* accumulate idle time */
-			break;
-		case 0:																/* select timeout */
-			elapsed = time((time_t *) NULL) - now;							/* seconds spent in select() */
-			idle_cnt += elapsed;											/* accumulate idle time */
-			write_to_debuglog(DBG_INF, "network_handle.c: si_com_proc(): no any connection at the moment on serial port %s",
+		if (idle_due)														/* we're just going into idle state */
+		{
+			idle_due = 0;
+			logout_sent = 1;
+			write_to_debuglog(DBG_INF, "network_handle.c: si_com_proc(): terminating idle connection on serial port %s",
+					sabre_serial_port->device);
+			syslog(LOG_INFO, "network_handle.c: si_com_proc(): terminating idle connection on serial port %s",
 										sabre_serial_port->device);
-			syslog(LOG_INFO, "network_handle.c: si_com_proc(): no any connection at the moment on serial port %s",
-													sabre_serial_port->device);
-/* For now, we do not need to use this, for clear seeing. ---- Changelog on 18.09.2015*/
 			/* let the remote user know what's happening */
-			//bfstrcat(sabre_to_socket_buf, "\r\nserial_ip: no any connection on sabre serial port\r\n");
-			//write_from_buffer_to_fd(sockfd, sabre_to_socket_buf);
-			/*Note: Refer to the author desciption at the beggining, */
-#if 0
-			advise_client_of_state_changes(sockfd, serial_file_descriptor, sabre_to_socket_buf);
-#endif
-			break;
-		default:															/* select fds for read/write */
-			idle_cnt = 0;													/* reset idle counter */
-			if (FD_ISSET(sockfd, &read_fds))								/*Return true if sockfd is already in read_fd set. */
-			{
-				syslog(LOG_INFO, "network_handle.c: si_com_proc(): reading on network socket %d......", sockfd);
-				/*Folow direction: Client => sockfd, sever read from sockfd and put into socket_to_serial buffer. */
-				if(!raw_flag)
-					error = read_socket(sockfd, serial_file_descriptor, socket_to_serial_buf, sabre_to_socket_buf);		/*Read socket fd */
-				else
-					error = raw_TCP_socket_to_serial(sockfd, serial_file_descriptor, (void *) &op_pdu_recv, sizeof(op_pdu_recv));
-				if (! error)
-				{
-					if(!raw_flag)
-						error = write_serial(serial_file_descriptor, socket_to_serial_buf);
-				}
-				if (error) continue;										/* this will break the while loop */
-			}
-			/*if (FD_ISSET(serial_file_descriptor, &read_fds)) 				Return true if serial fd is already in read_fd set. */
-			if (check_serialfd)
-			{
-				if(raw_flag){
-					syslog(LOG_INFO, "network_handle.c: si_com_proc(): now, read data on serial port and send to TCP socket");
-					error = raw_data_to_TCP_socket(serial_file_descriptor, sockfd, (void*) &op_pdu_send, sizeof(op_pdu_send));
-				}else
-					error = read_serial(serial_file_descriptor, serial_to_socket_buf);
-				if ((! error) && (!raw_flag)) {
-					error = write_socket(sockfd, serial_to_socket_buf);
-				}
-				if (error) continue;										/* this will break the while loop */
+			bfstrcat(sabre_to_socket_buf, "\r\nserial_ip: terminating idle connection\r\n");
+			write_from_buffer_to_fd(sockfd, sabre_to_socket_buf);
+			/* tell the client to log out, if its protocol can */
+			proto->idle(&io);
+			/*	we keep going for 0.25 second, in order to process the client's reply to DO LOGOUT.	*/
+			timer_add(&linger_timer, 250);
+		}
+		if (linger_due)
+			idle++;															/* set the idle state flag */
+		if (poll_due)
+		{
+			/* poll the modem lines, for the drivers modem_watch.c cannot wait on, and the line state */
+			poll_due = 0;
+			proto->state_changed(&io);
+			timer_add(&poll_timer, session_poll_interval());
+		}
+		if (socket_due)														/* batching window or write pacing is over */
+		{
+			socket_due = 0;
+			FD_SET(sockfd, &orig_fds);
+		}
+		if (serial_due)														/* batching window is over */
+		{
+			serial_due = 0;
+			FD_SET(io.serial_watch_fd, &orig_fds);
+		}
+		if (quiet_due)														/* no traffic for a while */
+		{
+			quiet_due = 0;
+			if (session_slab_trim(slab) != 0)								/* the pages come back with the traffic */
+				timer_add(&quiet_timer, SESSION_BUFFER_LINGER * 1000UL);	/* data still queued, try later */
+		}
+
+		socket_ready = FD_ISSET(sockfd, &read_fds);
+		if (socket_ready && (useconds > 0) && (! socket_batched))
+		{
+			/* wait a bit before reading the socket (-w), more data may come in the meantime */
+			FD_CLR(sockfd, &orig_fds);
+			socket_batched = 1;
+			timer_add(&socket_timer, useconds / 1000);
+			socket_ready = 0;
+		}
+		if (socket_ready)													/*Return true if sockfd is already in read_fd set. */
+		{
+			socket_batched = 0;
+			if ((conf.idletimer > 0) && (! logout_sent))
+				timer_add(&idle_timer, conf.idletimer * 1000UL);			/* reset idle timer */
+			syslog(LOG_INFO, "network_handle.c: si_com_proc(): reading on network socket %d......", sockfd);
+			/*Folow direction: Client => sockfd, sever read from sockfd and pass it on to the serial port. */
+			error = proto->socket_ready(&io);
+			if (proto->pacing > 0) {
+				/* give the serial device time to answer before the next command */
+				FD_CLR(sockfd, &orig_fds);
+				timer_add(&socket_timer, proto->pacing);
 			}
-			/*Note: Refer to the author desciption at the beggining, */
-#if 0
-			advise_client_of_state_changes(sockfd, serial_file_descriptor, sabre_to_socket_buf);
-#endif
-			break;
+			if (error) continue;											/* this will break the while loop */
 		}
-		child_pending_signal_handle();										/* did we receive any signals? */
+		check_serialfd = FD_ISSET(io.serial_watch_fd, &read_fds);
+		if (check_serialfd && proto->buffered && (useconds > 0) && (! serial_batched))
+		{
+			/* wait a bit before reading the serial port (-w) */
+			FD_CLR(io.serial_watch_fd, &orig_fds);
+			serial_batched = 1;
+			timer_add(&serial_timer, useconds / 1000);
+			check_serialfd = 0;
+		}
+		if (check_serialfd)													/* Return true if serial fd is already in read_fd set. */
+		{
+			serial_batched = 0;
+			if ((conf.idletimer > 0) && (! logout_sent))
+				timer_add(&idle_timer, conf.idletimer * 1000UL);			/* reset idle timer */
+			/* Direction: serial port => socket */
+			error = proto->serial_ready(&io);
+			if (error) continue;											/* this will break the while loop */
+		}
+		if ((socket_ready || check_serialfd) && (slab != NULL) && (! buffers_pinned))
+			timer_add(&quiet_timer, SESSION_BUFFER_LINGER * 1000UL);		/* reset quiet timer */
+		child_pending_signal_handle();										/* signals, when there is no signal_fd */
 
 		/* react to loss of carrier */
 #if 0
 		if (sabre_serial_port->track_carrier) {
 			if (check_carrier_state(serial_file_descriptor) == LOST_CARRIER) {
 				++error;													/* will break the while() loop */
-				advise_client_of_state_changes(sockfd,serial_file_descriptor,sabre_to_socket_buf);
+				advise_client_of_state_changes(serial_file_descriptor);
 			}
 		}
 #endif
 	}	/* while() loop ends */
+	/* the timers live on our stack */
+	timer_cancel(&idle_timer);
+	timer_cancel(&linger_timer);
+	timer_cancel(&poll_timer);
+	timer_cancel(&socket_timer);
+	timer_cancel(&serial_timer);
+	timer_cancel(&quiet_timer);
+	io_engine_forget(sockfd);												/* before the buffers go */
+	io_engine_forget(serial_file_descriptor);
+	io_engine_unregister_buffers();
+	serial_thread_release();												/* the device gets its flags back */
+	modem_watch_stop();
 	child_pending_signal_handle();											/* did we receive any signals? */
-	if(!raw_flag){
-		bffree(socket_to_serial_buf);											/* release the buffers */
-		bffree(serial_to_socket_buf);
-		bffree(sabre_to_socket_buf);
+	session_slab_free(slab);												/* release the buffers */
+	return(0);
+}
+
+/*
+	Location: network_handle.c
+	The listening sockets of the serial ports which have their own "listen port" or "listen socket".
+	A listen port or socket shared by the ports of a pool has a single listener.
+*/
+struct port_listener_t {
+	int tcp_port;							/* tcp port number, 0 for a unix socket */
+	char *socket_name;						/* unix socket path or @name, NULL for a tcp port */
+	int fd;									/* listening socket */
+	int used;								/* some ready port wants it */
+};
+
+static struct port_listener_t *port_listeners = NULL;
+static int nport_listeners = 0;
+
+/*	Location: network_handle.c
+	This is to mark the listener of a tcp port, or of a unix socket if socket_name is not NULL, as wanted,
+	and to open it if we have none yet. what names its user in the log.
+	returns the socket fd of the listener, -1 if there is none.	*/
+static int port_listener_want(int tcp_port, const char *socket_name, const char *what)
+{
+	struct port_listener_t *l;
+	int j;
+
+	for (j = 0; j < nport_listeners; j++) {
+		l = &port_listeners[j];
+		if ((socket_name == NULL) ? ((l->socket_name == NULL) && (l->tcp_port == tcp_port)) :
+				((l->socket_name != NULL) && (strcmp(l->socket_name, socket_name) == 0)))
+			break;
+	}
+	if (j == nport_listeners) {
+		l = realloc(port_listeners, (nport_listeners + 1) * sizeof(struct port_listener_t));
+		if (l == NULL)
+			return(-1);
+		port_listeners = l;
+		l = &port_listeners[j];
+		if (socket_name == NULL) {
+			l->fd = create_server_socket(tcp_port, BLOCKING);
+			l->socket_name = NULL;
+		} else {
+			l->fd = create_unix_server_socket(socket_name);
+			l->socket_name = strdup(socket_name);
+			if ((l->fd >= 0) && (l->socket_name == NULL)) {
+				close(l->fd);
+				l->fd = -1;
+			}
+		}
+		if (l->fd < 0) {
+			if (socket_name == NULL)
+				syslog(LOG_ERR, "network_handle.c: port_listener_sync(): cannot listen on port %d for %s", tcp_port, what);
+			else
+				syslog(LOG_ERR, "network_handle.c: port_listener_sync(): cannot listen on %s for %s", socket_name, what);
+			free(l->socket_name);
+			return(-1);
+		}
+		l->tcp_port = tcp_port;
+		nport_listeners++;
+		if (socket_name == NULL)
+			syslog(LOG_INFO, "network_handle.c: port_listener_sync(): listening on port %d for %s", tcp_port, what);
+		else
+			syslog(LOG_INFO, "network_handle.c: port_listener_sync(): listening on %s for %s", socket_name, what);
+	}
+	port_listeners[j].used = 1;
+	return(port_listeners[j].fd);
+}
+
+/*	Location: network_handle.c
+	This is to open the listeners of the serial ports which are ready, and of the multiplexed
+	connections (see mux.c), and to close the listeners nobody uses any more. The listener of a port
+	gets the buffer sizes of its socket profile (see socket_profile.c). The main listening socket (-p)
+	is left alone. With reactor shards, the first shard serves the "mux port", and a unix socket is
+	served by the shard of its port: the shards cannot share it, as they share a tcp port.	*/
+void port_listener_sync(struct config_t *conf)
+{
+	extern int sabre_network_port;
+	extern int shard_index;
+	SERIAL_INFO *port;
+	int fd;
+	int i, j;
+
+	for (j = 0; j < nport_listeners; j++)
+		port_listeners[j].used = 0;
+	for (i = 0; i < conf->ports.nslots; i++) {
+		port = port_registry_at(&conf->ports, i);
+		if ((port == NULL) || (port->state != PORT_READY))
+			continue;
+		if ((port->listen_port > 0) && (port->listen_port != sabre_network_port) &&
+				((fd = port_listener_want(port->listen_port, NULL, port->device)) >= 0))
+			socket_profile_listen(port, fd);
+		if ((port->listen_socket != NULL) && shard_owns(port))
+			port_listener_want(0, port->listen_socket, port->device);
+	}
+	if ((conf->mux_port > 0) && (conf->mux_port != sabre_network_port) && (shard_index == 0))
+		port_listener_want(conf->mux_port, NULL, "multiplexed connections");
+	for (i = j = 0; j < nport_listeners; j++) {
+		if (port_listeners[j].used) {
+			port_listeners[i++] = port_listeners[j];
+			continue;
+		}
+		if (port_listeners[j].socket_name == NULL)
+			syslog(LOG_INFO, "network_handle.c: port_listener_sync(): closing listener on port %d", port_listeners[j].tcp_port);
+		else
+			syslog(LOG_INFO, "network_handle.c: port_listener_sync(): closing listener on %s", port_listeners[j].socket_name);
+		io_engine_forget(port_listeners[j].fd);
+		close(port_listeners[j].fd);
+		unix_socket_remove(port_listeners[j].socket_name);
+		free(port_listeners[j].socket_name);
+	}
+	nport_listeners = i;
+}
+
+/*	Location: network_handle.c
+	This is to close every serial port listener, eg. in a child process. The files of the unix
+	sockets stay: the parent still listens on them.	*/
+void port_listeners_close(void)
+{
+	int j;
+
+	for (j = 0; j < nport_listeners; j++) {
+		io_engine_forget(port_listeners[j].fd);
+		close(port_listeners[j].fd);
+		free(port_listeners[j].socket_name);
+	}
+	nport_listeners = 0;
+}
+
+/*	Location: network_handle.c
+	This is to get the j-th serial port listener, eg. to hand it over to a new binary.
+	returns its socket fd and sets tcp_port, or the name of its unix socket (an empty string for a
+	tcp port) into socket_name, -1 past the last one.	*/
+int port_listener_get(int j, int *tcp_port, char *socket_name, int len)
+{
+	if ((j < 0) || (j >= nport_listeners))
+		return(-1);
+	*tcp_port = port_listeners[j].tcp_port;
+	snprintf(socket_name, len, "%s", (port_listeners[j].socket_name != NULL) ? port_listeners[j].socket_name : "");
+	return(port_listeners[j].fd);
+}
+
+/*	Location: network_handle.c
+	This is to take over a listener the previous binary opened (see upgrade.c), on a tcp port or on
+	the unix socket socket_name. port_listener_sync() keeps it if a ready port wants it, and closes it
+	otherwise.
+	returns 0 on success, 1 on failure.	*/
+int port_listener_adopt(int tcp_port, const char *socket_name, int fd)
+{
+	struct port_listener_t *l;
+	char *name;
+
+	name = NULL;
+	l = realloc(port_listeners, (nport_listeners + 1) * sizeof(struct port_listener_t));
+	if ((l == NULL) || ((socket_name != NULL) && ((name = strdup(socket_name)) == NULL))) {
+		if (l != NULL)
+			port_listeners = l;
+		close(fd);
+		return(1);
 	}
+	port_listeners = l;
+	port_listeners[nport_listeners].tcp_port = tcp_port;
+	port_listeners[nport_listeners].socket_name = name;
+	port_listeners[nport_listeners].fd = fd;
+	port_listeners[nport_listeners].used = 0;
+	nport_listeners++;
 	return(0);
 }
 
+/*	Location: network_handle.c
+	this function waits for a connection on the listening socket or on one of the serial port listeners,
+	and accepts it (with io_uring, the engine has accepted it already). While we wait, we also watch the hotplug fd, so that serial devices can come and go
+	between client connections, pick up the ports the bring-up workers have opened, handle the signals
+	which came in on signal_fd, start or kill the port workers which are due (see port_worker.c), run
+	a configuration reload requested by SIGHUP, hand over to a new binary (see upgrade.c), and read the
+	idle serial ports into their capture rings (see capture.c).
+	returns the socket fd of the client, -1 on error (errno is set, EINTR if a signal came in without signal_fd).	*/
+int accept_client_connection(int sockfd, struct sockaddr_in *client_addr, socklen_t *client_len)
+{
+	extern struct config_t conf;
+	extern int hotplug_fd;
+	extern int bringup_notify_fd;
+	extern volatile sig_atomic_t reload_pending;
+	extern int reload_deferred;
+	extern int upgrade_listen_fd;
+	extern int signal_fd;
+	extern int port_worker_fd;
+	fd_set watchfds;
+	fd_set readfds;
+	int maxfd;
+	int events;
+	int j;
+
+	for ( ; ; ) {
+		if (reload_pending || reload_deferred)
+			reload_configuration();								/* or finish the one of the last session */
+		FD_ZERO(&watchfds);
+		FD_SET(sockfd, &watchfds);
+		io_engine_accept_on(sockfd);
+		maxfd = sockfd;
+		if (hotplug_fd >= 0) {
+			FD_SET(hotplug_fd, &watchfds);
+			maxfd = MAX(maxfd, hotplug_fd);
+		}
+		if (bringup_notify_fd >= 0) {
+			FD_SET(bringup_notify_fd, &watchfds);
+			maxfd = MAX(maxfd, bringup_notify_fd);
+		}
+		if ((upgrade_listen_fd >= 0) && (upgrade_listen_fd < FD_SETSIZE)) {
+			FD_SET(upgrade_listen_fd, &watchfds);
+			maxfd = MAX(maxfd, upgrade_listen_fd);
+		}
+		if ((signal_fd >= 0) && (signal_fd < FD_SETSIZE)) {
+			FD_SET(signal_fd, &watchfds);
+			maxfd = MAX(maxfd, signal_fd);
+		}
+		if ((port_worker_fd >= 0) && (port_worker_fd < FD_SETSIZE)) {
+			FD_SET(port_worker_fd, &watchfds);
+			maxfd = MAX(maxfd, port_worker_fd);
+		}
+		capture_watch(&conf, &watchfds, &maxfd);				/* the idle serial ports which capture */
+		for (j = 0; j < nport_listeners; j++) {
+			if (port_listeners[j].fd >= FD_SETSIZE)
+				continue;										/* select() cannot watch it */
+			FD_SET(port_listeners[j].fd, &watchfds);
+			io_engine_accept_on(port_listeners[j].fd);
+			maxfd = MAX(maxfd, port_listeners[j].fd);
+		}
+		if (io_engine_wait(&watchfds, &readfds, maxfd + 1) < 0) {
+			if ((errno == EINTR) && reload_pending)
+				continue;											/* SIGHUP: reload and wait again */
+			return(-1);
+		}
+		events = 0;
+		if ((signal_fd >= 0) && FD_ISSET(signal_fd, &readfds)) {
+			signal_fd_handle();									/* SIGTERM does not return */
+			port_worker_sync(&conf);								/* a port worker may have died */
+			events++;
+		} else if ((port_worker_fd >= 0) && (port_worker_fd < FD_SETSIZE) && FD_ISSET(port_worker_fd, &readfds)) {
+			port_worker_sync(&conf);								/* a respawn or a kill is due */
+			events++;
+		}
+		if ((hotplug_fd >= 0) && FD_ISSET(hotplug_fd, &readfds)) {
+			hotplug_handle_events(&conf);
+			events++;
+		}
+		if ((bringup_notify_fd >= 0) && FD_ISSET(bringup_notify_fd, &readfds)) {
+			port_bringup_collect(&conf);
+			events++;
+		}
+		if ((upgrade_listen_fd >= 0) && FD_ISSET(upgrade_listen_fd, &readfds)) {
+			upgrade_handoff(NULL);								/* returns only if the upgrade failed */
+			events++;
+		}
+		events += capture_drain(&conf, &readfds);
+		if (FD_ISSET(sockfd, &readfds))
+			return(io_engine_accept(sockfd, (struct sockaddr *) client_addr, client_len));
+		if (events)
+			continue;											/* the listeners may have changed, look again */
+		for (j = 0; j < nport_listeners; j++) {
+			if ((port_listeners[j].fd < FD_SETSIZE) && FD_ISSET(port_listeners[j].fd, &readfds))
+				return(io_engine_accept(port_listeners[j].fd, (struct sockaddr *) client_addr, client_len));
+		}
+	}
+}
+
 /*	Location: network_handle.c
 	this function provides a concurrent server (ie. one that accepts socket connections and forks to perform the
 	specified function).  the function whose address is passed to us will be called with its socket fd as the only arg.
@@ -243,6 +638,7 @@ int serial_ip_communication_process(int sockfd, int serial_file_descriptor, stru
 void concurrent_server(int sockfd, int (*funct)(int), int *signo, void (*sighandler)(int))
 {
 	extern int errno;
+	extern volatile sig_atomic_t reload_pending;
 	int sockfd_for_client;
 	socklen_t client_len;
 	int childpid;
@@ -254,7 +650,7 @@ void concurrent_server(int sockfd, int (*funct)(int), int *signo, void (*sighand
 		client_len = sizeof(client_addr);
 		errno = 0;
 		syslog(LOG_DEBUG,"Server is listening.....");
-		sockfd_for_client = accept(sockfd,(struct sockaddr *) &client_addr, &client_len);
+		sockfd_for_client = accept_client_connection(sockfd, &client_addr, &client_len);
 		if (sockfd_for_client < 0) {
 			if (errno != EINTR)
 				syslog(LOG_ERR,"network_handle.c: concurrent_server(): accept error (%s)",strerror(errno));
@@ -276,7 +672,15 @@ void concurrent_server(int sockfd, int (*funct)(int), int *signo, void (*sighand
 		{
 			syslog(LOG_ERR,"serial_handle.c: serial_port_init(): fork error (%s)",strerror(errno));
 		} else if (childpid == 0) {											/* child process */
+			io_engine_close();												/* first: the ring is the parent's */
 			close(sockfd);													/* close original socket */
+			hotplug_close();												/* the parent keeps track of devices */
+			port_listeners_close();
+			port_bringup_child();
+			port_worker_child();
+			upgrade_close(0);
+			reload_pending = 0;												/* the parent reloads, not us */
+			session_arena_child();											/* memory locks are not inherited */
 			ret = (*funct)(sockfd_for_client);								/* process the request */
 			_exit(ret);
 		}
@@ -302,7 +706,7 @@ void iterative_server(int sockfd, int (*funct)(int), int *signo, void (*sighandl
 		client_len = sizeof(client_addr);
 		errno = 0;
 		syslog(LOG_DEBUG,"Server is listening.....");
-		sockfd_for_client = accept(sockfd, (struct sockaddr *) &client_addr, &client_len);
+		sockfd_for_client = accept_client_connection(sockfd, &client_addr, &client_len);
 		if (sockfd_for_client < 0) {
 			if (errno != EINTR)
 				syslog(LOG_ERR,"accept error (%s)",strerror(errno));
@@ -344,7 +748,7 @@ void raw_TCP_gateway(int sockfd, int (*funct)(int), int *signo, void (*sighandle
 		client_len = sizeof(client_addr);
 		errno = 0;
 		syslog(LOG_DEBUG, "server is listening.....");
-		sockfd_for_client = accept(sockfd, (struct sockaddr *) &client_addr, &client_len);
+		sockfd_for_client = accept_client_connection(sockfd, &client_addr, &client_len);
 		if (sockfd_for_client < 0) {
 			if (errno != EINTR)
 				syslog(LOG_ERR, "accept error (%s)", strerror(errno));
@@ -367,6 +771,7 @@ void raw_TCP_gateway(int sockfd, int (*funct)(int), int *signo, void (*sighandle
 }
 
 int gsockfd = -1;						/* global copy of child socket fd for signal handle.*/
+int server_sockfd = -1;					/* the main listening socket */
 
 /*	Location: network_handle.c
 	This function is to handle connection from client. called by concurrent_server() and by	iterative_server(),
@@ -459,6 +864,7 @@ int create_server_socket(int tcp_network_port, int block_mode)
 		set socket options SO_KEEPALIVE and SO_REUSEADDR
 		SO_KEEPALIVE: enable sending of keepalive message on connection-oriented socket.
 		SO_REUSEADDR: refers man page for more information.
+		With reactor shards, each shard binds the same port with SO_REUSEPORT (see shard.c).
 	*/
 	if (setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(int)) < 0) {
 		syslog(LOG_ERR,"network_handle.c: create_server_socket(): cannot set SO_KEEPALIVE (%s)",strerror(errno));
@@ -470,6 +876,11 @@ int create_server_socket(int tcp_network_port, int block_mode)
 		close(sockfd);
 		return(-1);
 	}
+	if ((shard_count > 1) && (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) < 0)) {
+		syslog(LOG_ERR,"network_handle.c: create_server_socket(): cannot set SO_REUSEPORT (%s)",strerror(errno));
+		close(sockfd);
+		return(-1);
+	}
 	bzero((char *) &server_addr, sizeof(server_addr));
 	server_addr.sin_family = AF_INET;							/*Ipv4*/
 	server_addr.sin_addr.s_addr = htonl(INADDR_ANY);			/*INADDR_ANY: bind wildcard address.*/
@@ -490,21 +901,30 @@ int create_server_socket(int tcp_network_port, int block_mode)
 	1. Raw TCP gateway.
 	2. Concurrent.
 	3. Iterative.
+	A raw TCP gateway serves its sessions one at a time, as an iterative server; what it speaks on them
+	is the protocol of each port, framed unless the port says otherwise (see session_protocol.c).
 	Function doesnot return.	*/
 void server_init(int tcp_network_port)
 {
 	extern struct config_t conf;		/* built from config file */
 	extern int signo;					/* parent signal number */
-	extern int raw_flag;
+	extern int server_sockfd;
+	extern int upgrade_server_sockfd;	/* handed over by the previous binary */
 	int sockfd;
 
-	/* create a blocking TCP server socket	*/
-	sockfd = create_server_socket(tcp_network_port, BLOCKING);
+	/* create a blocking TCP server socket, unless we took it over	*/
+	if (upgrade_server_sockfd >= 0)
+		sockfd = upgrade_server_sockfd;
+	else
+		sockfd = create_server_socket(tcp_network_port, BLOCKING);
 	if (sockfd == -1) {
 		syslog(LOG_ERR,"network_handle.c: server_init(): cannot create server tcp socket");
 		exit(1);
 	}
+	server_sockfd = sockfd;
 	syslog(LOG_DEBUG,"network_handle.c: server_init(): server socket is fd %d",sockfd);
+	upgrade_listen(&conf);				/* a new binary may take over from us */
+	upgrade_resume_session();			/* carry on with the session the previous binary was serving */
 	/*	accept socket connections.  for a concurrent server, we fork a child process for each new connection.
 		for an iterative server, we handle the connection within this process.
 		for a raw TCP gateway, we handle with raw data.
@@ -519,7 +939,6 @@ void server_init(int tcp_network_port)
 	}
 	if (strcmp(conf.server_type,"raw TCP gateway") == 0)
 	{
-		raw_flag = 1;
 		syslog(LOG_DEBUG,"serial-ip: Now we are in the %s mode!", conf.server_type);
 		raw_TCP_gateway(sockfd, handle_network_connection, &signo, parent_signal_received);
 	}
@@ -0,0 +1,255 @@
+/*
+ * port_bringup.c
+ *	This is to open and configure the serial ports in parallel, ahead of the client connections.
+ *	open(), tcgetattr(), tcsetattr() and tcflush() can block for a long time on some USB adapters,
+ *	so a small pool of worker threads brings the ports up while the parent keeps accepting.
+ *	A worker only sees a private copy of the port settings. When it is done, it queues the result
+ *	and writes a byte into the notify pipe; the parent picks the results up in port_bringup_collect()
+ *	from its accept loop, so the port registry is only ever touched by the parent.
+ *	A port which is ready is held open by the parent, and its listener is opened right away.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#define _GNU_SOURCE							/* pipe2() */
+#include "serial_ip.h"
+
+#include <pthread.h>
+
+#define BRINGUP_MAX_WORKERS		64
+
+/*
+	Location: port_bringup.c
+	One port to bring up. The worker fills in fd, the termios settings and error.
+*/
+struct bringup_job_t {
+	SERIAL_INFO settings;					/* private copy of the port settings, we own device */
+	int index;								/* port registry index */
+	unsigned int seq;						/* bringup_seq of the port when it was queued */
+	int fd;									/* the open device, -1 on error */
+	int error;								/* serial_port_open() result */
+	struct bringup_job_t *next;
+};
+
+static pthread_mutex_t bringup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bringup_cond = PTHREAD_COND_INITIALIZER;
+static struct bringup_job_t *bringup_todo = NULL;		/* waiting for a worker */
+static struct bringup_job_t *bringup_todo_tail = NULL;
+static struct bringup_job_t *bringup_done = NULL;		/* waiting for port_bringup_collect() */
+static int bringup_nworkers = 0;
+static int bringup_pipe[2] = { -1, -1 };
+
+int bringup_notify_fd = -1;				/* readable when bring-up results are waiting */
+
+/*
+	Location: port_bringup.c
+	This is the worker thread. It takes jobs off the todo list until the process ends.
+*/
+static void *port_bringup_worker(void *arg)
+{
+	struct bringup_job_t *job;
+
+	for ( ; ; ) {
+		pthread_mutex_lock(&bringup_lock);
+		while (bringup_todo == NULL)
+			pthread_cond_wait(&bringup_cond, &bringup_lock);
+		job = bringup_todo;
+		bringup_todo = job->next;
+		if (bringup_todo == NULL)
+			bringup_todo_tail = NULL;
+		pthread_mutex_unlock(&bringup_lock);
+
+		job->error = serial_port_open(&job->settings, &job->fd, &job->settings.old_termios, &job->settings.new_termios);
+
+		pthread_mutex_lock(&bringup_lock);
+		job->next = bringup_done;
+		bringup_done = job;
+		pthread_mutex_unlock(&bringup_lock);
+		if (write(bringup_pipe[1], "", 1) < 0)
+			;												/* pipe full: the parent has been woken up already */
+	}
+	return(NULL);
+}
+
+/*
+	Location: port_bringup.c
+	This is to start the worker threads, or add some if the configuration asks for more.
+	Signals are blocked in the workers, they are for the parent's accept loop.
+	returns 0 on success, 1 if no worker could be started (ports are then opened on demand).
+*/
+int port_bringup_init(int workers)
+{
+	extern int bringup_notify_fd;
+	sigset_t all, old;
+	pthread_attr_t attr;
+	pthread_t tid;
+	int ret;
+
+	if (workers > BRINGUP_MAX_WORKERS)
+		workers = BRINGUP_MAX_WORKERS;
+	if (bringup_pipe[0] < 0) {
+		if (pipe2(bringup_pipe, O_NONBLOCK|O_CLOEXEC) < 0) {
+			syslog(LOG_ERR, "port_bringup.c: port_bringup_init(): pipe2() error: %s", strerror(errno));
+			return(1);
+		}
+		bringup_notify_fd = bringup_pipe[0];
+	}
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	while (bringup_nworkers < workers) {
+		ret = pthread_create(&tid, &attr, port_bringup_worker, NULL);
+		if (ret != 0) {
+			syslog(LOG_ERR, "port_bringup.c: port_bringup_init(): pthread_create() error: %s", strerror(ret));
+			break;
+		}
+		bringup_nworkers++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+	syslog(LOG_INFO, "port_bringup.c: port_bringup_init(): %d bring-up worker(s)", bringup_nworkers);
+	return(bringup_nworkers > 0 ? 0 : 1);
+}
+
+/*
+	Location: port_bringup.c
+	This is to queue a port for bring-up. Ports which are ready or already queued are left alone, and
+	ports of another shard are never brought up here.
+	returns 0 if the port is queued (or needs nothing), 1 otherwise.
+*/
+int port_bringup_queue(SERIAL_INFO *port)
+{
+	struct bringup_job_t *job;
+
+	if ((port == NULL) || (port->device == NULL))
+		return(1);
+	if ((port->state == PORT_OPENING) || (port->state == PORT_READY))
+		return(0);
+	if (! shard_owns(port))
+		return(1);
+	if (bringup_nworkers == 0)
+		return(1);											/* no workers: opened on demand */
+	job = calloc(1, sizeof(struct bringup_job_t));
+	if (job == NULL)
+		return(1);
+	job->settings = *port;									/* structure copy */
+	job->settings.device = strdup(port->device);
+	job->settings.lockfile = NULL;
+	job->settings.description = NULL;
+	job->settings.pool = NULL;
+	if (job->settings.device == NULL) {
+		free(job);
+		return(1);
+	}
+	job->index = port->index;
+	job->seq = ++port->bringup_seq;
+	job->fd = -1;
+	port->state = PORT_OPENING;
+
+	pthread_mutex_lock(&bringup_lock);
+	if (bringup_todo_tail == NULL)
+		bringup_todo = job;
+	else
+		bringup_todo_tail->next = job;
+	bringup_todo_tail = job;
+	pthread_cond_signal(&bringup_cond);
+	pthread_mutex_unlock(&bringup_lock);
+	return(0);
+}
+
+/*
+	Location: port_bringup.c
+	This is to queue every registered port which is not up yet.
+*/
+void port_bringup_start(struct config_t *conf)
+{
+	SERIAL_INFO *port;
+	int queued = 0;
+	int i;
+
+	for (i = 0; i < conf->ports.nslots; i++) {
+		port = port_registry_at(&conf->ports, i);
+		if ((port != NULL) && (port->state == PORT_DOWN) && (port_bringup_queue(port) == 0))
+			queued++;
+	}
+	if (queued > 0)
+		syslog(LOG_INFO, "port_bringup.c: port_bringup_start(): bringing up %d serial port(s)", queued);
+}
+
+/*
+	Location: port_bringup.c
+	This is to close the device we hold open for a port and to forget any bring-up still in progress.
+	Sessions which are running keep their own fd.
+*/
+void port_bringup_release(SERIAL_INFO *port)
+{
+	if (port == NULL)
+		return;
+	port->bringup_seq++;									/* a pending result is stale now */
+	if (port->fd >= 0)
+		close(port->fd);
+	port->fd = -1;
+	port->state = PORT_DOWN;
+}
+
+/*
+	Location: port_bringup.c
+	This is called from the accept loop when the notify pipe is readable. Every finished bring-up is
+	applied to its port, unless the port went away or changed in the meantime.
+*/
+void port_bringup_collect(struct config_t *conf)
+{
+	extern int bringup_notify_fd;
+	struct bringup_job_t *job;
+	struct bringup_job_t *next;
+	SERIAL_INFO *port;
+	char drain[64];
+
+	while (read(bringup_notify_fd, drain, sizeof(drain)) > 0)
+		;
+	pthread_mutex_lock(&bringup_lock);
+	job = bringup_done;
+	bringup_done = NULL;
+	pthread_mutex_unlock(&bringup_lock);
+
+	for ( ; job != NULL; job = next) {
+		next = job->next;
+		port = port_registry_at(&conf->ports, job->index);
+		if ((port == NULL) || (port->bringup_seq != job->seq) || (strcmp(port->device, job->settings.device) != 0)) {
+			syslog(LOG_DEBUG, "port_bringup.c: port_bringup_collect(): dropping stale bring-up of %s", job->settings.device);
+			if (job->fd >= 0)
+				close(job->fd);
+		} else if (job->error != 0) {
+			syslog(LOG_ERR, "port_bringup.c: port_bringup_collect(): %s failed, it will be opened on demand", port->device);
+			port->state = PORT_FAILED;
+		} else {
+			port->fd = job->fd;
+			port->old_termios = job->settings.old_termios;
+			port->new_termios = job->settings.new_termios;
+			port->state = PORT_READY;
+			syslog(LOG_INFO, "port_bringup.c: port_bringup_collect(): %s is ready", port->device);
+		}
+		free(job->settings.device);
+		free(job);
+	}
+	port_listener_sync(conf);								/* listeners for the ports which are ready */
+	port_worker_sync(conf);									/* and their port workers */
+}
+
+/*
+	Location: port_bringup.c
+	This is for a child process: the notify pipe belongs to the parent.
+*/
+void port_bringup_child(void)
+{
+	extern int bringup_notify_fd;
+
+	if (bringup_pipe[0] >= 0)
+		close(bringup_pipe[0]);
+	if (bringup_pipe[1] >= 0)
+		close(bringup_pipe[1]);
+	bringup_pipe[0] = bringup_pipe[1] = -1;
+	bringup_notify_fd = -1;
+	bringup_nworkers = 0;									/* the workers were not forked with us */
+}
@@ -0,0 +1,583 @@
+/*
+ * port_registry.c
+ *	This is to keep track of every configured serial port.
+ *	Ports live in fixed size chunks of SERIAL_INFO's, so a port never moves once it is registered
+ *	and a SERIAL_INFO pointer stays valid for as long as the port exists.
+ *	Three hash maps index the ports by device path, by listen port and by pool name, so a lookup on
+ *	connect or on a control operation does not depend on how many ports are configured.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+#define PORT_MAP_EMPTY		0x00			/* slot never used */
+#define PORT_MAP_USED		0x01			/* slot holds a key */
+#define PORT_MAP_DELETED	0x02			/* slot held a key which was removed */
+
+#define PORT_MAP_MINSIZE	16				/* initial number of slots, must be a power of 2 */
+
+/*
+	Location: port_registry.c
+	This is the FNV-1a hash of a string key.
+*/
+static unsigned long port_map_hash_string(const char *key)
+{
+	unsigned long h = 2166136261UL;
+
+	while (*key != '\0') {
+		h ^= (unsigned char) *key++;
+		h *= 16777619UL;
+	}
+	return(h);
+}
+
+/*
+	Location: port_registry.c
+	This is the multiplicative (Fibonacci) hash of an integer key.
+*/
+static unsigned long port_map_hash_int(long key)
+{
+	return((unsigned long) key * 2654435761UL);
+}
+
+/*
+	Location: port_registry.c
+	This is to compare the key in a slot with a string or an integer key.
+	returns 1 if they match, 0 otherwise.
+*/
+static int port_map_key_match(PORT_MAP *map, struct port_map_slot_t *slot, const char *skey, long ikey)
+{
+	if (slot->state != PORT_MAP_USED)
+		return(0);
+	if (map->string_keys)
+		return(strcmp(slot->skey, skey) == 0);
+	return(slot->ikey == ikey);
+}
+
+/*
+	Location: port_registry.c
+	This is to find the slot for a key. If the key is not in the map, we return the first reusable slot
+	along its probe sequence instead, so the caller can insert it there.
+	returns NULL if the map has no slots at all.
+*/
+static struct port_map_slot_t *port_map_probe(PORT_MAP *map, const char *skey, long ikey)
+{
+	struct port_map_slot_t *slot;
+	struct port_map_slot_t *reuse = NULL;
+	unsigned long h;
+	unsigned int i;
+	unsigned int mask;
+
+	if (map->size == 0)
+		return(NULL);
+	mask = map->size - 1;
+	h = map->string_keys ? port_map_hash_string(skey) : port_map_hash_int(ikey);
+	for (i = 0; i < map->size; i++) {
+		slot = &map->slots[(h + i) & mask];				/* linear probing */
+		if (port_map_key_match(map, slot, skey, ikey))
+			return(slot);
+		if (slot->state == PORT_MAP_EMPTY)
+			return((reuse != NULL) ? reuse : slot);
+		if ((slot->state == PORT_MAP_DELETED) && (reuse == NULL))
+			reuse = slot;
+	}
+	return(reuse);
+}
+
+/*
+	Location: port_registry.c
+	This is to resize the map to newsize slots (a power of 2) and re-insert every live key.
+	Deleted slots are dropped along the way.
+	returns 0 on success, 1 on failure.
+*/
+static int port_map_resize(PORT_MAP *map, unsigned int newsize)
+{
+	extern int errno;
+	struct port_map_slot_t *old_slots;
+	struct port_map_slot_t *slot;
+	unsigned int old_size;
+	unsigned int i;
+
+	old_slots = map->slots;
+	old_size = map->size;
+	map->slots = calloc(newsize, sizeof(struct port_map_slot_t));
+	if (map->slots == NULL) {
+		syslog(LOG_ERR, "port_registry.c: port_map_resize(): calloc() error: %s", strerror(errno));
+		map->slots = old_slots;
+		return(1);
+	}
+	map->size = newsize;
+	map->used = 0;
+	for (i = 0; i < old_size; i++) {
+		if (old_slots[i].state != PORT_MAP_USED)
+			continue;
+		slot = port_map_probe(map, old_slots[i].skey, old_slots[i].ikey);
+		*slot = old_slots[i];
+		map->used++;
+	}
+	if (old_slots != NULL)
+		free(old_slots);
+	return(0);
+}
+
+/*
+	Location: port_registry.c
+	This is to insert (or replace) a key in the map. String keys are not copied, they must stay
+	valid for as long as they are in the map (we always use strings owned by the SERIAL_INFO).
+	returns 0 on success, 1 on failure.
+*/
+static int port_map_insert(PORT_MAP *map, const char *skey, long ikey, int index)
+{
+	struct port_map_slot_t *slot;
+
+	/* keep the load factor (live + deleted slots) below 70% */
+	if ((map->used + 1) * 10 >= map->size * 7) {
+		if (port_map_resize(map, (map->size == 0) ? PORT_MAP_MINSIZE : map->size * 2) != 0)
+			return(1);
+	}
+	slot = port_map_probe(map, skey, ikey);
+	if (slot == NULL)
+		return(1);
+	if (slot->state != PORT_MAP_USED) {
+		if (slot->state == PORT_MAP_EMPTY)
+			map->used++;
+		slot->state = PORT_MAP_USED;
+	}
+	slot->skey = skey;
+	slot->ikey = ikey;
+	slot->index = index;
+	return(0);
+}
+
+/*
+	Location: port_registry.c
+	This is to look up a key in the map.
+	returns the port index stored under the key, -1 if it isn't there.
+*/
+static int port_map_find(PORT_MAP *map, const char *skey, long ikey)
+{
+	struct port_map_slot_t *slot;
+
+	slot = port_map_probe(map, skey, ikey);
+	if ((slot == NULL) || (slot->state != PORT_MAP_USED))
+		return(-1);
+	return(slot->index);
+}
+
+/*
+	Location: port_registry.c
+	This is to remove a key from the map. Its slot becomes a tombstone so that probe sequences
+	running through it stay intact.
+*/
+static void port_map_delete(PORT_MAP *map, const char *skey, long ikey)
+{
+	struct port_map_slot_t *slot;
+
+	slot = port_map_probe(map, skey, ikey);
+	if ((slot != NULL) && (slot->state == PORT_MAP_USED)) {
+		slot->state = PORT_MAP_DELETED;
+		slot->skey = NULL;
+	}
+}
+
+/*
+	Location: port_registry.c
+	This is to make room for nkeys more keys, so that as many port_map_insert() calls do not resize the map.
+	returns 0 on success, 1 on failure.
+*/
+static int port_map_reserve(PORT_MAP *map, unsigned int nkeys)
+{
+	unsigned int size;
+
+	size = (map->size == 0) ? PORT_MAP_MINSIZE : map->size;
+	while ((map->used + nkeys + 1) * 10 >= size * 7)		/* see port_map_insert() */
+		size *= 2;
+	if (size == map->size)
+		return(0);
+	return(port_map_resize(map, size));
+}
+
+/*
+	Location: port_registry.c
+	This is to release the slots of a map.
+*/
+static void port_map_free(PORT_MAP *map)
+{
+	if (map->slots != NULL)
+		free(map->slots);
+	map->slots = NULL;
+	map->size = 0;
+	map->used = 0;
+}
+
+/*
+	Location: port_registry.c
+	This is to initialize an empty port registry.
+*/
+void port_registry_init(PORT_REGISTRY *reg)
+{
+	memset(reg, 0, sizeof(PORT_REGISTRY));
+	reg->free_head = -1;
+	reg->by_device.string_keys = 1;
+	reg->by_listen_port.string_keys = 0;
+	reg->by_pool.string_keys = 1;
+}
+
+/*
+	Location: port_registry.c
+	This is to return the port stored at a registry index.
+	returns NULL if the index is out of range or the slot is not in use.
+*/
+SERIAL_INFO *port_registry_at(PORT_REGISTRY *reg, int index)
+{
+	SERIAL_INFO *port;
+
+	if ((reg == NULL) || (index < 0) || (index >= reg->nslots))
+		return(NULL);
+	port = &reg->chunks[index / PORT_CHUNK][index % PORT_CHUNK];
+	if (port->device == NULL)
+		return(NULL);
+	return(port);
+}
+
+/*
+	Location: port_registry.c
+	This is to grow the registry by one chunk of PORT_CHUNK ports.
+	returns 0 on success, 1 on failure.
+*/
+static int port_registry_grow(PORT_REGISTRY *reg)
+{
+	extern int errno;
+	SERIAL_INFO **chunks;
+
+	chunks = realloc(reg->chunks, (reg->nchunks + 1) * sizeof(SERIAL_INFO *));
+	if (chunks == NULL) {
+		syslog(LOG_ERR, "port_registry.c: port_registry_grow(): realloc() error: %s", strerror(errno));
+		return(1);
+	}
+	reg->chunks = chunks;
+	reg->chunks[reg->nchunks] = calloc(PORT_CHUNK, sizeof(SERIAL_INFO));
+	if (reg->chunks[reg->nchunks] == NULL) {
+		syslog(LOG_ERR, "port_registry.c: port_registry_grow(): calloc() error: %s", strerror(errno));
+		return(1);
+	}
+	reg->nchunks++;
+	return(0);
+}
+
+/*
+	Location: port_registry.c
+	This is to get an unused SERIAL_INFO, either from the free list or by growing the registry
+	by one chunk of PORT_CHUNK ports. The SERIAL_INFO is zeroed and has its index set.
+	returns NULL on failure.
+*/
+static SERIAL_INFO *port_registry_new_slot(PORT_REGISTRY *reg)
+{
+	SERIAL_INFO *port;
+	int index;
+
+	if (reg->free_head >= 0) {								/* reuse a released slot */
+		index = reg->free_head;
+		port = &reg->chunks[index / PORT_CHUNK][index % PORT_CHUNK];
+		reg->free_head = port->next_free;
+	} else {
+		if ((reg->nslots == reg->nchunks * PORT_CHUNK) && (port_registry_grow(reg) != 0))
+			return(NULL);									/* all chunks were full */
+		index = reg->nslots++;
+		port = &reg->chunks[index / PORT_CHUNK][index % PORT_CHUNK];
+	}
+	memset(port, 0, sizeof(SERIAL_INFO));
+	port->index = index;
+	port->next_in_pool = -1;
+	port->next_free = -1;
+	port->fd = -1;
+	port->state = PORT_DOWN;
+	return(port);
+}
+
+/*
+	Location: port_registry.c
+	This is to make room for nports more ports, and for nkeys more keys in each map. The next nports
+	port_registry_add() calls then allocate nothing but the device path, and nkeys keys can be set
+	with port_registry_set_listen_port() or port_registry_take_pool() without allocating at all.
+	returns 0 on success, 1 on failure (the registry may have grown, but holds what it held).
+*/
+int port_registry_reserve(PORT_REGISTRY *reg, int nports, int nkeys)
+{
+	SERIAL_INFO *port;
+	int nfree;
+	int index;
+
+	if (reg == NULL)
+		return(1);
+	nfree = reg->nchunks * PORT_CHUNK - reg->nslots;
+	for (index = reg->free_head; index >= 0; index = port->next_free) {
+		port = &reg->chunks[index / PORT_CHUNK][index % PORT_CHUNK];
+		nfree++;
+	}
+	for ( ; nfree < nports; nfree += PORT_CHUNK) {
+		if (port_registry_grow(reg) != 0)
+			return(1);
+	}
+	if ((port_map_reserve(&reg->by_device, nkeys) != 0) ||
+		(port_map_reserve(&reg->by_listen_port, nkeys) != 0) ||
+		(port_map_reserve(&reg->by_pool, nkeys) != 0))
+		return(1);
+	return(0);
+}
+
+/*
+	Location: port_registry.c
+	This is to register a new serial port for the specified device path.
+	returns a ptr to the new SERIAL_INFO, or NULL if the device is already registered or on error.
+*/
+SERIAL_INFO *port_registry_add(PORT_REGISTRY *reg, char *device)
+{
+	extern int errno;
+	SERIAL_INFO *port;
+
+	if ((reg == NULL) || (device == NULL) || (*device == '\0'))
+		return(NULL);
+	if (port_map_find(&reg->by_device, device, 0) >= 0) {
+		syslog(LOG_ERR, "port_registry.c: port_registry_add(): serial device %s is already registered", device);
+		return(NULL);
+	}
+	port = port_registry_new_slot(reg);
+	if (port == NULL)
+		return(NULL);
+	port->device = strdup(device);
+	if (port->device == NULL) {
+		syslog(LOG_ERR, "port_registry.c: port_registry_add(): strdup() error: %s", strerror(errno));
+		port->next_free = reg->free_head;
+		reg->free_head = port->index;
+		return(NULL);
+	}
+	if (port_map_insert(&reg->by_device, port->device, 0, port->index) != 0) {
+		free(port->device);
+		port->device = NULL;
+		port->next_free = reg->free_head;
+		reg->free_head = port->index;
+		return(NULL);
+	}
+	reg->nports++;
+	syslog(LOG_DEBUG, "port_registry.c: port_registry_add(): %s registered at index %d, %d port(s)",
+			port->device, port->index, reg->nports);
+	return(port);
+}
+
+/*
+	Location: port_registry.c
+	This is to unlink a port from the pool it belongs to.
+*/
+static void port_registry_leave_pool(PORT_REGISTRY *reg, SERIAL_INFO *port)
+{
+	SERIAL_INFO *p;
+	int head;
+
+	if (port->pool == NULL)
+		return;
+	head = port_map_find(&reg->by_pool, port->pool, 0);
+	if (head == port->index) {								/* first port of the pool */
+		p = port_registry_at(reg, port->next_in_pool);
+		if (p != NULL)
+			port_map_insert(&reg->by_pool, p->pool, 0, p->index);	/* next port carries the key now */
+		else
+			port_map_delete(&reg->by_pool, port->pool, 0);
+	} else {
+		for (p = port_registry_at(reg, head); p != NULL; p = port_registry_at(reg, p->next_in_pool)) {
+			if (p->next_in_pool == port->index) {
+				p->next_in_pool = port->next_in_pool;
+				break;
+			}
+		}
+	}
+	port->next_in_pool = -1;
+	free(port->pool);
+	port->pool = NULL;
+}
+
+/*
+	Location: port_registry.c
+	This is to set or change the listen port of a serial port. 0 removes it.
+	If another port already listens on the same TCP port, the map keeps that one and connections
+	on the listen port hunt through its pool. When the port the map keeps leaves the listen port, the
+	next port which listens on it carries the key, as in port_registry_leave_pool().
+	returns 0 on success, 1 on failure.
+*/
+int port_registry_set_listen_port(PORT_REGISTRY *reg, SERIAL_INFO *port, int listen_port)
+{
+	SERIAL_INFO *p;
+	int i;
+
+	if ((reg == NULL) || (port == NULL))
+		return(1);
+	if ((listen_port < 0) || (listen_port > 65535)) {
+		syslog(LOG_ERR, "port_registry.c: invalid listen port %d for %s", listen_port, port->device);
+		return(1);
+	}
+	if ((port->listen_port > 0) && (port->listen_port != listen_port) &&
+			(port_map_find(&reg->by_listen_port, NULL, port->listen_port) == port->index)) {
+		port_map_delete(&reg->by_listen_port, NULL, port->listen_port);
+		for (i = 0; i < reg->nslots; i++) {
+			p = port_registry_at(reg, i);
+			if ((p != NULL) && (p != port) && (p->listen_port == port->listen_port)) {
+				port_map_insert(&reg->by_listen_port, NULL, p->listen_port, p->index);
+				break;
+			}
+		}
+	}
+	port->listen_port = listen_port;
+	if (listen_port == 0)
+		return(0);
+	if (port_map_find(&reg->by_listen_port, NULL, listen_port) >= 0)
+		return(0);											/* shared listen port, see above */
+	return(port_map_insert(&reg->by_listen_port, NULL, listen_port, port->index));
+}
+
+/*
+	Location: port_registry.c
+	This is to put a serial port into the named pool, or take it out of its pool if pool is NULL.
+	Ports of a pool are chained through next_in_pool, in registration order.
+	returns 0 on success, 1 on failure.
+*/
+int port_registry_set_pool(PORT_REGISTRY *reg, SERIAL_INFO *port, char *pool)
+{
+	extern int errno;
+	char *name;
+
+	if ((reg == NULL) || (port == NULL))
+		return(1);
+	name = NULL;
+	if ((pool != NULL) && (*pool != '\0') && ((name = strdup(pool)) == NULL)) {
+		syslog(LOG_ERR, "port_registry.c: port_registry_set_pool(): strdup() error: %s", strerror(errno));
+		return(1);											/* the port stays where it was */
+	}
+	return(port_registry_take_pool(reg, port, name));
+}
+
+/*
+	Location: port_registry.c
+	This is port_registry_set_pool() with a pool name the port takes over: pool is a malloc()ed string
+	which is freed with the port, or NULL to take the port out of its pool.
+	returns 0 on success, 1 on failure.
+*/
+int port_registry_take_pool(PORT_REGISTRY *reg, SERIAL_INFO *port, char *pool)
+{
+	SERIAL_INFO *p;
+	int head;
+
+	if ((reg == NULL) || (port == NULL))
+		return(1);
+	port_registry_leave_pool(reg, port);
+	if (pool == NULL)
+		return(0);
+	if (*pool == '\0') {
+		free(pool);
+		return(0);
+	}
+	port->pool = pool;
+	head = port_map_find(&reg->by_pool, port->pool, 0);
+	if (head < 0)
+		return(port_map_insert(&reg->by_pool, port->pool, 0, port->index));
+	for (p = port_registry_at(reg, head); p->next_in_pool >= 0; p = port_registry_at(reg, p->next_in_pool))
+		;													/* append to the end of the chain */
+	p->next_in_pool = port->index;
+	return(0);
+}
+
+/*
+	Location: port_registry.c
+	This is to remove a serial port from the registry and release its memory.
+	The slot goes onto the free list and will be reused by the next port_registry_add().
+	returns 0 on success, 1 on failure.
+*/
+int port_registry_remove(PORT_REGISTRY *reg, SERIAL_INFO *port)
+{
+	if ((reg == NULL) || (port == NULL) || (port->device == NULL))
+		return(1);
+	syslog(LOG_DEBUG, "port_registry.c: port_registry_remove(): removing %s at index %d", port->device, port->index);
+	port_registry_set_listen_port(reg, port, 0);
+	port_registry_leave_pool(reg, port);
+	port_map_delete(&reg->by_device, port->device, 0);
+	port_bringup_release(port);								/* closes the device if we hold it */
+	free_serial_port(port);									/* releases device, lockfile, ... */
+	port->device = NULL;
+	port->next_free = reg->free_head;
+	reg->free_head = port->index;
+	reg->nports--;
+	return(0);
+}
+
+/*
+	Location: port_registry.c
+	This is to look up a serial port by its device path.
+*/
+SERIAL_INFO *port_lookup_device(PORT_REGISTRY *reg, const char *device)
+{
+	if ((reg == NULL) || (device == NULL))
+		return(NULL);
+	return(port_registry_at(reg, port_map_find(&reg->by_device, device, 0)));
+}
+
+/*
+	Location: port_registry.c
+	This is to look up a serial port by the TCP port clients connect to for it.
+*/
+SERIAL_INFO *port_lookup_listen_port(PORT_REGISTRY *reg, int listen_port)
+{
+	if ((reg == NULL) || (listen_port <= 0))
+		return(NULL);
+	return(port_registry_at(reg, port_map_find(&reg->by_listen_port, NULL, listen_port)));
+}
+
+/*
+	Location: port_registry.c
+	This is to look up the first serial port of a pool. Use port_pool_next() for the others.
+*/
+SERIAL_INFO *port_lookup_pool(PORT_REGISTRY *reg, const char *pool)
+{
+	if ((reg == NULL) || (pool == NULL))
+		return(NULL);
+	return(port_registry_at(reg, port_map_find(&reg->by_pool, pool, 0)));
+}
+
+/*
+	Location: port_registry.c
+	This is to return the port which follows the specified one in its pool, NULL at the end of the pool.
+*/
+SERIAL_INFO *port_pool_next(PORT_REGISTRY *reg, SERIAL_INFO *port)
+{
+	if ((reg == NULL) || (port == NULL))
+		return(NULL);
+	return(port_registry_at(reg, port->next_in_pool));
+}
+
+/*
+	Location: port_registry.c
+	This is to release every port and the hash maps of the registry.
+	The registry is empty (and usable again) afterwards.
+*/
+void port_registry_free(PORT_REGISTRY *reg)
+{
+	SERIAL_INFO *port;
+	int i;
+
+	if (reg == NULL)
+		return;
+	for (i = 0; i < reg->nslots; i++) {
+		port = port_registry_at(reg, i);
+		if (port != NULL) {
+			port_bringup_release(port);
+			free_serial_port(port);
+		}
+	}
+	for (i = 0; i < reg->nchunks; i++)
+		free(reg->chunks[i]);
+	if (reg->chunks != NULL)
+		free(reg->chunks);
+	port_map_free(&reg->by_device);
+	port_map_free(&reg->by_listen_port);
+	port_map_free(&reg->by_pool);
+	port_registry_init(reg);
+}
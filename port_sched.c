@@ -0,0 +1,174 @@
+/*
+ * port_sched.c
+ *	This is to give the session of a serial port the scheduling it was configured with: a real-time
+ *	policy (SCHED_FIFO or SCHED_RR) and priority, a nice level, and the CPUs it may run on. Lines
+ *	carrying control traffic can then run ahead of the bulk lines of the same gateway.
+ *	The settings are applied to the process (or, with an iterative server, the thread) serving the
+ *	session when it starts, so the threads it starts afterwards (modem_watch.c, serial_thread.c) get
+ *	them as well. They are undone when the session ends, which matters for the iterative server.
+ *	We need CAP_SYS_NICE (or a RLIMIT_RTPRIO / RLIMIT_NICE allowance) for most of it; what we are
+ *	refused is logged, and the session goes on with what it has.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#define _GNU_SOURCE							/* sched_setaffinity(), CPU_* macros */
+#include "serial_ip.h"
+
+#include <sys/resource.h>
+
+/*
+	Location: port_sched.c
+	What the session had before port_sched_apply(), for port_sched_restore().
+*/
+static int sched_saved = 0;
+static int sched_saved_policy;
+static struct sched_param sched_saved_param;
+static int sched_saved_nice;
+static cpu_set_t sched_saved_cpus;
+static int sched_saved_have_cpus;
+
+/*
+	Location: port_sched.c
+	This is to set the scheduling settings of a port to "leave everything as it is".
+*/
+void port_sched_init(struct port_sched_t *sched)
+{
+	sched->policy = SCHED_OTHER;
+	sched->priority = 0;
+	sched->nice = PORT_NICE_UNSET;
+	sched->cpus = 0;
+}
+
+/*
+	Location: port_sched.c
+	This is to parse a "scheduling policy" value: fifo, rr or other.
+	returns 0 on success, 1 on failure.
+*/
+int port_sched_parse_policy(const char *value, int *policy)
+{
+	if (strcasecmp(value, "fifo") == 0)
+		*policy = SCHED_FIFO;
+	else if (strcasecmp(value, "rr") == 0)
+		*policy = SCHED_RR;
+	else if (strcasecmp(value, "other") == 0)
+		*policy = SCHED_OTHER;
+	else
+		return(1);
+	return(0);
+}
+
+/*
+	Location: port_sched.c
+	This is to parse a "cpu affinity" value, a list of CPUs and ranges, eg. "0,2-3".
+	returns 0 on success, 1 on failure.
+*/
+int port_sched_parse_cpus(const char *value, unsigned long long *cpus)
+{
+	const char *p = value;
+	char *end;
+	long first;
+	long last;
+
+	*cpus = 0;
+	while (*p != '\0') {
+		first = strtol(p, &end, 10);
+		if (end == p)
+			return(1);
+		last = first;
+		p = end;
+		if (*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			if (end == p)
+				return(1);
+			p = end;
+		}
+		if ((first < 0) || (last < first) || (last >= PORT_SCHED_MAXCPU))
+			return(1);
+		for ( ; first <= last; first++)
+			*cpus |= 1ULL << first;
+		while ((*p == ',') || (*p == ' '))
+			p++;
+	}
+	return(*cpus == 0);
+}
+
+/*
+	Location: port_sched.c
+	This is to log a refused setting, and the capability it takes.
+*/
+static void port_sched_refused(SERIAL_INFO *port, const char *what, int error)
+{
+	if ((error == EPERM) || (error == EACCES))
+		syslog(LOG_ERR, "port_sched.c: port_sched_apply(): %s for %s refused: needs CAP_SYS_NICE or a matching rlimit (%s)",
+				what, port->device, strerror(error));
+	else
+		syslog(LOG_ERR, "port_sched.c: port_sched_apply(): %s for %s failed: %s", what, port->device, strerror(error));
+}
+
+/*
+	Location: port_sched.c
+	This is to apply the scheduling settings of a port, when its session starts.
+*/
+void port_sched_apply(SERIAL_INFO *port)
+{
+	extern int errno;
+	struct port_sched_t *sched;
+	struct sched_param param;
+	cpu_set_t cpus;
+	int cpu;
+
+	if (port == NULL)
+		return;
+	sched = &port->sched;
+	if ((sched->policy == SCHED_OTHER) && (sched->nice == PORT_NICE_UNSET) && (sched->cpus == 0))
+		return;
+	sched_saved_policy = sched_getscheduler(0);
+	sched_getparam(0, &sched_saved_param);
+	errno = 0;
+	sched_saved_nice = getpriority(PRIO_PROCESS, 0);
+	sched_saved_have_cpus = (sched_getaffinity(0, sizeof(sched_saved_cpus), &sched_saved_cpus) == 0);
+	sched_saved = 1;
+
+	if (sched->cpus != 0) {
+		CPU_ZERO(&cpus);
+		for (cpu = 0; cpu < PORT_SCHED_MAXCPU; cpu++) {
+			if (sched->cpus & (1ULL << cpu))
+				CPU_SET(cpu, &cpus);
+		}
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+			port_sched_refused(port, "cpu affinity", errno);
+	}
+	if ((sched->nice != PORT_NICE_UNSET) && (setpriority(PRIO_PROCESS, 0, sched->nice) < 0))
+		port_sched_refused(port, "nice level", errno);
+	if (sched->policy != SCHED_OTHER) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = sched->priority;
+		if (param.sched_priority < sched_get_priority_min(sched->policy))
+			param.sched_priority = sched_get_priority_min(sched->policy);
+		if (param.sched_priority > sched_get_priority_max(sched->policy))
+			param.sched_priority = sched_get_priority_max(sched->policy);
+		if (sched_setscheduler(0, sched->policy, &param) < 0)
+			port_sched_refused(port, "real-time scheduling", errno);
+	}
+	syslog(LOG_INFO, "port_sched.c: port_sched_apply(): %s runs with policy %d priority %d nice %d cpus 0x%llx",
+			port->device, sched_getscheduler(0), sched->priority, getpriority(PRIO_PROCESS, 0), sched->cpus);
+}
+
+/*
+	Location: port_sched.c
+	This is to undo port_sched_apply(), when the session ends.
+*/
+void port_sched_restore(void)
+{
+	if (! sched_saved)
+		return;
+	sched_saved = 0;
+	if (sched_setscheduler(0, sched_saved_policy, &sched_saved_param) < 0)
+		syslog(LOG_ERR, "port_sched.c: port_sched_restore(): sched_setscheduler() error: %s", strerror(errno));
+	if (setpriority(PRIO_PROCESS, 0, sched_saved_nice) < 0)
+		syslog(LOG_ERR, "port_sched.c: port_sched_restore(): setpriority() error: %s", strerror(errno));
+	if (sched_saved_have_cpus && (sched_setaffinity(0, sizeof(sched_saved_cpus), &sched_saved_cpus) < 0))
+		syslog(LOG_ERR, "port_sched.c: port_sched_restore(): sched_setaffinity() error: %s", strerror(errno));
+}
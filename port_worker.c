@@ -0,0 +1,392 @@
+/*
+ * port_worker.c
+ *	These are the worker processes of the ports which are not served by sessions of the listen port, but
+ *	by a process of their own for as long as the daemon runs: the datagram transport (udp.c), the
+ *	shared sessions (share.c) and the shared-memory rings (shm.c). A worker holds the uucp lock of its port: a TCP client of the port finds
+ *	it busy.
+ *	A port is served by the first kind of worker of port_worker_kinds[] which wants it, so that two
+ *	kinds never fight over the same device. The parent starts the workers of the ports which are ready,
+ *	and stops them when the settings of their port change or the port is gone (see port_worker_sync());
+ *	a worker which died is started again, at most once every PORT_WORKER_RESPAWN_DELAY.
+ *	The parent never waits for a worker: a worker it stops is sent SIGTERM and reaped when its SIGCHLD
+ *	comes in, and no other worker takes its port before that (it still holds the lock). Workers are
+ *	reaped by their pid, before the sessions are (see action_sigchild()), so their status is logged
+ *	and a pid the kernel gave to another process is never taken for the worker. A respawn
+ *	which has to wait, or a worker which takes too long to stop, arms port_worker_fd, a timerfd the
+ *	accept loop watches (see accept_client_connection()).
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+#include <sys/timerfd.h>
+
+#define PORT_WORKER_RESPAWN_DELAY	1		/* seconds between two starts of the same worker */
+#define PORT_WORKER_KILL_DELAY		3		/* seconds a worker has to stop before it is killed */
+
+/*
+	Location: port_worker.c
+	A kind of worker: whether it wants a port, the settings it serves the port with, and what it does.
+*/
+struct port_worker_kind_t {
+	const char *name;
+	int (*wanted)(SERIAL_INFO *port);
+	void (*settings)(SERIAL_INFO *port, char *buf, int len);
+	int (*run)(struct config_t *conf, SERIAL_INFO *port);
+};
+
+static struct port_worker_kind_t port_worker_kinds[] = {
+	{"shared", share_port_wanted, share_port_settings, share_worker},
+	{"udp", udp_port_wanted, udp_port_settings, udp_worker},
+	{"shm", shm_port_wanted, shm_port_settings, shm_worker},
+};
+
+#define PORT_WORKER_KINDS	(sizeof(port_worker_kinds) / sizeof(port_worker_kinds[0]))
+
+/*
+	Location: port_worker.c
+	The worker of a port, as the parent keeps track of it.
+*/
+struct port_worker_t {
+	char *device;
+	struct port_worker_kind_t *kind;
+	char *settings;							/* the settings it was started with */
+	pid_t pid;								/* 0 once it is gone */
+	time_t started;
+	time_t stopping;						/* when it was sent SIGTERM, 0 if it was not */
+};
+
+static struct port_worker_t *port_workers = NULL;
+static int nport_workers = 0;
+
+volatile sig_atomic_t port_worker_stop = 0;		/* the worker was told to stop */
+int port_worker_fd = -1;						/* readable when a worker is due to be started or killed */
+
+/*
+	Location: port_worker.c
+	This is what a worker does with the signals it gets.
+*/
+static void port_worker_signal(int signal)
+{
+	extern volatile sig_atomic_t port_worker_stop;
+
+	if (signal == SIGCLD)
+		return;
+	if ((signal == SIGTERM) || (signal == SIGQUIT) || (signal == SIGHUP))
+		port_worker_stop = 1;
+}
+
+/*
+	Location: port_worker.c
+	This is to find the kind of worker which serves a port.
+	returns the kind, NULL if the port wants none.
+*/
+static struct port_worker_kind_t *port_worker_kind(SERIAL_INFO *port)
+{
+	unsigned int k;
+
+	if ((port == NULL) || (port->state != PORT_READY))
+		return(NULL);
+	for (k = 0; k < PORT_WORKER_KINDS; k++) {
+		if (port_worker_kinds[k].wanted(port))
+			return(&port_worker_kinds[k]);
+	}
+	return(NULL);
+}
+
+/*
+	Location: port_worker.c
+	This is to get the settings a kind of worker serves a port with, as a string.
+	returns the string, to be freed, NULL if out of memory.
+*/
+static char *port_worker_settings(struct port_worker_kind_t *kind, SERIAL_INFO *port)
+{
+	char settings[PATH_MAX];
+
+	settings[0] = '\0';
+	kind->settings(port, settings, sizeof(settings));
+	return(strdup(settings));
+}
+
+/*
+	Location: port_worker.c
+	This is to start the worker of a port.
+	returns 0 on success, 1 on failure.
+*/
+static int port_worker_start(struct config_t *conf, SERIAL_INFO *port, struct port_worker_t *w)
+{
+	extern int errno;
+	extern int server_sockfd;
+	extern int gsockfd;
+	pid_t pid;
+
+	w->started = time(NULL);
+	pid = fork();
+	if (pid < 0) {
+		syslog(LOG_ERR, "port_worker.c: port_worker_start(): fork error (%s)", strerror(errno));
+		return(1);
+	}
+	if (pid == 0) {
+		/* as a session child does, see concurrent_server() */
+		io_engine_close();
+		if (server_sockfd >= 0)
+			close(server_sockfd);
+		if (gsockfd >= 0)
+			close(gsockfd);									/* started from the session loop by a reload */
+		hotplug_close();
+		port_listeners_close();
+		port_bringup_child();
+		port_worker_child();
+		upgrade_close(0);
+		reset_signals();
+		if ((chdir(conf->directory) != 0) || (setgid(conf->gid) != 0) || (setuid(conf->uid) != 0)) {
+			syslog(LOG_ERR, "port_worker.c: port_worker_start(): cannot take the directory, group or user: %s", strerror(errno));
+			_exit(1);
+		}
+		signal_fd_redirect(port_worker_signal);
+		_exit(w->kind->run(conf, port));
+	}
+	w->pid = pid;
+	syslog(LOG_INFO, "port_worker.c: port_worker_start(): pid %d serves %s (%s: %s)", (int) pid, port->device,
+			w->kind->name, w->settings);
+	return(0);
+}
+
+/*
+	Location: port_worker.c
+	This is to tell a worker to stop. It is reaped later (see port_worker_reap()).
+*/
+static void port_worker_halt(struct port_worker_t *w)
+{
+	if ((w->pid <= 0) || (w->stopping != 0))
+		return;
+	kill(w->pid, SIGTERM);
+	w->stopping = time(NULL);
+}
+
+/*
+	Location: port_worker.c
+	This is to reap a worker which is gone, and to kill one which takes too long to stop.
+	waitpid() on the pid of the worker cannot reap anything else: the pid is not given to another
+	process before the worker is reaped. ECHILD means it was reaped already.
+	returns 1 if it is gone, 0 otherwise.
+*/
+static int port_worker_reap(struct port_worker_t *w)
+{
+	extern int errno;
+	pid_t ret;
+	int status;
+
+	if (w->pid <= 0)
+		return(0);
+	ret = waitpid(w->pid, &status, WNOHANG);
+	if ((ret == 0) || ((ret < 0) && (errno == EINTR))) {
+		if ((w->stopping != 0) && (time(NULL) - w->stopping >= PORT_WORKER_KILL_DELAY)) {
+			syslog(LOG_WARNING, "port_worker.c: port_worker_reap(): the %s worker of %s does not stop, killing it",
+					w->kind->name, w->device);
+			kill(w->pid, SIGKILL);
+		}
+		return(0);
+	}
+	if (w->stopping == 0) {
+		syslog(LOG_ERR, "port_worker.c: port_worker_reap(): the %s worker of %s is gone", w->kind->name, w->device);
+		if (ret > 0)
+			log_termination_status(ret, status);
+	}
+	w->pid = 0;
+	w->stopping = 0;
+	return(1);
+}
+
+/*
+	Location: port_worker.c
+	This is called on SIGCHLD, before the other children are reaped with waitpid(-1): it reaps the
+	workers which are gone. Without signal_fd we run in signal context; port_worker_sync() blocks
+	SIGCHLD while it changes the table of workers.
+*/
+void port_worker_wait(void)
+{
+	int j;
+
+	for (j = 0; j < nport_workers; j++)
+		port_worker_reap(&port_workers[j]);
+}
+
+/*
+	Location: port_worker.c
+	This is to arm port_worker_fd for the next respawn or kill which is due, or to disarm it.
+*/
+static void port_worker_arm(void)
+{
+	extern int errno;
+	extern int port_worker_fd;
+	struct itimerspec its;
+	struct port_worker_t *w;
+	time_t now;
+	time_t due;
+	int j;
+
+	now = time(NULL);
+	due = 0;
+	for (j = 0; j < nport_workers; j++) {
+		w = &port_workers[j];
+		if ((w->pid == 0) && (w->started + PORT_WORKER_RESPAWN_DELAY > now))
+			due = (due == 0) ? w->started + PORT_WORKER_RESPAWN_DELAY : MIN(due, w->started + PORT_WORKER_RESPAWN_DELAY);
+		else if (w->stopping != 0)
+			due = (due == 0) ? w->stopping + PORT_WORKER_KILL_DELAY : MIN(due, w->stopping + PORT_WORKER_KILL_DELAY);
+	}
+	if ((due == 0) && (port_worker_fd < 0))
+		return;
+	if (port_worker_fd < 0) {
+		port_worker_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+		if (port_worker_fd < 0) {
+			syslog(LOG_ERR, "port_worker.c: port_worker_arm(): timerfd_create() error: %s", strerror(errno));
+			return;
+		}
+	}
+	memset(&its, 0, sizeof(its));
+	if (due != 0)
+		its.it_value.tv_sec = MAX(due - now, 1);			/* 0 would disarm it */
+	if (timerfd_settime(port_worker_fd, 0, &its, NULL) < 0)
+		syslog(LOG_ERR, "port_worker.c: port_worker_arm(): timerfd_settime() error: %s", strerror(errno));
+}
+
+/*
+	Location: port_worker.c
+	This is for a child process: port_worker_fd and the workers are the parent's.
+*/
+void port_worker_child(void)
+{
+	extern int port_worker_fd;
+
+	if (port_worker_fd >= 0)
+		close(port_worker_fd);
+	port_worker_fd = -1;
+	nport_workers = 0;										/* the workers are not our children */
+}
+
+/*
+	Location: port_worker.c
+	This is to forget a worker.
+*/
+static void port_worker_free(struct port_worker_t *w)
+{
+	free(w->device);
+	free(w->settings);
+	w->device = NULL;
+	w->settings = NULL;
+}
+
+/*
+	Location: port_worker.c
+	This is to tell whether a port was changed since its worker started, or now wants another kind.
+	returns 1 if it was, 0 otherwise.
+*/
+static int port_worker_stale(struct port_worker_t *w, SERIAL_INFO *port)
+{
+	struct port_worker_kind_t *kind;
+	char *settings;
+	int stale;
+
+	kind = port_worker_kind(port);
+	if (kind != w->kind)
+		return(1);
+	settings = port_worker_settings(kind, port);
+	stale = (settings == NULL) || (strcmp(settings, w->settings) != 0);
+	free(settings);
+	return(stale);
+}
+
+/*
+	Location: port_worker.c
+	This is to run a worker for each port of our shard which wants one, and no other: the workers of
+	the ports which are gone or changed are stopped, new ones are started, and the ones which died are
+	started again. It is called whenever the ports may have changed, whenever a signal came in (a
+	worker may have died), and when port_worker_fd is readable.
+*/
+void port_worker_sync(struct config_t *conf)
+{
+	extern int port_worker_fd;
+	struct port_worker_kind_t *kind;
+	struct port_worker_t *w;
+	SERIAL_INFO *port;
+	unsigned long long expirations;
+	sigset_t sigchld;
+	sigset_t saved;
+	int i, j;
+
+	if ((port_worker_fd >= 0) && (read(port_worker_fd, &expirations, sizeof(expirations)) < 0))
+		;													/* EAGAIN: we were called for something else */
+	sigemptyset(&sigchld);
+	sigaddset(&sigchld, SIGCLD);
+	sigprocmask(SIG_BLOCK, &sigchld, &saved);				/* port_worker_wait() must not see the table move */
+	/* the workers which died, or whose port is gone or changed: they are forgotten once they are gone */
+	for (j = 0; j < nport_workers; j++) {
+		w = &port_workers[j];
+		port_worker_reap(w);
+		port = port_lookup_device(&conf->ports, w->device);
+		if ((port == NULL) || port_worker_stale(w, port)) {
+			port_worker_halt(w);
+			if (w->pid == 0)
+				port_worker_free(w);
+		}
+	}
+	for (i = j = 0; j < nport_workers; j++) {
+		if (port_workers[j].device != NULL)
+			port_workers[i++] = port_workers[j];
+	}
+	nport_workers = i;
+	/* start what is missing */
+	for (i = 0; i < conf->ports.nslots; i++) {
+		port = port_registry_at(&conf->ports, i);
+		kind = port_worker_kind(port);
+		if ((kind == NULL) || (! shard_owns(port)))
+			continue;
+		for (j = 0; j < nport_workers; j++) {
+			if (strcmp(port_workers[j].device, port->device) == 0)
+				break;
+		}
+		if (j == nport_workers) {
+			w = realloc(port_workers, (nport_workers + 1) * sizeof(struct port_worker_t));
+			if (w == NULL)
+				continue;
+			port_workers = w;
+			w = &port_workers[nport_workers];
+			memset(w, 0, sizeof(struct port_worker_t));
+			w->device = strdup(port->device);
+			w->kind = kind;
+			w->settings = port_worker_settings(kind, port);
+			if ((w->device == NULL) || (w->settings == NULL)) {
+				port_worker_free(w);
+				continue;
+			}
+			nport_workers++;
+		}
+		w = &port_workers[j];
+		if ((w->pid == 0) && (time(NULL) - w->started >= PORT_WORKER_RESPAWN_DELAY))
+			port_worker_start(conf, port, w);
+	}
+	sigprocmask(SIG_SETMASK, &saved, NULL);
+	port_worker_arm();
+}
+
+/*
+	Location: port_worker.c
+	This is to stop every worker, eg. before a new binary takes over: it starts its own, so this one
+	waits for them to release their ports (serial_cleanup() takes a second).
+*/
+void port_worker_stop_all(void)
+{
+	int i, j;
+
+	for (j = 0; j < nport_workers; j++)
+		port_worker_halt(&port_workers[j]);						/* all of them at once */
+	for (j = 0; j < nport_workers; j++) {
+		for (i = 0; (i < 150) && (port_workers[j].pid > 0) && (! port_worker_reap(&port_workers[j])); i++)
+			msleep(20000);
+		port_workers[j].pid = 0;
+		port_workers[j].stopping = 0;
+	}
+	port_worker_arm();
+}
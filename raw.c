@@ -85,7 +85,6 @@ ssize_t serialip_send(int sockfd, void *buff, size_t bufflen)
 	returns 0 on success, 1 on failure (including EOF)	*/
 int raw_TCP_socket_to_serial(int sockfd, int serial_file_descriptor, void* buff, size_t bufflen)
 {
-	extern int useconds;			/* i/o wait time */
 	int n, i;
 	int size = 0;
 	int numbytes;
@@ -101,10 +100,6 @@ int raw_TCP_socket_to_serial(int sockfd, int serial_file_descriptor, void* buff,
 	bzero(&op_pdu_recv, sizeof(op_pdu_recv));
 #endif
 
-	/* wait a bit before reading the socket */
-	if (useconds > 0) {
-		msleep(useconds);
-	}
 	syslog(LOG_INFO, "raw.c: raw_TCP_socket_to_serial(): reading.....!");
 #if 0
 	n = read_from_raw_tcp_buffer(sockfd, (void *) &op_pdu_recv.message, sizeof(op_pdu_recv));
@@ -157,7 +152,6 @@ int raw_TCP_socket_to_serial(int sockfd, int serial_file_descriptor, void* buff,
 	/*----Change Log on 18.09.2015 (next line)*/
 	//numbytes = write(serial_file_descriptor, command, sizeof(command));
 	numbytes = write(serial_file_descriptor, raw_buffer, n+1);
-	msleep(250000);
 	if(numbytes < 0)
 	{
 		error = 1;
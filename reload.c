@@ -0,0 +1,346 @@
+/*
+ * reload.c
+ *	This is to reload serial_ip.conf without disturbing the sessions which are running.
+ *	SIGHUP only raises reload_pending. The reload itself runs later from the accept loop of the
+ *	parent, or from the session loop when the parent serves the session itself (iterative server,
+ *	raw TCP gateway): serial_ip.conf is parsed into a fresh config_t (a snapshot nobody else sees),
+ *	and the live configuration is only touched once the snapshot has been read and checked and
+ *	the live registry has made room for what the snapshot adds.
+ *	Ports are compared one by one: new ports are added, removed ports are dropped and changed
+ *	ports get their new settings in place, so ports which did not change are left alone.
+ *	A bad serial_ip.conf, or one the registry has no room for, leaves the running configuration
+ *	as it was.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+volatile sig_atomic_t reload_pending = 0;		/* set by SIGHUP */
+int reload_deferred = 0;						/* a port could not be removed during its session */
+unsigned long config_generation = 0;			/* incremented by every successful reload */
+
+/*
+	Location: reload.c
+	This is to compare two optional strings.
+	returns 1 if they differ, 0 otherwise.
+*/
+static int reload_string_changed(const char *a, const char *b)
+{
+	if ((a == NULL) || (b == NULL))
+		return(a != b);
+	return(strcmp(a, b) != 0);
+}
+
+/*
+	Location: reload.c
+	This is to check whether the line settings (termios) of a port changed.
+	returns 1 if they did, 0 otherwise.
+*/
+static int reload_port_line_changed(SERIAL_INFO *live, SERIAL_INFO *want)
+{
+	return((live->speed != want->speed) ||
+		(live->databits != want->databits) ||
+		(live->parity != want->parity) ||
+		(live->stopbits != want->stopbits) ||
+		(live->flowcontrol != want->flowcontrol));
+}
+
+/*
+	Location: reload.c
+	This is to check whether the line settings (termios), the flush settings, the scheduling, the
+	protocol, the socket profile or the datagram transport of a port changed.
+	returns 1 if they did, 0 otherwise.
+*/
+static int reload_port_settings_changed(SERIAL_INFO *live, SERIAL_INFO *want)
+{
+	return(reload_port_line_changed(live, want) ||
+		(live->conn_flush != want->conn_flush) ||
+		(live->disc_flush != want->disc_flush) ||
+		(memcmp(&live->sched, &want->sched, sizeof(struct port_sched_t)) != 0) ||
+		(live->protocol != want->protocol) ||
+		(live->socket_profile != want->socket_profile) ||
+		(live->udp_port != want->udp_port) ||
+		(live->udp_sequence != want->udp_sequence) ||
+		reload_string_changed(live->udp_peers, want->udp_peers) ||
+		(live->multicast_ttl != want->multicast_ttl) ||
+		(live->share_port != want->share_port) ||
+		(live->share_writer != want->share_writer) ||
+		(live->capture_size != want->capture_size) ||
+		(live->capture_replay_bytes != want->capture_replay_bytes) ||
+		(live->capture_replay_seconds != want->capture_replay_seconds) ||
+		(live->shm_size != want->shm_size) ||
+		reload_string_changed(live->shm_ring, want->shm_ring) ||
+		reload_string_changed(live->listen_socket, want->listen_socket) ||
+		reload_string_changed(live->socket_users, want->socket_users) ||
+		reload_string_changed(live->multicast_group, want->multicast_group) ||
+		reload_string_changed(live->description, want->description));
+}
+
+/*
+	Location: reload.c
+	This is to copy the settings of a port from the snapshot into the live port. Strings are exchanged,
+	not copied, and the pool name is taken over: the live registry has room for its key (see
+	reload_ports()), so nothing is allocated here. The listen port is set later, once every port has
+	released its old one.
+	returns 0 on success, 1 on failure.
+*/
+static int reload_port_apply(PORT_REGISTRY *ports, SERIAL_INFO *live, SERIAL_INFO *want)
+{
+	char *description;
+	char *udp_peers;
+	char *multicast_group;
+	char *shm_ring;
+	char *listen_socket;
+	char *socket_users;
+	char *pool;
+
+	if (reload_port_line_changed(live, want))
+		port_bringup_release(live);							/* bring it up again with the new settings */
+	live->speed = want->speed;
+	live->databits = want->databits;
+	live->parity = want->parity;
+	live->stopbits = want->stopbits;
+	live->flowcontrol = want->flowcontrol;
+	live->conn_flush = want->conn_flush;
+	live->disc_flush = want->disc_flush;
+	live->sched = want->sched;								/* applies from the next session on */
+	live->protocol = want->protocol;						/* likewise */
+	live->socket_profile = want->socket_profile;			/* likewise */
+	live->udp_port = want->udp_port;						/* port_worker_sync() restarts its worker */
+	live->udp_sequence = want->udp_sequence;
+	udp_peers = live->udp_peers;
+	live->udp_peers = want->udp_peers;
+	want->udp_peers = udp_peers;
+	live->multicast_ttl = want->multicast_ttl;
+	multicast_group = live->multicast_group;
+	live->multicast_group = want->multicast_group;
+	want->multicast_group = multicast_group;
+	live->share_port = want->share_port;
+	live->share_writer = want->share_writer;
+	live->capture_size = want->capture_size;				/* capture_watch() resizes the ring */
+	live->capture_replay_bytes = want->capture_replay_bytes;
+	live->capture_replay_seconds = want->capture_replay_seconds;
+	live->shm_size = want->shm_size;
+	shm_ring = live->shm_ring;
+	live->shm_ring = want->shm_ring;
+	want->shm_ring = shm_ring;
+	listen_socket = live->listen_socket;					/* port_listener_sync() moves the listener */
+	live->listen_socket = want->listen_socket;
+	want->listen_socket = listen_socket;
+	socket_users = live->socket_users;
+	live->socket_users = want->socket_users;
+	want->socket_users = socket_users;
+	live->hotplug = 0;										/* serial_ip.conf owns it from now on */
+	description = live->description;						/* take over the snapshot description */
+	live->description = want->description;
+	want->description = description;
+	if (! reload_string_changed(live->pool, want->pool))
+		return(0);
+	pool = want->pool;										/* the snapshot registry only frees it */
+	want->pool = NULL;
+	return(port_registry_take_pool(ports, live, pool));
+}
+
+/*
+	Location: reload.c
+	This is to bring the live port registry in line with the snapshot.
+	Everything which may fail is done first: the registry makes room for the new ports and for the
+	keys of the listen ports and pools, and the new ports are registered. If that fails, the ports
+	registered so far are removed again and the live registry is as it was. The port of a session
+	this process serves itself (iterative server, raw TCP gateway) is not removed under it: the
+	removal waits for the reload the accept loop runs once the session is over.
+	returns 0 on success, 1 if the live registry was left unchanged.
+*/
+static int reload_ports(struct config_t *live, struct config_t *snapshot)
+{
+	extern SERIAL_INFO *si;
+	extern int reload_deferred;
+	SERIAL_INFO **added;
+	SERIAL_INFO *port;
+	SERIAL_INFO *want;
+	int nadded = 0;
+	int nnew = 0;
+	int changed = 0;
+	int removed = 0;
+	int error = 0;
+	int i, j;
+
+	/*	make room for everything first, then register the new ports */
+	for (i = 0; i < snapshot->ports.nslots; i++) {
+		want = port_registry_at(&snapshot->ports, i);
+		if ((want != NULL) && (port_lookup_device(&live->ports, want->device) == NULL))
+			nnew++;
+	}
+	added = calloc(nnew + 1, sizeof(SERIAL_INFO *));
+	if ((added == NULL) ||
+		(port_registry_reserve(&live->ports, nnew, 2 * snapshot->ports.nports + live->ports.nports) != 0)) {
+		syslog(LOG_ERR, "reload.c: reload_ports(): cannot make room for %d new port(s)", nnew);
+		if (added != NULL)
+			free(added);
+		return(1);
+	}
+	for (i = 0; i < snapshot->ports.nslots; i++) {
+		want = port_registry_at(&snapshot->ports, i);
+		if ((want == NULL) || (port_lookup_device(&live->ports, want->device) != NULL))
+			continue;
+		port = add_serial_port_info(live, want->device);
+		if (port == NULL) {
+			while (nadded > 0)								/* take them out again */
+				port_registry_remove(&live->ports, added[--nadded]);
+			free(added);
+			return(1);
+		}
+		added[nadded++] = port;
+	}
+
+	/*	from here on nothing fails. drop the ports which are gone from serial_ip.conf.
+		Hotplug ports stay until they are unplugged. */
+	for (i = 0; i < live->ports.nslots; i++) {
+		port = port_registry_at(&live->ports, i);
+		if ((port == NULL) || port->hotplug)
+			continue;
+		if (port_lookup_device(&snapshot->ports, port->device) == NULL) {
+			if (port == si) {
+				syslog(LOG_INFO, "reload.c: reload_ports(): serial device %s is removed when its session ends", port->device);
+				reload_deferred = 1;
+				continue;
+			}
+			syslog(LOG_INFO, "reload.c: reload_ports(): removing serial device %s", port->device);
+			port_registry_remove(&live->ports, port);
+			removed++;
+		}
+	}
+	/*	set up the new ports, update changed ones, and release the listen ports which move */
+	for (i = 0, j = 0; i < snapshot->ports.nslots; i++) {
+		want = port_registry_at(&snapshot->ports, i);
+		if (want == NULL)
+			continue;
+		port = port_lookup_device(&live->ports, want->device);
+		if ((j < nadded) && (port == added[j])) {				/* in the order they were registered */
+			j++;
+			syslog(LOG_INFO, "reload.c: reload_ports(): adding serial device %s", want->device);
+		} else if (reload_port_settings_changed(port, want) || (port->listen_port != want->listen_port) ||
+				reload_string_changed(port->pool, want->pool) || port->hotplug) {
+			syslog(LOG_INFO, "reload.c: reload_ports(): updating serial device %s", want->device);
+			changed++;
+		} else {
+			continue;										/* unchanged: leave it alone */
+		}
+		error |= reload_port_apply(&live->ports, port, want);
+		if (port->listen_port != want->listen_port)
+			error |= port_registry_set_listen_port(&live->ports, port, 0);
+	}
+	/*	now every moving listen port is free, give them to their new owners */
+	for (i = 0; i < snapshot->ports.nslots; i++) {
+		want = port_registry_at(&snapshot->ports, i);
+		if (want == NULL)
+			continue;
+		port = port_lookup_device(&live->ports, want->device);
+		if (port->listen_port != want->listen_port)
+			error |= port_registry_set_listen_port(&live->ports, port, want->listen_port);
+	}
+	if (error)
+		syslog(LOG_ERR, "reload.c: reload_ports(): the registry could not take every listen port or pool");
+	syslog(LOG_INFO, "reload.c: reload_ports(): %d port(s) added, %d changed, %d removed, %d unchanged",
+			nadded, changed, removed, live->ports.nports - nadded - changed);
+	free(added);
+	return(0);
+}
+
+/*
+	Location: reload.c
+	This is to exchange a string item of the live configuration with the one of the snapshot.
+	The old value ends up in the snapshot and is freed with it.
+*/
+static void reload_swap_string(char **live, char **snapshot)
+{
+	char *tmp;
+
+	tmp = *live;
+	*live = *snapshot;
+	*snapshot = tmp;
+}
+
+/*
+	Location: reload.c
+	This is to reload serial_ip.conf. It must be called from the accept loop or the session loop of the
+	parent, never from a signal handler.
+	returns 0 on success, 1 if the new serial_ip.conf was rejected and the old configuration is kept.
+*/
+int reload_configuration(void)
+{
+	extern struct config_t conf;
+	extern char *config_file;
+	extern volatile sig_atomic_t reload_pending;
+	extern int reload_deferred;
+	extern unsigned long config_generation;
+	struct config_t snapshot;
+	SERIAL_INFO defaults;
+	char **patterns;
+	int npatterns;
+
+	reload_pending = 0;
+	reload_deferred = 0;
+	syslog(LOG_INFO, "reload.c: reload_configuration(): reloading %s", config_file);
+	config_init(&snapshot);
+	if ((read_configuration_file(config_file, &snapshot) != 0) || (sane_config(&snapshot) != 0)) {
+		syslog(LOG_ERR, "reload.c: reload_configuration(): %s rejected, keeping the running configuration", config_file);
+		config_free(&snapshot);
+		return(1);
+	}
+	/*	these are only used when we start up, a change needs a restart */
+	if (reload_string_changed(conf.server_type, snapshot.server_type) ||
+		reload_string_changed(conf.pidfile, snapshot.pidfile) ||
+		reload_string_changed(conf.directory, snapshot.directory) ||
+		reload_string_changed(conf.user, snapshot.user) ||
+		reload_string_changed(conf.group, snapshot.group) ||
+		reload_string_changed(conf.io_engine, snapshot.io_engine) ||
+		(conf.reactor_shards != snapshot.reactor_shards) ||
+		(conf.pin_shards != snapshot.pin_shards) ||
+		(conf.deterministic_memory != snapshot.deterministic_memory))
+		syslog(LOG_WARNING, "reload.c: reload_configuration(): server type, pid file, directory, user, group, io engine, shard and deterministic memory changes need a restart");
+
+	if (reload_ports(&conf, &snapshot) != 0) {
+		syslog(LOG_ERR, "reload.c: reload_configuration(): %s not applied, keeping the running configuration", config_file);
+		config_free(&snapshot);
+		return(1);
+	}
+
+	/*	the global settings are plain values, we just take the new ones */
+	conf.timeout = snapshot.timeout;
+	conf.debuglevel = snapshot.debuglevel;
+	conf.ms_pollinterval = snapshot.ms_pollinterval;
+	conf.ls_pollinterval = snapshot.ls_pollinterval;
+	conf.reply_purge_data = snapshot.reply_purge_data;
+	conf.idletimer = snapshot.idletimer;
+	conf.send_logout = snapshot.send_logout;
+	conf.serial_thread = snapshot.serial_thread;
+	conf.mux_port = snapshot.mux_port;						/* port_listener_sync() moves the listener */
+	conf.bringup_workers = snapshot.bringup_workers;
+	reload_swap_string(&conf.tmpdir, &snapshot.tmpdir);
+	reload_swap_string(&conf.debuglog, &snapshot.debuglog);
+	reload_swap_string(&conf.lockdir, &snapshot.lockdir);
+	reload_swap_string(&conf.locktemplate, &snapshot.locktemplate);
+	defaults = conf.port_defaults;
+	conf.port_defaults = snapshot.port_defaults;
+	snapshot.port_defaults = defaults;
+	patterns = conf.hotplug_patterns;
+	npatterns = conf.nhotplug;
+	conf.hotplug_patterns = snapshot.hotplug_patterns;
+	conf.nhotplug = snapshot.nhotplug;
+	snapshot.hotplug_patterns = patterns;
+	snapshot.nhotplug = npatterns;
+	config_free(&snapshot);									/* frees whatever was replaced */
+
+	hotplug_init(&conf);									/* the hotplug patterns may have changed */
+	port_bringup_init(conf.bringup_workers);
+	port_bringup_start(&conf);								/* new and changed ports */
+	port_listener_sync(&conf);								/* listen ports may have moved */
+	port_worker_sync(&conf);									/* and so may port workers */
+	session_arena_refresh(&conf);							/* signatures of the new and changed ports */
+	config_generation++;
+	syslog(LOG_INFO, "reload.c: reload_configuration(): configuration generation %lu, %d port(s)",
+			config_generation, conf.ports.nports);
+	return(0);
+}
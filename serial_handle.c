@@ -10,13 +10,36 @@
 
 #include "serial_ip.h"
 
+#include <poll.h>
+
+/*
+	Location: serial_handle.c
+	This is to put the settings of a device back as a session or a worker is done with it: the ones
+	found on it (old_setting), or, if the daemon holds it open (see port_bringup.c), the settings the
+	daemon configured and the blocking mode it keeps it in. fd is then a dup() of the fd of the
+	parent, with the same file flags, and the parent reads the idle device (see capture.c).
+*/
+void serial_port_restore(SERIAL_INFO *sabre_serial_port, int fd, struct termios *old_setting)
+{
+	int flags;
+
+	if ((sabre_serial_port->state != PORT_READY) || (sabre_serial_port->fd < 0) || (sabre_serial_port->fd == fd)) {
+		tcsetattr(fd, TCSADRAIN, old_setting);
+		return;
+	}
+	tcsetattr(fd, TCSADRAIN, &(sabre_serial_port->new_termios));
+	flags = fcntl(fd, F_GETFL, 0);
+	if (flags != -1)
+		fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+}
+
 /*
 	Location: serial_handle.c
 	this function:
 	- puts the modem device back to non-blocking mode
 	- hangs up the modem by setting the speed to B0
 	- (optionally) flushes the modem device
-	- restores the previous modem line termios settings
+	- restores the previous modem line termios settings, or the daemon's (see serial_port_restore())
 	- closes the modem device file
 	- releases the modem back to the pool
 	- closes the debug log
@@ -69,8 +92,8 @@ void serial_cleanup(SERIAL_INFO *sabre_serial_port, int *serial_file_descriptor,
 #ifdef USE_TERMIOX
 	ioctl(*fd,TCSETXW,&(oldterm->tx));
 #endif
-	/* restore the old termios settings */
-	tcsetattr(*serial_file_descriptor, TCSADRAIN, &old_setting);
+	/* restore the old termios settings, or the ones the daemon holds the device with */
+	serial_port_restore(sabre_serial_port, *serial_file_descriptor, &old_setting);
 	/* close the serial device file */
 	close(*serial_file_descriptor);
 	*serial_file_descriptor = -1;
@@ -350,137 +373,230 @@ int release_serial_port(SERIAL_INFO *serial_port)
 }
 */
 
+/*
+	Location: serial_handle.c
+	This is to try to lock one serial port for our process.
+	returns 0 if we got the lock, 1 otherwise.
+*/
+static int try_lock_serial_port(SERIAL_INFO *serial_port, pid_t pid)
+{
+	char *device_lockfile;
+
+	syslog(LOG_DEBUG, "serial_handle.c: select_serial_port(): serial port will be assigned %s", serial_port->device);
+	device_lockfile = create_uucp_lockfile(serial_port->device, pid);
+	if (device_lockfile == NULL) {
+		syslog(LOG_DEBUG, "serial_handle.c: select_serial_port(): serial port %s is busy", serial_port->device);
+		serial_port->busy = 1;
+		return(1);
+	}
+	if (serial_port->lockfile != NULL)
+		free(serial_port->lockfile);
+	serial_port->lockfile = strdup(device_lockfile);
+	serial_port->busy = 0;
+	syslog(LOG_DEBUG, "serial_handle.c: select_serial_port(): serial port is assigned %s", serial_port->device);
+	return(0);
+}
+
 /*
 	Location: serial_handle.c
 	This function is to select a serial port from available serial ports.
-	In case of Sabre Lite, just 1 port used.
+	bound is the port of the listen port or listen socket the client connected to. If that port
+	belongs to a pool, the other ports of the pool are tried in turn (hunt group).
+	Without a bound port (the main listening socket), every registered port is tried: those of our
+	shard first, whose devices we hold open, then those of the other shards, which the kernel may not
+	have given a connection to when they had a free port; the uucp lock keeps two shards off one port.
+	A port of another shard which captures is left to it: its shard reads the device while it sees it
+	idle (see capture.c).
 	returns a SERIAL_INFO ptr on success, NULL on failure.
 	After running this function, we can use serial port on sabre with device file descriptor and 1 process
 	takes control of this port!
 */
-SERIAL_INFO *select_serial_port(struct config_t *conf)
+SERIAL_INFO *select_serial_port(struct config_t *conf, SERIAL_INFO *bound)
 {
-	int nbusy;
+	extern int shard_count;
 	SERIAL_INFO *sabre_serial_port;
-	int r;
-	char *device_lockfile;
+	SERIAL_INFO *p;
 	pid_t pid;
-	time_t seconds;
+	int own;
+	int r;
 
 	pid = getpid();									/* get our process id */
-	syslog(LOG_DEBUG,"serial_handle.c: select_serial_port(): process's pid %d", pid);
-	sabre_serial_port = NULL;						/* init return value */
-	/*	clear the busy flag on all available serial ports. */
-	for (r = 0; r < conf->number_ports; r++) {
-		conf->serial_port[r]->busy = 0;
+	syslog(LOG_DEBUG,"serial_handle.c: select_serial_port(): process's pid %d, bound to %s", pid, (bound != NULL) ? bound->device : "no port");
+
+	sabre_serial_port = bound;
+	if (sabre_serial_port != NULL) {
+		if (sabre_serial_port->pool == NULL)
+			return((try_lock_serial_port(sabre_serial_port, pid) == 0) ? sabre_serial_port : NULL);
+		/* hunt through the pool of the port */
+		for (p = port_lookup_pool(&conf->ports, sabre_serial_port->pool); p != NULL; p = port_pool_next(&conf->ports, p)) {
+			if (try_lock_serial_port(p, pid) == 0)
+				return(p);
+		}
+		return(NULL);
 	}
-	nbusy = 0;
-	/*	seed the random number generator. */
-	seconds = time((time_t *) NULL);
-	srand(seconds);
-	/*	choose a port randomly, until we can lock one or we've tried them all. */
-	while (nbusy < conf->number_ports) {
-		/*	generate a random integer between 0 and conf->number_ports.
-		r = (int) (rand() / ((RAND_MAX / conf->number_ports) + 1));	*/
-		/*	Sabre just needs 1 port.	*/
-		r = 0;
-		syslog(LOG_DEBUG, "serial_handle.c: select_serial_port(): random modem index: %d", r);
-		syslog(LOG_DEBUG, "serial_handle.c: select_serial_port(): number of available port: %d, r is: %d", conf->number_ports, r);
-		if ((r >= 0) && (r < conf->number_ports)) {
-			/* skip this one if we've tried it already */
-			if (conf->serial_port[r]->busy) continue;
-			syslog(LOG_DEBUG, "serial_handle.c: select_serial_port(): serial port will be assigned %s", conf->serial_port[r]->device);
-			/* try to lock serial port. */
-			device_lockfile = create_uucp_lockfile(conf->serial_port[r]->device, pid);
-			syslog(LOG_DEBUG, "serial_handle.c: select_serial_port(): checking device_lockfile...");
-			if (device_lockfile != NULL) {
-				conf->serial_port[r]->lockfile = strdup(device_lockfile);
-				sabre_serial_port = conf->serial_port[r];
-				syslog(LOG_DEBUG, "serial_handle.c: select_serial_port(): serial port is assigned %s", sabre_serial_port->device);
-				break;
-			} else {
-				syslog(LOG_DEBUG, "serial_handle.c: select_serial_port(): serial port is assigned - failed");
-				conf->serial_port[r]->busy = 1;
-				nbusy++;
-			}
+	/* no port is bound to this listener, try all of them */
+	syslog(LOG_DEBUG, "serial_handle.c: select_serial_port(): number of available port: %d", conf->ports.nports);
+	for (own = 1; own >= 0; own--) {
+		for (r = 0; r < conf->ports.nslots; r++) {
+			p = port_registry_at(&conf->ports, r);
+			if ((p == NULL) || (shard_owns(p) != own) || ((! own) && (p->capture_size > 0)))
+				continue;
+			if (try_lock_serial_port(p, pid) == 0)
+				return(p);
 		}
+		if (shard_count <= 1)
+			break;										/* we own them all */
 	}
-	return(sabre_serial_port);
+	return(NULL);
 }
 
 /*
 	Location: serial_handle.c
 	This function is to:
-	- selects a serial port from available serial ports on board
-    - opens the serial device in non-blocking mode
-	- saves the serial line's original termios settings
-	- configures the serial line's termios settings for raw i/o
-    - puts the serial device into blocking mode again
-	- (optionally) flushes the serial port.
-	- opens a debug log, named for the selected serial port
-	on success, we return a SERIAL_INFO ptr for the selected serial port,
-	plus the file descriptor returned by open(), the original termios
-	settings, and the new termios settings.
-	on failure, a NULL ptr is returned.
+    - open the serial device in non-blocking mode
+	- save the serial line's original termios settings
+	- configure the serial line's termios settings for raw i/o
+    - put the serial device into blocking mode again
+	- (optionally) flush the serial port.
+	It only reads the settings of the SERIAL_INFO, so the bring-up workers can use it on a private copy.
+	returns 0 on success with the fd and both termios settings filled in, 1 on failure.
 */
-SERIAL_INFO *serial_port_init(int *fd, struct termios old_setting, struct termios new_setting)
+int serial_port_open(SERIAL_INFO *sabre_serial_port, int *fd, struct termios *old_setting, struct termios *new_setting)
 {
 	extern int errno;
-	extern char *program_name;							/* our program name */
-	extern char *version;								/* version string */
-	extern struct config_t conf;						/* built from config file */
-	char log[PATH_MAX];									/* name of debug log */
-	SERIAL_INFO *sabre_serial_port;
 	int flags;
 	int ret;
 
-	/* allocate a serial port. */
-	sabre_serial_port = select_serial_port(&conf);
-	if (sabre_serial_port == NULL)
-	{
-		syslog(LOG_ERR,"serial_handle.c: serial_port_init(): unable to allocate a serial port");
-		return(sabre_serial_port);
-	} else {
-		syslog(LOG_INFO,"serial_handle.c: serial_port_init(): using serial port %s", sabre_serial_port->device);
-	}
-
 	/* open the serial port */
 	*fd = open(sabre_serial_port->device, O_RDWR|O_NOCTTY|O_NDELAY);
 	if (*fd < 0) {
-		syslog(LOG_ERR, "serial_handle.c: serial_port_init(): open(%s,...) error: %s", sabre_serial_port->device, strerror(errno));
-		release_serial_port(sabre_serial_port);
-		return(NULL);
+		syslog(LOG_ERR, "serial_handle.c: serial_port_open(): open(%s,...) error: %s", sabre_serial_port->device, strerror(errno));
+		return(1);
 	}else
-		syslog(LOG_INFO, "serial_handle.c: serial_port_init(): open(%s,...) status: ok!", sabre_serial_port->device);
+		syslog(LOG_INFO, "serial_handle.c: serial_port_open(): open(%s,...) status: ok!", sabre_serial_port->device);
 	/* configure the termios settings */
-	ret = serial_init_termios(sabre_serial_port,fd, old_setting, new_setting);
+	ret = serial_init_termios(sabre_serial_port, fd, old_setting, new_setting);
 	if (ret != 0) {
 		close(*fd);
-		release_serial_port(sabre_serial_port);
-		return(NULL);
+		*fd = -1;
+		return(1);
 	}else
-		syslog(LOG_INFO, "serial_handle.c: serial_port_init(): init(%s,...) status: ok!", sabre_serial_port->device);
+		syslog(LOG_INFO, "serial_handle.c: serial_port_open(): init(%s,...) status: ok!", sabre_serial_port->device);
 	/* put the serial port device file back to blocking mode */
 	flags = fcntl(*fd, F_GETFL, 0);
 	if (flags != -1) {
 		flags &= ~O_NONBLOCK;
 		flags = fcntl(*fd, F_SETFL, flags);
-		syslog(LOG_INFO, "serial_handle.c: serial_port_init(): Set blocking mode for (%s,...) status: ok!", sabre_serial_port->device);
+		syslog(LOG_INFO, "serial_handle.c: serial_port_open(): Set blocking mode for (%s,...) status: ok!", sabre_serial_port->device);
 	}
 	if (flags == -1) {
-		syslog(LOG_ERR, "serial_handle.c: serial_port_init(): warning: cannot remove O_NONBLOCK from modem device %s (%s)",
+		syslog(LOG_ERR, "serial_handle.c: serial_port_open(): warning: cannot remove O_NONBLOCK from modem device %s (%s)",
 				sabre_serial_port->device, strerror(errno));
 	}
 	/* flush the serial port (both input and output) */
 	if (sabre_serial_port->conn_flush) {
 		ret = tcflush(*fd,TCIOFLUSH);
 		if (ret != 0) {
-			syslog(LOG_ERR, "serial_handle.c: serial_port_init(): warning: cannot flush serial device %s (%s)",
+			syslog(LOG_ERR, "serial_handle.c: serial_port_open(): warning: cannot flush serial device %s (%s)",
 					sabre_serial_port->device, strerror(errno));
 		} else {
-			syslog(LOG_INFO, "serial_handle.c: serial_port_init(): flushed serial device %s", sabre_serial_port->device);
+			syslog(LOG_INFO, "serial_handle.c: serial_port_open(): flushed serial device %s", sabre_serial_port->device);
 		}
 	}
+	return(0);
+}
+
+/*
+	Location: serial_handle.c
+	This is to take the device of a serial port we hold the lock of: the one the daemon holds open for
+	it (see port_bringup.c), or opened and configured now if its bring-up did not succeed.
+	The lock is released on failure.
+	returns 0 on success with the fd and both termios settings filled in, 1 on failure.
+*/
+static int serial_port_take(SERIAL_INFO *sabre_serial_port, int *fd, struct termios *old_setting, struct termios *new_setting)
+{
+	int flags;
+
+	if ((sabre_serial_port->state == PORT_READY) && ((*fd = dup(sabre_serial_port->fd)) >= 0)) {
+		/* the device is open and configured already, put our settings back on in case a previous session changed them */
+		*old_setting = sabre_serial_port->old_termios;
+		*new_setting = sabre_serial_port->new_termios;
+		tcsetattr(*fd, TCSANOW, new_setting);
+		flags = fcntl(*fd, F_GETFL, 0);
+		if (flags != -1)
+			fcntl(*fd, F_SETFL, flags & ~O_NONBLOCK);
+		capture_take(sabre_serial_port, *fd);				/* what the parent did not capture yet, before the flush */
+		if (sabre_serial_port->conn_flush)
+			tcflush(*fd, TCIOFLUSH);
+		syslog(LOG_INFO, "serial_handle.c: serial_port_take(): using the open device %s", sabre_serial_port->device);
+	} else if (serial_port_open(sabre_serial_port, fd, old_setting, new_setting) != 0) {
+		release_serial_port(sabre_serial_port);
+		return(1);
+	} else {
+		sabre_serial_port->old_termios = *old_setting;		/* kept for an upgrade, see upgrade.c */
+		sabre_serial_port->new_termios = *new_setting;
+	}
+	return(0);
+}
+
+/*
+	Location: serial_handle.c
+	This is to lock the serial port of a device by name and take its device, for a channel of a
+	multiplexed connection (see mux.c). Unlike serial_port_init(), the debug log is left alone: the
+	channels of a connection share it.
+	returns a SERIAL_INFO ptr on success with the fd and both termios settings filled in, NULL on failure.
+*/
+SERIAL_INFO *serial_port_claim(struct config_t *conf, const char *device, int *fd, struct termios *old_setting, struct termios *new_setting)
+{
+	SERIAL_INFO *sabre_serial_port;
+
+	sabre_serial_port = port_lookup_device(&conf->ports, device);
+	if (sabre_serial_port == NULL) {
+		syslog(LOG_ERR, "serial_handle.c: serial_port_claim(): no serial port %s", device);
+		return(NULL);
+	}
+	if (try_lock_serial_port(sabre_serial_port, getpid()) != 0)
+		return(NULL);
+	if (serial_port_take(sabre_serial_port, fd, old_setting, new_setting) != 0)
+		return(NULL);
+	syslog(LOG_INFO, "serial_handle.c: serial_port_claim(): using serial port %s", sabre_serial_port->device);
+	return(sabre_serial_port);
+}
+
+/*
+	Location: serial_handle.c
+	This function is to:
+	- selects a serial port from available serial ports on board, starting with bound (see
+	  select_serial_port())
+	- takes the device the daemon holds open for it (see port_bringup.c), or opens and configures
+	  it now if its bring-up did not succeed
+	- opens a debug log, named for the selected serial port
+	on success, we return a SERIAL_INFO ptr for the selected serial port,
+	plus the file descriptor of the device, the original termios
+	settings, and the new termios settings.
+	on failure, a NULL ptr is returned.
+*/
+SERIAL_INFO *serial_port_init(SERIAL_INFO *bound, int *fd, struct termios *old_setting, struct termios *new_setting)
+{
+	extern int errno;
+	extern char *program_name;							/* our program name */
+	extern char *version;								/* version string */
+	extern struct config_t conf;						/* built from config file */
+	char log[PATH_MAX];									/* name of debug log */
+	SERIAL_INFO *sabre_serial_port;
+
+	/* allocate a serial port. */
+	sabre_serial_port = select_serial_port(&conf, bound);
+	if (sabre_serial_port == NULL)
+	{
+		syslog(LOG_ERR,"serial_handle.c: serial_port_init(): unable to allocate a serial port");
+		return(sabre_serial_port);
+	} else {
+		syslog(LOG_INFO,"serial_handle.c: serial_port_init(): using serial port %s", sabre_serial_port->device);
+	}
+
+	if (serial_port_take(sabre_serial_port, fd, old_setting, new_setting) != 0)
+		return(NULL);
 	/* open the debug log */
 	if ((conf.debuglog == NULL) || (*conf.debuglog == '\0') || (strcasecmp(conf.debuglog, "syslog") == 0))
 	{
@@ -495,10 +611,70 @@ SERIAL_INFO *serial_port_init(int *fd, struct termios old_setting, struct termio
 	return(sabre_serial_port);
 }
 
+/*
+	Location: serial_handle.c
+	This is to write what is pending for a serial device which is in non-blocking mode, as much as it
+	takes now, for the port workers (see udp.c, share.c). A device which holds off (CTS, XOFF) is no
+	failure: the rest stays pending, and the worker waits for POLLOUT along with everything else.
+	returns 0 on success, 1 if the device failed.
+*/
+int serial_pending_flush(int fd, SERIAL_PENDING *pending)
+{
+	extern int errno;
+	int n;
+
+	while (pending->len > 0) {
+		n = write(fd, pending->data, pending->len);
+		if (n > 0) {
+			memmove(pending->data, pending->data + n, pending->len - n);
+			pending->len -= n;
+		} else if ((n < 0) && (errno == EINTR)) {
+			continue;
+		} else if ((n < 0) && (errno == EAGAIN)) {
+			break;
+		} else {
+			return(1);
+		}
+	}
+	return(0);
+}
+
+/*
+	Location: serial_handle.c
+	This is to write bytes to a serial device which is in non-blocking mode, after what is pending for
+	it: what it does not take now is left pending. The caller makes sure there is room for them
+	(SERIAL_PENDING_SIZE - pending->len bytes).
+	returns 0 on success, 1 if the device failed.
+*/
+int serial_pending_write(int fd, SERIAL_PENDING *pending, unsigned char *data, int len)
+{
+	extern int errno;
+	int n;
+
+	if (serial_pending_flush(fd, pending) != 0)
+		return(1);
+	while ((pending->len == 0) && (len > 0)) {
+		n = write(fd, data, len);
+		if (n > 0) {
+			data += n;
+			len -= n;
+		} else if ((n < 0) && (errno == EAGAIN)) {
+			break;
+		} else if ((n < 0) && (errno != EINTR)) {
+			return(1);
+		}
+	}
+	if (len > SERIAL_PENDING_SIZE - pending->len)
+		return(1);												/* the caller did not check for room */
+	memcpy(pending->data + pending->len, data, len);
+	pending->len += len;
+	return(0);
+}
+
 /*
 	Location: serial_handler.c
 	This is to free the memory used by a SERIAL_INFO for a specific serial port.
-	We need free() each dynamically allocated element before doing the whole serial port itself.
+	We free() each dynamically allocated element. The SERIAL_INFO itself belongs to the port registry.
 */
 void free_serial_port(SERIAL_INFO *serial_port)
 {
@@ -509,86 +685,73 @@ void free_serial_port(SERIAL_INFO *serial_port)
 		free(serial_port->device);
 	if (serial_port->lockfile != NULL)
 		free(serial_port->lockfile);
-	free(serial_port);
+	if (serial_port->description != NULL)
+		free(serial_port->description);
+	if (serial_port->pool != NULL)
+		free(serial_port->pool);
+	if (serial_port->udp_peers != NULL)
+		free(serial_port->udp_peers);
+	if (serial_port->multicast_group != NULL)
+		free(serial_port->multicast_group);
+	if (serial_port->shm_ring != NULL)
+		free(serial_port->shm_ring);
+	if (serial_port->listen_socket != NULL)
+		free(serial_port->listen_socket);
+	if (serial_port->socket_users != NULL)
+		free(serial_port->socket_users);
+	capture_free(serial_port);
+	serial_port->device = NULL;
+	serial_port->lockfile = NULL;
+	serial_port->description = NULL;
+	serial_port->pool = NULL;
+	serial_port->udp_peers = NULL;
+	serial_port->multicast_group = NULL;
+	serial_port->shm_ring = NULL;
+	serial_port->listen_socket = NULL;
+	serial_port->socket_users = NULL;
 }
 
 /*
 	Location: serial_handle.c
-	This function is to free the memory used by the array of SERIAL_INFO's
+	This function is to free the memory used by all the serial ports in the registry.
 */
-void free_all_serial_ports(SERIAL_INFO *serial_ports[])
+void free_all_serial_ports(PORT_REGISTRY *ports)
 {
-	int i;
-
 	/* sanity checks */
-	if (serial_ports == NULL)
+	if (ports == NULL)
 		return;
 
-	for (i = 0; i < MAX_SPORTS; i++) {
-		free_serial_port(serial_ports[i]);
-	}
+	port_registry_free(ports);
 }
 
 /*	Location: serial_handle.c
-	This function is to add a serial port information to the array of SERIAL_INFO's within the config_t structure
-	returns 0 on success, 1 on failure.	*/
-int add_serial_port_info(struct config_t *conf, char *device_path)
+	This function is to add a serial port information to the port registry within the config_t structure
+	returns a ptr to the new SERIAL_INFO on success, NULL on failure.	*/
+SERIAL_INFO *add_serial_port_info(struct config_t *conf, char *device_path)
 {
-	extern int errno;
 	SERIAL_INFO *new_serial;
-	int i;
 
 	/* sanity checks */
 	if (conf == NULL)
 	{
 		syslog(LOG_ERR,"serial_handle.c: failed add_serial_port_info() %s; Unable to read configuration file", device_path);
-		return(1);
-	}
-	if (device_path == NULL)
-	{
-		syslog(LOG_ERR,"serial_handle.c: failed add_serial_port_info() %s; Unable to get device path", device_path);
-		return(1);
+		return(NULL);
 	}
-	if (*device_path == '\0')
+	if ((device_path == NULL) || (*device_path == '\0'))
 	{
 		syslog(LOG_ERR,"serial_handle.c: failed add_serial_port_info() %s; Unable to get device path", device_path);
-		return(1);
-	}
-	if (conf->number_ports >= MAX_SPORTS) {
-		syslog(LOG_ERR, "serial_handle.c: failed add_serial_port_info() %s; port %d is over max port numbers", device_path, conf->number_ports);
-		return(1);
-	}else
-		syslog(LOG_DEBUG, "serial_handle.c: add_serial_port_info() %s; initialize with %d port(s)", device_path, conf->number_ports);
-
-	new_serial = alloc_serial_port();
-	if (new_serial != NULL) {
-		i = conf->number_ports;
-		conf->serial_port[i] = new_serial;
-		conf->number_ports++;
-		syslog(LOG_DEBUG, "serial_handle.c: add_serial_port_info(): number port is: %d", conf->number_ports);
-		conf->serial_port[i]->device = strdup(device_path);
-		if (conf->serial_port[i]->device == NULL) {
-			syslog(LOG_ERR,"add_serial_port_info(): strdup() error: %s",strerror(errno));
-			return(1);
-		}else
-			syslog(LOG_DEBUG,"serial_handle.c: add_serial_port_info(): device path is: %s", conf->serial_port[i]->device);
+		return(NULL);
 	}
-	return(0);
-}
-
-/*	Location: serial_handle.c
-	This function is to allocate memory for a new serial port.
-	returns a ptr to the new SERIAL_INFO, otherwise NULL for error.	*/
-SERIAL_INFO *alloc_serial_port(void)
-{
-	extern int errno;
-	SERIAL_INFO *new_serial;
+	syslog(LOG_DEBUG, "serial_handle.c: add_serial_port_info() %s; initialize with %d port(s)", device_path, conf->ports.nports);
 
-	new_serial = calloc(1,sizeof(SERIAL_INFO));
-	if (new_serial == NULL)
-		syslog(LOG_ERR,"alloc_serial_port() error: %s",strerror(errno));
-	else
-		syslog(LOG_DEBUG,"serial_handle.c: alloc_serial_port() - Initialize a serial port successful!");
+	new_serial = port_registry_add(&conf->ports, device_path);
+	if (new_serial == NULL) {
+		syslog(LOG_ERR, "serial_handle.c: failed add_serial_port_info() %s", device_path);
+		return(NULL);
+	}
+	port_sched_init(&new_serial->sched);
+	syslog(LOG_DEBUG,"serial_handle.c: add_serial_port_info(): device path is: %s, number port is: %d",
+			new_serial->device, conf->ports.nports);
 	return(new_serial);
 }
 
@@ -602,6 +765,7 @@ int release_serial_port(SERIAL_INFO *sabre_serial_port)
 	if (sabre_serial_port == NULL) return(1);
 	if (sabre_serial_port->device == NULL) return(1);
 
+	capture_release(sabre_serial_port);					/* the parent captures it again */
 	ret = unlock_uucp_lockfile(sabre_serial_port->device);
 	if (sabre_serial_port->lockfile != NULL)
 	{
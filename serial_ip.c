@@ -29,7 +29,6 @@ int Daemon				= 0;
 int signo				= 0;							/* received signal number */
 int useconds 			= 0;
 int noquote 			= 0;							/* No quote 'IAC' chars from serial line.*/
-int raw_flag			= 0;							/* Flag for active raw_TCP_gateway mode. */
 struct config_t conf	   ;
 
 /* Local functions. */
@@ -39,6 +38,7 @@ void usage(void);
 
 /* Default configure parameters. */
 char *def_servertype       = "raw TCP gateway";	/* or "concurrent" or "iterative" */
+char *def_ioengine         = "auto";			/* or "io_uring" or "epoll" or "select" */
 char *def_configfile       = "/etc/serial_ip.conf";
 char *def_pidfile          = "/var/run/serial_ip.pid";
 int   def_timeout          = 30;
@@ -49,6 +49,8 @@ int   def_ls_pollinterval  = 30;
 int   def_reply_purge_data = 0;
 int   def_idletimer        = 0;
 int   def_send_logout      = 0;
+int   def_bringup_workers  = 4;
+int   def_reactor_shards   = 1;
 
 int main(int argc, char** argv)
 {
@@ -68,6 +70,7 @@ int main(int argc, char** argv)
 	serial_ip_init();
 	install_signal_handlers();
 	create_pidfile();					/* write our pid to a file */
+	shard_init(&conf);					/* the supervisor of the shards stays in there */
 	server_init(sabre_network_port);
 	program_clean_up();
 	exit(0);
@@ -86,11 +89,12 @@ int get_options_from_input(int argc, char** argv)
 	extern int Daemon;					/* flag; become a daemon */
 	extern int noquote;					/* flag; don't quote IAC chars from serial lines */
 	extern int useconds;				/* i/o wait in u-seconds */
+	extern int upgrade_mode;			/* flag; take over from the running daemon */
 	extern char *optarg;
 	int next_option;
 	int error_flag 				= 0;
 	/*Parse options.	*/
-	while ((next_option = getopt(argc,(GETOPT_CAST) argv,"udnc:p:w:")) != EOF)
+	while ((next_option = getopt(argc,(GETOPT_CAST) argv,"udnUc:p:w:")) != EOF)
 	{
 			switch(next_option) {
 			case 'u':
@@ -102,6 +106,9 @@ int get_options_from_input(int argc, char** argv)
 			case 'n':
 				noquote++;
 				break;
+			case 'U':
+				upgrade_mode++;
+				break;
 			case 'c':
 				config_file = malloc(strlen(optarg)+1);
 				if (config_file != NULL)
@@ -135,10 +142,11 @@ void usage(void)
 	extern char *version;				/* version string */
 
 	fprintf(stderr,"%s %s\n\n", program_name, version);
-	fprintf(stderr,"usage: %s [-dn] [-c file] [-p port] [-w u-seconds]\n",program_name);
+	fprintf(stderr,"usage: %s [-dnU] [-c file] [-p port] [-w u-seconds]\n",program_name);
 	fprintf(stderr,"\n");
 	fprintf(stderr,"    -d  become a daemon\n");
 	fprintf(stderr,"    -n  no quoting of IAC char from serial lines\n");
+	fprintf(stderr,"    -U  take over from the running serial_ip (upgrade without downtime)\n");
 	fprintf(stderr,"    -c  configuration file name.  default is %s\n",def_configfile);
 	fprintf(stderr,"    -p  tcp port number for server.  default is %d\n",sabre_network_port);
 	fprintf(stderr,"    -w  wait before reading socket and serial port, specified in u-seconds\n");
@@ -157,12 +165,7 @@ void serial_ip_init()
 	extern char *config_file;			/* config file name. This is serial_ip.conf by default. */
 	extern char *def_configfile;		/* serial_ip.conf */
 	extern struct config_t conf;		/* This is configuration file - serial_ip.conf*/
-	extern int def_timeout;
-	extern int def_ms_pollinterval;
-	extern int def_ls_pollinterval;
-	extern int def_reply_purge_data;
-	extern int def_idletimer;
-	extern int def_send_logout;
+	extern int upgrade_mode;			/* -U */
 
 	openlog(program_name, LOG_PID|LOG_CONS|LOG_PERROR,LOG_DAEMON);
 	syslog(LOG_INFO,"serial_ip.c: serial_ip_init(): restart, %s",version);
@@ -178,13 +181,7 @@ void serial_ip_init()
 /*
 	Set defaults for configuration file
 */
-	memset(&conf,(int) '\0',sizeof(conf));
-	conf.timeout = def_timeout;
-	conf.ms_pollinterval = def_ms_pollinterval;
-	conf.ls_pollinterval = def_ls_pollinterval;
-	conf.reply_purge_data = def_reply_purge_data;
-	conf.idletimer = def_idletimer;
-	conf.send_logout = def_send_logout;
+	config_init(&conf);
 
 	if (config_file == NULL)
 		config_file = def_configfile;	/* use default name. */
@@ -198,7 +195,87 @@ void serial_ip_init()
 		syslog(LOG_ERR,"serial_ip.c(): Unable to read configuration file. sane_config().");
 		exit(1);
 	}
+	session_arena_init(&conf);			/* "deterministic memory": preallocate and lock, shards inherit it */
+	if (conf.reactor_shards > 1) {
+		/* each shard brings up its own ports, see shard_init() */
+		if (upgrade_mode)
+			syslog(LOG_ERR,"serial_ip.c: serial_ip_init(): -U is not supported with reactor shards, starting afresh");
+		upgrade_mode = 0;
+		return;
+	}
+	hotplug_init(&conf);				/* attach hotplug serial devices, and watch for more */
+	if (upgrade_mode)
+		upgrade_receive(&conf);			/* take the sockets and serial ports of the running serial_ip */
+	port_bringup_init(conf.bringup_workers);
+	port_bringup_start(&conf);			/* open the serial ports in the background */
+
+}
 
+/*
+	Location: serial_ip.c
+	This is to set a configuration structure to the built-in defaults, with an empty port registry.
+	serial_ip.conf is read on top of it.
+*/
+void config_init(struct config_t *config)
+{
+	extern int def_timeout;
+	extern int def_ms_pollinterval;
+	extern int def_ls_pollinterval;
+	extern int def_reply_purge_data;
+	extern int def_idletimer;
+	extern int def_send_logout;
+	extern int def_bringup_workers;
+	extern int def_reactor_shards;
+
+	memset(config,(int) '\0',sizeof(struct config_t));
+	port_registry_init(&config->ports);
+	config->timeout = def_timeout;
+	config->ms_pollinterval = def_ms_pollinterval;
+	config->ls_pollinterval = def_ls_pollinterval;
+	config->reply_purge_data = def_reply_purge_data;
+	config->idletimer = def_idletimer;
+	config->send_logout = def_send_logout;
+	config->bringup_workers = def_bringup_workers;
+	config->reactor_shards = def_reactor_shards;
+}
+
+/*
+	Location: serial_ip.c
+	This is to free the memory allocated for items in a configuration structure, including its ports.
+	The structure is left with NULL pointers and an empty port registry.
+*/
+void config_free(struct config_t *config)
+{
+	if (config->directory != NULL)
+		free(config->directory);
+	if (config->tmpdir != NULL)
+		free(config->tmpdir);
+	if (config->debuglog != NULL)
+		free(config->debuglog);
+	if (config->pidfile != NULL)
+		free(config->pidfile);
+	if (config->user != NULL)
+		free(config->user);
+	if (config->group != NULL)
+		free(config->group);
+	if (config->server_type != NULL)
+		free(config->server_type);
+	if (config->io_engine != NULL)
+		free(config->io_engine);
+	if (config->lockdir != NULL)
+		free(config->lockdir);
+	if (config->locktemplate != NULL)
+		free(config->locktemplate);
+	config->directory = config->tmpdir = config->debuglog = config->pidfile = NULL;
+	config->user = config->group = config->server_type = config->io_engine = NULL;
+	config->lockdir = config->locktemplate = NULL;
+	free_all_serial_ports(&config->ports);
+	free_serial_port(&config->port_defaults);
+	while (config->nhotplug > 0)
+		free(config->hotplug_patterns[--config->nhotplug]);
+	if (config->hotplug_patterns != NULL)
+		free(config->hotplug_patterns);
+	config->hotplug_patterns = NULL;
 }
 
 /*
@@ -210,26 +287,9 @@ void program_clean_up(void)
 {
 	extern struct config_t conf;		/* Global variable config file */
 	closelog();							/* close the syslog. */
-	/*
-		free the memory allocated for items in the config file structure.
-	*/
-	if (conf.directory != NULL)
-		free(conf.directory);
-	if (conf.tmpdir != NULL)
-		free(conf.tmpdir);
-	if (conf.pidfile != NULL)
-		free(conf.pidfile);
-	if (conf.user != NULL)
-		free(conf.user);
-	if (conf.group != NULL)
-		free(conf.group);
-	if (conf.server_type != NULL)
-		free(conf.server_type);
-	if (conf.lockdir != NULL)
-		free(conf.lockdir);
-	if (conf.locktemplate != NULL)
-		free(conf.locktemplate);
-	free_all_serial_ports(conf.serial_port);
+	hotplug_close();
+	upgrade_close(1);
+	config_free(&conf);				/* free the memory allocated for items in the config file structure. */
 
 	/*Destroy keyword table*/
 	hdestroy();
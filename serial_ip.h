@@ -21,6 +21,7 @@
 #include <grp.h>
 #include <stdarg.h>
 #include <time.h>
+#include <sched.h>
 
 
 #include <search.h>   			/* hash entry table. */
@@ -35,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/sysmacros.h>
@@ -55,6 +57,38 @@
 #define SABRE_NETWORK_PORT				1194
 #endif
 
+/*
+	time the serial device gets to answer a raw TCP command (ms), before the next one is read.
+*/
+#ifndef RAW_WRITE_PACING
+#define RAW_WRITE_PACING				250
+#endif
+
+/*
+	most reactor shards (processes) the serial ports can be spread over.
+*/
+#define SHARD_MAX						64
+
+/*
+	real-time (SCHED_FIFO) priority of the serial I/O thread of a session, see serial_thread.c.
+*/
+#ifndef SERIAL_THREAD_PRIORITY
+#define SERIAL_THREAD_PRIORITY			10
+#endif
+
+/*
+	seconds without traffic after which a session gives the pages of its buffers back, see session_slab.c.
+*/
+#ifndef SESSION_BUFFER_LINGER
+#define SESSION_BUFFER_LINGER			10
+#endif
+
+/*
+	sizes of the rings between a session and its serial I/O thread, see serial_thread.c.
+*/
+#define SERIAL_RING_IN					65536		/* device -> session, about 5 seconds at 115200 bps */
+#define SERIAL_RING_OUT					16384		/* session -> device */
+
 /*
 	defaults for uucp locking.
 */
@@ -89,10 +123,50 @@
 
 
 /*
-  	  max number of serial port.
+  	  serial ports are allocated in chunks of PORT_CHUNK, see port_registry.c.
   	  In case of SabreLite, we have 1 RS232/485 port.
 */
-#define MAX_SPORTS	256
+#define PORT_CHUNK	64
+
+/*
+	Location: serial_ip.h
+	The scheduling a serial port gets while a session serves it, see port_sched.c.
+*/
+#define PORT_NICE_UNSET		(-100)		/* leave the nice level alone */
+#define PORT_SCHED_MAXCPU	64			/* cpus are a bit mask */
+
+struct port_sched_t {
+	int policy;					/* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+	int priority;				/* real-time priority */
+	int nice;					/* nice level, PORT_NICE_UNSET if not set */
+	unsigned long long cpus;	/* cpus the session may run on, 0 for any */
+};
+
+/*
+	Location: serial_ip.h
+	The protocol a serial port speaks to its clients, see session_protocol.c.
+*/
+#define PORT_PROTOCOL_DEFAULT	0			/* by server type: framed for a raw TCP gateway, Telnet otherwise */
+#define PORT_PROTOCOL_TELNET	1			/* Telnet, with RFC2217 Com Port Control */
+#define PORT_PROTOCOL_RAW		2			/* bytes as they are, both ways */
+#define PORT_PROTOCOL_FRAMED	3			/* a command per read, as the raw TCP gateway (raw.c) */
+
+/*
+	socket profiles of the sessions of a serial port, see socket_profile.c.
+*/
+#define SOCKET_PROFILE_DEFAULT		0		/* the sockets are left as they are */
+#define SOCKET_PROFILE_LATENCY		1		/* no Nagle, quick acks, marked for expedited forwarding */
+#define SOCKET_PROFILE_THROUGHPUT	2		/* large buffers */
+#define PORT_PROTOCOLS			3			/* not counting the default */
+
+/*
+	Location: serial_ip.h
+	Who writes to a shared port, see share.c.
+*/
+#define SHARE_WRITER_FIRST		0			/* the client attached the longest */
+#define SHARE_WRITER_ALL		1			/* every client */
+#define SHARE_WRITER_NONE		2			/* nobody, the port is only observed */
+#define SHARE_WRITERS			3
 
 /*
 	Location: serial_ip.h
@@ -110,10 +184,97 @@ struct serial_info_t {
 	int conn_flush;				/* flush device on connect? */
 	int disc_flush;				/* flush device on disconnect? */
 	int busy;					/* modem already in use */
+	int index;					/* slot in the port registry */
+	int listen_port;			/* tcp port for this serial port, 0 if none */
+	char *listen_socket;		/* unix socket path for it, @name if abstract, NULL if none (see unix_socket.c) */
+	char *socket_users;			/* who may connect to its unix socket, NULL for anyone */
+	char *pool;					/* name of the pool this port belongs to */
+	int next_in_pool;			/* index of the next port of the pool, -1 at the end */
+	int next_free;				/* index of the next free slot, while on the free list */
+	int hotplug;				/* attached at run time by hotplug discovery */
+	int fd;						/* device held open by the daemon, -1 if none */
+	int state;					/* bring-up state: PORT_DOWN, PORT_OPENING, ... */
+	unsigned int bringup_seq;	/* bumped whenever a pending bring-up becomes stale */
+	struct port_sched_t sched;	/* scheduling of its sessions */
+	int protocol;				/* PORT_PROTOCOL_*, of its sessions */
+	int socket_profile;			/* SOCKET_PROFILE_*, of the sockets of its sessions */
+	int udp_port;				/* udp port of its datagram transport, 0 if none (see udp.c) */
+	char *udp_peers;			/* where its datagrams go: host:port, ... */
+	int udp_sequence;			/* datagrams carry a sequence number? */
+	char *multicast_group;		/* group:port its reads are published to, NULL if none */
+	int multicast_ttl;			/* hops the published datagrams may take */
+	int share_port;				/* tcp port of its shared session, 0 if none (see share.c) */
+	int share_writer;			/* SHARE_WRITER_*, who writes to it there */
+	int capture_size;			/* bytes of its capture ring, 0 if none (see capture.c) */
+	int capture_replay_bytes;	/* a new client is sent the last so many bytes of it */
+	int capture_replay_seconds;	/* or what came in the last so many seconds */
+	struct capture_t *capture;	/* its capture ring, in shared memory, NULL if none */
+	char *shm_ring;				/* shm_open() name of its shared-memory rings, NULL if none (see shm.c) */
+	int shm_size;				/* bytes of each of them */
+	struct termios old_termios;	/* termios found on the device before we configured it */
+	struct termios new_termios;	/* termios we configured on the device */
 };
 
 typedef struct serial_info_t SERIAL_INFO;
 
+/*
+	bring-up states of a serial port, see port_bringup.c.
+*/
+#define PORT_DOWN		0			/* not opened yet, or released */
+#define PORT_OPENING	1			/* queued for, or in, bring-up */
+#define PORT_READY		2			/* open and configured, its listener is up */
+#define PORT_FAILED		3			/* bring-up failed, it is opened on demand */
+
+/*
+	Device output a port worker could not write yet, the device holding it off (CTS, XOFF): the worker
+	writes it when the device takes more, and never waits for it (see serial_pending_write()).
+*/
+#define SERIAL_PENDING_SIZE	16384
+
+struct serial_pending_t {
+	unsigned char data[SERIAL_PENDING_SIZE];
+	int len;
+};
+
+typedef struct serial_pending_t SERIAL_PENDING;
+
+/*
+	Location: serial_ip.h
+	A hash map from a device path, a pool name or a listen port to a port registry index.
+	Open addressing with linear probing, see port_registry.c.
+*/
+struct port_map_slot_t {
+	const char *skey;			/* string key (owned by the SERIAL_INFO) */
+	long ikey;					/* integer key */
+	int index;					/* port registry index */
+	int state;					/* empty, used or deleted */
+};
+
+struct port_map_t {
+	struct port_map_slot_t *slots;
+	unsigned int size;			/* number of slots, a power of 2 */
+	unsigned int used;			/* live + deleted slots */
+	int string_keys;			/* keys are strings? */
+};
+typedef struct port_map_t PORT_MAP;
+
+/*
+	Location: serial_ip.h
+	The registry of all serial ports. SERIAL_INFO's are kept in chunks of PORT_CHUNK contiguous
+	entries, so their addresses never change while the registry grows.
+*/
+struct port_registry_t {
+	SERIAL_INFO **chunks;		/* array of ptrs to chunks of PORT_CHUNK ports */
+	int nchunks;				/* number of chunks */
+	int nslots;					/* slots handed out so far */
+	int nports;					/* number of registered ports */
+	int free_head;				/* first slot on the free list, -1 if none */
+	PORT_MAP by_device;			/* device path -> index */
+	PORT_MAP by_listen_port;	/* listen port -> index */
+	PORT_MAP by_pool;			/* pool name -> index of first port of the pool */
+};
+typedef struct port_registry_t PORT_REGISTRY;
+
 
 /*
 	Location: serial_ip.h
@@ -139,8 +300,17 @@ struct config_t {
 	int reply_purge_data;			/* reply to Purge Data commands? */
 	int idletimer;					/* idle timer */
 	int send_logout;				/* send Telnet LOGOUT command? */
-	int number_ports;					/* number of serial ports */
-	SERIAL_INFO *serial_port[MAX_SPORTS]; /* array of ptrs to SERIAL_INFO's */
+	PORT_REGISTRY ports;			/* registry of serial ports */
+	SERIAL_INFO port_defaults;		/* settings for serial ports attached at run time */
+	char **hotplug_patterns;		/* glob patterns of hotplug serial devices */
+	int nhotplug;					/* number of hotplug patterns */
+	int bringup_workers;			/* threads opening serial ports in parallel */
+	char *io_engine;				/* I/O engine: auto, io_uring, epoll or select */
+	int reactor_shards;				/* processes the serial ports are spread over, 1: none */
+	int pin_shards;					/* pin each shard to a CPU? */
+	int serial_thread;				/* serial device served by a thread of its own? */
+	int deterministic_memory;		/* preallocate and lock session memory? */
+	int mux_port;					/* tcp port of the multiplexed connections, 0: none */
 };
 
 /*
@@ -191,6 +361,35 @@ struct config_t {
 #define DISCFLUSH		0x04000000
 #define IDLETIMER		0x08000000
 #define SENDLOGOUT		0x10000000
+#define LISTENPORT		0x20000000
+#define POOL			0x20000001
+#define HOTPLUG			0x20000002
+#define BRINGUPWORKERS	0x20000003
+#define IOENGINE		0x20000004
+#define REACTORSHARDS	0x20000005
+#define PINSHARDS		0x20000006
+#define SERIALTHREAD	0x20000007
+#define SCHEDPOLICY		0x20000008
+#define SCHEDPRIORITY	0x20000009
+#define CPUAFFINITY		0x2000000A
+#define NICELEVEL		0x2000000B
+#define DETERMINISTICMEMORY	0x2000000C
+#define PORTPROTOCOL	0x2000000D
+#define MUXPORT			0x2000000E
+#define UDPPORT			0x2000000F
+#define UDPPEERS		0x20000010
+#define UDPSEQUENCE		0x20000011
+#define MULTICASTGROUP	0x20000012
+#define MULTICASTTTL	0x20000013
+#define SHAREPORT		0x20000014
+#define SHAREWRITER		0x20000015
+#define CAPTURESIZE		0x20000016
+#define CAPTUREREPLAY	0x20000017
+#define SHMRING			0x20000018
+#define SHMSIZE			0x20000019
+#define LISTENSOCKET	0x2000001A
+#define SOCKETUSERS		0x2000001B
+#define SOCKETPROFILE	0x2000001C
 
 /*
 	parity symbols
@@ -220,9 +419,24 @@ struct buffer_t {
 	unsigned char *tailp;			/* ptr past end of buffer */
 	unsigned char *readp;			/* read ptr */
 	unsigned char *writep;			/* write ptr */
+	int arena;						/* part of a session arena or slab, not freed by bffree() */
 };
 typedef struct buffer_t BUFFER;
 
+/*
+	The buffers of a session, their data in one mapping, see session_slab.c.
+*/
+#define SESSION_SLAB_NBUFFERS		3
+
+struct session_slab_t {
+	struct session_slab_t *next;	/* free list of its size class */
+	int class;						/* size class */
+	unsigned char *data;			/* data of the buffers, only backed when used */
+	size_t length;
+	BUFFER buffers[SESSION_SLAB_NBUFFERS];	/* network, serial, sabre */
+};
+typedef struct session_slab_t SESSION_SLAB;
+
 
 
 /* ----------------------------RAW TCP MODE----------------------------------- */
@@ -249,6 +463,35 @@ struct op_pdu {
 	pack_uint16_t(pack, &(op_pdu)->version);\
 } while (0)
 
+/* ---------------------------------------------------------------------- */
+/* Multiplexed connections (see mux.c): many serial ports over one TCP connection.
+   Each frame is a header, in network byte order, and length bytes of payload. */
+#define MUX_VERSION			(SERIAL_IP_VERSION | 1)
+#define MUX_MAX_PAYLOAD		4096			/* largest payload of a frame */
+#define MUX_WINDOW			8192			/* credit of a channel when it opens, each way */
+
+#define MUX_DATA			0				/* bytes for or from the serial port */
+#define MUX_OPEN			1				/* client: open the device named in the payload; server: done */
+#define MUX_CLOSE			2				/* either side: the channel is over */
+#define MUX_CREDIT			3				/* the peer may send <bytes(4)> more on the channel */
+#define MUX_CONTROL			4				/* <RFC2217 command(1)> <value(4)>, answered in kind */
+#define MUX_ERROR			5				/* the request on the channel failed, the payload says why */
+
+struct mux_header {
+	uint16_t version;						/* MUX_VERSION */
+	uint8_t type;							/* MUX_* */
+	uint8_t flags;							/* 0 */
+	uint16_t channel;						/* chosen by the client when it opens the channel */
+	uint16_t length;						/* of the payload */
+} __attribute__((packed));
+
+/* by value: the fields of the packed header may be unaligned, pack_uint16_t() takes a pointer */
+#define PACK_MUX_HEADER(pack, hdr)  do {\
+	(hdr)->version = (pack) ? htons((hdr)->version) : ntohs((hdr)->version);\
+	(hdr)->channel = (pack) ? htons((hdr)->channel) : ntohs((hdr)->channel);\
+	(hdr)->length = (pack) ? htons((hdr)->length) : ntohs((hdr)->length);\
+} while (0)
+
 /* ----------------------------END- RAW TCP MODE------------------------------ */
 
 /*
@@ -296,6 +539,35 @@ struct config_entry keyword_table[] = {
 	{"port",						DEVICE,			STRING,			NULL},
 	{"speed",						SPEED,			LONGVALUE,		NULL},
 	{"baudrate",					SPEED,			LONGVALUE,		NULL},
+	{"listen port",					LISTENPORT,		VALUE,			NULL},
+	{"listen socket",				LISTENSOCKET,	STRING,			NULL},
+	{"socket users",				SOCKETUSERS,	STRING,			NULL},
+	{"pool",						POOL,			STRING,			NULL},
+	{"hotplug device",				HOTPLUG,		STRING,			NULL},
+	{"bringup workers",				BRINGUPWORKERS,	VALUE,			NULL},
+	{"io engine",					IOENGINE,		STRING,			NULL},
+	{"reactor shards",				REACTORSHARDS,	VALUE,			NULL},
+	{"pin shards",					PINSHARDS,		BOOLEAN,		NULL},
+	{"serial thread",				SERIALTHREAD,	BOOLEAN,		NULL},
+	{"scheduling policy",			SCHEDPOLICY,	STRING,			NULL},
+	{"scheduling priority",			SCHEDPRIORITY,	VALUE,			NULL},
+	{"cpu affinity",				CPUAFFINITY,	STRING,			NULL},
+	{"nice",						NICELEVEL,		VALUE,			NULL},
+	{"deterministic memory",		DETERMINISTICMEMORY,	BOOLEAN,	NULL},
+	{"mux port",					MUXPORT,		VALUE,			NULL},
+	{"udp port",					UDPPORT,		VALUE,			NULL},
+	{"udp peers",					UDPPEERS,		STRING,			NULL},
+	{"udp sequence",				UDPSEQUENCE,	BOOLEAN,		NULL},
+	{"multicast group",				MULTICASTGROUP,	STRING,			NULL},
+	{"multicast ttl",				MULTICASTTTL,	VALUE,			NULL},
+	{"share port",					SHAREPORT,		VALUE,			NULL},
+	{"share writer",				SHAREWRITER,	STRING,			NULL},
+	{"capture size",				CAPTURESIZE,	VALUE,			NULL},
+	{"capture replay",				CAPTUREREPLAY,	STRING,			NULL},
+	{"shm ring",					SHMRING,		STRING,			NULL},
+	{"shm size",					SHMSIZE,		VALUE,			NULL},
+	{"protocol",					PORTPROTOCOL,	STRING,			NULL},
+	{"socket profile",				SOCKETPROFILE,	STRING,			NULL},
 	{"",							UNKNOWN,		STRING,			NULL}	/* this entry must be last */
 };
 #else
@@ -322,17 +594,64 @@ extern struct config_entry keyword_table[];
 #define DBG_LV9			9
 
 /*
-	telnet options
+	Location: serial_ip.h
+	A timer of the timing wheel, see timer_wheel.c.
+*/
+struct wheel_timer_t {
+	unsigned long long expires;			/* tick (ms) it expires at */
+	void (*callback)(void *);			/* called when it expires */
+	void *arg;
+	int armed;							/* linked into the wheel */
+	int level;							/* where it is linked */
+	int slot;
+	struct wheel_timer_t *next;
+	struct wheel_timer_t *prev;
+};
+typedef struct wheel_timer_t WHEEL_TIMER;
+
+/*
+	Location: serial_ip.h
+	The session in progress, as handed over to a new binary by upgrade_handoff(), see upgrade.c.
 */
-struct telnet_options_t {
-	int sent_will:1;
-	int sent_do:1;
-	int sent_wont:1;
-	int sent_dont:1;
-	int server:1;
-	int client:1;
+struct upgrade_session_t {
+	int sockfd;					/* client socket */
+	int serial_fd;				/* serial device of the session */
+	SERIAL_INFO *port;			/* its port */
+	BUFFER *buffers[3];			/* socket -> serial, serial -> socket, us -> socket */
 };
-typedef struct telnet_options_t TELNET_OPTIONS;
+
+/*
+	Location: serial_ip.h
+	The session in progress, as the data path of its protocol sees it, see session_protocol.c.
+*/
+struct session_io_t {
+	int sockfd;					/* client socket */
+	int serial_fd;				/* serial device */
+	int serial_watch_fd;		/* serial_fd, or serial_thread_fd when a thread serves the device */
+	int quote;					/* double the IAC chars from the serial device */
+	BUFFER *socket_to_serial_buf;
+	BUFFER *serial_to_socket_buf;
+	BUFFER *sabre_to_socket_buf;
+};
+typedef struct session_io_t SESSION_IO;
+
+/*
+	Location: serial_ip.h
+	The data path of a protocol. A session binds to one when it starts, and the session loop
+	(serial_ip_communication_process()) calls it, see session_protocol.c.
+*/
+struct session_protocol_t {
+	char *name;
+	int buffered;				/* data goes through the session buffers: serial thread, io_uring, -w */
+	int rfc2217;				/* the modem lines are watched and reported to the client */
+	unsigned long pacing;		/* ms the serial device gets to answer a command, before the next is read */
+	void (*start)(SESSION_IO *io, int resumed);	/* resumed: taken over from the previous binary */
+	int (*socket_ready)(SESSION_IO *io);		/* the socket can be read. returns 0, 1 to end */
+	int (*serial_ready)(SESSION_IO *io);		/* the serial device can be read. returns 0, 1 to end */
+	void (*state_changed)(SESSION_IO *io);		/* the modem lines changed, or are due a poll */
+	void (*idle)(SESSION_IO *io);				/* the session is ended for idleness */
+};
+typedef struct session_protocol_t SESSION_PROTOCOL;
 
 /* Telnet commands */
 
@@ -361,6 +680,68 @@ typedef struct telnet_options_t TELNET_OPTIONS;
 #define GOT_CARRIER								0x01
 #define LOST_CARRIER							0x02
 
+/*
+	The Telnet state of a session. It is kept small, since most sessions sit idle: the options
+	are bitsets of MAX_TELNET_OPTIONS bits, one per kind of mark (see telnet_engine.c).
+	The engine keeps everything it needs here, the state of its parser included, so any number of
+	sessions may run side by side; the daemon serves one per process (tnsession in telnet.c).
+*/
+#define TELNET_SENT_WILL						0		/* we sent WILL */
+#define TELNET_SENT_DO							1
+#define TELNET_SENT_WONT						2
+#define TELNET_SENT_DONT						3
+#define TELNET_OPT_SERVER						4		/* negotiated, server to client */
+#define TELNET_OPT_CLIENT						5		/* negotiated, client to server */
+#define TELNET_OPTION_SETS						6
+#define TELNET_OPTION_WORDS						(MAX_TELNET_OPTIONS / 32)
+
+/*	the parser of telnet_engine_recv(), where it is in the stream from the client	*/
+#define TELNET_STATE_DATA						0		/* data for the serial port */
+#define TELNET_STATE_IAC						1		/* after IAC */
+#define TELNET_STATE_OPTION						2		/* after IAC WILL, WONT, DO or DONT */
+#define TELNET_STATE_SB							3		/* after IAC SB */
+#define TELNET_STATE_SB_DATA					4		/* in a suboption */
+#define TELNET_STATE_SB_IAC						5		/* after IAC in a suboption */
+
+/*	what the engine hands to its host (see telnet_engine.c)	*/
+#define TELNET_EV_SEND							1		/* data: bytes for the client */
+#define TELNET_EV_CPC							2		/* a Com Port Control request the host answers */
+
+struct telnet_session_t;
+
+struct telnet_event_t {
+	int type;							/* TELNET_EV_* */
+	unsigned char suboptcode;			/* TELNET_EV_CPC */
+	unsigned long value;				/* TELNET_EV_CPC: command of 1, 2 or 4 bytes, as a value */
+	unsigned char *data;				/* TELNET_EV_SEND: the bytes, TELNET_EV_CPC: the command */
+	int len;
+};
+
+/*	returns 0 when the event was taken care of, 1 on failure	*/
+typedef int (*telnet_event_handler)(struct telnet_session_t *tn, struct telnet_event_t *ev);
+
+struct telnet_session_t {
+	unsigned int options[TELNET_OPTION_SETS][TELNET_OPTION_WORDS];
+	unsigned char tnmode[2];			/* ASCII or BINARY, client and server side */
+	unsigned char session_state;		/* SUSPEND or RESUME */
+	unsigned char carrier_state;		/* NO_CARRIER, GOT_CARRIER or LOST_CARRIER */
+	unsigned char break_signaled;
+	unsigned char ask_client_signature;	/* ask client for its signature? */
+	unsigned char client_logged_in;		/* is the client still "logged in"? */
+	unsigned char linestate_mask;
+	unsigned char linestate;
+	unsigned char modemstate_mask;
+	unsigned char modemstate;
+	unsigned char state;				/* TELNET_STATE_*, across reads */
+	unsigned char optcode;				/* WILL, WONT, DO or DONT being parsed */
+	unsigned char sb_option;			/* option of the suboption being parsed */
+	short sb_len;
+	unsigned char sb[MAX_TELNET_CPC_COMMAND_LEN+1];	/* suboption being parsed, IAC's undoubled */
+	telnet_event_handler handler;		/* the host, see telnet_engine_bind() */
+	void *user;
+};
+typedef struct telnet_session_t TELNET_SESSION;
+
 /*	Telnet Com Port Control (CPC) option values (from rfc2217)	*/
 #define CPC_SIGNATURE_C2S						0		/* C2S = client to server */
 #define CPC_SET_BAUDRATE_C2S					1
@@ -466,10 +847,24 @@ typedef struct telnet_options_t TELNET_OPTIONS;
 extern char *program_name 	 	   						    ;
 extern int  sabre_network_port								;
 extern int signo											;
-extern TELNET_OPTIONS tnoptions[MAX_TELNET_OPTIONS]         ;
+extern TELNET_SESSION tnsession                             ;
 extern int useconds											;
 extern int noquote											;
-extern int raw_flag											;
+extern int hotplug_fd										;
+extern int bringup_notify_fd								;
+extern int modem_watch_fd									;
+extern int timer_fd											;
+extern int signal_fd										;
+extern int serial_thread_fd									;
+extern int upgrade_mode										;
+extern int upgrade_listen_fd								;
+extern int upgrade_server_sockfd							;
+extern int server_sockfd									;
+extern int shard_index										;
+extern int shard_count										;
+extern volatile sig_atomic_t reload_pending					;
+extern int reload_deferred								;
+extern unsigned long config_generation						;
 extern struct config_t conf									;
 
 /* Symbols defined in utilities.c  */
@@ -511,6 +906,8 @@ extern int retrieve_hex_escape_sequence(char *s, int *len);
  Symbols defined in serial_ip.c
 */
 extern void serial_ip_init();
+extern void config_init(struct config_t *config);
+extern void config_free(struct config_t *config);
 extern void program_clean_up(void);
 
 /*
@@ -526,18 +923,20 @@ extern void close_all_fds(int begin);
 /*
 Symbols defined in configuration.c
 */
-extern int serial_init_termios(SERIAL_INFO *sabre_serial_port, int *fd, struct termios old_setting, struct termios new_setting);
+extern int serial_init_termios(SERIAL_INFO *sabre_serial_port, int *fd, struct termios *old_setting, struct termios *new_setting);
 extern int keyword_table_init(struct config_entry keyword_table[]);
 extern int read_configuration_file(char *file, struct config_t *conf);
 extern int lookup_user(char *user, uid_t *uid);
 extern int lookup_group(char *group, gid_t *gid);
 extern int is_directory(char *name);
 extern int sane_config(struct config_t *conf);
+extern int add_hotplug_pattern(struct config_t *conf, char *pattern);
 
 /*
  Symbols defined in serial_handle.c
  */
 extern void serial_cleanup(SERIAL_INFO *sabre_serial_port, int *serial_file_descriptor, struct termios old_setting, struct termios new_setting);
+extern void serial_port_restore(SERIAL_INFO *sabre_serial_port, int fd, struct termios *old_setting);
 extern unsigned char get_stopsize(int serial_file_descriptor);
 extern int set_stopsize(int serial_file_descriptor, unsigned long value);
 extern unsigned char get_parity(int serial_file_descriptor);
@@ -546,12 +945,15 @@ extern unsigned char get_datasize(int serial_file_descriptor);
 extern int set_datasize(int serial_file_descriptor, unsigned long value);
 extern unsigned long get_baudrate(int serial_file_descriptor);
 extern int set_baudrate(int serial_file_descriptor, unsigned long value);
-extern SERIAL_INFO *select_serial_port(struct config_t *conf);
-extern SERIAL_INFO *serial_port_init(int *fd, struct termios old_setting, struct termios new_setting);
+extern SERIAL_INFO *select_serial_port(struct config_t *conf, SERIAL_INFO *bound);
+extern int serial_port_open(SERIAL_INFO *sabre_serial_port, int *fd, struct termios *old_setting, struct termios *new_setting);
+extern SERIAL_INFO *serial_port_init(SERIAL_INFO *bound, int *fd, struct termios *old_setting, struct termios *new_setting);
+extern SERIAL_INFO *serial_port_claim(struct config_t *conf, const char *device, int *fd, struct termios *old_setting, struct termios *new_setting);
+extern int serial_pending_flush(int fd, SERIAL_PENDING *pending);
+extern int serial_pending_write(int fd, SERIAL_PENDING *pending, unsigned char *data, int len);
 extern void free_serial_port(SERIAL_INFO *serial_port);
-extern void free_all_serial_ports(SERIAL_INFO *serial_ports[]);
-extern int add_serial_port_info(struct config_t *conf, char *device_path);
-extern SERIAL_INFO *alloc_serial_port(void);
+extern void free_all_serial_ports(PORT_REGISTRY *ports);
+extern SERIAL_INFO *add_serial_port_info(struct config_t *conf, char *device_path);
 extern int release_serial_port(SERIAL_INFO *sabre_serial_port);
 
 /*
@@ -559,6 +961,9 @@ extern int release_serial_port(SERIAL_INFO *sabre_serial_port);
 */
 extern void child_sighandler(int signal);
 extern void child_signal_received(int signal);
+extern void child_signal_handle(int signal);
+extern void signal_fd_handle(void);
+extern int signal_fd_redirect(void (*handler)(int));
 extern void reset_signals(void);
 extern pid_t wait_child_termination(pid_t pid, int *child_status);
 extern void log_termination_status(pid_t pid, int status);
@@ -618,46 +1023,53 @@ extern int set_nonblocking_mode(int sockfd);
 extern int create_server_socket(int tcp_network_port,int block_mode);
 extern void server_init(int tcp_network_port);
 extern void disconnect(int sockfd);
+extern int accept_client_connection(int sockfd, struct sockaddr_in *client_addr, socklen_t *client_len);
+extern void port_listener_sync(struct config_t *conf);
+extern void port_listeners_close(void);
+extern int port_listener_get(int j, int *tcp_port, char *socket_name, int len);
+extern int port_listener_adopt(int tcp_port, const char *socket_name, int fd);
 
 /*
  Symbols defined in network_controller.c
  */
 extern int write_socket(int sockfd, BUFFER *serial_to_socket_buf);
-extern int read_serial(int serial_file_descriptor, BUFFER *serial_to_socket_buf);
+extern int read_serial(int serial_file_descriptor, BUFFER *serial_to_socket_buf, int quote);
 extern int write_serial(int serial_file_descriptor, BUFFER *socket_to_serial_buf);
-extern int read_socket(int sockfd, int serial_file_descriptor, BUFFER *socket_to_serial_buf, BUFFER *sabre_to_socket_buf);
+extern int read_socket(int sockfd, BUFFER *socket_to_serial_buf);
 extern int network_init(int sockfd, int blockopt);
 extern int parent_accept_socket_connection(int sockfd);
 
 /*
 Symbols defined in telnet.c
 */
-extern int send_telnet_cpc_suboption(int sockfd, BUFFER *sabre_to_socket_buf, unsigned char suboptcode, unsigned char *content, int cmdlen);
-extern int respond_telnet_cpc_signature_subopt(int sockfd, BUFFER *sabre_to_socket_buf, unsigned char suboptcode, unsigned char *command, int cmdlen);
-extern int respond_telnet_cpc_baudrate_subopt(int sockfd, int serial_file_descriptor, BUFFER *sabre_to_socket_buf, unsigned char suboptcode, unsigned long value);
-extern int respond_telnet_cpc_datasize_subopt(int sockfd, int serial_file_descriptor, BUFFER *sabre_to_socket_buf, unsigned char suboptcode, unsigned long value);
-extern int respond_telnet_cpc_parity_subopt(int sockfd, int serial_file_descriptor, BUFFER *sabre_to_socket_buf, unsigned char suboptcode, unsigned long value);
-extern int respond_telnet_cpc_stopsize_subopt(int sockfd, int serial_file_descriptor, BUFFER *sabre_to_socket_buf, unsigned char suboptcode, unsigned long value);
-extern void telnet_cpc_log_subopt(char *prefix, unsigned char suboptcode, unsigned long value, unsigned char *command, int cmdlen);
-extern int process_telnet_cpc_suboption(int sockfd, int serial_file_descriptor, BUFFER *socket_to_serial_buf, BUFFER *sabre_to_socket_buf, unsigned char *optstr, int optlen);
+extern int telnet_cpc_signature(SERIAL_INFO *port, char *buff, int size);
+extern int respond_telnet_cpc_signature_subopt(TELNET_SESSION *tn, unsigned char suboptcode, unsigned char *command, int cmdlen);
+extern int respond_telnet_cpc_baudrate_subopt(TELNET_SESSION *tn, int serial_file_descriptor, unsigned char suboptcode, unsigned long value);
+extern int respond_telnet_cpc_datasize_subopt(TELNET_SESSION *tn, int serial_file_descriptor, unsigned char suboptcode, unsigned long value);
+extern int respond_telnet_cpc_parity_subopt(TELNET_SESSION *tn, int serial_file_descriptor, unsigned char suboptcode, unsigned long value);
+extern int respond_telnet_cpc_stopsize_subopt(TELNET_SESSION *tn, int serial_file_descriptor, unsigned char suboptcode, unsigned long value);
+extern int advise_client_of_state_changes(int serial_file_descriptor);
+extern int telnet_event(TELNET_SESSION *tn, struct telnet_event_t *ev);
+extern void telnet_attach(int sockfd, int serial_file_descriptor, BUFFER *sabre_to_socket_buf);
+extern void process_telnet_options(BUFFER *socket_to_serial_buf, unsigned char *data, int n);
+extern int send_telnet_option(unsigned char optcode, unsigned char option);
+extern int telnet_init(void);
 extern void escape_iac_chars(BUFFER *serial_to_socket_buf);
-extern void enable_telnet_client_option(unsigned char option);
-extern void disable_telnet_client_option(unsigned char option);
-extern void enable_telnet_server_option(unsigned char option);
-extern void disable_telnet_server_option(unsigned char option);
-extern int respond_telnet_binary_option(int sockfd, BUFFER *sabre_to_socket_buf, unsigned char optcode, unsigned char option);
-extern int respond_known_telnet_option(int sockfd, BUFFER *sabre_to_socket_buf, unsigned char optcode, unsigned char option);
-extern int respond_telnet_option(int sockfd, BUFFER *sabre_to_socket_buf, unsigned char optcode, unsigned char option);
-extern void process_telnet_options(int sockfd, int serial_file_descriptor, BUFFER *socket_to_serial_buf, BUFFER *sabre_to_socket_buf);
-extern int telnet_client_option_is_enabled(unsigned char option);
-extern int telnet_client_option_is_disabled(unsigned char option);
-extern int telnet_server_option_is_enabled(unsigned char option);
-extern int telnet_server_option_is_disabled(unsigned char option);
-extern int send_telnet_option(int sockfd, BUFFER *sabre_to_socket_buf, unsigned char optcode, unsigned char option);
-extern void mark_telnet_option_as_sent(unsigned char optcode, unsigned char option);
-extern int telnet_option_was_sent(unsigned char optcode,unsigned char option);
-extern int send_init_telnet_option(int sockfd, BUFFER *sabre_to_socket_buf, unsigned char optcode, unsigned char option);
-extern int telnet_init(int sockfd, BUFFER *sabre_to_socket_buf);
+
+/*
+Symbols defined in telnet_engine.c
+*/
+extern void telnet_engine_bind(TELNET_SESSION *tn, telnet_event_handler handler, void *user);
+extern void telnet_engine_reset(TELNET_SESSION *tn);
+extern void telnet_engine_restore(TELNET_SESSION *tn, const TELNET_SESSION *saved);
+extern void telnet_cpc_log_subopt(char *prefix, unsigned char suboptcode, unsigned long value, unsigned char *command, int cmdlen);
+extern int telnet_engine_send_cpc(TELNET_SESSION *tn, unsigned char suboptcode, unsigned char *content, int cmdlen);
+extern int telnet_client_option_is_enabled(TELNET_SESSION *tn, unsigned char option);
+extern int telnet_server_option_is_enabled(TELNET_SESSION *tn, unsigned char option);
+extern int telnet_engine_send_option(TELNET_SESSION *tn, unsigned char optcode, unsigned char option);
+extern int telnet_engine_start(TELNET_SESSION *tn);
+extern int telnet_engine_recv(TELNET_SESSION *tn, unsigned char *data, int len);
+extern int telnet_engine_notify(TELNET_SESSION *tn, unsigned char newstate, unsigned char line_errors);
 
 
 /*
@@ -684,6 +1096,210 @@ extern void bffree(BUFFER *buff);
 extern void bfinit(BUFFER *buff);
 extern BUFFER *bfmalloc(char *label, int size);
 
+/*
+ Symbols defined in port_registry.c
+*/
+extern void port_registry_init(PORT_REGISTRY *reg);
+extern SERIAL_INFO *port_registry_at(PORT_REGISTRY *reg, int index);
+extern SERIAL_INFO *port_registry_add(PORT_REGISTRY *reg, char *device);
+extern int port_registry_remove(PORT_REGISTRY *reg, SERIAL_INFO *port);
+extern int port_registry_set_listen_port(PORT_REGISTRY *reg, SERIAL_INFO *port, int listen_port);
+extern int port_registry_set_pool(PORT_REGISTRY *reg, SERIAL_INFO *port, char *pool);
+extern int port_registry_take_pool(PORT_REGISTRY *reg, SERIAL_INFO *port, char *pool);
+extern int port_registry_reserve(PORT_REGISTRY *reg, int nports, int nkeys);
+extern SERIAL_INFO *port_lookup_device(PORT_REGISTRY *reg, const char *device);
+extern SERIAL_INFO *port_lookup_listen_port(PORT_REGISTRY *reg, int listen_port);
+extern SERIAL_INFO *port_lookup_pool(PORT_REGISTRY *reg, const char *pool);
+extern SERIAL_INFO *port_pool_next(PORT_REGISTRY *reg, SERIAL_INFO *port);
+extern void port_registry_free(PORT_REGISTRY *reg);
+
+/*
+ Symbols defined in hotplug.c
+*/
+extern int hotplug_attach(struct config_t *conf, char *device);
+extern int hotplug_detach(struct config_t *conf, char *device);
+extern int hotplug_init(struct config_t *conf);
+extern void hotplug_close(void);
+extern void hotplug_handle_events(struct config_t *conf);
+
+/*
+ Symbols defined in port_bringup.c
+*/
+extern int port_bringup_init(int workers);
+extern int port_bringup_queue(SERIAL_INFO *port);
+extern void port_bringup_start(struct config_t *conf);
+extern void port_bringup_release(SERIAL_INFO *port);
+extern void port_bringup_collect(struct config_t *conf);
+extern void port_bringup_child(void);
+
+/*
+ Symbols defined in modem_watch.c
+*/
+extern int modem_watch_start(int serial_file_descriptor);
+extern void modem_watch_stop(void);
+extern void modem_watch_drain(void);
+extern unsigned char get_modemstate(int serial_file_descriptor, unsigned char previous, unsigned char *line_errors);
+extern int modem_watch_waiting(void);
+
+/*
+ Symbols defined in port_sched.c
+*/
+extern void port_sched_init(struct port_sched_t *sched);
+extern int port_sched_parse_policy(const char *value, int *policy);
+extern int port_sched_parse_cpus(const char *value, unsigned long long *cpus);
+extern void port_sched_apply(SERIAL_INFO *port);
+extern void port_sched_restore(void);
+
+/*
+ Symbols defined in serial_thread.c
+*/
+extern int serial_thread_start(int serial_file_descriptor);
+extern void serial_thread_stop(void);
+extern int serial_thread_resume(void);
+extern void serial_thread_release(void);
+extern int serial_thread_read(int fd, unsigned char *ptr, int bytes, int *n);
+extern int serial_thread_write(int fd, unsigned char *ptr, int bytes, int *n);
+
+/*
+ Symbols defined in session_arena.c
+*/
+extern int session_arena_init(struct config_t *conf);
+extern void session_arena_signature_update(SERIAL_INFO *port);
+extern void session_arena_refresh(struct config_t *conf);
+extern char *session_arena_signature(SERIAL_INFO *port, int *len);
+extern int session_arena_buffers(BUFFER **buffers);
+extern int session_arena_rings(unsigned char **ring_in, unsigned char **ring_out);
+extern void session_arena_child(void);
+
+/*
+ Symbols defined in session_slab.c
+*/
+extern SESSION_SLAB *session_slab_alloc(int size);
+extern int session_slab_trim(SESSION_SLAB *slab);
+extern void session_slab_free(SESSION_SLAB *slab);
+extern void session_slab_stats(void);
+
+/*
+ Symbols defined in session_protocol.c
+*/
+extern SESSION_PROTOCOL *session_protocol(SERIAL_INFO *port);
+extern int session_protocol_parse(const char *value, int *protocol);
+
+/*
+ Symbols defined in socket_profile.c
+*/
+extern int socket_profile_parse(const char *value, int *profile);
+extern int socket_profile_apply(SERIAL_INFO *port, int sockfd);
+extern int socket_profile_listen(SERIAL_INFO *port, int sockfd);
+extern void socket_profile_read(SERIAL_INFO *port, int sockfd);
+
+/*
+ Symbols defined in mux.c
+*/
+extern int mux_session(int sockfd);
+
+/*
+ Symbols defined in udp.c
+*/
+extern int udp_port_wanted(SERIAL_INFO *port);
+extern void udp_port_settings(SERIAL_INFO *port, char *buf, int len);
+extern int udp_worker(struct config_t *conf, SERIAL_INFO *port);
+
+/*
+ Symbols defined in share.c
+*/
+extern int share_writer_parse(const char *value, int *writer);
+extern int share_port_wanted(SERIAL_INFO *port);
+extern void share_port_settings(SERIAL_INFO *port, char *buf, int len);
+extern int share_worker(struct config_t *conf, SERIAL_INFO *port);
+
+/*
+ Symbols defined in capture.c
+*/
+extern int capture_replay_parse(const char *value, int *bytes, int *seconds);
+extern int capture_size_check(int size);
+extern void capture_free(SERIAL_INFO *port);
+extern void capture_watch(struct config_t *conf, fd_set *watch, int *maxfd);
+extern int capture_drain(struct config_t *conf, fd_set *ready);
+extern void capture_take(SERIAL_INFO *port, int fd);
+extern void capture_release(SERIAL_INFO *port);
+extern int capture_replay(SERIAL_INFO *port, int sockfd, int quote);
+
+/*
+ Symbols defined in shm.c
+*/
+extern int shm_size_check(int size);
+extern int shm_port_wanted(SERIAL_INFO *port);
+extern void shm_port_settings(SERIAL_INFO *port, char *buf, int len);
+extern int shm_worker(struct config_t *conf, SERIAL_INFO *port);
+
+/*
+ Symbols defined in unix_socket.c
+*/
+extern int unix_socket_name_check(const char *name);
+extern int create_unix_server_socket(const char *name);
+extern void unix_socket_remove(const char *name);
+extern int unix_socket_users_check(const char *users);
+extern SERIAL_INFO *unix_socket_accept(struct config_t *conf, int sockfd, struct sockaddr_un *addr, socklen_t len);
+
+/*
+ Symbols defined in port_worker.c
+*/
+extern volatile sig_atomic_t port_worker_stop;
+extern int port_worker_fd;
+extern void port_worker_child(void);
+extern void port_worker_wait(void);
+extern void port_worker_sync(struct config_t *conf);
+extern void port_worker_stop_all(void);
+
+/*
+ Symbols defined in io_engine.c
+*/
+extern int io_engine_init(void);
+extern void io_engine_close(void);
+extern void io_engine_read_into(int fd, BUFFER *buff);
+extern void io_engine_accept_on(int fd);
+extern void io_engine_quiesce(int fd);
+extern void io_engine_forget(int fd);
+extern int io_engine_register_buffers(BUFFER **buffers, int nbuffers);
+extern void io_engine_unregister_buffers(void);
+extern int io_engine_read_done(int fd, BUFFER *buff, int bytes, int *n);
+extern int io_engine_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+extern int io_engine_wait(fd_set *watch, fd_set *ready, int nfds);
+
+/*
+ Symbols defined in timer_wheel.c
+*/
+extern unsigned long long timer_now(void);
+extern int timer_wheel_init(void);
+extern void timer_wheel_close(void);
+extern void timer_init(WHEEL_TIMER *timer, void (*callback)(void *), void *arg);
+extern void timer_add(WHEEL_TIMER *timer, unsigned long msecs);
+extern void timer_cancel(WHEEL_TIMER *timer);
+extern int timer_pending(WHEEL_TIMER *timer);
+extern void timer_wheel_run(void);
+
+/*
+ Symbols defined in shard.c
+*/
+extern int shard_owns(SERIAL_INFO *port);
+extern void shard_init(struct config_t *conf);
+
+/*
+ Symbols defined in reload.c
+*/
+extern int reload_configuration(void);
+
+/*
+ Symbols defined in upgrade.c
+*/
+extern int upgrade_listen(struct config_t *conf);
+extern void upgrade_close(int remove);
+extern void upgrade_handoff(struct upgrade_session_t *session);
+extern int upgrade_receive(struct config_t *conf);
+extern void upgrade_resume_session(void);
+extern int upgrade_restore_session(BUFFER *socket_to_serial_buf, BUFFER *serial_to_socket_buf, BUFFER *sabre_to_socket_buf);
+
 /*
  Symbols defined in raw.c
 */
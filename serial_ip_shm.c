@@ -0,0 +1,269 @@
+/*
+ * serial_ip_shm.c
+ *	This is the client library of the shared-memory rings of serial_ip (see serial_ip_shm.h), for the
+ *	processes on the gateway which read and write a serial port without going through a socket:
+ *	make shmlib, then link with libserial_ip_shm.a.
+ *		SIP_SHM *shm = sip_shm_open("/serial_ip.ttyS0");
+ *		n = sip_shm_read(shm, buf, sizeof(buf), 1000);		bytes, 0 on timeout, -1 once the daemon is done
+ *		n = sip_shm_write(shm, "AT\r", 3);					bytes queued, as many as there was room for
+ *	A read or a write which finds what it wants does not make a system call. When the daemon is done
+ *	with the ring (the port was changed, the daemon stopped), sip_shm_read() returns -1 once the ring
+ *	is empty: close it and open it again.
+ *	The futex helpers are used by the daemon as well.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define SIP_SHM_SPINS		1000			/* tries on out_lock before we look at its owner */
+
+/*
+	Location: serial_ip_shm.c
+	A client of a ring: where it is in the inbound ring, and what it lost.
+*/
+struct sip_shm {
+	struct sip_shm_header *h;
+	size_t length;
+	uint64_t cursor;						/* inbound position of the next byte it reads */
+	unsigned long long lost;				/* inbound bytes it missed, being too slow */
+};
+
+/*
+	Location: serial_ip_shm.c
+	This is to sleep on a shared futex for as long as it holds value, at most timeout_ms (-1 for ever).
+	returns 0 when woken up or if the value had changed already, 1 on timeout.
+*/
+int sip_futex_wait(uint32_t *futex, uint32_t value, int timeout_ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+	if (syscall(SYS_futex, futex, FUTEX_WAIT, value, (timeout_ms < 0) ? NULL : &ts, NULL, 0) < 0)
+		return((errno == ETIMEDOUT) ? 1 : 0);
+	return(0);
+}
+
+/*
+	Location: serial_ip_shm.c
+	This is to wake up to nwaiters processes asleep on a shared futex.
+*/
+void sip_futex_wake(uint32_t *futex, int nwaiters)
+{
+	syscall(SYS_futex, futex, FUTEX_WAKE, nwaiters, NULL, NULL, 0);
+}
+
+/*
+	Location: serial_ip_shm.c
+	This is to attach to a ring, by its shm_open() name. Reading starts with the live data.
+	returns the client, NULL on failure (errno is set).
+*/
+SIP_SHM *sip_shm_open(const char *name)
+{
+	struct sip_shm_header *h;
+	struct stat st;
+	SIP_SHM *shm;
+	int fd;
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return(NULL);
+	if ((fstat(fd, &st) != 0) || (st.st_size < (off_t) sizeof(struct sip_shm_header))) {
+		close(fd);
+		errno = EINVAL;
+		return(NULL);
+	}
+	h = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (h == MAP_FAILED)
+		return(NULL);
+	if ((__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SIP_SHM_MAGIC) || (h->version != SIP_SHM_VERSION) ||
+			(SIP_SHM_LENGTH(h->size) > (size_t) st.st_size)) {
+		munmap(h, st.st_size);
+		errno = EAGAIN;										/* not ready yet, or not ours */
+		return(NULL);
+	}
+	shm = calloc(1, sizeof(SIP_SHM));
+	if (shm == NULL) {
+		munmap(h, st.st_size);
+		return(NULL);
+	}
+	shm->h = h;
+	shm->length = st.st_size;
+	shm->cursor = __atomic_load_n(&h->in_head, __ATOMIC_ACQUIRE);
+	return(shm);
+}
+
+/*
+	Location: serial_ip_shm.c
+	This is to tell whether the daemon is done with a ring: it said so, or it is gone.
+	returns 1 if it is, 0 otherwise.
+*/
+static int sip_shm_closed(SIP_SHM *shm)
+{
+	if (__atomic_load_n(&shm->h->state, __ATOMIC_ACQUIRE) != SIP_SHM_RUNNING)
+		return(1);
+	return((kill(shm->h->pid, 0) != 0) && (errno == ESRCH));
+}
+
+/*
+	Location: serial_ip_shm.c
+	This is to read what the serial port read since we last did, up to len bytes, waiting at most
+	timeout_ms for it (0 not at all, -1 for ever). What the daemon overwrote while we were too slow is
+	skipped, and counted (see sip_shm_lost()).
+	returns the number of bytes read, 0 on timeout, -1 once the daemon is done with the ring.
+*/
+int sip_shm_read(SIP_SHM *shm, void *buf, size_t len, int timeout_ms)
+{
+	struct sip_shm_header *h;
+	unsigned char *data;
+	uint64_t head;
+	uint64_t reserve;
+	uint32_t futex;
+	size_t offset;
+	size_t n;
+	size_t first;
+
+	h = shm->h;
+	data = SIP_SHM_IN_DATA(h);
+	for ( ; ; ) {
+		futex = __atomic_load_n(&h->in_futex, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&h->in_head, __ATOMIC_ACQUIRE);
+		if (head - shm->cursor > h->size) {
+			shm->lost += head - shm->cursor;				/* overwritten: skip ahead to the live data */
+			shm->cursor = head;
+		}
+		if (head != shm->cursor) {
+			n = (head - shm->cursor < len) ? head - shm->cursor : len;
+			offset = shm->cursor & (h->size - 1);
+			first = (offset + n <= h->size) ? n : h->size - offset;
+			memcpy(buf, data + offset, first);
+			memcpy((unsigned char *) buf + first, data, n - first);		/* where the ring wraps */
+			/* what we copied is good if the daemon was not writing over it meanwhile */
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			reserve = __atomic_load_n(&h->in_reserve, __ATOMIC_RELAXED);
+			if (reserve - shm->cursor > h->size) {
+				shm->lost += head - shm->cursor;
+				shm->cursor = head;
+				continue;
+			}
+			shm->cursor += n;
+			return((int) n);
+		}
+		if (sip_shm_closed(shm))
+			return(-1);
+		if (timeout_ms == 0)
+			return(0);
+		__atomic_add_fetch(&h->in_waiters, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&h->in_head, __ATOMIC_SEQ_CST) == shm->cursor) {
+			if (sip_futex_wait(&h->in_futex, futex, timeout_ms) != 0) {
+				__atomic_sub_fetch(&h->in_waiters, 1, __ATOMIC_SEQ_CST);
+				if (__atomic_load_n(&h->in_head, __ATOMIC_ACQUIRE) == shm->cursor)
+					return(sip_shm_closed(shm) ? -1 : 0);
+				continue;
+			}
+		}
+		__atomic_sub_fetch(&h->in_waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/*
+	Location: serial_ip_shm.c
+	This is to take the lock of the outbound ring, which holds the pid of its owner. A producer killed
+	while it held it had not published what it copied (out_head moves last), so once its pid is gone
+	the lock is taken over from it.
+*/
+static void sip_shm_lock(struct sip_shm_header *h)
+{
+	uint32_t self;
+	uint32_t owner;
+	int spins;
+
+	self = (uint32_t) getpid();
+	for (spins = 0; ; spins++) {
+		owner = 0;
+		if (__atomic_compare_exchange_n(&h->out_lock, &owner, self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return;
+		if (spins < SIP_SHM_SPINS)
+			continue;												/* another producer is copying */
+		spins = 0;
+		if ((kill((pid_t) owner, 0) != 0) && (errno == ESRCH) &&
+				__atomic_compare_exchange_n(&h->out_lock, &owner, self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return;													/* its owner died holding it */
+		sched_yield();
+	}
+}
+
+/*
+	Location: serial_ip_shm.c
+	This is to queue bytes for the serial port, as many as there is room for: the daemon writes them to
+	the device in the order they were queued, whoever queued them.
+	returns the number of bytes queued, -1 once the daemon is done with the ring.
+*/
+int sip_shm_write(SIP_SHM *shm, const void *buf, size_t len)
+{
+	struct sip_shm_header *h;
+	unsigned char *data;
+	uint64_t head;
+	uint64_t room;
+	size_t offset;
+	size_t n;
+	size_t first;
+
+	h = shm->h;
+	if (sip_shm_closed(shm))
+		return(-1);
+	data = SIP_SHM_OUT_DATA(h);
+	sip_shm_lock(h);
+	head = h->out_head;
+	room = h->size - (head - __atomic_load_n(&h->out_tail, __ATOMIC_ACQUIRE));
+	n = (room < len) ? room : len;
+	offset = head & (h->size - 1);
+	first = (offset + n <= h->size) ? n : h->size - offset;
+	memcpy(data + offset, buf, first);
+	memcpy(data, (const unsigned char *) buf + first, n - first);
+	__atomic_store_n(&h->out_head, head + n, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&h->out_lock, 0, __ATOMIC_RELEASE);
+	if (n > 0) {
+		__atomic_add_fetch(&h->out_futex, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&h->out_waiting, __ATOMIC_SEQ_CST))
+			sip_futex_wake(&h->out_futex, 1);
+	}
+	return((int) n);
+}
+
+/*
+	Location: serial_ip_shm.c
+	This is to tell how many inbound bytes a client missed, being too slow.
+*/
+unsigned long long sip_shm_lost(SIP_SHM *shm)
+{
+	return(shm->lost);
+}
+
+/*
+	Location: serial_ip_shm.c
+	This is to detach from a ring.
+*/
+void sip_shm_close(SIP_SHM *shm)
+{
+	if (shm == NULL)
+		return;
+	munmap(shm->h, shm->length);
+	free(shm);
+}
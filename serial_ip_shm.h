@@ -0,0 +1,83 @@
+/*
+ * serial_ip_shm.h
+ *	This is the shared-memory interface of serial_ip ("shm ring" in serial_ip.conf), for the consumers
+ *	which run on the gateway itself: the daemon publishes what a serial port reads into a ring in
+ *	/dev/shm, and takes what they want written from a second one, without a socket, Telnet or a system
+ *	call per message in between. It is included by the daemon (see shm.c) and by its clients, which link
+ *	with libserial_ip_shm.a (see serial_ip_shm.c, "make shmlib").
+ *	The inbound ring has a single producer, the daemon, and any number of consumers, each with a cursor
+ *	of its own: the daemon never waits for them, a consumer which fell a whole ring behind loses what was
+ *	overwritten and skips ahead. The outbound ring has any number of producers, which take turns with a
+ *	spin lock, and the daemon as its single consumer: a producer is told how much room there was. The
+ *	lock holds the pid of its owner, so that a producer killed while it held it does not stop the others
+ *	(the producers must see each other's pids, ie. run in the same pid namespace).
+ *	Positions count every byte ever put into a ring: the byte at position p is at p % size.
+ *	Whoever waits for a ring says so and sleeps on a futex, which is bumped whenever the ring moves:
+ *	the other side only makes a system call when there is somebody to wake up.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#ifndef SERIAL_IP_SHM_H_
+#define SERIAL_IP_SHM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SIP_SHM_MAGIC		0x53495052		/* "SIPR" */
+#define SIP_SHM_VERSION		2				/* 2: out_lock holds a pid */
+#define SIP_SHM_CACHELINE	64
+
+#define SIP_SHM_RUNNING		1				/* the daemon serves the ring */
+#define SIP_SHM_CLOSED		2				/* the daemon is done with it: open it again */
+
+/*
+	Location: serial_ip_shm.h
+	The header of the shared memory, followed by the inbound data, then the outbound data. The fields
+	each side writes have a cache line of their own.
+*/
+struct sip_shm_header {
+	uint32_t magic;							/* SIP_SHM_MAGIC, written last */
+	uint32_t version;
+	uint32_t size;							/* bytes of each ring, a power of 2 */
+	uint32_t state;							/* SIP_SHM_RUNNING or SIP_SHM_CLOSED */
+	pid_t pid;								/* of the daemon process which serves it */
+	char device[128];						/* the serial device, for information */
+
+	/* inbound, written by the daemon */
+	uint64_t in_reserve __attribute__((aligned(SIP_SHM_CACHELINE)));	/* the daemon writes up to there */
+	uint64_t in_head;						/* bytes ever published */
+	uint32_t in_futex;						/* bumped whenever in_head moves */
+	/* inbound, written by the consumers */
+	uint32_t in_waiters __attribute__((aligned(SIP_SHM_CACHELINE)));	/* consumers asleep on in_futex */
+
+	/* outbound, written by the producers */
+	uint32_t out_lock __attribute__((aligned(SIP_SHM_CACHELINE)));	/* pid of the producer which writes, 0 if none */
+	uint64_t out_head;						/* bytes ever queued */
+	uint32_t out_futex;						/* bumped whenever out_head moves */
+	/* outbound, written by the daemon */
+	uint64_t out_tail __attribute__((aligned(SIP_SHM_CACHELINE)));	/* bytes ever written to the device */
+	uint32_t out_waiting;					/* the daemon is asleep on out_futex */
+} __attribute__((aligned(SIP_SHM_CACHELINE)));
+
+#define SIP_SHM_IN_DATA(h)		((unsigned char *) (h) + sizeof(struct sip_shm_header))
+#define SIP_SHM_OUT_DATA(h)		(SIP_SHM_IN_DATA(h) + (h)->size)
+#define SIP_SHM_LENGTH(size)	(sizeof(struct sip_shm_header) + 2 * (size_t) (size))
+
+/*
+	Location: serial_ip_shm.h
+	A client of a ring, see serial_ip_shm.c.
+*/
+typedef struct sip_shm SIP_SHM;
+
+extern int sip_futex_wait(uint32_t *futex, uint32_t value, int timeout_ms);
+extern void sip_futex_wake(uint32_t *futex, int nwaiters);
+
+extern SIP_SHM *sip_shm_open(const char *name);
+extern int sip_shm_read(SIP_SHM *shm, void *buf, size_t len, int timeout_ms);
+extern int sip_shm_write(SIP_SHM *shm, const void *buf, size_t len);
+extern unsigned long long sip_shm_lost(SIP_SHM *shm);
+extern void sip_shm_close(SIP_SHM *shm);
+
+#endif /* SERIAL_IP_SHM_H_ */
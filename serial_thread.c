@@ -0,0 +1,457 @@
+/*
+ * serial_thread.c
+ *	This is to drain the serial device independently of the network ("serial thread" in serial_ip.conf).
+ *	While a Telnet session runs, a helper thread, real-time if we are allowed to, owns all reads and
+ *	writes of the serial device. It reads the device into an inbound ring as soon as data arrives, and
+ *	writes the outbound ring to the device as the device takes it. The session loop only copies from and
+ *	into the rings, so a slow write() to the socket no longer holds up the UART; the kernel tty buffer
+ *	is emptied at the pace of the device, and the inbound ring takes up what the network cannot take yet.
+ *	Each ring has one producer and one consumer, so they need no lock: the producer publishes its head,
+ *	the consumer its tail, with release/acquire ordering.
+ *	The thread writes into serial_thread_fd (an eventfd) when there is data for the session, when the
+ *	outbound ring has room again, and on EOF or error. The session writes into the wake eventfd of the
+ *	thread when it has queued output or made room in a full inbound ring.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#define _GNU_SOURCE
+#include "serial_ip.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+/*
+	Location: serial_thread.c
+	A single-producer/single-consumer byte ring. size is a power of two; head and tail run freely
+	and are masked on use, so head - tail is the number of bytes in the ring.
+*/
+struct spsc_ring_t {
+	unsigned char *data;
+	unsigned int size;
+	unsigned int head;						/* written by the producer only */
+	unsigned int tail;						/* written by the consumer only */
+	int arena;								/* data comes from session_arena.c */
+};
+
+int serial_thread_fd = -1;					/* readable when the session has something to do */
+
+static struct spsc_ring_t serial_ring_in;
+static struct spsc_ring_t serial_ring_out;
+static int serial_thread_wake = -1;			/* eventfd the thread waits on */
+static int serial_thread_serial_fd = -1;
+static int serial_thread_flags = -1;		/* file status flags of the device before we started */
+static int serial_thread_running = 0;
+static int serial_thread_stopping = 0;
+static int serial_thread_in_blocked = 0;	/* the inbound ring was full, the thread waits for room */
+static int serial_thread_out_waiting = 0;	/* the session waits for room in the outbound ring */
+static int serial_thread_eof = 0;
+static int serial_thread_error = 0;			/* errno of a failed read or write */
+static pthread_t serial_thread_tid;
+
+/*
+	Location: serial_thread.c
+	This is to set up a ring of size bytes, in storage from the arena if we are given some.
+	returns 0 on success, 1 on failure.
+*/
+static int spsc_ring_init(struct spsc_ring_t *ring, unsigned int size, unsigned char *storage)
+{
+	ring->arena = (storage != NULL);
+	ring->data = (storage != NULL) ? storage : malloc(size);
+	if (ring->data == NULL)
+		return(1);
+	ring->size = size;
+	ring->head = ring->tail = 0;
+	return(0);
+}
+
+/*
+	Location: serial_thread.c
+	This is to release a ring.
+*/
+static void spsc_ring_free(struct spsc_ring_t *ring)
+{
+	if ((ring->data != NULL) && ! ring->arena)
+		free(ring->data);
+	memset(ring, 0, sizeof(struct spsc_ring_t));
+}
+
+/*
+	Location: serial_thread.c
+	This is for the producer: where the next bytes go, and how many fit there in one piece.
+	returns a pointer into the ring, with *room set (0 if the ring is full).
+*/
+static unsigned char *spsc_ring_room(struct spsc_ring_t *ring, unsigned int *room)
+{
+	unsigned int head = ring->head;
+	unsigned int used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	unsigned int offset = head & (ring->size - 1);
+
+	*room = MIN(ring->size - used, ring->size - offset);
+	return(ring->data + offset);
+}
+
+/*
+	Location: serial_thread.c
+	This is for the producer: hand n bytes written at spsc_ring_room() over to the consumer.
+*/
+static void spsc_ring_produce(struct spsc_ring_t *ring, unsigned int n)
+{
+	__atomic_store_n(&ring->head, ring->head + n, __ATOMIC_RELEASE);
+}
+
+/*
+	Location: serial_thread.c
+	This is for the consumer: where the next bytes are, and how many of them are in one piece.
+	returns a pointer into the ring, with *avail set (0 if the ring is empty).
+*/
+static unsigned char *spsc_ring_data(struct spsc_ring_t *ring, unsigned int *avail)
+{
+	unsigned int tail = ring->tail;
+	unsigned int used = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+	unsigned int offset = tail & (ring->size - 1);
+
+	*avail = MIN(used, ring->size - offset);
+	return(ring->data + offset);
+}
+
+/*
+	Location: serial_thread.c
+	This is for the consumer: give n bytes read at spsc_ring_data() back to the producer.
+*/
+static void spsc_ring_consume(struct spsc_ring_t *ring, unsigned int n)
+{
+	__atomic_store_n(&ring->tail, ring->tail + n, __ATOMIC_RELEASE);
+}
+
+/*
+	Location: serial_thread.c
+	This is to write into an eventfd.
+*/
+static void serial_thread_notify(int fd)
+{
+	unsigned long long one = 1;
+
+	if (write(fd, &one, sizeof(one)) < 0)
+		;												/* the counter is set already */
+}
+
+/*
+	Location: serial_thread.c
+	This is the helper thread: it moves bytes between the device and the rings until it is stopped, or
+	the device gives EOF or an error.
+*/
+static void *serial_thread_main(void *arg)
+{
+	extern int serial_thread_fd;
+	struct pollfd pfd[2];
+	unsigned long long count;
+	unsigned char *p;
+	unsigned int room;
+	unsigned int avail;
+	int reading = 1;
+	int n;
+
+	for ( ; ; ) {
+		pfd[0].fd = serial_thread_serial_fd;
+		pfd[0].events = 0;
+		spsc_ring_room(&serial_ring_in, &room);
+		if (reading && (room == 0)) {
+			/* ask for a wake up, then look again: the session may have made room in between */
+			__atomic_store_n(&serial_thread_in_blocked, 1, __ATOMIC_SEQ_CST);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			spsc_ring_room(&serial_ring_in, &room);
+		}
+		if (reading && (room > 0))
+			pfd[0].events |= POLLIN;
+		spsc_ring_data(&serial_ring_out, &avail);
+		if (avail > 0)
+			pfd[0].events |= POLLOUT;
+		if (pfd[0].events == 0)
+			pfd[0].fd = -1;								/* POLLHUP would wake us up for nothing */
+		pfd[1].fd = serial_thread_wake;
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (pfd[1].revents & POLLIN) {
+			if (read(serial_thread_wake, &count, sizeof(count)) < 0)
+				;
+		}
+		if (__atomic_load_n(&serial_thread_stopping, __ATOMIC_ACQUIRE))
+			break;
+		if (pfd[0].revents & (POLLIN|POLLHUP|POLLERR)) {
+			p = spsc_ring_room(&serial_ring_in, &room);
+			if (room > 0) {
+				n = read(serial_thread_serial_fd, p, room);
+				if (n > 0) {
+					spsc_ring_produce(&serial_ring_in, n);
+					serial_thread_notify(serial_thread_fd);
+				} else if ((n == 0) || ((errno != EAGAIN) && (errno != EINTR))) {
+					if (n < 0)
+						__atomic_store_n(&serial_thread_error, errno, __ATOMIC_RELEASE);
+					__atomic_store_n(&serial_thread_eof, 1, __ATOMIC_RELEASE);
+					serial_thread_notify(serial_thread_fd);
+					reading = 0;
+				}
+			}
+		}
+		if (pfd[0].revents & POLLOUT) {
+			p = spsc_ring_data(&serial_ring_out, &avail);
+			if (avail > 0) {
+				n = write(serial_thread_serial_fd, p, avail);
+				if (n > 0) {
+					spsc_ring_consume(&serial_ring_out, n);
+					__atomic_thread_fence(__ATOMIC_SEQ_CST);
+					if (__atomic_exchange_n(&serial_thread_out_waiting, 0, __ATOMIC_SEQ_CST))
+						serial_thread_notify(serial_thread_fd);		/* the session can write on */
+				} else if ((n < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+					__atomic_store_n(&serial_thread_error, errno, __ATOMIC_RELEASE);
+					__atomic_store_n(&serial_thread_eof, 1, __ATOMIC_RELEASE);
+					serial_thread_notify(serial_thread_fd);
+					break;
+				}
+			}
+		}
+	}
+	return(NULL);
+}
+
+/*
+	Location: serial_thread.c
+	This is to start the thread of the session, once the rings are set up. It runs SCHED_FIFO at
+	SERIAL_THREAD_PRIORITY if we may, as an ordinary thread otherwise. A session which runs with the
+	real-time scheduling of its port (port_sched.c) passes it on to the thread instead.
+	returns 0 on success, 1 on failure.
+*/
+static int serial_thread_spawn(void)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	sigset_t all, old;
+	int ret;
+
+	__atomic_store_n(&serial_thread_stopping, 0, __ATOMIC_RELEASE);
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);					/* signals are for the session */
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = SERIAL_THREAD_PRIORITY;
+	pthread_attr_setschedparam(&attr, &param);
+	if (sched_getscheduler(0) != SCHED_OTHER)
+		ret = pthread_create(&serial_thread_tid, NULL, serial_thread_main, NULL);	/* inherits it */
+	else
+		ret = pthread_create(&serial_thread_tid, &attr, serial_thread_main, NULL);
+	if (ret == EPERM) {
+		syslog(LOG_DEBUG, "serial_thread.c: serial_thread_spawn(): no real-time priority, running as an ordinary thread");
+		ret = pthread_create(&serial_thread_tid, NULL, serial_thread_main, NULL);
+	}
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0) {
+		syslog(LOG_ERR, "serial_thread.c: serial_thread_spawn(): pthread_create() error: %s", strerror(ret));
+		return(1);
+	}
+	serial_thread_running = 1;
+	return(0);
+}
+
+/*
+	Location: serial_thread.c
+	This is to hand the serial device of a session over to the thread.
+	returns 0 on success, 1 on failure (the session then reads and writes the device itself).
+*/
+int serial_thread_start(int serial_file_descriptor)
+{
+	extern int serial_thread_fd;
+	unsigned char *ring_in = NULL;
+	unsigned char *ring_out = NULL;
+
+	serial_thread_release();
+	session_arena_rings(&ring_in, &ring_out);								/* deterministic memory? */
+	if ((spsc_ring_init(&serial_ring_in, SERIAL_RING_IN, ring_in) != 0) || (spsc_ring_init(&serial_ring_out, SERIAL_RING_OUT, ring_out) != 0)) {
+		syslog(LOG_ERR, "serial_thread.c: serial_thread_start(): cannot allocate the rings");
+		serial_thread_release();
+		return(1);
+	}
+	serial_thread_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	serial_thread_wake = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if ((serial_thread_fd < 0) || (serial_thread_wake < 0)) {
+		syslog(LOG_ERR, "serial_thread.c: serial_thread_start(): eventfd() error: %s", strerror(errno));
+		serial_thread_release();
+		return(1);
+	}
+	serial_thread_serial_fd = serial_file_descriptor;
+	serial_thread_flags = fcntl(serial_file_descriptor, F_GETFL, 0);
+	if (serial_thread_flags != -1)
+		fcntl(serial_file_descriptor, F_SETFL, serial_thread_flags | O_NONBLOCK);	/* the thread never blocks in write() */
+	serial_thread_eof = serial_thread_error = 0;
+	serial_thread_in_blocked = serial_thread_out_waiting = 0;
+	if (serial_thread_spawn() != 0) {
+		serial_thread_release();
+		return(1);
+	}
+	syslog(LOG_INFO, "serial_thread.c: serial_thread_start(): serial fd %d is served by its own thread", serial_file_descriptor);
+	return(0);
+}
+
+/*
+	Location: serial_thread.c
+	This is to stop the thread. What is left in the outbound ring is written to the device as far as it
+	takes it without waiting; the inbound ring keeps its data for serial_thread_read().
+*/
+void serial_thread_stop(void)
+{
+	unsigned char *p;
+	unsigned int avail;
+	int n;
+
+	if (! serial_thread_running)
+		return;
+	__atomic_store_n(&serial_thread_stopping, 1, __ATOMIC_RELEASE);
+	serial_thread_notify(serial_thread_wake);
+	pthread_join(serial_thread_tid, NULL);
+	serial_thread_running = 0;
+	while ((p = spsc_ring_data(&serial_ring_out, &avail)), avail > 0) {
+		n = write(serial_thread_serial_fd, p, avail);
+		if (n <= 0)
+			break;
+		spsc_ring_consume(&serial_ring_out, n);
+	}
+}
+
+/*
+	Location: serial_thread.c
+	This is to start the thread again after serial_thread_stop(), eg. when an upgrade failed.
+	returns 0 on success, 1 on failure.
+*/
+int serial_thread_resume(void)
+{
+	if (serial_thread_running || (serial_thread_serial_fd < 0))
+		return(serial_thread_running ? 0 : 1);
+	return(serial_thread_spawn());
+}
+
+/*
+	Location: serial_thread.c
+	This is to stop the thread and release everything, at the end of a session. The device gets its
+	file status flags back.
+*/
+void serial_thread_release(void)
+{
+	extern int serial_thread_fd;
+
+	serial_thread_stop();
+	if ((serial_thread_serial_fd >= 0) && (serial_thread_flags != -1))
+		fcntl(serial_thread_serial_fd, F_SETFL, serial_thread_flags);
+	if (serial_thread_fd >= 0) {
+		io_engine_forget(serial_thread_fd);
+		close(serial_thread_fd);
+	}
+	if (serial_thread_wake >= 0)
+		close(serial_thread_wake);
+	serial_thread_fd = serial_thread_wake = -1;
+	serial_thread_serial_fd = -1;
+	serial_thread_flags = -1;
+	spsc_ring_free(&serial_ring_in);
+	spsc_ring_free(&serial_ring_out);
+}
+
+/*
+	Location: serial_thread.c
+	This is the read hook of read_from_fd_to_buffer(): reads of the device of the thread are served from
+	the inbound ring. When the ring is empty we say EAGAIN, or give the EOF or error of the thread.
+	returns 1 if fd is ours, with *n set as read() would, 0 otherwise.
+*/
+int serial_thread_read(int fd, unsigned char *ptr, int bytes, int *n)
+{
+	extern int serial_thread_fd;
+	unsigned long long count;
+	unsigned char *p;
+	unsigned int avail;
+	int copied = 0;
+
+	if ((fd != serial_thread_serial_fd) || (serial_ring_in.data == NULL))
+		return(0);
+	if (serial_thread_running && (read(serial_thread_fd, &count, sizeof(count)) < 0))
+		;												/* not set, eg. we were woken for output room */
+	while (copied < bytes) {
+		p = spsc_ring_data(&serial_ring_in, &avail);
+		if (avail == 0)
+			break;
+		avail = MIN(avail, (unsigned int) (bytes - copied));
+		memcpy(ptr + copied, p, avail);
+		spsc_ring_consume(&serial_ring_in, avail);
+		copied += avail;
+	}
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&serial_thread_in_blocked, 0, __ATOMIC_SEQ_CST) && serial_thread_running)
+		serial_thread_notify(serial_thread_wake);		/* there is room again */
+	spsc_ring_data(&serial_ring_in, &avail);
+	if ((avail > 0) && serial_thread_running)
+		serial_thread_notify(serial_thread_fd);			/* our buffer is full, come back for the rest */
+	if (copied > 0) {
+		*n = copied;
+	} else if (! serial_thread_running) {
+		return(0);										/* the ring is empty, read the device itself */
+	} else if (__atomic_load_n(&serial_thread_eof, __ATOMIC_ACQUIRE)) {
+		errno = __atomic_load_n(&serial_thread_error, __ATOMIC_ACQUIRE);
+		*n = (errno != 0) ? -1 : 0;
+	} else {
+		errno = EAGAIN;
+		*n = -1;
+	}
+	return(1);
+}
+
+/*
+	Location: serial_thread.c
+	This is the write hook of write_from_buffer_to_fd(): writes to the device of the thread are queued on
+	the outbound ring. When it is full we say EAGAIN, and the thread wakes us up once it has room.
+	returns 1 if fd is ours, with *n set as write() would, 0 otherwise.
+*/
+int serial_thread_write(int fd, unsigned char *ptr, int bytes, int *n)
+{
+	unsigned char *p;
+	unsigned int room;
+	int copied = 0;
+
+	if ((fd != serial_thread_serial_fd) || (! serial_thread_running))
+		return(0);
+	if (__atomic_load_n(&serial_thread_eof, __ATOMIC_ACQUIRE) && (serial_thread_error != 0)) {
+		errno = serial_thread_error;
+		*n = -1;
+		return(1);
+	}
+	while (copied < bytes) {
+		p = spsc_ring_room(&serial_ring_out, &room);
+		if (room == 0)
+			break;
+		room = MIN(room, (unsigned int) (bytes - copied));
+		memcpy(p, ptr + copied, room);
+		spsc_ring_produce(&serial_ring_out, room);
+		copied += room;
+	}
+	if (copied < bytes) {
+		/* ask for a wake up, then look again: the thread may have made room in between */
+		__atomic_store_n(&serial_thread_out_waiting, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		spsc_ring_room(&serial_ring_out, &room);
+		if (room > 0)
+			serial_thread_notify(serial_thread_fd);
+	}
+	if (copied > 0) {
+		serial_thread_notify(serial_thread_wake);
+		*n = copied;
+	} else {
+		errno = EAGAIN;
+		*n = -1;
+	}
+	return(1);
+}
@@ -0,0 +1,207 @@
+/*
+ * session_arena.c
+ *	This is the memory of the "deterministic memory" mode. At startup, everything a session needs is
+ *	carved out of one arena, mapped and populated in one go: the three session buffers, the rings of the
+ *	serial thread, and the CPC signature of each port, formatted ahead. mlockall(MCL_CURRENT|MCL_FUTURE)
+ *	then keeps it, and whatever we map later, in RAM. A session started in this mode does not call
+ *	malloc(), and once it runs it takes no page faults.
+ *	A process serves one session at a time, so one set of session buffers is enough; a concurrent server
+ *	child gets a copy of the arena through fork() and locks it again (memory locks are not inherited),
+ *	which faults it in before the session starts. The iterative server avoids the fork altogether.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+#include <sys/mman.h>
+
+#define ARENA_SIGNATURE_MAX		256			/* room for the signature of a port */
+#define ARENA_STACK_PREFAULT	65536		/* stack we touch, so it is mapped before we lock it */
+
+static unsigned char *arena = NULL;
+static size_t arena_size = 0;
+static size_t arena_used = 0;
+static BUFFER arena_buffers[3];
+static unsigned char *arena_ring_in = NULL;
+static unsigned char *arena_ring_out = NULL;
+static char *arena_signatures = NULL;		/* ARENA_SIGNATURE_MAX bytes per port slot */
+static int *arena_signature_len = NULL;	/* -1 if the slot has no signature */
+static int arena_nsignatures = 0;
+
+/*
+	Location: session_arena.c
+	This is to take size bytes from the arena, aligned for any use.
+	returns a pointer into the arena.
+*/
+static void *session_arena_take(size_t size)
+{
+	void *p;
+
+	p = arena + arena_used;
+	arena_used += (size + 15) & ~((size_t) 15);
+	return(p);
+}
+
+/*
+	Location: session_arena.c
+	This is to touch the stack we may use, so mlockall() maps it now and not on the hot path.
+*/
+static void session_arena_prefault_stack(void)
+{
+	volatile unsigned char stack[ARENA_STACK_PREFAULT];
+
+	memset((unsigned char *) stack, 0, sizeof(stack));
+}
+
+/*
+	Location: session_arena.c
+	This is to lock our memory, now and what we map later.
+	returns 0 on success, 1 on failure.
+*/
+static int session_arena_lock(void)
+{
+	extern int errno;
+
+	session_arena_prefault_stack();
+	if (mlockall(MCL_CURRENT|MCL_FUTURE) < 0) {
+		syslog(LOG_ERR, "session_arena.c: session_arena_lock(): mlockall() error: %s%s", strerror(errno),
+				((errno == EPERM) || (errno == ENOMEM)) ? " (needs CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK)" : "");
+		return(1);
+	}
+	return(0);
+}
+
+/*
+	Location: session_arena.c
+	This is to set up the arena and lock our memory, once serial_ip.conf has been read. Nothing happens
+	unless "deterministic memory" is set.
+	returns 0 on success, 1 on failure (sessions then allocate as usual).
+*/
+int session_arena_init(struct config_t *conf)
+{
+	extern int errno;
+	int i;
+
+	if (! conf->deterministic_memory)
+		return(0);
+	arena_nsignatures = ((conf->ports.nslots / PORT_CHUNK) + 1) * PORT_CHUNK;	/* room for hotplug ports */
+	arena_size = 3 * ((SIZE_BUFFER + 1 + 15) & ~15) + SERIAL_RING_IN + SERIAL_RING_OUT +
+			arena_nsignatures * (ARENA_SIGNATURE_MAX + sizeof(int)) + 16;
+	arena = mmap(NULL, arena_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+	if (arena == MAP_FAILED) {
+		syslog(LOG_ERR, "session_arena.c: session_arena_init(): mmap(%lu) error: %s", (unsigned long) arena_size, strerror(errno));
+		arena = NULL;
+		return(1);
+	}
+	for (i = 0; i < 3; i++) {
+		memset(&arena_buffers[i], 0, sizeof(BUFFER));
+		arena_buffers[i].size = SIZE_BUFFER;
+		arena_buffers[i].buffp = session_arena_take(SIZE_BUFFER + 1);
+		arena_buffers[i].arena = 1;
+	}
+	arena_buffers[0].label = (unsigned char *) "network";
+	arena_buffers[1].label = (unsigned char *) "serial";
+	arena_buffers[2].label = (unsigned char *) "sabre";
+	arena_ring_in = session_arena_take(SERIAL_RING_IN);
+	arena_ring_out = session_arena_take(SERIAL_RING_OUT);
+	arena_signatures = session_arena_take(arena_nsignatures * ARENA_SIGNATURE_MAX);
+	arena_signature_len = session_arena_take(arena_nsignatures * sizeof(int));
+	session_arena_refresh(conf);
+	session_arena_lock();
+	syslog(LOG_INFO, "session_arena.c: session_arena_init(): %lu byte arena, signatures for %d port(s)",
+			(unsigned long) arena_size, arena_nsignatures);
+	return(0);
+}
+
+/*
+	Location: session_arena.c
+	This is to format the signature of a port ahead, eg. when it is attached or reloaded. A port which
+	does not fit in the arena formats it when it is asked for, as without the arena.
+*/
+void session_arena_signature_update(SERIAL_INFO *port)
+{
+	int len;
+
+	if ((arena == NULL) || (port == NULL) || (port->index < 0))
+		return;
+	if (port->index >= arena_nsignatures) {
+		syslog(LOG_INFO, "session_arena.c: session_arena_signature_update(): no room for the signature of %s", port->device);
+		return;
+	}
+	len = telnet_cpc_signature(port, arena_signatures + port->index * ARENA_SIGNATURE_MAX, ARENA_SIGNATURE_MAX);
+	arena_signature_len[port->index] = MIN(len, ARENA_SIGNATURE_MAX - 1);
+}
+
+/*
+	Location: session_arena.c
+	This is to format the signatures of all ports ahead.
+*/
+void session_arena_refresh(struct config_t *conf)
+{
+	int i;
+
+	if (arena == NULL)
+		return;
+	for (i = 0; i < arena_nsignatures; i++)
+		arena_signature_len[i] = -1;
+	for (i = 0; i < conf->ports.nslots; i++)
+		session_arena_signature_update(port_registry_at(&conf->ports, i));
+}
+
+/*
+	Location: session_arena.c
+	This is to get the signature of a port, formatted ahead.
+	returns a pointer to it, with *len set, NULL if there is none.
+*/
+char *session_arena_signature(SERIAL_INFO *port, int *len)
+{
+	if ((arena == NULL) || (port == NULL) || (port->index < 0) || (port->index >= arena_nsignatures) ||
+		(arena_signature_len[port->index] < 0))
+		return(NULL);
+	*len = arena_signature_len[port->index];
+	return(arena_signatures + port->index * ARENA_SIGNATURE_MAX);
+}
+
+/*
+	Location: session_arena.c
+	This is to get the three session buffers from the arena, emptied.
+	returns 0 on success, 1 if there is no arena.
+*/
+int session_arena_buffers(BUFFER **buffers)
+{
+	int i;
+
+	if (arena == NULL)
+		return(1);
+	for (i = 0; i < 3; i++) {
+		arena_buffers[i].eof = 0;
+		bfinit(&arena_buffers[i]);
+		buffers[i] = &arena_buffers[i];
+	}
+	return(0);
+}
+
+/*
+	Location: session_arena.c
+	This is to get the storage of the serial thread rings from the arena.
+	returns 0 on success, 1 if there is no arena.
+*/
+int session_arena_rings(unsigned char **ring_in, unsigned char **ring_out)
+{
+	if (arena == NULL)
+		return(1);
+	*ring_in = arena_ring_in;
+	*ring_out = arena_ring_out;
+	return(0);
+}
+
+/*
+	Location: session_arena.c
+	This is for a concurrent server child, right after fork(): memory locks are not inherited.
+*/
+void session_arena_child(void)
+{
+	if (arena != NULL)
+		session_arena_lock();
+}
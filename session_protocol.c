@@ -0,0 +1,200 @@
+/*
+ * session_protocol.c
+ *	This is the data path of each protocol a serial port may speak, set per port with "protocol":
+ *	- telnet: Telnet with RFC2217 Com Port Control (telnet.c, telnet_engine.c).
+ *	- raw: the bytes as they are, both ways, through the session buffers.
+ *	- framed: a command per read, paced, as the raw TCP gateway has always done (raw.c).
+ *	A port which does not say follows the server type: framed for a "raw TCP gateway", Telnet otherwise.
+ *	A session binds to the data path of its port when it starts, so the session loop calls it without
+ *	asking which protocol it speaks, and one daemon serves Telnet and raw ports side by side. The ports
+ *	of a pool share a listener, they had better speak the same protocol.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+/*
+	Location: session_protocol.c
+	This is to start a Telnet session: bind the engine to it and, unless the previous binary had
+	negotiated it already (see upgrade.c), send the initial options.
+*/
+static void session_telnet_start(SESSION_IO *io, int resumed)
+{
+	extern int noquote;					/* don't quote IAC chars from serial lines */
+
+	io->quote = ! noquote;
+	telnet_attach(io->sockfd, io->serial_fd, io->sabre_to_socket_buf);
+	if (! resumed)
+		telnet_init();
+}
+
+/*
+	Location: session_protocol.c
+	This is to read the socket into socket_to_serial_buf and write what we have to the serial device.
+	returns 0 on success, 1 on failure (including EOF)
+*/
+static int session_buffered_socket(SESSION_IO *io)
+{
+	int error;
+
+	error = read_socket(io->sockfd, io->socket_to_serial_buf);
+	if (! error)
+		error = write_serial(io->serial_fd, io->socket_to_serial_buf);
+	return(error);
+}
+
+/*
+	Location: session_protocol.c
+	This is the same for a Telnet session, whose commands are taken out of what was read.
+	returns 0 on success, 1 on failure (including EOF)
+*/
+static int session_telnet_socket(SESSION_IO *io)
+{
+	unsigned char *data;
+	int nbuffered;
+	int error;
+
+	data = io->socket_to_serial_buf->readp;							/* where the new bytes go */
+	nbuffered = io->socket_to_serial_buf->nbuffered;
+	error = read_socket(io->sockfd, io->socket_to_serial_buf);
+	if ((! error) && (io->socket_to_serial_buf->nbuffered > nbuffered))
+		process_telnet_options(io->socket_to_serial_buf, data, io->socket_to_serial_buf->nbuffered - nbuffered);
+	if (! error)
+		error = write_serial(io->serial_fd, io->socket_to_serial_buf);
+	return(error);
+}
+
+/*
+	Location: session_protocol.c
+	This is to read the serial device into serial_to_socket_buf and write what we have to the socket.
+	The serial thread also wakes us up when it has room for what we could not queue.
+	returns 0 on success, 1 on failure (including EOF)
+*/
+static int session_buffered_serial(SESSION_IO *io)
+{
+	int error;
+
+	error = read_serial(io->serial_fd, io->serial_to_socket_buf, io->quote);
+	if (! error)
+		error = write_socket(io->sockfd, io->serial_to_socket_buf);
+	if ((! error) && (io->serial_watch_fd != io->serial_fd) && (bf_get_nbytes_active(io->socket_to_serial_buf) > 0))
+		error = write_serial(io->serial_fd, io->socket_to_serial_buf);
+	return(error);
+}
+
+/*
+	Location: session_protocol.c
+	This is to tell the Telnet client about modem line and line state changes.
+*/
+static void session_telnet_state_changed(SESSION_IO *io)
+{
+	advise_client_of_state_changes(io->serial_fd);
+}
+
+/*
+	Location: session_protocol.c
+	This is to ask the idle Telnet client to log out.
+*/
+static void session_telnet_idle(SESSION_IO *io)
+{
+	send_telnet_option(DO, TELOPT_LOGOUT);
+}
+
+/*
+	Location: session_protocol.c
+	This is to pass a command from the socket to the serial device, framed as raw.c does.
+	returns 0 on success, 1 on failure (including EOF)
+*/
+static int session_framed_socket(SESSION_IO *io)
+{
+	extern SERIAL_INFO *si;
+	int error;
+
+	error = raw_TCP_socket_to_serial(io->sockfd, io->serial_fd, NULL, 0);
+	if (! error)
+		socket_profile_read(si, io->sockfd);						/* as read_socket() does */
+	return(error);
+}
+
+/*
+	Location: session_protocol.c
+	This is to pass what the serial device answered to the socket, framed as raw.c does.
+	returns 0 on success, 1 on failure
+*/
+static int session_framed_serial(SESSION_IO *io)
+{
+	syslog(LOG_INFO, "session_protocol.c: session_framed_serial(): now, read data on serial port and send to TCP socket");
+	return(raw_data_to_TCP_socket(io->serial_fd, io->sockfd, NULL, 0));
+}
+
+/*
+	Location: session_protocol.c
+	This is for what a protocol does not do.
+*/
+static void session_nothing(SESSION_IO *io)
+{
+}
+
+/*
+	Location: session_protocol.c
+	This is the start of a protocol with nothing to negotiate.
+*/
+static void session_no_start(SESSION_IO *io, int resumed)
+{
+}
+
+/*
+	Location: session_protocol.c
+	The data paths, by PORT_PROTOCOL_* - 1.
+*/
+static SESSION_PROTOCOL session_protocols[PORT_PROTOCOLS] = {
+	{"telnet", 1, 1, 0, session_telnet_start, session_telnet_socket, session_buffered_serial,
+			session_telnet_state_changed, session_telnet_idle},
+	{"raw", 1, 0, 0, session_no_start, session_buffered_socket, session_buffered_serial,
+			session_nothing, session_nothing},
+	{"framed", 0, 0, RAW_WRITE_PACING, session_no_start, session_framed_socket, session_framed_serial,
+			session_nothing, session_nothing},
+};
+
+/*
+	Location: session_protocol.c
+	This is to get the data path of the sessions of a port.
+	returns the data path, never NULL.
+*/
+SESSION_PROTOCOL *session_protocol(SERIAL_INFO *port)
+{
+	extern struct config_t conf;
+	int protocol;
+
+	protocol = (port != NULL) ? port->protocol : PORT_PROTOCOL_DEFAULT;
+	if ((protocol < PORT_PROTOCOL_TELNET) || (protocol > PORT_PROTOCOLS)) {
+		if ((conf.server_type != NULL) && (strcmp(conf.server_type, "raw TCP gateway") == 0))
+			protocol = PORT_PROTOCOL_FRAMED;
+		else
+			protocol = PORT_PROTOCOL_TELNET;
+	}
+	return(&session_protocols[protocol - 1]);
+}
+
+/*
+	Location: session_protocol.c
+	This is to parse a "protocol" value: telnet, raw, framed or default.
+	returns 0 on success, 1 on failure.
+*/
+int session_protocol_parse(const char *value, int *protocol)
+{
+	int i;
+
+	if (strcasecmp(value, "default") == 0) {
+		*protocol = PORT_PROTOCOL_DEFAULT;
+		return(0);
+	}
+	for (i = 0; i < PORT_PROTOCOLS; i++) {
+		if (strcasecmp(value, session_protocols[i].name) == 0) {
+			*protocol = i + 1;
+			return(0);
+		}
+	}
+	return(1);
+}
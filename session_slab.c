@@ -0,0 +1,209 @@
+/*
+ * session_slab.c
+ *	This is the allocator of the session buffers. bfmalloc() takes four trips to the heap for a buffer
+ *	(structure, data, label, and as many to free it) and a session has three of them, which fragments
+ *	the heap of a small board when clients come and go all day.
+ *	A session takes instead one slab: a small header holding its three BUFFER's, and one mapping holding
+ *	their data, each buffer on a cache line of its own. Slabs come in size classes, powers of two from
+ *	SLAB_MIN_SIZE to SLAB_MAX_SIZE, by the size asked for the buffers; a released slab goes on the free
+ *	list of its class and serves the next session. A class keeps at most SLAB_KEEP slabs there, the
+ *	rest are unmapped.
+ *	The data pages are only backed when traffic touches them. session_slab_trim() hands them back to the
+ *	kernel once the buffers are empty, so an idle session costs its header and its Telnet state, a few
+ *	hundred bytes; a free slab costs its header.
+ *	The counters of each class are logged with SIGUSR1 (see signal_handle.c).
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+#include <sys/mman.h>
+
+#define SLAB_ALIGN			64					/* a cache line */
+#define SLAB_MIN_SHIFT		10					/* 1 KB */
+#define SLAB_MAX_SHIFT		16					/* 64 KB */
+#define SLAB_MIN_SIZE		(1 << SLAB_MIN_SHIFT)
+#define SLAB_MAX_SIZE		(1 << SLAB_MAX_SHIFT)
+#define SLAB_CLASSES		(SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define SLAB_KEEP			4					/* free slabs a class holds on to */
+#define SLAB_ROUND(n)		(((n) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+
+/*
+	Location: session_slab.c
+	A size class: its free list and its counters.
+*/
+struct slab_class_t {
+	SESSION_SLAB *free;						/* released slabs, ready for reuse */
+	int nfree;
+	unsigned long allocs;					/* slabs handed out */
+	unsigned long reused;					/* of which from the free list */
+	unsigned long released;					/* slabs given back */
+	unsigned long unmapped;					/* of which returned to the system */
+	unsigned long trims;					/* data of an idle session returned to the kernel */
+	int inuse;								/* slabs held by sessions now */
+};
+
+static struct slab_class_t slab_classes[SLAB_CLASSES];
+
+/*
+	Location: session_slab.c
+	This is to find the size class of a buffer size.
+	returns the class, -1 if the size is too large.
+*/
+static int session_slab_class(int size)
+{
+	int class = 0;
+
+	while ((SLAB_MIN_SIZE << class) < size) {
+		if (++class >= SLAB_CLASSES)
+			return(-1);
+	}
+	return(class);
+}
+
+/*
+	Location: session_slab.c
+	This is to empty the buffers of a slab. The data is zero-filled already (fresh or trimmed pages),
+	so unlike bfinit() we do not touch it.
+*/
+static void session_slab_reset(SESSION_SLAB *slab)
+{
+	BUFFER *buff;
+	int i;
+
+	for (i = 0; i < SESSION_SLAB_NBUFFERS; i++) {
+		buff = &slab->buffers[i];
+		buff->readp = buff->buffp;
+		buff->writep = buff->buffp;
+		buff->tailp = buff->buffp + buff->size;
+		buff->nbuffered = 0;
+		buff->eof = 0;
+	}
+}
+
+/*
+	Location: session_slab.c
+	This is to get the three buffers of a session, of size bytes each (SIZE_BUFFER if size is 0),
+	emptied and labelled "network", "serial" and "sabre".
+	returns the slab, NULL on failure.
+*/
+SESSION_SLAB *session_slab_alloc(int size)
+{
+	extern int errno;
+	static char *labels[SESSION_SLAB_NBUFFERS] = {"network", "serial", "sabre"};
+	struct slab_class_t *sc;
+	SESSION_SLAB *slab;
+	int class;
+	int i;
+
+	if (size <= 0)
+		size = SIZE_BUFFER;
+	class = session_slab_class(size);
+	if (class < 0) {
+		syslog(LOG_ERR, "session_slab.c: session_slab_alloc(): no size class for %d byte buffers", size);
+		return(NULL);
+	}
+	sc = &slab_classes[class];
+	if (sc->free != NULL) {
+		slab = sc->free;
+		sc->free = slab->next;
+		sc->nfree--;
+		sc->reused++;
+	} else {
+		slab = calloc(1, sizeof(SESSION_SLAB));
+		if (slab == NULL) {
+			debug_perror("session_slab.c: session_slab_alloc()");
+			return(NULL);
+		}
+		slab->class = class;
+		slab->length = SESSION_SLAB_NBUFFERS * SLAB_ROUND((SLAB_MIN_SIZE << class) + 1);
+		slab->data = mmap(NULL, slab->length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (slab->data == MAP_FAILED) {
+			syslog(LOG_ERR, "session_slab.c: session_slab_alloc(): mmap(%lu) error: %s", (unsigned long) slab->length, strerror(errno));
+			free(slab);
+			return(NULL);
+		}
+	}
+	slab->next = NULL;
+	for (i = 0; i < SESSION_SLAB_NBUFFERS; i++) {
+		memset(&slab->buffers[i], 0, sizeof(BUFFER));
+		slab->buffers[i].size = size;
+		slab->buffers[i].buffp = slab->data + i * SLAB_ROUND((SLAB_MIN_SIZE << class) + 1);
+		slab->buffers[i].label = (unsigned char *) labels[i];
+		slab->buffers[i].arena = 1;
+	}
+	session_slab_reset(slab);
+	sc->allocs++;
+	sc->inuse++;
+	return(slab);
+}
+
+/*
+	Location: session_slab.c
+	This is to hand the data pages of an idle session back to the kernel. They come back, zero-filled,
+	when traffic touches them again. Buffers registered with the io_uring engine are pinned, they must
+	be unregistered first.
+	returns 0 on success, 1 if a buffer still holds data.
+*/
+int session_slab_trim(SESSION_SLAB *slab)
+{
+	extern int errno;
+	int i;
+
+	if (slab == NULL)
+		return(1);
+	for (i = 0; i < SESSION_SLAB_NBUFFERS; i++) {
+		if (slab->buffers[i].nbuffered > 0)
+			return(1);
+	}
+	if (madvise(slab->data, slab->length, MADV_DONTNEED) < 0) {
+		syslog(LOG_ERR, "session_slab.c: session_slab_trim(): madvise() error: %s", strerror(errno));
+		return(1);
+	}
+	session_slab_reset(slab);
+	slab_classes[slab->class].trims++;
+	return(0);
+}
+
+/*
+	Location: session_slab.c
+	This is to give the slab of a session back, when the session ends.
+*/
+void session_slab_free(SESSION_SLAB *slab)
+{
+	struct slab_class_t *sc;
+
+	if (slab == NULL)
+		return;
+	sc = &slab_classes[slab->class];
+	sc->released++;
+	sc->inuse--;
+	if ((sc->nfree >= SLAB_KEEP) || (madvise(slab->data, slab->length, MADV_DONTNEED) < 0)) {
+		sc->unmapped++;
+		munmap(slab->data, slab->length);
+		free(slab);
+		return;
+	}
+	slab->next = sc->free;
+	sc->free = slab;
+	sc->nfree++;
+}
+
+/*
+	Location: session_slab.c
+	This is to log the counters of the size classes which were used.
+*/
+void session_slab_stats(void)
+{
+	struct slab_class_t *sc;
+	int class;
+
+	for (class = 0; class < SLAB_CLASSES; class++) {
+		sc = &slab_classes[class];
+		if (sc->allocs == 0)
+			continue;
+		syslog(LOG_INFO, "session_slab.c: session_slab_stats(): %d byte class: %lu alloc(s), %lu reused, %lu released, %lu unmapped, %lu idle trim(s), %d in use, %d free",
+				SLAB_MIN_SIZE << class, sc->allocs, sc->reused, sc->released, sc->unmapped, sc->trims, sc->inuse, sc->nfree);
+	}
+}
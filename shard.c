@@ -0,0 +1,286 @@
+/*
+ * shard.c
+ *	This is to spread the serial ports over several reactors ("reactor shards" in serial_ip.conf).
+ *	Each shard is a process of its own, with its own event loop, I/O engine, timer wheel and signalfd:
+ *	the Telnet and session state of serial_ip is kept in globals, so a process is the unit which can
+ *	run next to another one without sharing anything.
+ *	A serial port belongs to exactly one shard, chosen by a hash of its pool (or of its device when it
+ *	is not in a pool), so the ports of a hunt group always end up together. Only the owner brings the
+ *	port up, holds it open and listens on its listen port. Every shard opens the main listener (-p) with
+ *	SO_REUSEPORT, and the kernel spreads those connections over them; a session of the main listener
+ *	hunts through the ports of the other shards too once its own are busy (see select_serial_port()).
+ *	With "pin shards", shard k runs on the k-th CPU we are allowed to use; its sessions inherit that.
+ *	The process we started from stays behind as a supervisor: it forwards SIGHUP, SIGUSR1 and SIGUSR2
+ *	to the shards, takes them all down on SIGTERM, and starts a shard again when one dies.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#define _GNU_SOURCE							/* sched_setaffinity(), CPU_* macros */
+#include "serial_ip.h"
+
+#include <sched.h>
+#include <sys/prctl.h>
+
+#define SHARD_RESPAWN_DELAY		1			/* seconds between two starts of the same shard */
+
+int shard_index = 0;						/* which shard we are */
+int shard_count = 1;						/* 1: not sharded */
+
+static pid_t shard_pids[SHARD_MAX];
+static time_t shard_started[SHARD_MAX];
+static pid_t shard_supervisor = 0;
+static volatile sig_atomic_t shard_pending = 0;	/* bit mask of the signals the supervisor got */
+
+/*
+	Location: shard.c
+	This is to tell whether a serial port belongs to our shard.
+	returns 1 if it does (always, when we are not sharded), 0 otherwise.
+*/
+int shard_owns(SERIAL_INFO *port)
+{
+	extern int shard_index;
+	extern int shard_count;
+	unsigned int hash = 2166136261U;		/* FNV-1a */
+	const char *key;
+
+	if ((shard_count <= 1) || (port == NULL))
+		return(1);
+	key = (port->pool != NULL) ? port->pool : port->device;
+	if (key == NULL)
+		return(shard_index == 0);
+	for ( ; *key != '\0'; key++) {
+		hash ^= (unsigned char) *key;
+		hash *= 16777619U;
+	}
+	return((int) (hash % (unsigned int) shard_count) == shard_index);
+}
+
+/*
+	Location: shard.c
+	This is to pin our process to the CPU of our shard, the k-th of the CPUs we may run on.
+	returns 0 on success, 1 on failure.
+*/
+static int shard_pin(int k)
+{
+	extern int errno;
+	cpu_set_t allowed;
+	cpu_set_t mine;
+	int ncpus;
+	int cpu;
+	int n;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+		syslog(LOG_ERR, "shard.c: shard_pin(): sched_getaffinity() error: %s", strerror(errno));
+		return(1);
+	}
+	ncpus = CPU_COUNT(&allowed);
+	if (ncpus <= 0)
+		return(1);
+	k %= ncpus;
+	for (cpu = n = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (! CPU_ISSET(cpu, &allowed))
+			continue;
+		if (n++ == k)
+			break;
+	}
+	CPU_ZERO(&mine);
+	CPU_SET(cpu, &mine);
+	if (sched_setaffinity(0, sizeof(mine), &mine) < 0) {
+		syslog(LOG_ERR, "shard.c: shard_pin(): sched_setaffinity(%d) error: %s", cpu, strerror(errno));
+		return(1);
+	}
+	syslog(LOG_INFO, "shard.c: shard_pin(): shard %d runs on cpu %d", shard_index, cpu);
+	return(0);
+}
+
+/*
+	Location: shard.c
+	This is the start of a shard, in the child process: it takes its own signals, and brings up the
+	serial ports it owns.
+*/
+static void shard_child_init(struct config_t *conf, int k)
+{
+	extern int shard_index;
+
+	shard_index = k;
+	prctl(PR_SET_PDEATHSIG, SIGTERM);						/* go with the supervisor */
+	if (getppid() != shard_supervisor)
+		_exit(0);											/* it is gone already */
+	if (conf->pin_shards)
+		shard_pin(k);
+	install_signal_handlers();								/* a signalfd of our own */
+	session_arena_child();									/* memory locks are not inherited */
+	syslog(LOG_INFO, "shard.c: shard_child_init(): shard %d of %d started", k, shard_count);
+	hotplug_init(conf);
+	port_bringup_init(conf->bringup_workers);
+	port_bringup_start(conf);
+}
+
+/*
+	Location: shard.c
+	This is to start shard k.
+	returns 0 in the new shard, 1 in the supervisor.
+*/
+static int shard_spawn(struct config_t *conf, int k)
+{
+	extern int errno;
+	pid_t pid;
+
+	shard_started[k] = time(NULL);
+	pid = fork();
+	if (pid == 0) {
+		shard_child_init(conf, k);
+		return(0);
+	}
+	if (pid < 0)
+		syslog(LOG_ERR, "shard.c: shard_spawn(): cannot start shard %d: %s", k, strerror(errno));
+	shard_pids[k] = pid;
+	return(1);
+}
+
+/*
+	Location: shard.c
+	This is to send a signal to every shard.
+*/
+static void shard_forward(int signal)
+{
+	int k;
+
+	for (k = 0; k < shard_count; k++) {
+		if (shard_pids[k] > 0)
+			kill(shard_pids[k], signal);
+	}
+}
+
+/*
+	Location: shard.c
+	This is to collect the shards which died.
+*/
+static void shard_reap(void)
+{
+	pid_t pid;
+	int status;
+	int k;
+
+	while ((pid = waitpid((pid_t) -1, &status, WNOHANG)) > 0) {
+		log_termination_status(pid, status);
+		for (k = 0; k < shard_count; k++) {
+			if (shard_pids[k] == pid) {
+				syslog(LOG_ERR, "shard.c: shard_reap(): shard %d (pid %d) is gone", k, (int) pid);
+				shard_pids[k] = -1;
+			}
+		}
+	}
+}
+
+/*
+	Location: shard.c
+	This is the signal handler of the supervisor: signals are only noted here, and handled by
+	shard_supervise().
+*/
+static void shard_signal_received(int signal)
+{
+	if ((signal > 0) && (signal < 32))
+		shard_pending |= 1 << signal;
+}
+
+/*
+	Location: shard.c
+	This is the loop of the supervisor.
+	returns only in a shard it started again.
+*/
+static void shard_supervise(struct config_t *conf)
+{
+	extern int signal_fd;
+	struct sigaction sa;
+	struct timeval tv;
+	fd_set fds;
+	sig_atomic_t pending;
+	int down;
+	int k;
+
+	if (signal_fd_redirect(shard_signal_received) != 0) {
+		sa.sa_handler = &shard_signal_received;
+		sigemptyset(&sa.sa_mask);
+		sa.sa_flags = 0;
+		sigaction(SIGTERM, &sa, NULL);
+		sigaction(SIGINT,  &sa, NULL);
+		sigaction(SIGQUIT, &sa, NULL);
+		sigaction(SIGHUP,  &sa, NULL);
+		sigaction(SIGCLD,  &sa, NULL);
+		sigaction(SIGUSR1, &sa, NULL);
+		sigaction(SIGUSR2, &sa, NULL);
+		sigaction(SIGPIPE, &sa, NULL);
+	}
+	syslog(LOG_INFO, "shard.c: shard_supervise(): supervising %d shard(s)", shard_count);
+	for ( ; ; ) {
+		down = 0;
+		for (k = 0; k < shard_count; k++) {
+			if (shard_pids[k] > 0)
+				continue;
+			if (time(NULL) - shard_started[k] < SHARD_RESPAWN_DELAY) {
+				down++;										/* do not spin on a shard which dies at once */
+				continue;
+			}
+			if (shard_spawn(conf, k) == 0)
+				return;										/* we are the new shard */
+			if (shard_pids[k] < 0)
+				down++;
+		}
+		tv.tv_sec = SHARD_RESPAWN_DELAY;
+		tv.tv_usec = 0;
+		if (signal_fd >= 0) {
+			FD_ZERO(&fds);
+			FD_SET(signal_fd, &fds);
+			if (select(signal_fd + 1, &fds, NULL, NULL, down ? &tv : NULL) > 0)
+				signal_fd_handle();
+		} else if (shard_pending == 0) {
+			if (down)
+				select(0, NULL, NULL, NULL, &tv);			/* a signal cuts it short */
+			else
+				pause();
+		}
+		pending = shard_pending;
+		shard_pending = 0;
+		if (pending & ((1 << SIGTERM) | (1 << SIGINT) | (1 << SIGQUIT)))
+			action_sigterm((pending & (1 << SIGINT)) ? SIGINT : ((pending & (1 << SIGQUIT)) ? SIGQUIT : SIGTERM));
+		if (pending & (1 << SIGCLD))
+			shard_reap();
+		if (pending & (1 << SIGHUP)) {
+			syslog(LOG_INFO, "shard.c: shard_supervise(): asking the shards to reload");
+			shard_forward(SIGHUP);
+		}
+		if (pending & (1 << SIGUSR1)) {
+			action_sigusr1(SIGUSR1);
+			shard_forward(SIGUSR1);
+		}
+		if (pending & (1 << SIGUSR2)) {
+			action_sigusr2(SIGUSR2);
+			shard_forward(SIGUSR2);
+		}
+	}
+}
+
+/*
+	Location: shard.c
+	This is to start the shards, after the configuration was read and before the listeners are opened.
+	returns at once when we are not sharded, and in each shard. The supervisor does not return.
+*/
+void shard_init(struct config_t *conf)
+{
+	extern int shard_count;
+	int k;
+
+	if (conf->reactor_shards <= 1)
+		return;
+	shard_count = conf->reactor_shards;
+	shard_supervisor = getpid();
+	for (k = 0; k < shard_count; k++)
+		shard_pids[k] = -1;
+	for (k = 0; k < shard_count; k++) {
+		if (shard_spawn(conf, k) == 0)
+			return;
+	}
+	shard_supervise(conf);
+}
@@ -0,0 +1,394 @@
+/*
+ * share.c
+ *	This is the shared session of a serial port ("share port" in serial_ip.conf): any number of TCP
+ *	clients attach to the same port at once, a writer (or, by "share writer", every client or none of
+ *	them) and read-only observers, instead of tap tools which each open the device and compete for it.
+ *	The device is read once, into a ring of SHARE_RING_SIZE bytes, whatever the clients do: the port
+ *	never waits for them. Each client has its own cursor in the ring and is sent what it has not seen
+ *	yet, as fast as it takes it. A client which fell a whole ring behind skips ahead to the live data,
+ *	and how much it missed is logged when it leaves; one whose connection failed is cut off.
+ *	With "share writer = first", the client which has been attached the longest writes to the device,
+ *	and the next one takes over when it leaves; with "all", every client writes; with "none", the port
+ *	is only observed. What the other clients send is thrown away.
+ *	What a writer sends while the device holds off (CTS, XOFF) is kept pending, up to
+ *	SERIAL_PENDING_SIZE bytes, and written when the device takes it; meanwhile the writers are not read,
+ *	so that TCP holds them off in turn, and the observers are served as before.
+ *	The bytes go as they are, both ways: there is no Telnet to negotiate for many clients at once.
+ *	The clients get the socket profile of the port (see socket_profile.c).
+ *	A port is served by a worker process of its own (see port_worker.c), which holds its uucp lock for
+ *	as long as it runs: a session of its listen port finds it busy.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+#include <poll.h>
+#include <sys/uio.h>
+
+#define SHARE_RING_SIZE		65536			/* a power of 2 */
+#define SHARE_MAX_CLIENTS	32
+#define SHARE_READ_SIZE		4096			/* bytes read from a client at once */
+
+/*
+	Location: share.c
+	The ring the device is read into. head counts every byte ever read: the byte at position p is at
+	data[p % SHARE_RING_SIZE] for as long as head - p <= SHARE_RING_SIZE.
+*/
+struct share_ring_t {
+	unsigned char data[SHARE_RING_SIZE];
+	unsigned long long head;
+};
+
+/*
+	Location: share.c
+	A client of the shared port.
+*/
+struct share_client_t {
+	int fd;
+	struct sockaddr_in addr;
+	unsigned long long cursor;				/* ring position of the next byte it is sent */
+	unsigned long long skipped;				/* bytes it missed, being too slow */
+};
+
+static const char *share_writer_names[SHARE_WRITERS] = {"first", "all", "none"};
+
+/*
+	Location: share.c
+	This is to parse a "share writer" value: first, all or none.
+	returns 0 on success, 1 on failure.
+*/
+int share_writer_parse(const char *value, int *writer)
+{
+	int i;
+
+	for (i = 0; i < SHARE_WRITERS; i++) {
+		if (strcasecmp(value, share_writer_names[i]) == 0) {
+			*writer = i;
+			return(0);
+		}
+	}
+	return(1);
+}
+
+/*
+	Location: share.c
+	This is to tell whether a port wants a shared session worker: it has a share port.
+	returns 1 if it does, 0 otherwise.
+*/
+int share_port_wanted(SERIAL_INFO *port)
+{
+	return(port->share_port > 0);
+}
+
+/*
+	Location: share.c
+	This is to write down the settings a shared session worker serves a port with.
+*/
+void share_port_settings(SERIAL_INFO *port, char *buf, int len)
+{
+	snprintf(buf, len, "share port %d, writer %s", port->share_port,
+			share_writer_names[(port->share_writer >= 0) && (port->share_writer < SHARE_WRITERS) ? port->share_writer : 0]);
+}
+
+/*
+	Location: share.c
+	This is to read what the serial device has into the ring, without ever waiting for the clients.
+	returns 0 on success, 1 on EOF or if the device failed.
+*/
+static int share_serial_to_ring(int fd, struct share_ring_t *ring)
+{
+	extern int errno;
+	unsigned int offset;
+	int total;
+	int n;
+
+	for (total = 0; total < SHARE_RING_SIZE / 2; total += n) {		/* let the clients have their turn */
+		offset = ring->head & (SHARE_RING_SIZE - 1);
+		n = read(fd, &ring->data[offset], SHARE_RING_SIZE - offset);
+		if (n > 0) {
+			ring->head += n;
+			continue;
+		}
+		if (n == 0) {
+			syslog(LOG_INFO, "share.c: share_serial_to_ring(): EOF on the serial device");
+			return(1);
+		}
+		if ((errno == EAGAIN) || (errno == EINTR))
+			break;
+		syslog(LOG_ERR, "share.c: share_serial_to_ring(): read error: %s", strerror(errno));
+		return(1);
+	}
+	return(0);
+}
+
+/*
+	Location: share.c
+	This is to send a client what it has not seen of the ring yet, as much as its socket takes. A client
+	which fell a whole ring behind skips ahead to the live data.
+	returns 0 on success, 1 if the client is gone.
+*/
+static int share_ring_to_client(struct share_ring_t *ring, struct share_client_t *c)
+{
+	extern int errno;
+	struct iovec iov[2];
+	unsigned long long pending;
+	unsigned int offset;
+	int niov;
+	int n;
+
+	pending = ring->head - c->cursor;
+	if (pending > SHARE_RING_SIZE) {
+		if (c->skipped == 0)										/* the total is logged when it leaves */
+			syslog(LOG_WARNING, "share.c: share_ring_to_client(): %s:%d is too slow, it skips ahead",
+					inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
+		c->skipped += pending;
+		c->cursor = ring->head;
+		return(0);
+	}
+	if (pending == 0)
+		return(0);
+	offset = c->cursor & (SHARE_RING_SIZE - 1);
+	iov[0].iov_base = &ring->data[offset];
+	if (offset + pending <= SHARE_RING_SIZE) {
+		iov[0].iov_len = pending;
+		niov = 1;
+	} else {
+		iov[0].iov_len = SHARE_RING_SIZE - offset;
+		iov[1].iov_base = &ring->data[0];
+		iov[1].iov_len = pending - iov[0].iov_len;					/* where the ring wraps */
+		niov = 2;
+	}
+	n = writev(c->fd, iov, niov);
+	if (n > 0) {
+		c->cursor += n;
+		return(0);
+	}
+	if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+		return(0);
+	return(1);
+}
+
+/*
+	Location: share.c
+	This is to tell whether the client at index i of the list writes to the device.
+	returns 1 if it does, 0 otherwise.
+*/
+static int share_is_writer(SERIAL_INFO *port, int i)
+{
+	return((port->share_writer == SHARE_WRITER_ALL) || ((port->share_writer == SHARE_WRITER_FIRST) && (i == 0)));
+}
+
+/*
+	Location: share.c
+	This is to read what a client sent, and write it to the serial device if the client is a writer. A
+	writer is read no more than there is room for in what is pending for the device.
+	returns 0 on success, 1 if the client is gone, 2 if the device failed.
+*/
+static int share_client_to_serial(SERIAL_INFO *port, struct share_client_t *c, int writer, int fd, SERIAL_PENDING *pending)
+{
+	extern int errno;
+	unsigned char data[SHARE_READ_SIZE];
+	int room;
+	int n;
+
+	room = writer ? MIN((int) sizeof(data), SERIAL_PENDING_SIZE - pending->len) : (int) sizeof(data);
+	if (room <= 0)
+		return(0);												/* it waits for the device */
+	n = read(c->fd, data, room);
+	if (n == 0)
+		return(1);
+	if (n < 0)
+		return(((errno == EAGAIN) || (errno == EINTR)) ? 0 : 1);
+	socket_profile_read(port, c->fd);
+	if (writer && (serial_pending_write(fd, pending, data, n) != 0)) {
+		syslog(LOG_ERR, "share.c: share_client_to_serial(): cannot write to the serial device");
+		return(2);
+	}
+	return(0);
+}
+
+/*
+	Location: share.c
+	This is to take a new client: it starts with the live data.
+*/
+static void share_accept(SERIAL_INFO *port, int listen_fd, struct share_client_t *clients, int *nclients, struct share_ring_t *ring)
+{
+	extern int errno;
+	struct sockaddr_in addr;
+	socklen_t len;
+	int fd;
+	int flags;
+
+	len = sizeof(addr);
+	fd = accept(listen_fd, (struct sockaddr *) &addr, &len);
+	if (fd < 0)
+		return;
+	if (*nclients == SHARE_MAX_CLIENTS) {
+		syslog(LOG_ERR, "share.c: share_accept(): no room for %s:%d, %d clients already", inet_ntoa(addr.sin_addr),
+				ntohs(addr.sin_port), SHARE_MAX_CLIENTS);
+		close(fd);
+		return;
+	}
+	flags = fcntl(fd, F_GETFL, 0);
+	if (flags != -1)
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	socket_profile_apply(port, fd);								/* before it is sent anything */
+	clients[*nclients].fd = fd;
+	clients[*nclients].addr = addr;
+	clients[*nclients].cursor = ring->head;
+	clients[*nclients].skipped = 0;
+	(*nclients)++;
+	syslog(LOG_INFO, "share.c: share_accept(): %s:%d attached, %d client(s)", inet_ntoa(addr.sin_addr),
+			ntohs(addr.sin_port), *nclients);
+}
+
+/*
+	Location: share.c
+	This is to let a client go. The others keep the order they came in, the first writer included.
+*/
+static void share_drop(struct share_client_t *clients, int *nclients, int i)
+{
+	syslog(LOG_INFO, "share.c: share_drop(): %s:%d detached, %llu bytes skipped, %d client(s) left",
+			inet_ntoa(clients[i].addr.sin_addr), ntohs(clients[i].addr.sin_port), clients[i].skipped, *nclients - 1);
+	close(clients[i].fd);
+	memmove(&clients[i], &clients[i + 1], (*nclients - i - 1) * sizeof(struct share_client_t));
+	(*nclients)--;
+}
+
+/*
+	Location: share.c
+	This is to open the listener of the shared port.
+	returns the socket, -1 on failure.
+*/
+static int share_listen(SERIAL_INFO *port)
+{
+	extern int errno;
+	struct sockaddr_in addr;
+	int sock;
+	int opt;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		syslog(LOG_ERR, "share.c: share_listen(): socket() error: %s", strerror(errno));
+		return(-1);
+	}
+	opt = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port->share_port);
+	if ((bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) || (listen(sock, 5) < 0)) {
+		syslog(LOG_ERR, "share.c: share_listen(): cannot listen on port %d for %s: %s", port->share_port, port->device,
+				strerror(errno));
+		close(sock);
+		return(-1);
+	}
+	opt = fcntl(sock, F_GETFL, 0);
+	if (opt != -1)
+		fcntl(sock, F_SETFL, opt | O_NONBLOCK);
+	socket_profile_listen(port, sock);
+	return(sock);
+}
+
+/*
+	Location: share.c
+	This is the worker of a shared port: serve its clients until we are told to stop or the device fails.
+	returns 0 on success, 1 on failure.
+*/
+int share_worker(struct config_t *conf, SERIAL_INFO *port)
+{
+	extern volatile sig_atomic_t port_worker_stop;
+	extern int errno;
+	extern int signal_fd;
+	static struct share_ring_t ring;
+	static SERIAL_PENDING pending;
+	struct share_client_t clients[SHARE_MAX_CLIENTS];
+	struct pollfd pfds[3 + SHARE_MAX_CLIENTS];
+	struct termios old_setting;
+	struct termios new_setting;
+	SERIAL_INFO *sabre_serial_port;
+	int nclients;
+	int listen_fd;
+	int writer;
+	int fd;
+	int opt;
+	int error;
+	int i;
+
+	listen_fd = share_listen(port);
+	if (listen_fd < 0)
+		return(1);
+	sabre_serial_port = serial_port_claim(conf, port->device, &fd, &old_setting, &new_setting);
+	if (sabre_serial_port == NULL) {
+		close(listen_fd);
+		return(1);
+	}
+	opt = fcntl(fd, F_GETFL, 0);
+	if (opt != -1)
+		fcntl(fd, F_SETFL, opt | O_NONBLOCK);					/* read until there is no more */
+	syslog(LOG_INFO, "share.c: share_worker(): sharing %s on port %d, %s writes", port->device, port->share_port,
+			(port->share_writer == SHARE_WRITER_ALL) ? "every client" :
+			(port->share_writer == SHARE_WRITER_NONE) ? "no client" : "the first client");
+
+	ring.head = 0;
+	pending.len = 0;
+	nclients = 0;
+	error = 0;
+	while ((! port_worker_stop) && (! error)) {
+		pfds[0].fd = fd;
+		pfds[0].events = POLLIN | ((pending.len > 0) ? POLLOUT : 0);
+		pfds[1].fd = listen_fd;
+		pfds[1].events = POLLIN;
+		pfds[2].fd = signal_fd;
+		pfds[2].events = POLLIN;
+		for (i = 0; i < nclients; i++) {
+			pfds[3 + i].fd = clients[i].fd;
+			pfds[3 + i].events = ((share_is_writer(port, i) && (pending.len == SERIAL_PENDING_SIZE)) ? 0 : POLLIN) |
+					((clients[i].cursor != ring.head) ? POLLOUT : 0);
+		}
+		if (poll(pfds, 3 + nclients, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "share.c: share_worker(): poll() error: %s", strerror(errno));
+			break;
+		}
+		if (pfds[2].revents & POLLIN)
+			signal_fd_handle();
+		if (pfds[0].revents & (POLLIN|POLLHUP|POLLERR))
+			error = share_serial_to_ring(fd, &ring);
+		if ((! error) && (pfds[0].revents & POLLOUT) && (serial_pending_flush(fd, &pending) != 0)) {
+			syslog(LOG_ERR, "share.c: share_worker(): cannot write to the serial device: %s", strerror(errno));
+			error = 1;
+		}
+		/* from the clients, the last one first: share_drop() moves the ones after it */
+		for (i = nclients - 1; (i >= 0) && (! error); i--) {
+			if (! (pfds[3 + i].revents & (POLLIN|POLLHUP|POLLERR)))
+				continue;
+			writer = share_is_writer(port, i);
+			if (writer && (pending.len == SERIAL_PENDING_SIZE) && (pfds[3 + i].revents & (POLLHUP|POLLERR))) {
+				share_drop(clients, &nclients, i);					/* it failed while it waited for the device */
+				continue;
+			}
+			opt = share_client_to_serial(port, &clients[i], writer, fd, &pending);
+			if (opt == 1)
+				share_drop(clients, &nclients, i);
+			else if (opt == 2)
+				error = 1;
+		}
+		/* to the clients, whatever woke us up */
+		for (i = nclients - 1; (i >= 0) && (! error); i--) {
+			if (share_ring_to_client(&ring, &clients[i]) != 0)
+				share_drop(clients, &nclients, i);
+		}
+		if (pfds[1].revents & POLLIN)
+			share_accept(port, listen_fd, clients, &nclients, &ring);
+	}
+	syslog(LOG_INFO, "share.c: share_worker(): %s done with port %d", port->device, port->share_port);
+	for (i = 0; i < nclients; i++)
+		close(clients[i].fd);
+	close(listen_fd);
+	serial_cleanup(sabre_serial_port, &fd, old_setting, new_setting);
+	return(error);
+}
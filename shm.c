@@ -0,0 +1,299 @@
+/*
+ * shm.c
+ *	This is the shared-memory transport of a serial port ("shm ring" in serial_ip.conf), for consumers
+ *	on the gateway itself which would rather not pay for a loopback TCP connection and Telnet: what the
+ *	device reads is published into a ring in /dev/shm, and what the local processes queue in a second
+ *	ring is written to the device. The layout and the client library are in serial_ip_shm.h and
+ *	serial_ip_shm.c.
+ *	The main loop reads the device into the inbound ring, and wakes up the consumers only if one of
+ *	them sleeps. A thread of its own takes the outbound ring to the device, and sleeps on its futex
+ *	when there is nothing to write, or waits for the device when it holds off (CTS, XOFF): what the
+ *	device does not take yet stays in the ring, and the producers are told there is less room.
+ *	A port is served by a worker process of its own (see port_worker.c), which holds its uucp lock for
+ *	as long as it runs: a TCP client of the port finds it busy. The worker creates the ring when it
+ *	starts and removes it when it stops; clients which still have it mapped are told it is closed.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+#include "serial_ip_shm.h"
+
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define SHM_MIN_SIZE		4096
+#define SHM_MAX_SIZE		(16 * 1024 * 1024)
+#define SHM_WRITER_WAIT		200				/* ms the writer thread sleeps before it looks at its stop flag */
+
+/*
+	Location: shm.c
+	What the writer thread needs.
+*/
+struct shm_writer_t {
+	struct sip_shm_header *h;
+	int fd;									/* of the serial device */
+	volatile int stop;
+	int error;								/* the device failed */
+};
+
+/*
+	Location: shm.c
+	This is to check a "shm size" value: a power of 2, within bounds.
+	returns 0 if it will do, 1 otherwise.
+*/
+int shm_size_check(int size)
+{
+	if ((size < SHM_MIN_SIZE) || (size > SHM_MAX_SIZE))
+		return(1);
+	return(((size & (size - 1)) != 0) ? 1 : 0);
+}
+
+/*
+	Location: shm.c
+	This is to tell whether a port wants a shared-memory worker: it has a shm ring.
+	returns 1 if it does, 0 otherwise.
+*/
+int shm_port_wanted(SERIAL_INFO *port)
+{
+	return(port->shm_ring != NULL);
+}
+
+/*
+	Location: shm.c
+	This is to write down the settings a shared-memory worker serves a port with.
+*/
+void shm_port_settings(SERIAL_INFO *port, char *buf, int len)
+{
+	snprintf(buf, len, "shm ring %s, size %d", port->shm_ring, port->shm_size);
+}
+
+/*
+	Location: shm.c
+	This is the writer thread: write what the local processes queued in the outbound ring to the device.
+*/
+static void *shm_writer(void *arg)
+{
+	extern int errno;
+	struct shm_writer_t *w;
+	struct sip_shm_header *h;
+	struct pollfd pfd;
+	unsigned char *data;
+	uint64_t head;
+	uint64_t tail;
+	uint32_t futex;
+	unsigned int offset;
+	unsigned int len;
+	int n;
+
+	w = arg;
+	h = w->h;
+	data = SIP_SHM_OUT_DATA(h);
+	tail = h->out_tail;
+	while (! w->stop) {
+		futex = __atomic_load_n(&h->out_futex, __ATOMIC_SEQ_CST);
+		head = __atomic_load_n(&h->out_head, __ATOMIC_SEQ_CST);
+		if (head == tail) {
+			__atomic_store_n(&h->out_waiting, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&h->out_head, __ATOMIC_SEQ_CST) == tail)
+				sip_futex_wait(&h->out_futex, futex, SHM_WRITER_WAIT);
+			__atomic_store_n(&h->out_waiting, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		offset = tail & (h->size - 1);
+		len = MIN(head - tail, h->size - offset);
+		n = write(w->fd, &data[offset], len);
+		if (n <= 0) {
+			if ((n < 0) && (errno == EAGAIN)) {
+				/* the device holds off (CTS, XOFF): the ring keeps the rest, however long it takes */
+				pfd.fd = w->fd;
+				pfd.events = POLLOUT;
+				poll(&pfd, 1, SHM_WRITER_WAIT);
+				continue;
+			}
+			if ((n < 0) && (errno == EINTR))
+				continue;
+			syslog(LOG_ERR, "shm.c: shm_writer(): cannot write to the serial device: %s", strerror(errno));
+			w->error = 1;
+			break;
+		}
+		tail += n;
+		__atomic_store_n(&h->out_tail, tail, __ATOMIC_RELEASE);	/* room for the producers */
+	}
+	return(NULL);
+}
+
+/*
+	Location: shm.c
+	This is to read what the device has into the inbound ring, and wake up the consumers which sleep.
+	The daemon says how far it writes (in_reserve) before it does, so that a consumer can tell whether
+	what it copied was overwritten meanwhile.
+	returns 0 on success, 1 on EOF or if the device failed.
+*/
+static int shm_serial_to_ring(int fd, struct sip_shm_header *h)
+{
+	extern int errno;
+	unsigned char *data;
+	unsigned int offset;
+	unsigned int chunk;
+	uint64_t head;
+	int total;
+	int n;
+
+	data = SIP_SHM_IN_DATA(h);
+	head = h->in_head;
+	for (total = 0; total < (int) h->size / 2; total += n) {	/* let the consumers have their turn */
+		offset = head & (h->size - 1);
+		chunk = MIN(h->size / 2, h->size - offset);
+		__atomic_store_n(&h->in_reserve, head + chunk, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		n = read(fd, &data[offset], chunk);
+		if (n <= 0)
+			break;
+		head += n;
+		__atomic_store_n(&h->in_head, head, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&h->in_reserve, head, __ATOMIC_RELEASE);
+	if (total > 0) {
+		__atomic_add_fetch(&h->in_futex, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&h->in_waiters, __ATOMIC_SEQ_CST) > 0)
+			sip_futex_wake(&h->in_futex, INT_MAX);
+	}
+	if (n == 0) {
+		syslog(LOG_INFO, "shm.c: shm_serial_to_ring(): EOF on the serial device");
+		return(1);
+	}
+	if ((n < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+		syslog(LOG_ERR, "shm.c: shm_serial_to_ring(): read error: %s", strerror(errno));
+		return(1);
+	}
+	return(0);
+}
+
+/*
+	Location: shm.c
+	This is to create the rings of a port in /dev/shm.
+	returns the header, NULL on failure.
+*/
+static struct sip_shm_header *shm_create(SERIAL_INFO *port)
+{
+	extern int errno;
+	struct sip_shm_header *h;
+	size_t length;
+	int fd;
+
+	length = SIP_SHM_LENGTH(port->shm_size);
+	shm_unlink(port->shm_ring);									/* what a worker which died left behind */
+	fd = shm_open(port->shm_ring, O_CREAT|O_EXCL|O_RDWR, 0660);
+	if (fd < 0) {
+		syslog(LOG_ERR, "shm.c: shm_create(): cannot create %s: %s", port->shm_ring, strerror(errno));
+		return(NULL);
+	}
+	if (ftruncate(fd, length) != 0) {
+		syslog(LOG_ERR, "shm.c: shm_create(): cannot size %s: %s", port->shm_ring, strerror(errno));
+		close(fd);
+		shm_unlink(port->shm_ring);
+		return(NULL);
+	}
+	h = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (h == MAP_FAILED) {
+		syslog(LOG_ERR, "shm.c: shm_create(): cannot map %s: %s", port->shm_ring, strerror(errno));
+		shm_unlink(port->shm_ring);
+		return(NULL);
+	}
+	/* ftruncate() zeroed it all */
+	h->version = SIP_SHM_VERSION;
+	h->size = port->shm_size;
+	h->state = SIP_SHM_RUNNING;
+	h->pid = getpid();
+	snprintf(h->device, sizeof(h->device), "%s", port->device);
+	__atomic_store_n(&h->magic, SIP_SHM_MAGIC, __ATOMIC_RELEASE);	/* the clients may come now */
+	return(h);
+}
+
+/*
+	Location: shm.c
+	This is to tell the clients we are done with the rings, and remove them.
+*/
+static void shm_destroy(SERIAL_INFO *port, struct sip_shm_header *h)
+{
+	__atomic_store_n(&h->state, SIP_SHM_CLOSED, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&h->in_futex, 1, __ATOMIC_SEQ_CST);
+	sip_futex_wake(&h->in_futex, INT_MAX);
+	shm_unlink(port->shm_ring);
+	munmap(h, SIP_SHM_LENGTH(h->size));
+}
+
+/*
+	Location: shm.c
+	This is the worker of a port: serve its rings until we are told to stop or the device fails.
+	returns 0 on success, 1 on failure.
+*/
+int shm_worker(struct config_t *conf, SERIAL_INFO *port)
+{
+	extern volatile sig_atomic_t port_worker_stop;
+	extern int errno;
+	extern int signal_fd;
+	struct shm_writer_t writer;
+	struct sip_shm_header *h;
+	struct termios old_setting;
+	struct termios new_setting;
+	struct pollfd pfds[2];
+	SERIAL_INFO *sabre_serial_port;
+	pthread_t thread;
+	int fd;
+	int opt;
+	int error;
+
+	sabre_serial_port = serial_port_claim(conf, port->device, &fd, &old_setting, &new_setting);
+	if (sabre_serial_port == NULL)
+		return(1);
+	h = shm_create(port);
+	if (h == NULL) {
+		serial_cleanup(sabre_serial_port, &fd, old_setting, new_setting);
+		return(1);
+	}
+	opt = fcntl(fd, F_GETFL, 0);
+	if (opt != -1)
+		fcntl(fd, F_SETFL, opt | O_NONBLOCK);					/* read until there is no more */
+	memset(&writer, 0, sizeof(writer));
+	writer.h = h;
+	writer.fd = fd;
+	if (pthread_create(&thread, NULL, shm_writer, &writer) != 0) {
+		syslog(LOG_ERR, "shm.c: shm_worker(): cannot start the writer thread");
+		shm_destroy(port, h);
+		serial_cleanup(sabre_serial_port, &fd, old_setting, new_setting);
+		return(1);
+	}
+	syslog(LOG_INFO, "shm.c: shm_worker(): serving %s through %s, %d bytes each way", port->device, port->shm_ring,
+			port->shm_size);
+
+	error = 0;
+	while ((! port_worker_stop) && (! error) && (! writer.error)) {
+		pfds[0].fd = fd;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = signal_fd;
+		pfds[1].events = POLLIN;
+		if (poll(pfds, 2, SHM_WRITER_WAIT) < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "shm.c: shm_worker(): poll() error: %s", strerror(errno));
+			break;
+		}
+		if (pfds[1].revents & POLLIN)
+			signal_fd_handle();
+		if (pfds[0].revents & (POLLIN|POLLHUP|POLLERR))
+			error = shm_serial_to_ring(fd, h);
+	}
+	syslog(LOG_INFO, "shm.c: shm_worker(): %s done with %s", port->device, port->shm_ring);
+	writer.stop = 1;
+	__atomic_add_fetch(&h->out_futex, 1, __ATOMIC_SEQ_CST);
+	sip_futex_wake(&h->out_futex, 1);
+	pthread_join(thread, NULL);
+	shm_destroy(port, h);
+	serial_cleanup(sabre_serial_port, &fd, old_setting, new_setting);
+	return(error || writer.error);
+}
@@ -11,7 +11,89 @@
 
 #include "serial_ip.h"
 
+#include <sys/signalfd.h>
+
 int signo_child = 0;      /* Global child signal, 0 by default.	*/
+int signal_fd = -1;			/* readable when a signal is pending, -1 if we use signal handlers */
+
+static void (*signal_fd_handler)(int) = NULL;	/* parent_signal_received() or child_signal_handle() */
+
+/*
+	Location: signal_handle.c
+	This is to get the set of signals we handle.
+*/
+static void handled_signals(sigset_t *set)
+{
+	sigemptyset(set);
+	sigaddset(set, SIGTERM);
+	sigaddset(set, SIGINT);
+	sigaddset(set, SIGQUIT);
+	sigaddset(set, SIGHUP);
+	sigaddset(set, SIGCLD);
+	sigaddset(set, SIGUSR1);
+	sigaddset(set, SIGUSR2);
+	sigaddset(set, SIGPIPE);
+}
+
+/*
+	Location: signal_handle.c
+	This is to receive our signals through a signalfd. They are blocked, and the event loops select on
+	signal_fd and call signal_fd_handle() when it is readable: handler then runs as ordinary code, not
+	in signal context, and no system call is interrupted with EINTR.
+	returns 0 on success, 1 on failure (the signals are left unblocked).
+*/
+static int signal_fd_open(void (*handler)(int))
+{
+	extern int errno;
+	extern int signal_fd;
+	sigset_t set;
+
+	if (signal_fd >= 0)
+		close(signal_fd);								/* eg. the one a child inherited */
+	signal_fd = -1;
+	handled_signals(&set);
+	if (sigprocmask(SIG_BLOCK, &set, NULL) < 0)
+		return(1);
+	signal_fd = signalfd(-1, &set, SFD_NONBLOCK|SFD_CLOEXEC);
+	if (signal_fd < 0) {
+		syslog(LOG_ERR, "signal_handle.c: signal_fd_open(): signalfd() error: %s", strerror(errno));
+		sigprocmask(SIG_UNBLOCK, &set, NULL);
+		return(1);
+	}
+	signal_fd_handler = handler;
+	return(0);
+}
+
+/*
+	Location: signal_handle.c
+	This is called when signal_fd is readable: it handles every pending signal, in the order they came.
+*/
+void signal_fd_handle(void)
+{
+	extern int signal_fd;
+	struct signalfd_siginfo info;
+
+	while ((signal_fd >= 0) && (read(signal_fd, &info, sizeof(info)) == sizeof(info))) {
+		if (signal_fd_handler != NULL)
+			(*signal_fd_handler)(info.ssi_signo);
+	}
+}
+
+/*
+	Location: signal_handle.c
+	This is to pass the signals read from signal_fd to another handler, eg. the shard supervisor.
+	returns 0 on success, 1 if we do not use a signalfd.
+*/
+int signal_fd_redirect(void (*handler)(int))
+{
+	extern int signal_fd;
+
+	if (signal_fd < 0)
+		return(1);
+	signal_fd_handler = handler;
+	return(0);
+}
+
 /*
 	Location: signal_handle.c
 	This is a generic signal handler. Log which signal occurred, tidy up a bit, then we terminate.
@@ -32,11 +114,10 @@ void child_sighandler(int signal)
 */
 void telnet_sigint(void)
 {
-	extern int break_signaled;
-	extern unsigned char linestate;
+	extern TELNET_SESSION tnsession;
 
-	break_signaled = 1;
-	linestate |= CPC_LINESTATE_BREAK_DETECT;
+	tnsession.break_signaled = 1;
+	tnsession.linestate |= CPC_LINESTATE_BREAK_DETECT;
 }
 /*
 	Location: signal_handle.c
@@ -77,10 +158,24 @@ void child_signal_received(int signal)
 	signo_child = signal;
 }
 
+/*
+	Location: signal_handle.c
+	This is the handler signal_fd_handle() calls in a child process.
+*/
+void child_signal_handle(int signal)
+{
+	if (signal == SIGCLD) {
+		action_sigchild(signal);			/* not ours to die of */
+		return;
+	}
+	child_signal_received(signal);
+	child_pending_signal_handle();
+}
+
 /*
 	Location: signal_handle.c
 	This is to reset the signal handlers that a child inherited from
-	its parent, except for SIGCHLD.
+	its parent, except for SIGCHLD. The child reads its signals from a signalfd of its own if it can.
 	No return value.
 */
 void reset_signals(void)
@@ -88,6 +183,9 @@ void reset_signals(void)
 	extern int signo_child;				/* what signal did we receive? */
 	struct sigaction act;				/* for signals */
 
+	signo_child = 0;					/* default. */
+	if (signal_fd_open(child_signal_handle) == 0)
+		return;
 	act.sa_handler = &child_signal_received;	/* function to handle signals */
 	sigemptyset(&act.sa_mask);			/* required before sigaction() */
 	act.sa_flags = 0;					/* no SA_RESTART */
@@ -132,16 +230,6 @@ pid_t wait_child_termination(pid_t pid, int *child_status)
 	  	  waitpid with flag WNOHANG will put the calling being non-blocked during the systemcall waitpid().
 	 */
 	ret = waitpid(pid,status,WNOHANG);
-	if ((ret == (pid_t) 0) && (pid == (pid_t) -1)) 			/*Author note: update pid condition!!!!*/
-	{
-		/*
-			Status not yet available for specified pid.
-			we'll wait a second and try again
-		*/
-		syslog(LOG_DEBUG,"signal_handle.c: wait_child_termination() returned 0; will try again");
-		sleep(1);
-		ret = waitpid(pid,status,WNOHANG);
-	}
 	if (ret == (pid_t) -1)
 	{
 		if (errno == ECHILD)
@@ -200,6 +288,9 @@ void action_sigterm(int signal)
 	sigemptyset(&sa.sa_mask);			/* required before sigaction() */
 	sa.sa_flags = 0;					/* signal is fatal, so no SA_RESTART */
 	sigaction(SIGTERM,&sa,NULL);
+	sigemptyset(&sa.sa_mask);
+	sigaddset(&sa.sa_mask, SIGTERM);
+	sigprocmask(SIG_UNBLOCK, &sa.sa_mask, NULL);	/* blocked while we use signal_fd */
 
 	/* kill parent process.*/
 	kill(0,SIGTERM);					/* kill(int pid, int signum) */
@@ -208,16 +299,15 @@ void action_sigterm(int signal)
 /*
 	Location: signal_handle.c
 	This function is to define a propriate action for SIGHUP.
-	SIGHUP is to re-initialize our program.
+	SIGHUP is to reload serial_ip.conf. Without signal_fd we are called from signal context, so we
+	only ask for the reload here; reload_configuration() runs it later from the accept loop.
 	returns nothing.
 */
 void action_sighup(int signal)
 {
-		/* log this at the ERR level to be sure it reaches the log */
-		syslog(LOG_ERR,"received signal %d (%s)",signal,signame(signal));
+	extern volatile sig_atomic_t reload_pending;
 
-		program_clean_up();				/* close everything */
-		serial_ip_init();					/* initialization program. */
+	reload_pending = 1;
 }
 
 /*
@@ -235,6 +325,7 @@ void action_sigchild(int signal)
 	/* log this at the ERR level to be sure it reaches the log */
 	syslog(LOG_ERR,"received signal %d (%s)",signal,signame(signal));
 
+	port_worker_wait();					/* the port workers first, by their pid */
 	while (1) {
     	pid = wait_child_termination((pid_t) -1, &status);	/* get pid and child's status (note: status now is not available yet).
     	 	 	 	 	 	 	 	 	 	 	 -1 for the calling process wait for any child process terminate.	 */
@@ -273,7 +364,7 @@ void action_sigpipe(int signal)
 /*
 	Location: signal_handle.c
 	This is to handle SIGUSR1.
-	Action: Increment the debug level.
+	Action: Increment the debug level, and log the statistics of the session slab allocator.
 */
 void action_sigusr1(int signal)
 {
@@ -288,6 +379,7 @@ void action_sigusr1(int signal)
 	}
 	/* log this at the LOG_ERR level to be sure it reaches the log */
     syslog(LOG_ERR,"Received %s signal.  Debug level now %d.",signame(signal),level);
+	session_slab_stats();										/* and how the session buffers are doing */
 }
 
 /*
@@ -357,11 +449,16 @@ void parent_signal_received(int signal)
 	3. Direct sa_handler field of "sa" to our defined function action which we want a specific signal do.
 	4. Calling function "sigaction(SIGNAL, &sa, NULL).
 	5. ...Our code...
+	If the kernel has signalfd, the signals are read from signal_fd instead and no handler is installed.
 */
 void install_signal_handlers(void)
 {
 	struct sigaction sa;
 
+	if (signal_fd_open(parent_signal_received) == 0) {
+		syslog(LOG_INFO,"signal_handle.c: signals are read from signalfd %d", signal_fd);
+		return;
+	}
 	//memset(sa, 0, sizeof(sa));
 	sa.sa_handler = &parent_signal_received;	/* function to handle all signals */
 
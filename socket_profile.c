@@ -0,0 +1,197 @@
+/*
+ * socket_profile.c
+ *	These are the socket profiles a serial port may give the sockets of its sessions, set per port
+ *	with "socket profile":
+ *	- latency: for interactive command lines. Nagle is off (TCP_NODELAY) and acks go out at once
+ *	  (TCP_QUICKACK, armed again after each read: the kernel drops it on its own), so a short reply is
+ *	  not held back 40-200 ms to be coalesced; little unsent data is queued (TCP_NOTSENT_LOWAT), and
+ *	  the packets are marked for expedited forwarding (DSCP EF) and queued first on the gateway
+ *	  (SO_PRIORITY).
+ *	- throughput: for bulk lines. Large socket buffers, set on the listener of the port as well, since
+ *	  the window scale is agreed on in the handshake, before accept(). The socket is not corked: each
+ *	  flush is a single write(), with nothing to coalesce, and Nagle, which is left on, already holds a
+ *	  partial segment back until the next flush or the ack.
+ *	- default: the sockets are left as they are.
+ *	A session process applies the whole profile of its port as soon as it knows the port, before
+ *	anything is sent on the socket; so does the worker of a shared port (share.c) for each client.
+ *	A multiplexed connection (mux.c) carries many ports at once and keeps the defaults: no single
+ *	profile fits it. Neither does the main listening socket (-p), which all the ports may share: its
+ *	sessions get their buffers only after accept(), with the window scale they had.
+ *	The tcp options are skipped on a unix socket (see unix_socket.c). What is refused is logged, and
+ *	the session goes on with what it has.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+#define SOCKET_PROFILE_NOTSENT_LOWAT	4096			/* unsent bytes a latency socket queues at most */
+#define SOCKET_PROFILE_PRIORITY			6				/* TC_PRIO_INTERACTIVE, the highest without CAP_NET_ADMIN */
+#define SOCKET_PROFILE_DSCP_EF			0xb8			/* expedited forwarding, in the TOS / traffic class byte */
+#define SOCKET_PROFILE_BUFFER			(1024 * 1024)	/* capped by net.core.wmem_max / rmem_max */
+
+#define SOCKET_OPTION_ANY		0				/* any stream socket */
+#define SOCKET_OPTION_TCP		1				/* a tcp socket, IPv4 or IPv6 */
+#define SOCKET_OPTION_IPV4		2
+#define SOCKET_OPTION_IPV6		3
+
+/*
+	Location: socket_profile.c
+	A socket option of a profile, and the sockets it applies to.
+*/
+struct socket_option_t {
+	const char *name;
+	int applies;							/* SOCKET_OPTION_* */
+	int listener;							/* it is set on the listener too */
+	int level;
+	int option;
+	int value;
+};
+
+static struct socket_option_t socket_profile_latency[] = {
+	{"TCP_NODELAY",			SOCKET_OPTION_TCP,	0,	IPPROTO_TCP,	TCP_NODELAY,		1},
+	{"TCP_QUICKACK",		SOCKET_OPTION_TCP,	0,	IPPROTO_TCP,	TCP_QUICKACK,		1},
+	{"TCP_NOTSENT_LOWAT",	SOCKET_OPTION_TCP,	0,	IPPROTO_TCP,	TCP_NOTSENT_LOWAT,	SOCKET_PROFILE_NOTSENT_LOWAT},
+	{"IP_TOS",				SOCKET_OPTION_IPV4,	0,	IPPROTO_IP,		IP_TOS,				SOCKET_PROFILE_DSCP_EF},
+	{"IPV6_TCLASS",			SOCKET_OPTION_IPV6,	0,	IPPROTO_IPV6,	IPV6_TCLASS,		SOCKET_PROFILE_DSCP_EF},
+	{"SO_PRIORITY",			SOCKET_OPTION_ANY,	0,	SOL_SOCKET,		SO_PRIORITY,		SOCKET_PROFILE_PRIORITY},
+	{NULL,					0,					0,	0,				0,					0}
+};
+
+static struct socket_option_t socket_profile_throughput[] = {
+	{"SO_SNDBUF",			SOCKET_OPTION_ANY,	1,	SOL_SOCKET,		SO_SNDBUF,			SOCKET_PROFILE_BUFFER},
+	{"SO_RCVBUF",			SOCKET_OPTION_ANY,	1,	SOL_SOCKET,		SO_RCVBUF,			SOCKET_PROFILE_BUFFER},
+	{NULL,					0,					0,	0,				0,					0}
+};
+
+/*
+	Location: socket_profile.c
+	The profiles, in the order of their SOCKET_PROFILE_* value.
+*/
+static struct {
+	const char *name;
+	struct socket_option_t *options;
+} socket_profiles[] = {
+	{"default",		NULL},
+	{"latency",		socket_profile_latency},
+	{"throughput",	socket_profile_throughput},
+};
+
+#define SOCKET_PROFILES		(int) (sizeof(socket_profiles) / sizeof(socket_profiles[0]))
+
+/*
+	Location: socket_profile.c
+	This is to parse a "socket profile" value: latency, throughput or default.
+	returns 0 on success, 1 on failure.
+*/
+int socket_profile_parse(const char *value, int *profile)
+{
+	int i;
+
+	for (i = 0; i < SOCKET_PROFILES; i++) {
+		if (strcasecmp(value, socket_profiles[i].name) == 0) {
+			*profile = i;
+			return(0);
+		}
+	}
+	return(1);
+}
+
+/*
+	Location: socket_profile.c
+	This is to tell whether an option applies to a socket of a family.
+	returns 1 if it does, 0 otherwise.
+*/
+static int socket_option_applies(struct socket_option_t *opt, int family)
+{
+	switch (opt->applies) {
+	case SOCKET_OPTION_TCP:
+		return((family == AF_INET) || (family == AF_INET6));
+	case SOCKET_OPTION_IPV4:
+		return(family == AF_INET);
+	case SOCKET_OPTION_IPV6:
+		return(family == AF_INET6);
+	default:
+		return(1);
+	}
+}
+
+/*
+	Location: socket_profile.c
+	This is to give the socket of a session the profile of its port.
+	returns the number of options which were refused.
+*/
+int socket_profile_apply(SERIAL_INFO *port, int sockfd)
+{
+	extern int errno;
+	struct socket_option_t *opt;
+	struct sockaddr_storage addr;
+	socklen_t len;
+	int sndbuf;
+	int rcvbuf;
+	int refused;
+
+	if ((port->socket_profile <= SOCKET_PROFILE_DEFAULT) || (port->socket_profile >= SOCKET_PROFILES))
+		return(0);
+	len = sizeof(addr);
+	if (getsockname(sockfd, (struct sockaddr *) &addr, &len) != 0)
+		addr.ss_family = AF_UNSPEC;
+	refused = 0;
+	for (opt = socket_profiles[port->socket_profile].options; opt->name != NULL; opt++) {
+		if (! socket_option_applies(opt, addr.ss_family))
+			continue;
+		if (setsockopt(sockfd, opt->level, opt->option, &opt->value, sizeof(opt->value)) != 0) {
+			syslog(LOG_ERR, "socket_profile.c: socket_profile_apply(): cannot set %s for %s: %s", opt->name,
+					port->device, strerror(errno));
+			refused++;
+		}
+	}
+	/* what the kernel made of the buffer sizes */
+	len = sizeof(int);
+	if ((getsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) != 0) || (getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len) != 0))
+		sndbuf = rcvbuf = -1;
+	syslog(LOG_INFO, "socket_profile.c: socket_profile_apply(): %s profile for %s on socket %d, buffers %d/%d bytes%s",
+			socket_profiles[port->socket_profile].name, port->device, sockfd, sndbuf, rcvbuf,
+			(refused > 0) ? ", some options refused" : "");
+	return(refused);
+}
+
+/*
+	Location: socket_profile.c
+	This is to give the listener of a port the options of its profile which the sockets it accepts
+	must have from the start: the buffer sizes, which the window scale of the handshake follows.
+	returns the number of options which were refused.
+*/
+int socket_profile_listen(SERIAL_INFO *port, int sockfd)
+{
+	extern int errno;
+	struct socket_option_t *opt;
+	int refused;
+
+	if ((port->socket_profile <= SOCKET_PROFILE_DEFAULT) || (port->socket_profile >= SOCKET_PROFILES))
+		return(0);
+	refused = 0;
+	for (opt = socket_profiles[port->socket_profile].options; opt->name != NULL; opt++) {
+		if (opt->listener && (setsockopt(sockfd, opt->level, opt->option, &opt->value, sizeof(opt->value)) != 0)) {
+			syslog(LOG_ERR, "socket_profile.c: socket_profile_listen(): cannot set %s on the listener of %s: %s", opt->name,
+					port->device, strerror(errno));
+			refused++;
+		}
+	}
+	return(refused);
+}
+
+/*
+	Location: socket_profile.c
+	This is called after each read of a socket of a latency session: the kernel leaves quick ack
+	mode by itself, so it is asked for again. It fails quietly on a unix socket.
+*/
+void socket_profile_read(SERIAL_INFO *port, int sockfd)
+{
+	int on;
+
+	if ((port == NULL) || (port->socket_profile != SOCKET_PROFILE_LATENCY))
+		return;
+	on = 1;
+	setsockopt(sockfd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+}
@@ -0,0 +1,546 @@
+/*
+ * telnet_engine.c
+ *	This is the Telnet / RFC2217 protocol engine. It keeps all its state in a TELNET_SESSION and does no
+ *	I/O of its own. Bytes from the client go in through telnet_engine_recv(), which takes the Telnet
+ *	commands out of them in place and leaves the data for the serial port; a command split over two
+ *	reads is picked up where it stopped. What the engine has to say goes out as events to the handler
+ *	the session is bound to: bytes for the client, and the Com Port Control requests which need the
+ *	serial port (baud rate, data size, parity, stop size, signature).
+ *	Nothing here is static, so sessions may share a thread, and the engine can be driven without a
+ *	socket or a serial port. The daemon side, which owns the file descriptors, is in telnet.c.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+/* for the tnmode[] array */
+#define CLIENT 0x00
+#define SERVER 0x01
+
+/* the option bitsets of TELNET_SESSION */
+#define TELNET_OPTION_SET(tn, set, option)		((tn)->options[set][(option) >> 5] |= 1U << ((option) & 31))
+#define TELNET_OPTION_CLEAR(tn, set, option)	((tn)->options[set][(option) >> 5] &= ~(1U << ((option) & 31)))
+#define TELNET_OPTION_ISSET(tn, set, option)	(((tn)->options[set][(option) >> 5] >> ((option) & 31)) & 1U)
+
+/*
+	Location: telnet_engine.c
+	This is to bind a session to its host: handler gets the events of the session, user is left for it.
+*/
+void telnet_engine_bind(TELNET_SESSION *tn, telnet_event_handler handler, void *user)
+{
+	tn->handler = handler;
+	tn->user = user;
+}
+
+/*
+	Location: telnet_engine.c
+	This is to put a session back to the state of a new connection. The binding is kept.
+*/
+void telnet_engine_reset(TELNET_SESSION *tn)
+{
+	/* init all telnet options to "off" */
+	memset(tn->options, 0, sizeof(tn->options));
+	/* initially we're in ASCII mode */
+	tn->tnmode[CLIENT] = ASCII;
+	tn->tnmode[SERVER] = ASCII;
+	tn->session_state = RESUME;
+	tn->break_signaled = 0;
+	tn->ask_client_signature = 1;
+	/* these default values are dictated by RFC2217.  don't change them! */
+	tn->linestate_mask = 0x00;
+	tn->linestate = 0;
+	tn->modemstate_mask = 0xff;
+	tn->modemstate = 0;
+	tn->state = TELNET_STATE_DATA;
+	tn->sb_len = 0;
+}
+
+/*
+	Location: telnet_engine.c
+	This is to take over the state of a session saved elsewhere (see upgrade.c), keeping our binding:
+	the handler of the saved session may not exist in this process.
+*/
+void telnet_engine_restore(TELNET_SESSION *tn, const TELNET_SESSION *saved)
+{
+	telnet_event_handler handler = tn->handler;
+	void *user = tn->user;
+
+	*tn = *saved;														/* structure copy */
+	telnet_engine_bind(tn, handler, user);
+}
+
+/*
+	Location: telnet_engine.c
+	This is to hand bytes for the client to the host.
+	returns 0 on success, 1 on failure
+*/
+static int telnet_engine_send(TELNET_SESSION *tn, unsigned char *data, int len)
+{
+	struct telnet_event_t ev;
+
+	if (tn->handler == NULL)
+		return(1);
+	memset(&ev, 0, sizeof(ev));
+	ev.type = TELNET_EV_SEND;
+	ev.data = data;
+	ev.len = len;
+	return(tn->handler(tn, &ev));
+}
+
+/*
+	Location: telnet_engine.c
+	This is to read a command of 1, 2 or 4 bytes as a value, as RFC2217 sends them.
+*/
+static unsigned long telnet_engine_value(unsigned char *command, int cmdlen)
+{
+	if (cmdlen == 1)
+		return((unsigned long) command[0]);
+	if (cmdlen == 2)
+		return(((unsigned long) command[0] << 8) | command[1]);
+	if (cmdlen == 4)
+		return(((unsigned long) command[0] << 24) | ((unsigned long) command[1] << 16) |
+				((unsigned long) command[2] << 8) | command[3]);
+	return(0L);
+}
+
+/*
+	Location: telnet_engine.c
+	log some info about a telnet CPC suboption: its name, its value,
+	and a hex dump of the command string.
+*/
+void telnet_cpc_log_subopt(char *prefix, unsigned char suboptcode, unsigned long value, unsigned char *command, int cmdlen)
+{
+	char fmt[128];
+
+	fmt[0] = '\0';
+	if ((prefix != NULL) && (*prefix != '\0'))
+		snprintf(fmt, sizeof(fmt), "%s ", prefix);
+	strcat(fmt, "telnet CPC suboption \"%s\", value ");
+	if (value < 256) {
+		strcat(fmt,"0x%02lx");									/* one byte value, show as hex */
+	} else {
+		strcat(fmt,"%lu");										/* multi-byte value, show as long decimal */
+	}
+	if (cmdlen > 1)
+		strcat(fmt,", hex dump:");
+
+	syslog(LOG_INFO, fmt, telnet_cpc_subopt2str(suboptcode), value);	/* send to syslog */
+
+	if (cmdlen > 1)
+		memdump((char *) command, cmdlen, NULL);				/* will go to syslog() too */
+}
+
+/*
+	Location: telnet_engine.c
+	This is to send a telnet Com Port Control (CPC) suboption: IAC SB COM-PORT-OPT suboptcode <content> IAC SE,
+	with the IAC chars of the content escaped.
+	returns 0 on success, 1 on failure
+*/
+int telnet_engine_send_cpc(TELNET_SESSION *tn, unsigned char suboptcode, unsigned char *content, int cmdlen)
+{
+	unsigned char optstr[2*MAX_TELNET_CPC_COMMAND_LEN+8];
+	unsigned long value;
+	int size;
+	int i;
+
+	if (cmdlen >= MAX_TELNET_CPC_COMMAND_LEN)
+		cmdlen = MAX_TELNET_CPC_COMMAND_LEN - 1;
+	value = telnet_engine_value(content, cmdlen);
+	optstr[0] = IAC;
+	optstr[1] = SB;
+	optstr[2] = TELOPT_COM_PORT_OPTION;
+	optstr[3] = suboptcode;
+	size = 4;
+	for (i = 0; i < cmdlen; i++) {
+		if (content[i] == IAC)
+			optstr[size++] = IAC;							/* the command may contain IAC, double it */
+		optstr[size++] = content[i];
+	}
+	optstr[size++] = IAC;
+	optstr[size++] = SE;
+
+	if (telnet_engine_send(tn, optstr, size) == 0) {
+		telnet_cpc_log_subopt("sent", suboptcode, value, content, cmdlen);
+		return(0);
+	}
+	telnet_cpc_log_subopt("error sending", suboptcode, value, content, cmdlen);
+	return(1);
+}
+
+/*
+	Location: telnet_engine.c
+	is the specified telnet option enabled, client to server?
+*/
+int telnet_client_option_is_enabled(TELNET_SESSION *tn, unsigned char option)
+{
+	return(TELNET_OPTION_ISSET(tn, TELNET_OPT_CLIENT, option));
+}
+
+/*
+	Location: telnet_engine.c
+	is the specified telnet option enabled, server to client?
+*/
+int telnet_server_option_is_enabled(TELNET_SESSION *tn, unsigned char option)
+{
+	return(TELNET_OPTION_ISSET(tn, TELNET_OPT_SERVER, option));
+}
+
+/*
+	Location: telnet_engine.c
+	This is to get the mark which records that optcode was sent.
+	returns the option set, -1 for an unknown optcode.
+*/
+static int telnet_engine_sent_set(unsigned char optcode)
+{
+	switch (optcode) {
+	case WILL:
+		return(TELNET_SENT_WILL);
+	case DO:
+		return(TELNET_SENT_DO);
+	case WONT:
+		return(TELNET_SENT_WONT);
+	case DONT:
+		return(TELNET_SENT_DONT);
+	default:
+		return(-1);
+	}
+}
+
+/*
+	Location: telnet_engine.c
+	This is to send a telnet option, once. Formation: IAC optcode option.
+	returns 0 on success, 1 on failure
+*/
+int telnet_engine_send_option(TELNET_SESSION *tn, unsigned char optcode, unsigned char option)
+{
+	unsigned char optstr[3];
+	int set;
+
+	set = telnet_engine_sent_set(optcode);
+	if (set < 0) {
+		syslog(LOG_ERR, "telnet_engine.c: telnet_engine_send_option(): unknown telnet option code: %d", (int) optcode);
+		return(1);
+	}
+	/* make sure we only send it once */
+	if (TELNET_OPTION_ISSET(tn, set, option)) {
+		syslog(LOG_INFO, "telnet_engine.c: telnet_engine_send_option(): telnet option %s %s already sent",
+				telnet_optcode2str(optcode), telnet_option2str(option));
+		return(0);
+	}
+	optstr[0] = IAC;
+	optstr[1] = optcode;
+	optstr[2] = option;
+	if (telnet_engine_send(tn, optstr, 3) != 0) {
+		syslog(LOG_ERR, "telnet_engine.c: telnet_engine_send_option(): error sending telnet option %s %s",
+				telnet_optcode2str(optcode), telnet_option2str(option));
+		return(1);
+	}
+	TELNET_OPTION_SET(tn, set, option);
+	syslog(LOG_INFO, "telnet_engine.c: telnet_engine_send_option(): sent telnet option %s %s",
+			telnet_optcode2str(optcode), telnet_option2str(option));
+	return(0);
+}
+
+/*
+	Location: telnet_engine.c
+	This is to start a session: reset it and send the initial option negotiations, Com Port Control,
+	Binary, etc.
+	returns 0 on success, 1 on failure
+*/
+int telnet_engine_start(TELNET_SESSION *tn)
+{
+	int ret = 0;
+
+	telnet_engine_reset(tn);
+	ret += telnet_engine_send_option(tn, DO,   TELOPT_COM_PORT_OPTION);
+	ret += telnet_engine_send_option(tn, WILL, TELOPT_BINARY);
+	ret += telnet_engine_send_option(tn, DO,   TELOPT_BINARY);
+	ret += telnet_engine_send_option(tn, WILL, TELOPT_ECHO);
+	ret += telnet_engine_send_option(tn, WILL, TELOPT_SGA);
+	ret += telnet_engine_send_option(tn, DO,   TELOPT_SGA);
+	return(ret ? 1 : 0);
+}
+
+/*
+	Location: telnet_engine.c
+	This is to respond to the optcode+option that we've received from the client, for an option we
+	agree to. The answer is only sent when the state of the option changes, to prevent option loops.
+	For BINARY, the mode of the connection follows.
+*/
+static int telnet_engine_respond_known(TELNET_SESSION *tn, unsigned char optcode, unsigned char option)
+{
+	int ret = 0;
+
+	switch (optcode) {
+	case WILL:														/* server DO, client WILL */
+		if (! TELNET_OPTION_ISSET(tn, TELNET_OPT_CLIENT, option)) {
+			ret = telnet_engine_send_option(tn, DO, option);
+			TELNET_OPTION_SET(tn, TELNET_OPT_CLIENT, option);			/* server <<== client */
+			if ((option == TELOPT_BINARY) && (tn->tnmode[CLIENT] != BINARY)) {
+				syslog(LOG_INFO, "telnet_engine.c: telnet connection is now in BINARY mode (server <<== client)");
+				tn->tnmode[CLIENT] = BINARY;
+			}
+		}
+		break;
+	case WONT:														/* server DO, client WONT */
+		if (TELNET_OPTION_ISSET(tn, TELNET_OPT_CLIENT, option)) {
+			ret = telnet_engine_send_option(tn, DONT, option);
+			TELNET_OPTION_CLEAR(tn, TELNET_OPT_CLIENT, option);
+			if ((option == TELOPT_BINARY) && (tn->tnmode[CLIENT] != ASCII)) {
+				syslog(LOG_INFO, "telnet_engine.c: telnet connection is now in ASCII mode (server <<== client)");
+				tn->tnmode[CLIENT] = ASCII;
+			}
+		}
+		break;
+	case DO:														/* server WILL, client DO */
+		if (! TELNET_OPTION_ISSET(tn, TELNET_OPT_SERVER, option)) {
+			ret = telnet_engine_send_option(tn, WILL, option);
+			TELNET_OPTION_SET(tn, TELNET_OPT_SERVER, option);			/* server ==>> client */
+			if ((option == TELOPT_BINARY) && (tn->tnmode[SERVER] != BINARY)) {
+				syslog(LOG_INFO, "telnet_engine.c: telnet connection is now in BINARY mode (server ==>> client)");
+				tn->tnmode[SERVER] = BINARY;
+			}
+		}
+		break;
+	case DONT:														/* server WILL, client DONT */
+		if (TELNET_OPTION_ISSET(tn, TELNET_OPT_SERVER, option)) {
+			ret = telnet_engine_send_option(tn, WONT, option);
+			TELNET_OPTION_CLEAR(tn, TELNET_OPT_SERVER, option);
+			if ((option == TELOPT_BINARY) && (tn->tnmode[SERVER] != ASCII)) {
+				syslog(LOG_INFO, "telnet_engine.c: telnet connection is now in ASCII mode (server ==>> client)");
+				tn->tnmode[SERVER] = ASCII;
+			}
+		}
+		break;
+	default:
+		break;
+	}
+	return(ret);
+}
+
+/*
+	Location: telnet_engine.c
+	This is to send a response to a telnet option request.
+	returns 0 on success, 1 on failure
+*/
+static int telnet_engine_respond_option(TELNET_SESSION *tn, unsigned char optcode, unsigned char option)
+{
+	int ret;
+
+	syslog(LOG_INFO, "telnet_engine.c: telnet_engine_respond_option(): received telnet option %s %s",
+			telnet_optcode2str(optcode), telnet_option2str(option));
+
+	switch (option) {
+	case TELOPT_COM_PORT_OPTION:
+	case TELOPT_ECHO:
+	case TELOPT_SGA:
+	case TELOPT_BINARY:
+		ret = telnet_engine_respond_known(tn, optcode, option);
+		break;
+	case TELOPT_LOGOUT:
+		ret = telnet_engine_respond_known(tn, optcode, option);
+		if ((optcode == WILL) || (optcode == DO))
+			tn->client_logged_in = 0;									/* client and server agree to the logout */
+		break;
+	default:
+		/* send a negative acknowledgement */
+		ret = telnet_engine_send_option(tn, ((optcode == WILL) || (optcode == WONT)) ? DONT : WONT, option);
+		break;
+	}
+	return(ret);
+}
+
+/*
+	Location: telnet_engine.c
+	This is to act on a Com Port Control suboption from the client, once its IAC SE was seen. The masks
+	are kept here; the requests which need the serial port go to the host.
+	returns 0 on success, 1 on failure
+*/
+static int telnet_engine_cpc(TELNET_SESSION *tn)
+{
+	struct telnet_event_t ev;
+	unsigned char suboptcode;
+	unsigned char *command;
+	unsigned long value;
+	int len;
+
+	suboptcode = tn->sb[0];
+	command = &tn->sb[1];
+	len = tn->sb_len - 1;
+	command[len] = '\0';												/* the command may be empty */
+	value = telnet_engine_value(command, len);
+
+	/* log which telnet CPC suboption we've received, its args, and the arg value */
+	telnet_cpc_log_subopt("received", suboptcode, value, command, len);
+
+	switch (suboptcode) {
+	case CPC_SET_LINESTATE_MASK_C2S:
+	case CPC_SET_LINESTATE_MASK_S2C:
+		tn->linestate_mask = (unsigned char) value;
+		syslog(LOG_INFO, "telnet_engine.c: telnet_engine_cpc(): telnet CPC client sets the linestate mask to 0x%02x", tn->linestate_mask);
+		return(telnet_engine_send_cpc(tn, CPC_SET_LINESTATE_MASK_S2C, &tn->linestate_mask, 1));
+	case CPC_SET_MODEMSTATE_MASK_C2S:
+	case CPC_SET_MODEMSTATE_MASK_S2C:
+		tn->modemstate_mask = (unsigned char) value;
+		syslog(LOG_INFO, "telnet_engine.c: telnet_engine_cpc(): telnet CPC client sets the modemstate mask to 0x%02x", tn->modemstate_mask);
+		return(telnet_engine_send_cpc(tn, CPC_SET_MODEMSTATE_MASK_S2C, &tn->modemstate_mask, 1));
+	case CPC_NOTIFY_LINESTATE_C2S:
+	case CPC_NOTIFY_LINESTATE_S2C:
+		syslog(LOG_INFO, "telnet_engine.c: telnet_engine_cpc(): telnet CPC client notifies linestate 0x%02lx", value);
+		return(0);
+	case CPC_NOTIFY_MODEMSTATE_C2S:
+	case CPC_NOTIFY_MODEMSTATE_S2C:
+		syslog(LOG_INFO, "telnet_engine.c: telnet_engine_cpc(): telnet CPC client notifies modemstate 0x%02lx", value);
+		return(0);
+	default:
+		break;
+	}
+	if (tn->handler == NULL)
+		return(1);
+	memset(&ev, 0, sizeof(ev));
+	ev.type = TELNET_EV_CPC;
+	ev.suboptcode = suboptcode;
+	ev.value = value;
+	ev.data = command;
+	ev.len = len;
+	return(tn->handler(tn, &ev));
+}
+
+/*
+	Location: telnet_engine.c
+	This is to act on a complete suboption, IAC SB option ... IAC SE.
+*/
+static void telnet_engine_suboption(TELNET_SESSION *tn)
+{
+	if ((tn->sb_option == TELOPT_COM_PORT_OPTION) && TELNET_OPTION_ISSET(tn, TELNET_OPT_CLIENT, TELOPT_COM_PORT_OPTION)) {
+		if (tn->sb_len > 0)
+			telnet_engine_cpc(tn);
+	} else {
+		syslog(LOG_ERR, "telnet_engine.c: ignoring telnet suboption negotiations for %s", telnet_option2str(tn->sb_option));
+	}
+}
+
+/*
+	Location: telnet_engine.c
+	This is to process len bytes received from the client. The Telnet commands are acted on and taken
+	out, a doubled IAC is made one again, and the data for the serial port is moved to the front of
+	data, in place. A command which does not end in data carries on with the next call.
+	returns the number of data bytes left at data.
+*/
+int telnet_engine_recv(TELNET_SESSION *tn, unsigned char *data, int len)
+{
+	unsigned char *iac;
+	unsigned char c;
+	int in;
+	int out;
+
+	/* the common case: no command in sight, nothing moves */
+	if (tn->state == TELNET_STATE_DATA) {
+		iac = memchr(data, IAC, len);
+		if (iac == NULL)
+			return(len);
+		out = in = iac - data;
+	} else {
+		out = in = 0;
+	}
+
+	while (in < len) {
+		c = data[in++];
+		switch (tn->state) {
+		case TELNET_STATE_DATA:
+			if (c == IAC)
+				tn->state = TELNET_STATE_IAC;
+			else
+				data[out++] = c;
+			break;
+		case TELNET_STATE_IAC:
+			switch (c) {
+			case IAC:													/* a double IAC */
+				data[out++] = c;
+				tn->state = TELNET_STATE_DATA;
+				break;
+			case WILL:													/* WILL, DO, DONT, WONT */
+			case DO:
+			case DONT:
+			case WONT:
+				tn->optcode = c;
+				tn->state = TELNET_STATE_OPTION;
+				break;
+			case SB:													/* sub-option */
+				tn->state = TELNET_STATE_SB;
+				break;
+			default:						/* invalid char after IAC.  RFC854 says treat it as NOP. */
+				syslog(LOG_ERR, "telnet_engine.c: telnet_engine_recv(): ignoring telnet %s command", telnet_optcode2str(c));
+				tn->state = TELNET_STATE_DATA;
+				break;
+			}
+			break;
+		case TELNET_STATE_OPTION:
+			tn->state = TELNET_STATE_DATA;
+			telnet_engine_respond_option(tn, tn->optcode, c);
+			break;
+		case TELNET_STATE_SB:
+			tn->sb_option = c;
+			tn->sb_len = 0;
+			tn->state = TELNET_STATE_SB_DATA;
+			break;
+		case TELNET_STATE_SB_DATA:
+			if (c == IAC)
+				tn->state = TELNET_STATE_SB_IAC;
+			else if (tn->sb_len < MAX_TELNET_CPC_COMMAND_LEN)		/* the rest of a long one is dropped */
+				tn->sb[tn->sb_len++] = c;
+			break;
+		case TELNET_STATE_SB_IAC:
+			if (c == IAC) {												/* a double IAC in the suboption */
+				if (tn->sb_len < MAX_TELNET_CPC_COMMAND_LEN)
+					tn->sb[tn->sb_len++] = c;
+				tn->state = TELNET_STATE_SB_DATA;
+			} else if (c == SE) {
+				tn->state = TELNET_STATE_DATA;
+				telnet_engine_suboption(tn);
+			} else {													/* no IAC SE: drop it, and take the command */
+				syslog(LOG_ERR, "telnet_engine.c: telnet_engine_recv(): unterminated telnet suboption for %s", telnet_option2str(tn->sb_option));
+				tn->state = TELNET_STATE_IAC;
+				in--;
+			}
+			break;
+		default:
+			tn->state = TELNET_STATE_DATA;
+			break;
+		}
+	}
+	return(out);
+}
+
+/*
+	Location: telnet_engine.c
+	This is to tell the client about modem line and line state changes, with NOTIFY-MODEMSTATE and
+	NOTIFY-LINESTATE (RFC2217). newstate is what the host read from the modem lines, line_errors the
+	line state bits it saw. Only the bits of modemstate_mask / linestate_mask are reported, and only
+	when one of them changed.
+	returns 0 on success, 1 on failure
+*/
+int telnet_engine_notify(TELNET_SESSION *tn, unsigned char newstate, unsigned char line_errors)
+{
+	unsigned char value;
+	int ret = 0;
+
+	if (! TELNET_OPTION_ISSET(tn, TELNET_OPT_CLIENT, TELOPT_COM_PORT_OPTION))
+		return(0);												/* the client does not speak RFC2217 */
+	if ((newstate ^ tn->modemstate) & tn->modemstate_mask) {
+		value = newstate & tn->modemstate_mask;
+		ret += telnet_engine_send_cpc(tn, CPC_NOTIFY_MODEMSTATE_S2C, &value, 1);
+	}
+	/* the delta bits are reported once, we keep the line levels only */
+	tn->modemstate = newstate & (CPC_MODEMSTATE_CD|CPC_MODEMSTATE_RI|CPC_MODEMSTATE_DSR|CPC_MODEMSTATE_CTS);
+	if (tn->modemstate & CPC_MODEMSTATE_CD)
+		tn->carrier_state = GOT_CARRIER;
+	else if (tn->carrier_state == GOT_CARRIER)
+		tn->carrier_state = LOST_CARRIER;
+	if (line_errors & tn->linestate_mask) {
+		value = (tn->linestate | line_errors) & tn->linestate_mask;
+		ret += telnet_engine_send_cpc(tn, CPC_NOTIFY_LINESTATE_S2C, &value, 1);
+	}
+	return(ret ? 1 : 0);
+}
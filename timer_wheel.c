@@ -0,0 +1,303 @@
+/*
+ * timer_wheel.c
+ *	This is a hierarchical timing wheel for the timers of a session: idle timeout, modem polling,
+ *	batching windows (-w) and write pacing. The resolution is one millisecond. There are 4 levels of
+ *	64 slots, level n covers 64^(n+1) ms (about 4.6 hours in total, longer timers wait at the top).
+ *	Arming and cancelling a timer is O(1): it is linked into, or out of, the list of one slot.
+ *	Each level keeps a bitmap of its busy slots, so the next expiry is found without walking empty
+ *	slots. A single timerfd is programmed for that expiry; the event loop selects on timer_fd and calls
+ *	timer_wheel_run() when it is readable. Nothing wakes up while no timer is due.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#include "serial_ip.h"
+
+#include <sys/timerfd.h>
+
+#define WHEEL_BITS		6
+#define WHEEL_SLOTS		(1 << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_NEVER		(~0ULL)
+
+/*
+	Location: timer_wheel.c
+	The wheel: ticks are milliseconds of CLOCK_MONOTONIC.
+*/
+struct timer_wheel_t {
+	unsigned long long current;							/* every tick before this one has been run */
+	unsigned long long programmed;						/* expiry the timerfd is set for, WHEEL_NEVER if none */
+	unsigned long long busy[WHEEL_LEVELS];				/* bitmap of the slots which hold timers */
+	WHEEL_TIMER *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+static struct timer_wheel_t wheel;
+
+int timer_fd = -1;										/* readable when a timer is due */
+
+/*
+	Location: timer_wheel.c
+	This is to read the clock the wheel runs on.
+	returns the time in milliseconds.
+*/
+unsigned long long timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((unsigned long long) ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+/*
+	Location: timer_wheel.c
+	This is to create the timerfd. Timers can only be armed once this succeeded.
+	returns 0 on success, 1 on failure.
+*/
+int timer_wheel_init(void)
+{
+	extern int timer_fd;
+
+	if (timer_fd >= 0)
+		return(0);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		syslog(LOG_ERR, "timer_wheel.c: timer_wheel_init(): timerfd_create() error: %s", strerror(errno));
+		return(1);
+	}
+	memset(&wheel, 0, sizeof(wheel));
+	wheel.current = timer_now();
+	wheel.programmed = WHEEL_NEVER;
+	return(0);
+}
+
+/*
+	Location: timer_wheel.c
+	This is to close the timerfd, eg. in a child process. Armed timers are forgotten.
+*/
+void timer_wheel_close(void)
+{
+	extern int timer_fd;
+
+	if (timer_fd >= 0)
+		close(timer_fd);
+	timer_fd = -1;
+	memset(&wheel, 0, sizeof(wheel));
+}
+
+/*
+	Location: timer_wheel.c
+	This is to set up a timer. callback(arg) is called from timer_wheel_run() when it expires.
+*/
+void timer_init(WHEEL_TIMER *timer, void (*callback)(void *), void *arg)
+{
+	memset(timer, 0, sizeof(WHEEL_TIMER));
+	timer->callback = callback;
+	timer->arg = arg;
+}
+
+/*
+	Location: timer_wheel.c
+	This is to link a timer into the slot its expiry falls in.
+*/
+static void timer_link(WHEEL_TIMER *timer)
+{
+	unsigned long long delta;
+	int level;
+	int slot;
+
+	delta = (timer->expires > wheel.current) ? timer->expires - wheel.current : 0;
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < (1ULL << (WHEEL_BITS * (level + 1))))
+			break;
+	}
+	if (delta == 0)
+		slot = wheel.current & WHEEL_MASK;					/* overdue: the next run takes it */
+	else if (delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS)))
+		slot = ((wheel.current >> (WHEEL_BITS * level)) + WHEEL_MASK) & WHEEL_MASK;	/* too far: wait at the top */
+	else
+		slot = (timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	timer->level = level;
+	timer->slot = slot;
+	timer->prev = NULL;
+	timer->next = wheel.slots[level][slot];
+	if (timer->next != NULL)
+		timer->next->prev = timer;
+	wheel.slots[level][slot] = timer;
+	wheel.busy[level] |= 1ULL << slot;
+	timer->armed = 1;
+}
+
+/*
+	Location: timer_wheel.c
+	This is to unlink a timer from its slot.
+*/
+static void timer_unlink(WHEEL_TIMER *timer)
+{
+	if (timer->prev != NULL)
+		timer->prev->next = timer->next;
+	else
+		wheel.slots[timer->level][timer->slot] = timer->next;
+	if (timer->next != NULL)
+		timer->next->prev = timer->prev;
+	if (wheel.slots[timer->level][timer->slot] == NULL)
+		wheel.busy[timer->level] &= ~(1ULL << timer->slot);
+	timer->next = timer->prev = NULL;
+	timer->armed = 0;
+}
+
+/*
+	Location: timer_wheel.c
+	This is to find the next tick the wheel has something to do at: a timer of level 0 expires, or a
+	slot of a higher level must be spread over the levels below.
+	returns the tick, WHEEL_NEVER if no timer is armed.
+*/
+static unsigned long long timer_next_tick(void)
+{
+	unsigned long long next = WHEEL_NEVER;
+	unsigned long long bits;
+	unsigned long long tick;
+	int shift;
+	int pos;
+	int k;
+	int level;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		bits = wheel.busy[level];
+		if (bits == 0)
+			continue;
+		shift = WHEEL_BITS * level;
+		pos = (wheel.current >> shift) & WHEEL_MASK;
+		if (pos != 0)
+			bits = (bits >> pos) | (bits << (WHEEL_SLOTS - pos));	/* slot pos becomes bit 0 */
+		k = __builtin_ctzll(bits);
+		if (level == 0)
+			tick = wheel.current + k;
+		else
+			tick = ((wheel.current >> shift) + (k == 0 ? WHEEL_SLOTS : k)) << shift;
+		if (tick < next)
+			next = tick;
+	}
+	return(next);
+}
+
+/*
+	Location: timer_wheel.c
+	This is to program the timerfd for the next tick, or to disarm it.
+*/
+static void timer_program(void)
+{
+	extern int timer_fd;
+	struct itimerspec its;
+	unsigned long long next;
+
+	next = timer_next_tick();
+	if (next == wheel.programmed)
+		return;
+	memset(&its, 0, sizeof(its));
+	if (next != WHEEL_NEVER) {
+		if (next == 0)
+			next = 1;										/* 0 would disarm it */
+		its.it_value.tv_sec = next / 1000;
+		its.it_value.tv_nsec = (next % 1000) * 1000000;
+	}
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		syslog(LOG_ERR, "timer_wheel.c: timer_program(): timerfd_settime() error: %s", strerror(errno));
+	wheel.programmed = next;
+}
+
+/*
+	Location: timer_wheel.c
+	This is to arm a timer to expire msecs milliseconds from now (at least 1). A timer which is armed
+	already is moved to the new expiry.
+*/
+void timer_add(WHEEL_TIMER *timer, unsigned long msecs)
+{
+	extern int timer_fd;
+	int level;
+
+	if (timer_fd < 0)
+		return;
+	if (timer->armed)
+		timer_unlink(timer);
+	for (level = 0; (level < WHEEL_LEVELS) && (wheel.busy[level] == 0); level++)
+		;
+	if (level == WHEEL_LEVELS)
+		wheel.current = timer_now();						/* empty wheel: catch up with the clock */
+	timer->expires = timer_now() + (msecs > 0 ? msecs : 1);
+	timer_link(timer);
+	if ((wheel.programmed == WHEEL_NEVER) || (timer->expires < wheel.programmed))
+		timer_program();
+}
+
+/*
+	Location: timer_wheel.c
+	This is to cancel a timer. Nothing happens if it is not armed. The timerfd is left as it is, at
+	worst it wakes us up once for nothing.
+*/
+void timer_cancel(WHEEL_TIMER *timer)
+{
+	if (timer->armed)
+		timer_unlink(timer);
+}
+
+/*
+	Location: timer_wheel.c
+	This is to tell whether a timer is armed.
+	returns 1 if it is, 0 otherwise.
+*/
+int timer_pending(WHEEL_TIMER *timer)
+{
+	return(timer->armed);
+}
+
+/*
+	Location: timer_wheel.c
+	This is called when timer_fd is readable: it runs the callback of every timer which is due, and
+	programs the timerfd for the next one. A callback may arm and cancel timers.
+*/
+void timer_wheel_run(void)
+{
+	extern int timer_fd;
+	unsigned long long expirations;
+	unsigned long long now;
+	unsigned long long next;
+	WHEEL_TIMER *timer;
+	WHEEL_TIMER *list;
+	int level;
+	int slot;
+
+	if (timer_fd < 0)
+		return;
+	if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+		;													/* EAGAIN: we were woken for something else */
+	wheel.programmed = WHEEL_NEVER;
+	now = timer_now();
+	while ((next = timer_next_tick()) <= now) {
+		wheel.current = next;
+		/* spread the slots we reach over the levels below, the highest level first */
+		for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+			if ((wheel.current & ((1ULL << (WHEEL_BITS * level)) - 1)) != 0)
+				continue;
+			slot = (wheel.current >> (WHEEL_BITS * level)) & WHEEL_MASK;
+			list = wheel.slots[level][slot];
+			wheel.slots[level][slot] = NULL;
+			wheel.busy[level] &= ~(1ULL << slot);
+			while ((timer = list) != NULL) {
+				list = timer->next;
+				timer_link(timer);
+			}
+		}
+		/* run the timers of this tick */
+		slot = wheel.current & WHEEL_MASK;
+		while ((timer = wheel.slots[0][slot]) != NULL) {
+			timer_unlink(timer);
+			if (timer->callback != NULL)
+				(*timer->callback)(timer->arg);
+		}
+		wheel.current = next + 1;							/* this tick is done */
+	}
+	if (wheel.current <= now)
+		wheel.current = now + 1;							/* nothing was due in between */
+	timer_program();
+}
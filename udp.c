@@ -0,0 +1,414 @@
+/*
+ * udp.c
+ *	This is the datagram transport of a serial port ("udp port" in serial_ip.conf), for telemetry lines
+ *	which would rather lose a reading than wait for a retransmission, and have no connection to set up.
+ *	Each read of the serial device goes out as one datagram, the same to every peer of the port; each
+ *	datagram which comes in is written to the device. The peers are the ones of "udp peers", and any
+ *	host which sends us a datagram, an empty one will do, up to UDP_MAX_PEERS.
+ *	Datagrams go out and come in by batches, with sendmmsg() and recvmmsg(): one system call sends what
+ *	the device had to all the peers, one reads whatever the peers sent. A datagram carries at most
+ *	UDP_DATAGRAM_SIZE bytes, so that it is never fragmented on Ethernet.
+ *	With "udp sequence", a datagram starts with a sequence number, 4 bytes in network byte order, one
+ *	more for each datagram we send. We expect the same of the peers, and log the datagrams which were
+ *	lost or came out of order.
+ *	With "multicast group", the reads of the device are also published to a multicast group: a single
+ *	send reaches any number of read-only subscribers (historians, dashboards, loggers), none of which
+ *	needs a session of its own. Multicast datagrams always start with their sequence number, counted
+ *	apart from the unicast ones, so that a subscriber can tell what it missed; the count starts again
+ *	from 0 when the worker does. A port may publish without a "udp port", it then takes nothing in.
+ *	What the device does not take at once (CTS, XOFF) is kept pending, up to SERIAL_PENDING_SIZE bytes,
+ *	and written when it takes more; a datagram which finds no room left is dropped, as UDP would.
+ *	A port is served by a worker process of its own (see port_worker.c), which holds its uucp lock for
+ *	as long as it runs: a TCP client of the port finds it busy.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#define _GNU_SOURCE							/* sendmmsg(), recvmmsg() */
+#include "serial_ip.h"
+
+#include <poll.h>
+#include <netdb.h>
+
+#define UDP_DATAGRAM_SIZE	1472			/* Ethernet MTU less the IP and UDP headers */
+#define UDP_SEQ_SIZE		4
+#define UDP_BATCH			16				/* datagrams per system call */
+#define UDP_MAX_PEERS		8
+
+/*
+	Location: udp.c
+	A peer of a port, and what we know of its sequence numbers.
+*/
+struct udp_peer_t {
+	struct sockaddr_in addr;
+	uint32_t next_seq;						/* sequence number we expect from it */
+	int seen;								/* we have heard from it */
+	unsigned long lost;						/* datagrams missing from it */
+};
+
+/*
+	Location: udp.c
+	This is to resolve a host:port address. The string is cut at the colon.
+	returns 0 on success, 1 on failure.
+*/
+static int udp_resolve(char *item, struct sockaddr_in *addr)
+{
+	struct addrinfo hints;
+	struct addrinfo *res;
+	char *port;
+
+	port = strrchr(item, ':');
+	if (port == NULL) {
+		syslog(LOG_ERR, "udp.c: udp_resolve(): no port in udp address %s", item);
+		return(1);
+	}
+	*port++ = '\0';
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(item, port, &hints, &res) != 0) {
+		syslog(LOG_ERR, "udp.c: udp_resolve(): cannot resolve udp address %s", item);
+		return(1);
+	}
+	memcpy(addr, res->ai_addr, sizeof(struct sockaddr_in));
+	freeaddrinfo(res);
+	return(0);
+}
+
+/*
+	Location: udp.c
+	This is to parse a "udp peers" value: host:port, separated by commas or blanks.
+	returns the number of peers filled in.
+*/
+static int udp_parse_peers(const char *value, struct udp_peer_t *peers, int max)
+{
+	char *list;
+	char *item;
+	char *save;
+	int n;
+
+	if ((value == NULL) || ((list = strdup(value)) == NULL))
+		return(0);
+	n = 0;
+	for (item = strtok_r(list, ", \t", &save); (item != NULL) && (n < max); item = strtok_r(NULL, ", \t", &save)) {
+		memset(&peers[n], 0, sizeof(struct udp_peer_t));
+		if (udp_resolve(item, &peers[n].addr) == 0)
+			n++;
+	}
+	free(list);
+	return(n);
+}
+
+/*
+	Location: udp.c
+	This is to find the peer a datagram came from, and to take it on if it is new and there is room.
+	returns the peer, NULL if there is no room for it.
+*/
+static struct udp_peer_t *udp_peer(struct udp_peer_t *peers, int *npeers, struct sockaddr_in *from)
+{
+	int i;
+
+	for (i = 0; i < *npeers; i++) {
+		if ((peers[i].addr.sin_addr.s_addr == from->sin_addr.s_addr) && (peers[i].addr.sin_port == from->sin_port))
+			return(&peers[i]);
+	}
+	if (*npeers >= UDP_MAX_PEERS)
+		return(NULL);
+	memset(&peers[*npeers], 0, sizeof(struct udp_peer_t));
+	peers[*npeers].addr = *from;
+	syslog(LOG_INFO, "udp.c: udp_peer(): new udp peer %s:%d", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+	return(&peers[(*npeers)++]);
+}
+
+/*
+	Location: udp.c
+	This is to read what the serial device has, a datagram per read, up to UDP_BATCH of them, and send
+	them all to all the peers, and to the multicast group if there is one, with one sendmmsg().
+	A datagram is read in after room for its sequence number: the unicast datagrams carry seq there
+	when sequence is set, the multicast ones always carry mseq, from an iovec of their own.
+	returns 0 on success, 1 on EOF or if the device failed.
+*/
+static int udp_serial_to_peers(int fd, int sock, struct udp_peer_t *peers, int npeers, int sequence, uint32_t *seq,
+		struct sockaddr_in *group, uint32_t *mseq)
+{
+	extern int errno;
+	static unsigned char data[UDP_BATCH][UDP_SEQ_SIZE + UDP_DATAGRAM_SIZE];
+	static uint32_t mseqs[UDP_BATCH];
+	static struct iovec iov[UDP_BATCH];
+	static struct iovec miov[UDP_BATCH][2];
+	static struct mmsghdr msgs[UDP_BATCH * (UDP_MAX_PEERS + 1)];
+	uint32_t netseq;
+	int ndata;
+	int eof;
+	int nmsgs;
+	int sent;
+	int n;
+	int i, p;
+
+	eof = 0;
+	for (ndata = 0; ndata < UDP_BATCH; ndata++) {
+		n = read(fd, data[ndata] + UDP_SEQ_SIZE, UDP_DATAGRAM_SIZE);
+		if (n < 0) {
+			if ((errno == EAGAIN) || (errno == EINTR))
+				break;
+			syslog(LOG_ERR, "udp.c: udp_serial_to_peers(): read error: %s", strerror(errno));
+			return(1);
+		}
+		if (n == 0) {
+			eof = 1;											/* once the rest is sent */
+			break;
+		}
+		if (sequence) {
+			netseq = htonl((*seq)++);
+			memcpy(data[ndata], &netseq, UDP_SEQ_SIZE);
+			iov[ndata].iov_base = data[ndata];
+			iov[ndata].iov_len = UDP_SEQ_SIZE + n;
+		} else {
+			iov[ndata].iov_base = data[ndata] + UDP_SEQ_SIZE;
+			iov[ndata].iov_len = n;
+		}
+		if (group != NULL) {
+			mseqs[ndata] = htonl((*mseq)++);
+			miov[ndata][0].iov_base = &mseqs[ndata];
+			miov[ndata][0].iov_len = UDP_SEQ_SIZE;
+			miov[ndata][1].iov_base = data[ndata] + UDP_SEQ_SIZE;
+			miov[ndata][1].iov_len = n;
+		}
+	}
+	/* every datagram to every peer, and once to the group */
+	nmsgs = 0;
+	for (i = 0; i < ndata; i++) {
+		for (p = 0; p < npeers; p++) {
+			memset(&msgs[nmsgs], 0, sizeof(struct mmsghdr));
+			msgs[nmsgs].msg_hdr.msg_name = &peers[p].addr;
+			msgs[nmsgs].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			msgs[nmsgs].msg_hdr.msg_iov = &iov[i];
+			msgs[nmsgs].msg_hdr.msg_iovlen = 1;
+			nmsgs++;
+		}
+		if (group != NULL) {
+			memset(&msgs[nmsgs], 0, sizeof(struct mmsghdr));
+			msgs[nmsgs].msg_hdr.msg_name = group;
+			msgs[nmsgs].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			msgs[nmsgs].msg_hdr.msg_iov = miov[i];
+			msgs[nmsgs].msg_hdr.msg_iovlen = 2;
+			nmsgs++;
+		}
+	}
+	for (sent = 0; sent < nmsgs; sent += n) {
+		n = sendmmsg(sock, msgs + sent, nmsgs - sent, 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			/* a datagram transport may lose some, the line goes on */
+			syslog(LOG_ERR, "udp.c: udp_serial_to_peers(): sendmmsg() error: %s, %d datagram(s) dropped", strerror(errno), nmsgs - sent);
+			break;
+		}
+	}
+	return(eof);
+}
+
+/*
+	Location: udp.c
+	This is to read what the peers sent, up to UDP_BATCH datagrams with one recvmmsg(), and write each
+	one to the serial device, after what is pending for it. A datagram there is no room for is dropped,
+	and counted in dropped.
+	returns 0 on success, 1 if the device failed.
+*/
+static int udp_peers_to_serial(int sock, int fd, struct udp_peer_t *peers, int *npeers, int sequence, SERIAL_PENDING *pending,
+		unsigned long *dropped)
+{
+	extern int errno;
+	static unsigned char data[UDP_BATCH][UDP_SEQ_SIZE + UDP_DATAGRAM_SIZE];
+	static struct iovec iov[UDP_BATCH];
+	static struct mmsghdr msgs[UDP_BATCH];
+	static struct sockaddr_in from[UDP_BATCH];
+	struct udp_peer_t *peer;
+	uint32_t netseq;
+	uint32_t seq;
+	unsigned char *payload;
+	int len;
+	int n;
+	int i;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < UDP_BATCH; i++) {
+		iov[i].iov_base = data[i];
+		iov[i].iov_len = sizeof(data[i]);
+		msgs[i].msg_hdr.msg_name = &from[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	n = recvmmsg(sock, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+	if (n < 0)
+		return(0);
+	for (i = 0; i < n; i++) {
+		peer = udp_peer(peers, npeers, &from[i]);
+		payload = data[i];
+		len = msgs[i].msg_len;
+		if (sequence && (len >= UDP_SEQ_SIZE)) {
+			memcpy(&netseq, payload, UDP_SEQ_SIZE);
+			seq = ntohl(netseq);
+			if ((peer != NULL) && peer->seen && (seq != peer->next_seq)) {
+				if ((int32_t) (seq - peer->next_seq) > 0) {
+					peer->lost += seq - peer->next_seq;
+					syslog(LOG_INFO, "udp.c: udp_peers_to_serial(): %u datagram(s) lost from %s:%d, %lu so far",
+							seq - peer->next_seq, inet_ntoa(from[i].sin_addr), ntohs(from[i].sin_port), peer->lost);
+				} else {
+					syslog(LOG_INFO, "udp.c: udp_peers_to_serial(): datagram %u out of order from %s:%d",
+							seq, inet_ntoa(from[i].sin_addr), ntohs(from[i].sin_port));
+				}
+			}
+			if (peer != NULL) {
+				peer->seen = 1;
+				peer->next_seq = seq + 1;
+			}
+			payload += UDP_SEQ_SIZE;
+			len -= UDP_SEQ_SIZE;
+		} else if (sequence) {
+			len = 0;											/* too short to carry one: a hello */
+		}
+		if (len > SERIAL_PENDING_SIZE - pending->len) {
+			if ((*dropped)++ == 0)								/* the total is logged when the worker stops */
+				syslog(LOG_WARNING, "udp.c: udp_peers_to_serial(): the serial device holds off, dropping datagrams");
+			continue;
+		}
+		if ((len > 0) && (serial_pending_write(fd, pending, payload, len) != 0)) {
+			syslog(LOG_ERR, "udp.c: udp_peers_to_serial(): write error: %s", strerror(errno));
+			return(1);
+		}
+	}
+	return(0);
+}
+
+/*
+	Location: udp.c
+	This is the worker of a port: serve it over UDP until we are told to stop or the device fails.
+	returns 0 on success, 1 on failure.
+*/
+int udp_worker(struct config_t *conf, SERIAL_INFO *port)
+{
+	extern volatile sig_atomic_t port_worker_stop;
+	extern int errno;
+	extern int signal_fd;
+	struct udp_peer_t peers[UDP_MAX_PEERS];
+	struct sockaddr_in addr;
+	struct sockaddr_in group_addr;
+	struct sockaddr_in *group;
+	struct termios old_setting;
+	struct termios new_setting;
+	struct pollfd pfds[3];
+	static SERIAL_PENDING pending;
+	unsigned long dropped;
+	SERIAL_INFO *sabre_serial_port;
+	char group_name[PATH_MAX];
+	uint32_t seq;
+	uint32_t mseq;
+	int npeers;
+	int sock;
+	int fd;
+	int opt;
+	int error;
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		syslog(LOG_ERR, "udp.c: udp_worker(): socket() error: %s", strerror(errno));
+		return(1);
+	}
+	opt = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port->udp_port);
+	if ((port->udp_port > 0) && (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)) {
+		syslog(LOG_ERR, "udp.c: udp_worker(): cannot bind udp port %d for %s: %s", port->udp_port, port->device, strerror(errno));
+		close(sock);
+		return(1);
+	}
+	/* the multicast group, if the port publishes to one */
+	group = NULL;
+	if (port->multicast_group != NULL) {
+		snprintf(group_name, sizeof(group_name), "%s", port->multicast_group);
+		if ((udp_resolve(group_name, &group_addr) != 0) || (! IN_MULTICAST(ntohl(group_addr.sin_addr.s_addr)))) {
+			syslog(LOG_ERR, "udp.c: udp_worker(): %s is no multicast group", port->multicast_group);
+			close(sock);
+			return(1);
+		}
+		opt = port->multicast_ttl;
+		if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &opt, sizeof(opt)) < 0)
+			syslog(LOG_ERR, "udp.c: udp_worker(): cannot set the multicast ttl: %s", strerror(errno));
+		group = &group_addr;
+	}
+	sabre_serial_port = serial_port_claim(conf, port->device, &fd, &old_setting, &new_setting);
+	if (sabre_serial_port == NULL) {
+		close(sock);
+		return(1);
+	}
+	opt = fcntl(fd, F_GETFL, 0);
+	if (opt != -1)
+		fcntl(fd, F_SETFL, opt | O_NONBLOCK);					/* a read per datagram, until there is no more */
+	npeers = udp_parse_peers(port->udp_peers, peers, UDP_MAX_PEERS);
+	syslog(LOG_INFO, "udp.c: udp_worker(): serving %s on udp port %d, %d peer(s)%s%s%s", port->device, port->udp_port,
+			npeers, port->udp_sequence ? ", with sequence numbers" : "",
+			(group != NULL) ? ", publishing to " : "", (group != NULL) ? port->multicast_group : "");
+
+	seq = 0;
+	mseq = 0;
+	pending.len = 0;
+	dropped = 0;
+	error = 0;
+	while ((! port_worker_stop) && (! error)) {
+		pfds[0].fd = fd;
+		pfds[0].events = POLLIN | ((pending.len > 0) ? POLLOUT : 0);
+		pfds[1].fd = (port->udp_port > 0) ? sock : -1;			/* publishing only: nothing comes in */
+		pfds[1].events = POLLIN;
+		pfds[2].fd = signal_fd;
+		pfds[2].events = POLLIN;
+		if (poll(pfds, 3, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "udp.c: udp_worker(): poll() error: %s", strerror(errno));
+			break;
+		}
+		if (pfds[2].revents & POLLIN)
+			signal_fd_handle();
+		if ((pfds[0].revents & POLLOUT) && (serial_pending_flush(fd, &pending) != 0)) {
+			syslog(LOG_ERR, "udp.c: udp_worker(): write error: %s", strerror(errno));
+			error = 1;
+		}
+		if ((! error) && (pfds[1].revents & POLLIN))
+			error = udp_peers_to_serial(sock, fd, peers, &npeers, port->udp_sequence, &pending, &dropped);
+		if ((! error) && (pfds[0].revents & (POLLIN|POLLHUP|POLLERR)))
+			error = udp_serial_to_peers(fd, sock, peers, npeers, port->udp_sequence, &seq, group, &mseq);
+	}
+	syslog(LOG_INFO, "udp.c: udp_worker(): %s done with udp port %d, %lu datagram(s) dropped", port->device, port->udp_port,
+			dropped);
+	close(sock);
+	serial_cleanup(sabre_serial_port, &fd, old_setting, new_setting);
+	return(error);
+}
+
+/*
+	Location: udp.c
+	This is to tell whether a port wants a udp worker: it has a udp port or a multicast group.
+	returns 1 if it does, 0 otherwise.
+*/
+int udp_port_wanted(SERIAL_INFO *port)
+{
+	return((port->udp_port > 0) || (port->multicast_group != NULL));
+}
+
+/*
+	Location: udp.c
+	This is to write down the settings a udp worker serves a port with: it is started again when they change.
+*/
+void udp_port_settings(SERIAL_INFO *port, char *buf, int len)
+{
+	snprintf(buf, len, "udp port %d, peers %s, sequence %d, multicast group %s, ttl %d", port->udp_port,
+			(port->udp_peers != NULL) ? port->udp_peers : "none", port->udp_sequence,
+			(port->multicast_group != NULL) ? port->multicast_group : "none", port->multicast_ttl);
+}
@@ -0,0 +1,232 @@
+/*
+ * unix_socket.c
+ *	These are the Unix stream sockets a serial port can listen on ("listen socket" in serial_ip.conf),
+ *	besides or instead of its tcp listen port, for the consumers on the gateway itself: a path in the
+ *	file system, or @name in the abstract namespace. A session on a Unix socket is the same as on
+ *	the tcp port, in the protocol of the port (see session_protocol.c), without the TCP/IP stack.
+ *	The listeners are kept with the tcp ones (see port_listener_sync() in network_handle.c). A
+ *	session process looks up its port by the socket the client connected to, and checks who the client
+ *	is against "socket users" with SO_PEERCRED, before it takes the device. Without "socket users",
+ *	only root and the user the daemon runs its sessions as may connect: an abstract socket has no
+ *	permissions, and the sessions of a root daemon should not be open to every local user.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#define _GNU_SOURCE							/* struct ucred */
+#include "serial_ip.h"
+
+#include <stddef.h>
+
+#define UNIX_SOCKET_BACKLOG		5
+#define UNIX_SOCKET_MODE		0660			/* a path: the owner and group, socket users picks among them */
+
+/*
+	Location: unix_socket.c
+	This is to check a "listen socket" value: an absolute path, or @name, which fits in a sockaddr_un.
+	returns 0 if it will do, 1 otherwise.
+*/
+int unix_socket_name_check(const char *name)
+{
+	struct sockaddr_un addr;
+
+	if ((name == NULL) || ((name[0] != '/') && (name[0] != '@')) || (name[1] == '\0'))
+		return(1);
+	return((strlen(name) >= sizeof(addr.sun_path)) ? 1 : 0);
+}
+
+/*
+	Location: unix_socket.c
+	This is to build the address of a socket name: @name is in the abstract namespace, its first
+	byte is a NUL.
+	returns the length of the address.
+*/
+static socklen_t unix_socket_address(const char *name, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (name[0] == '@') {
+		memcpy(addr->sun_path + 1, name + 1, strlen(name + 1));
+		return(offsetof(struct sockaddr_un, sun_path) + strlen(name));
+	}
+	snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", name);
+	return(sizeof(struct sockaddr_un));
+}
+
+/*
+	Location: unix_socket.c
+	This is to remove the socket file a daemon which is gone left behind. A socket somebody still
+	listens on is left alone.
+	returns 0 if the path is free now, 1 otherwise.
+*/
+static int unix_socket_unlink_stale(const char *name, struct sockaddr_un *addr, socklen_t len)
+{
+	extern int errno;
+	struct stat st;
+	int fd;
+	int alive;
+
+	if ((name[0] == '@') || (lstat(name, &st) != 0))
+		return(0);
+	if (! S_ISSOCK(st.st_mode)) {
+		syslog(LOG_ERR, "unix_socket.c: unix_socket_unlink_stale(): %s is in the way, not a socket", name);
+		return(1);
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return(1);
+	alive = (connect(fd, (struct sockaddr *) addr, len) == 0) || (errno != ECONNREFUSED);
+	close(fd);
+	if (alive) {
+		syslog(LOG_ERR, "unix_socket.c: unix_socket_unlink_stale(): somebody listens on %s already", name);
+		return(1);
+	}
+	return((unlink(name) == 0) ? 0 : 1);
+}
+
+/*
+	Location: unix_socket.c
+	create a Unix stream server on a path, or in the abstract namespace for @name. A path is open to
+	its owner and group, and who of them may use it is checked on accept (see unix_socket_accept()).
+	returns a socket fd or -1 on error.
+*/
+int create_unix_server_socket(const char *name)
+{
+	extern int errno;
+	struct sockaddr_un addr;
+	socklen_t len;
+	int sockfd;
+
+	len = unix_socket_address(name, &addr);
+	if (unix_socket_unlink_stale(name, &addr, len) != 0)
+		return(-1);
+	if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		syslog(LOG_ERR, "unix_socket.c: create_unix_server_socket(): cannot open stream socket (%s)", strerror(errno));
+		return(-1);
+	}
+	if (bind(sockfd, (struct sockaddr *) &addr, len) < 0) {
+		syslog(LOG_ERR, "unix_socket.c: create_unix_server_socket(): cannot bind %s (%s)", name, strerror(errno));
+		close(sockfd);
+		return(-1);
+	}
+	if ((name[0] == '/') && (chmod(name, UNIX_SOCKET_MODE) != 0))
+		syslog(LOG_ERR, "unix_socket.c: create_unix_server_socket(): cannot chmod %s (%s)", name, strerror(errno));
+	if (listen(sockfd, UNIX_SOCKET_BACKLOG) < 0) {
+		syslog(LOG_ERR, "unix_socket.c: create_unix_server_socket(): listen on %s failed (%s)", name, strerror(errno));
+		close(sockfd);
+		unix_socket_remove(name);
+		return(-1);
+	}
+	return(sockfd);
+}
+
+/*
+	Location: unix_socket.c
+	This is to remove the file of a socket we no longer listen on.
+*/
+void unix_socket_remove(const char *name)
+{
+	if ((name != NULL) && (name[0] == '/'))
+		unlink(name);
+}
+
+/*
+	Location: unix_socket.c
+	This is to check a "socket users" value: user names or uids, separated by commas or spaces. A
+	name must be known now.
+	returns 0 if it will do, 1 otherwise.
+*/
+int unix_socket_users_check(const char *users)
+{
+	char buf[PATH_MAX];
+	char *user;
+	char *save;
+	char *end;
+
+	snprintf(buf, sizeof(buf), "%s", users);
+	for (user = strtok_r(buf, ", \t", &save); user != NULL; user = strtok_r(NULL, ", \t", &save)) {
+		strtol(user, &end, 10);
+		if ((*end != '\0') && (getpwnam(user) == NULL)) {
+			syslog(LOG_ERR, "unix_socket.c: unix_socket_users_check(): no user %s", user);
+			return(1);
+		}
+	}
+	return(0);
+}
+
+/*
+	Location: unix_socket.c
+	This is to tell whether a user is one of "socket users".
+	returns 1 if it is, 0 otherwise.
+*/
+static int unix_socket_user_allowed(const char *users, uid_t uid)
+{
+	struct passwd *pw;
+	char buf[PATH_MAX];
+	char *user;
+	char *save;
+	char *end;
+	long n;
+
+	snprintf(buf, sizeof(buf), "%s", users);
+	for (user = strtok_r(buf, ", \t", &save); user != NULL; user = strtok_r(NULL, ", \t", &save)) {
+		n = strtol(user, &end, 10);
+		if (*end == '\0') {
+			if ((uid_t) n == uid)
+				return(1);
+		} else if (((pw = getpwnam(user)) != NULL) && (pw->pw_uid == uid)) {
+			return(1);
+		}
+	}
+	return(0);
+}
+
+/*
+	Location: unix_socket.c
+	This is for a session process to find the port of the Unix socket its client connected to, whose
+	address is addr, and to check that the client may use it: one of "socket users", or, without
+	them, root or the user of the daemon.
+	returns the port, NULL if there is none or the client may not use it.
+*/
+SERIAL_INFO *unix_socket_accept(struct config_t *conf, int sockfd, struct sockaddr_un *addr, socklen_t len)
+{
+	extern int errno;
+	struct ucred cred;
+	socklen_t cred_len;
+	SERIAL_INFO *port;
+	char name[sizeof(addr->sun_path) + 1];
+	int n;
+	int i;
+
+	/* the name the way serial_ip.conf says it */
+	n = len - offsetof(struct sockaddr_un, sun_path);
+	if ((n > 0) && (addr->sun_path[0] == '\0')) {
+		name[0] = '@';
+		memcpy(name + 1, addr->sun_path + 1, n - 1);
+		name[n] = '\0';
+	} else {
+		snprintf(name, sizeof(name), "%.*s", MAX(n, 0), addr->sun_path);
+	}
+	port = NULL;
+	for (i = 0; (port == NULL) && (i < conf->ports.nslots); i++) {
+		port = port_registry_at(&conf->ports, i);
+		if ((port != NULL) && ((port->listen_socket == NULL) || (strcmp(port->listen_socket, name) != 0)))
+			port = NULL;
+	}
+	if (port == NULL) {
+		syslog(LOG_ERR, "unix_socket.c: unix_socket_accept(): no serial port listens on %s", name);
+		return(NULL);
+	}
+	cred_len = sizeof(cred);
+	if (getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0) {
+		syslog(LOG_ERR, "unix_socket.c: unix_socket_accept(): cannot get the credentials of the client: %s", strerror(errno));
+		return(NULL);
+	}
+	if ((port->socket_users != NULL) ? (! unix_socket_user_allowed(port->socket_users, cred.uid)) :
+			((cred.uid != 0) && (cred.uid != conf->uid))) {
+		syslog(LOG_ERR, "unix_socket.c: unix_socket_accept(): uid %d (pid %d) may not use %s", (int) cred.uid, (int) cred.pid, name);
+		return(NULL);
+	}
+	syslog(LOG_INFO, "unix_socket.c: unix_socket_accept(): uid %d (pid %d) connected to %s", (int) cred.uid, (int) cred.pid, name);
+	return(port);
+}
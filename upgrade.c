@@ -0,0 +1,480 @@
+/*
+ * upgrade.c
+ *	This is to replace a running daemon by a new binary without dropping anything.
+ *	The running process listens on a unix socket next to its pid file (<pid file>.upgrade).
+ *	A new process started with -U connects to it, and the running process hands over, with
+ *	SCM_RIGHTS, its listening sockets, the serial devices it holds open with their termios
+ *	settings, and the session it is serving (iterative and raw TCP gateway servers), with the
+ *	Telnet option state and whatever is still buffered. The uucp lock of that session goes to the
+ *	new process too. Once the new process has acknowledged, the old one simply exits.
+ *	Sessions of a concurrent server live in their own processes and carry on untouched.
+ *  Created on: Oct 19, 2026
+ *      Author: tientham
+ */
+
+#define _GNU_SOURCE							/* struct ucred */
+#include "serial_ip.h"
+
+#include <sys/un.h>
+
+#define UPGRADE_MAGIC		0x53495055		/* "SIPU" */
+
+#define UPGRADE_LISTENER	0x01			/* a listening socket, tcp_port 0 is the main one */
+#define UPGRADE_PORT		0x02			/* a serial device held open */
+#define UPGRADE_SESSION		0x03			/* the session in progress: socket and serial device */
+#define UPGRADE_END			0x04			/* no more records */
+
+#define UPGRADE_TIMEOUT		10				/* seconds to wait for the other side */
+
+/*
+	Location: upgrade.c
+	One record of the handover. Records go over a SOCK_SEQPACKET socket, so each one arrives whole,
+	together with its file descriptors.
+*/
+struct upgrade_msg_t {
+	unsigned int magic;
+	int type;
+	int tcp_port;							/* UPGRADE_LISTENER */
+	char device[PATH_MAX];					/* UPGRADE_PORT, UPGRADE_SESSION, the unix socket of an UPGRADE_LISTENER */
+	struct termios old_termios;
+	struct termios new_termios;
+};
+
+/*
+	Location: upgrade.c
+	The state of the session in progress, sent after an UPGRADE_SESSION record.
+*/
+struct upgrade_state_t {
+	TELNET_SESSION telnet;					/* Telnet options and line state */
+	int nbuffered[3];						/* socket -> serial, serial -> socket, us -> socket */
+	unsigned char data[3][SIZE_BUFFER];
+};
+
+int upgrade_mode = 0;						/* -U: take over from a running process */
+int upgrade_listen_fd = -1;					/* unix socket a new process connects to */
+int upgrade_server_sockfd = -1;				/* main listener handed over to us */
+
+static char upgrade_path[PATH_MAX];
+static struct upgrade_msg_t upgrade_session_msg;	/* session handed over to us */
+static struct upgrade_state_t upgrade_session_state;
+static int upgrade_session_fds[2] = { -1, -1 };	/* client socket, serial device */
+static int upgrade_resumed = 0;				/* serial_ip_communication_process() restores the state */
+
+/*
+	Location: upgrade.c
+	This is to build the name of the upgrade socket from the pid file name.
+*/
+static char *upgrade_socket_path(struct config_t *conf)
+{
+	snprintf(upgrade_path, sizeof(upgrade_path), "%s.upgrade", conf->pidfile);
+	return(upgrade_path);
+}
+
+/*
+	Location: upgrade.c
+	This is to send one record with up to 2 file descriptors.
+	returns 0 on success, 1 on failure.
+*/
+static int upgrade_send(int fd, struct upgrade_msg_t *msg, void *extra, int extralen, int *fds, int nfds)
+{
+	extern int errno;
+	struct msghdr mh;
+	struct iovec iov[2];
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(2 * sizeof(int))];
+
+	msg->magic = UPGRADE_MAGIC;
+	memset(&mh, 0, sizeof(mh));
+	iov[0].iov_base = msg;
+	iov[0].iov_len = sizeof(struct upgrade_msg_t);
+	iov[1].iov_base = extra;
+	iov[1].iov_len = extralen;
+	mh.msg_iov = iov;
+	mh.msg_iovlen = (extra != NULL) ? 2 : 1;
+	if (nfds > 0) {
+		memset(control, 0, sizeof(control));
+		mh.msg_control = control;
+		mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+	if (sendmsg(fd, &mh, MSG_NOSIGNAL) < 0) {
+		syslog(LOG_ERR, "upgrade.c: upgrade_send(): sendmsg() error: %s", strerror(errno));
+		return(1);
+	}
+	return(0);
+}
+
+/*
+	Location: upgrade.c
+	This is to receive one record and the file descriptors which came with it.
+	returns the number of bytes received, -1 on error.
+*/
+static int upgrade_recv(int fd, struct upgrade_msg_t *msg, void *extra, int extralen, int *fds, int *nfds)
+{
+	extern int errno;
+	struct msghdr mh;
+	struct iovec iov[2];
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	int n;
+
+	memset(&mh, 0, sizeof(mh));
+	iov[0].iov_base = msg;
+	iov[0].iov_len = sizeof(struct upgrade_msg_t);
+	iov[1].iov_base = extra;
+	iov[1].iov_len = extralen;
+	mh.msg_iov = iov;
+	mh.msg_iovlen = 2;
+	mh.msg_control = control;
+	mh.msg_controllen = sizeof(control);
+	*nfds = 0;
+	n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+	if (n < 0) {
+		syslog(LOG_ERR, "upgrade.c: upgrade_recv(): recvmsg() error: %s", strerror(errno));
+		return(-1);
+	}
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+			*nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), *nfds * sizeof(int));
+		}
+	}
+	if ((n < (int) sizeof(struct upgrade_msg_t)) || (msg->magic != UPGRADE_MAGIC) || (mh.msg_flags & (MSG_TRUNC|MSG_CTRUNC))) {
+		syslog(LOG_ERR, "upgrade.c: upgrade_recv(): bad record");
+		return(-1);
+	}
+	return(n);
+}
+
+/*
+	Location: upgrade.c
+	This is to open the upgrade socket a new process connects to. Only the owner may use it.
+	returns 0 on success, 1 on failure (we run on, we just cannot be upgraded in place).
+*/
+int upgrade_listen(struct config_t *conf)
+{
+	extern int errno;
+	extern int upgrade_listen_fd;
+	struct sockaddr_un addr;
+	int fd;
+
+	if ((conf->pidfile == NULL) || (strlen(upgrade_socket_path(conf)) >= sizeof(addr.sun_path)))
+		return(1);
+	if (shard_count > 1)
+		return(1);											/* the shards cannot be handed over */
+	fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		syslog(LOG_ERR, "upgrade.c: upgrade_listen(): socket() error: %s", strerror(errno));
+		return(1);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, upgrade_path);
+	unlink(upgrade_path);									/* left over, or the process we took over from */
+	if ((bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) || (listen(fd, 1) < 0)) {
+		syslog(LOG_ERR, "upgrade.c: upgrade_listen(): cannot listen on %s: %s", upgrade_path, strerror(errno));
+		close(fd);
+		return(1);
+	}
+	chmod(upgrade_path, 0600);
+	upgrade_listen_fd = fd;
+	syslog(LOG_INFO, "upgrade.c: upgrade_listen(): waiting for upgrades on %s", upgrade_path);
+	return(0);
+}
+
+/*
+	Location: upgrade.c
+	This is to close the upgrade socket: in a child process (remove = 0), or when we shut down (remove = 1).
+*/
+void upgrade_close(int remove)
+{
+	extern int upgrade_listen_fd;
+
+	if (upgrade_listen_fd < 0)
+		return;
+	io_engine_forget(upgrade_listen_fd);
+	close(upgrade_listen_fd);
+	upgrade_listen_fd = -1;
+	if (remove)
+		unlink(upgrade_path);
+}
+
+/*
+	Location: upgrade.c
+	This is called when a new process connects to the upgrade socket. We send everything over and,
+	once the new process has taken it, exit without touching the sockets or the serial devices.
+	session is the session in progress, NULL if there is none.
+	returns only if the upgrade did not happen; we then simply carry on.
+*/
+void upgrade_handoff(struct upgrade_session_t *session)
+{
+	extern int errno;
+	extern int upgrade_listen_fd;
+	extern int server_sockfd;
+	extern struct config_t conf;
+	extern TELNET_SESSION tnsession;
+	static struct upgrade_state_t state;
+	struct upgrade_msg_t msg;
+	struct ucred cred;
+	socklen_t len;
+	struct timeval tv;
+	SERIAL_INFO *port;
+	BUFFER *buff;
+	unsigned char *p;
+	int fds[2];
+	int error;
+	int fd;
+	int i;
+	char ack;
+
+	fd = accept4(upgrade_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+	len = sizeof(cred);
+	if ((getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) || ((cred.uid != 0) && (cred.uid != geteuid()))) {
+		syslog(LOG_ERR, "upgrade.c: upgrade_handoff(): refusing upgrade from uid %d", (int) cred.uid);
+		close(fd);
+		return;
+	}
+	syslog(LOG_INFO, "upgrade.c: upgrade_handoff(): handing over to pid %d", (int) cred.pid);
+	port_worker_stop_all();									/* the new process starts its own (see port_worker.c) */
+	tv.tv_sec = UPGRADE_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	/*	the listening sockets */
+	memset(&msg, 0, sizeof(msg));
+	msg.type = UPGRADE_LISTENER;
+	msg.tcp_port = 0;
+	error = upgrade_send(fd, &msg, NULL, 0, &server_sockfd, 1);
+	for (i = 0; (error == 0) && ((fds[0] = port_listener_get(i, &msg.tcp_port, msg.device, sizeof(msg.device))) >= 0); i++)
+		error = upgrade_send(fd, &msg, NULL, 0, fds, 1);
+	/*	the serial devices we hold open */
+	for (i = 0; (error == 0) && (i < conf.ports.nslots); i++) {
+		port = port_registry_at(&conf.ports, i);
+		if ((port == NULL) || (port->state != PORT_READY))
+			continue;
+		memset(&msg, 0, sizeof(msg));
+		msg.type = UPGRADE_PORT;
+		snprintf(msg.device, sizeof(msg.device), "%s", port->device);
+		msg.old_termios = port->old_termios;
+		msg.new_termios = port->new_termios;
+		error = upgrade_send(fd, &msg, NULL, 0, &port->fd, 1);
+	}
+	/*	the session in progress */
+	if ((error == 0) && (session != NULL)) {
+		memset(&msg, 0, sizeof(msg));
+		memset(&state, 0, sizeof(state));
+		msg.type = UPGRADE_SESSION;
+		snprintf(msg.device, sizeof(msg.device), "%s", session->port->device);
+		msg.old_termios = session->port->old_termios;
+		msg.new_termios = session->port->new_termios;
+		state.telnet = tnsession;											/* structure copy */
+		for (i = 0; i < 3; i++) {
+			buff = session->buffers[i];
+			p = bf_point_to_active_portion(buff, &state.nbuffered[i]);
+			if ((p != NULL) && (state.nbuffered[i] > 0))
+				memcpy(state.data[i], p, MIN(state.nbuffered[i], SIZE_BUFFER));
+		}
+		fds[0] = session->sockfd;
+		fds[1] = session->serial_fd;
+		error = upgrade_send(fd, &msg, &state, sizeof(state), fds, 2);
+	}
+	if (error == 0) {
+		memset(&msg, 0, sizeof(msg));
+		msg.type = UPGRADE_END;
+		error = upgrade_send(fd, &msg, NULL, 0, NULL, 0);
+	}
+	if ((error == 0) && (read(fd, &ack, 1) == 1) && (ack == 'A')) {
+		syslog(LOG_INFO, "upgrade.c: upgrade_handoff(): pid %d took over, exiting", (int) cred.pid);
+		_exit(0);											/* no clean up: everything is in use by the new process */
+	}
+	syslog(LOG_ERR, "upgrade.c: upgrade_handoff(): upgrade failed, carrying on");
+	port_worker_sync(&conf);
+	close(fd);
+}
+
+/*
+	Location: upgrade.c
+	This is for the new process (-U): connect to the running process and take over what it hands us.
+	Called once serial_ip.conf is read, before the ports are brought up.
+	returns 0 on success, 1 on failure (we then start up from scratch).
+*/
+int upgrade_receive(struct config_t *conf)
+{
+	extern int errno;
+	extern int upgrade_server_sockfd;
+	struct sockaddr_un addr;
+	struct upgrade_msg_t msg;
+	struct timeval tv;
+	SERIAL_INFO *port;
+	pid_t oldpid;
+	int fds[2];
+	int nfds;
+	int fd;
+	int n;
+	int i;
+	int done;
+
+	if ((conf->pidfile == NULL) || (strlen(upgrade_socket_path(conf)) >= sizeof(addr.sun_path)))
+		return(1);
+	oldpid = 0;
+	if ((fd = open(conf->pidfile, O_RDONLY)) >= 0) {
+		if (read(fd, &oldpid, sizeof(oldpid)) != sizeof(oldpid))
+			oldpid = 0;
+		close(fd);
+	}
+	fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return(1);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, upgrade_path);
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		syslog(LOG_ERR, "upgrade.c: upgrade_receive(): cannot connect to %s (pid %d): %s", upgrade_path, oldpid, strerror(errno));
+		close(fd);
+		return(1);
+	}
+	tv.tv_sec = UPGRADE_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	for (done = 0; ! done; ) {
+		n = upgrade_recv(fd, &msg, &upgrade_session_state, sizeof(upgrade_session_state), fds, &nfds);
+		if (n < 0)
+			break;
+		switch (msg.type) {
+		case UPGRADE_LISTENER:
+			if (nfds < 1)
+				break;
+			if ((msg.tcp_port == 0) && (msg.device[0] == '\0'))
+				upgrade_server_sockfd = fds[0];
+			else
+				port_listener_adopt(msg.tcp_port, (msg.device[0] != '\0') ? msg.device : NULL, fds[0]);
+			fcntl(fds[0], F_SETFD, 0);						/* inherited by our children, like before */
+			break;
+		case UPGRADE_PORT:
+			if (nfds < 1)
+				break;
+			port = port_lookup_device(&conf->ports, msg.device);
+			if ((port == NULL) || (port->state != PORT_DOWN)) {
+				close(fds[0]);								/* no longer configured */
+				break;
+			}
+			fcntl(fds[0], F_SETFD, 0);
+			port->fd = fds[0];
+			port->old_termios = msg.old_termios;
+			port->new_termios = msg.new_termios;
+			port->state = PORT_READY;
+			break;
+		case UPGRADE_SESSION:
+			if ((nfds < 2) || (n != (int) (sizeof(msg) + sizeof(upgrade_session_state)))) {
+				for (i = 0; i < nfds; i++)
+					close(fds[i]);
+				break;
+			}
+			upgrade_session_msg = msg;
+			upgrade_session_fds[0] = fds[0];
+			upgrade_session_fds[1] = fds[1];
+			fcntl(fds[0], F_SETFD, 0);
+			fcntl(fds[1], F_SETFD, 0);
+			break;
+		case UPGRADE_END:
+			done = 1;
+			break;
+		}
+	}
+	if (! done) {
+		syslog(LOG_ERR, "upgrade.c: upgrade_receive(): incomplete handover from pid %d", oldpid);
+		close(fd);
+		return(1);											/* the old process carries on, so do not ack */
+	}
+	/*	the uucp lock of the session is ours from now on */
+	port = port_lookup_device(&conf->ports, upgrade_session_msg.device);
+	if ((upgrade_session_fds[0] >= 0) && (port != NULL)) {
+		write_pidfile(get_uucp_lock_device_file(port->device), O_WRONLY|O_TRUNC, 0644, getpid());
+		port->lockfile = strdup(get_uucp_lock_device_file(port->device));
+	}
+	if (write(fd, "A", 1) != 1) {
+		close(fd);
+		return(1);
+	}
+	close(fd);
+	for (i = 0; (oldpid > 0) && (i < UPGRADE_TIMEOUT * 10) && (kill(oldpid, 0) == 0); i++)
+		msleep(100000);										/* let the old process go */
+	syslog(LOG_INFO, "upgrade.c: upgrade_receive(): took over from pid %d", oldpid);
+	port_listener_sync(conf);
+	port_worker_sync(conf);
+	return(0);
+}
+
+/*
+	Location: upgrade.c
+	This is for the new process: carry on with the session the old process was serving, if any.
+	returns when the session is over.
+*/
+void upgrade_resume_session(void)
+{
+	extern struct config_t conf;
+	extern SERIAL_INFO *si;
+	extern int gsockfd;
+	SERIAL_INFO *port;
+	int sockfd;
+	int serial_fd;
+
+	if (upgrade_session_fds[0] < 0)
+		return;
+	sockfd = upgrade_session_fds[0];
+	serial_fd = upgrade_session_fds[1];
+	upgrade_session_fds[0] = upgrade_session_fds[1] = -1;
+	port = port_lookup_device(&conf.ports, upgrade_session_msg.device);
+	if (port == NULL) {
+		syslog(LOG_ERR, "upgrade.c: upgrade_resume_session(): %s is no longer configured, dropping the session",
+				upgrade_session_msg.device);
+		close(serial_fd);
+		disconnect(sockfd);
+		close(sockfd);
+		return;
+	}
+	syslog(LOG_INFO, "upgrade.c: upgrade_resume_session(): resuming the session on %s", port->device);
+	gsockfd = sockfd;
+	si = port;
+	upgrade_resumed = 1;
+	serial_ip_communication_process(sockfd, serial_fd, upgrade_session_msg.new_termios, port);
+	serial_cleanup(port, &serial_fd, upgrade_session_msg.old_termios, upgrade_session_msg.new_termios);
+	si = NULL;
+	disconnect(sockfd);
+	close(sockfd);
+}
+
+/*
+	Location: upgrade.c
+	This is called by serial_ip_communication_process() instead of telnet_init() for a session we took
+	over: put back the Telnet option state and the buffered data, nothing is negotiated again.
+	returns 1 if the state was restored, 0 if this is an ordinary new session.
+*/
+int upgrade_restore_session(BUFFER *socket_to_serial_buf, BUFFER *serial_to_socket_buf, BUFFER *sabre_to_socket_buf)
+{
+	extern TELNET_SESSION tnsession;
+	struct upgrade_state_t *state = &upgrade_session_state;
+	BUFFER *buffers[3];
+	int i;
+
+	if (! upgrade_resumed)
+		return(0);
+	upgrade_resumed = 0;
+	telnet_engine_restore(&tnsession, &state->telnet);					/* keeps our telnet_attach() */
+	buffers[0] = socket_to_serial_buf;
+	buffers[1] = serial_to_socket_buf;
+	buffers[2] = sabre_to_socket_buf;
+	for (i = 0; i < 3; i++) {
+		if (state->nbuffered[i] > 0)
+			bfstrncat(buffers[i], (const char *) state->data[i], MIN(state->nbuffered[i], SIZE_BUFFER));
+	}
+	return(1);
+}